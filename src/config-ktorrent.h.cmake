@@ -9,6 +9,12 @@
 #cmakedefine HAVE_FSTAT64 1
 #cmakedefine HAVE_FTRUNCATE64 1
 #cmakedefine HAVE_FALLOCATE 1
+#cmakedefine HAVE_POSIX_FADVISE 1
+#cmakedefine HAVE_MADVISE 1
+#cmakedefine HAVE_COPY_FILE_RANGE 1
+#cmakedefine HAVE_SENDFILE64 1
+#cmakedefine HAVE_RECVMMSG 1
+#cmakedefine HAVE_SENDMMSG 1
 #cmakedefine HAVE_LSEEK64 1
 #cmakedefine HAVE_STAT64 1
 #cmakedefine HAVE_MMAP64 1
@@ -20,6 +26,8 @@
 #cmakedefine HAVE_XFS_XFS_H 1
 #cmakedefine HAVE___U64 1
 #cmakedefine HAVE___S64 1
+#cmakedefine HAVE_SYS_EPOLL_H 1
+#cmakedefine HAVE_SYS_SENDFILE_H 1
 
 #endif
 
@@ -103,6 +103,7 @@ namespace bt
 			}
 		}
 		
+		closePastFiles(tor.getNumFiles());
 		status(failed,found,downloaded,not_downloaded);
 	}
 	
@@ -124,6 +125,7 @@ namespace bt
 				if (fptr->seek(File::BEGIN,off) != off)
 					return false;
 				
+				fptr->advise(off + cs,tor.getChunkSize(),ADVICE_WILLNEED);
 				return fptr->read(buf,cs) == cs;
 			}
 			return false;
@@ -212,6 +214,8 @@ namespace bt
 		}
 		else
 		{
+			// files are read from start to end, so let the kernel read ahead
+			fptr->advise(0,0,ADVICE_SEQUENTIAL);
 			files.insert(idx,fptr);
 			return fptr;
 		}
@@ -223,7 +227,12 @@ namespace bt
 		while (i != files.end())
 		{
 			if (i.key() < min_idx)
+			{
+				// we are done with this file, drop it from the page cache
+				// so that the check doesn't push other data out
+				i.value()->advise(0,0,ADVICE_DONTNEED);
 				i = files.erase(i);
+			}
 			else
 				i++;
 		}
@@ -49,6 +49,9 @@ namespace bt
 			throw Error(i18n("Cannot open file %1: %2", path, fptr.errorString()));
 		}
 		
+		// we read the file from start to end, so let the kernel read ahead
+		fptr.advise(0,0,ADVICE_SEQUENTIAL);
+		
 		if (from >= tor.getNumChunks())
 			from = 0;
 		if (to >= tor.getNumChunks())
@@ -66,8 +69,14 @@ namespace bt
 				// read the chunk
 				Uint32 size = i == num_chunks - 1 ? tor.getLastChunkSize() : tor.getChunkSize();
 				
-				fptr.seek(File::BEGIN,(Int64)i*tor.getChunkSize());
+				Uint64 off = (Uint64)i*tor.getChunkSize();
+				if (i < to)
+					fptr.advise(off + size,chunk_size,ADVICE_WILLNEED);
+				
+				fptr.seek(File::BEGIN,off);
 				fptr.read(buf,size);
+				// we will not need this data again, so keep it from pushing other stuff out of the page cache
+				fptr.advise(off,size,ADVICE_DONTNEED);
 				// generate and test hash
 				SHA1Hash h = SHA1Hash::generate(buf,size);
 				bool ok = (h == tor.getHash(i));
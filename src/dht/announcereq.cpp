@@ -30,13 +30,13 @@ using namespace bt;
 
 namespace dht
 {
-	AnnounceReq::AnnounceReq()
+	AnnounceReq::AnnounceReq() : port(0), seed(false)
 	{
 		method = dht::ANNOUNCE_PEER;
 	}
 
 	AnnounceReq::AnnounceReq(const Key & id, const Key & info_hash, Uint16 port, const Key & token)
-			: GetPeersReq(id, info_hash), port(port), token(token)
+			: GetPeersReq(id, info_hash), port(port), token(token), seed(false)
 	{
 		method = dht::ANNOUNCE_PEER;
 	}
@@ -85,6 +85,8 @@ namespace dht
 		info_hash = Key(args->getByteArray("info_hash"));
 		port = args->getInt("port");
 		token = Key(args->getByteArray("token"));
+		BValueNode* v = args->getValue("seed");
+		seed = v && v->data().toInt() == 1;
 	}
 }
 
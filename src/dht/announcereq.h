@@ -45,10 +45,14 @@ namespace dht
 		const Key & getToken() const {return token;}
 		bt::Uint16 getPort() const {return port;}
 		
+		/// Whether or not the sender is seeding (BEP 33)
+		bool isSeed() const {return seed;}
+		
 		typedef QSharedPointer<AnnounceReq> Ptr;
 	private:
 		bt::Uint16 port;
 		Key token;
+		bool seed;
 	};
 
 }
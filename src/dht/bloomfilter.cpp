@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by                                                 *
+ *   Joris Guisson <joris.guisson@gmail.com>                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "bloomfilter.h"
+#include <math.h>
+#include <string.h>
+#include <util/sha1hash.h>
+#include <util/functions.h>
+
+using namespace bt;
+
+namespace dht
+{
+	static const Uint32 NUM_BITS = BloomFilter::SIZE * 8;
+	
+	BloomFilter::BloomFilter()
+	{
+		clear();
+	}
+	
+	BloomFilter::BloomFilter(const QByteArray & data)
+	{
+		if (data.size() == (int)SIZE)
+			memcpy(bits, data.constData(), SIZE);
+		else
+			clear();
+	}
+
+	BloomFilter::~BloomFilter()
+	{
+	}
+	
+	void BloomFilter::insert(const net::Address & addr)
+	{
+		if (addr.ipVersion() == 4)
+		{
+			Uint8 ip[4];
+			WriteUint32(ip, 0, addr.toIPv4Address());
+			insert(ip, 4);
+		}
+		else
+		{
+			Q_IPV6ADDR ip = addr.toIPv6Address();
+			insert(ip.c, 16);
+		}
+	}
+	
+	void BloomFilter::insert(const Uint8* ip, Uint32 size)
+	{
+		SHA1Hash h = SHA1Hash::generate(ip, size);
+		const Uint8* d = h.getData();
+		Uint32 index1 = (d[0] | d[1] << 8) % NUM_BITS;
+		Uint32 index2 = (d[2] | d[3] << 8) % NUM_BITS;
+		bits[index1 / 8] |= 0x01 << (index1 % 8);
+		bits[index2 / 8] |= 0x01 << (index2 % 8);
+	}
+	
+	double BloomFilter::estimate() const
+	{
+		Uint32 zeros = 0;
+		for (Uint32 i = 0; i < SIZE; i++)
+		{
+			for (Uint8 b = bits[i]; b != 0xFF; b |= b + 1)
+				zeros++;
+		}
+		
+		// a full filter would give an infinite estimate
+		double c = qMin(zeros, NUM_BITS - 1);
+		return log(c / NUM_BITS) / (2 * log(1.0 - 1.0 / NUM_BITS));
+	}
+	
+	bool BloomFilter::isEmpty() const
+	{
+		for (Uint32 i = 0; i < SIZE; i++)
+			if (bits[i])
+				return false;
+		return true;
+	}
+	
+	void BloomFilter::clear()
+	{
+		memset(bits, 0, SIZE);
+	}
+	
+	QByteArray BloomFilter::toByteArray() const
+	{
+		return QByteArray((const char*)bits, SIZE);
+	}
+	
+	BloomFilter & BloomFilter::operator |= (const BloomFilter & other)
+	{
+		for (Uint32 i = 0; i < SIZE; i++)
+			bits[i] |= other.bits[i];
+		return *this;
+	}
+}
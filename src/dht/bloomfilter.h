@@ -0,0 +1,76 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by                                                 *
+ *   Joris Guisson <joris.guisson@gmail.com>                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef DHT_BLOOMFILTER_H
+#define DHT_BLOOMFILTER_H
+
+#include <QByteArray>
+#include <ktorrent_export.h>
+#include <net/address.h>
+#include <util/constants.h>
+
+namespace dht
+{
+
+	/**
+	 * Bloom filter of IP addresses, used to tell how many seeds and peers
+	 * a torrent has in a scrape (BEP 33). The filter has 2048 bits, and the
+	 * two bit positions of an address are taken from the SHA1 hash of its IP.
+	 */
+	class KTORRENT_EXPORT BloomFilter
+	{
+	public:
+		BloomFilter();
+		
+		/// Create a filter from received data, it stays empty if the size is wrong
+		BloomFilter(const QByteArray & data);
+		virtual ~BloomFilter();
+		
+		/// Size of the filter in bytes
+		static const bt::Uint32 SIZE = 256;
+		
+		/// Insert the IP of an address, the port is not used
+		void insert(const net::Address & addr);
+		
+		/// Insert an IP in network byte order, 4 or 16 bytes long
+		void insert(const bt::Uint8* ip, bt::Uint32 size);
+		
+		/// Estimate the number of IPs in the filter
+		double estimate() const;
+		
+		/// Is the filter empty
+		bool isEmpty() const;
+		
+		/// Remove everything from the filter
+		void clear();
+		
+		/// Get the filter as it is sent in a message
+		QByteArray toByteArray() const;
+		
+		/// Add all IPs of another filter
+		BloomFilter & operator |= (const BloomFilter & other);
+		
+	private:
+		bt::Uint8 bits[SIZE];
+	};
+
+}
+
+#endif // DHT_BLOOMFILTER_H
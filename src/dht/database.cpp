@@ -19,6 +19,7 @@
  ***************************************************************************/
 #include "database.h"
 #include <arpa/inet.h>
+#include <string.h>
 #include <util/functions.h>
 #include <util/log.h>
 #include <torrent/globals.h>
@@ -75,8 +76,43 @@ namespace dht
 	}
 
 	///////////////////////////////////////////////
+	
+	// length of a slot of the expire wheel
+	static const TimeStamp WHEEL_SLOT_TIME = 60 * 1000;
+	
+	static const Uint32 MAX_ITEM_AGE_SECS = MAX_ITEM_AGE / 1000;
+	
+	// memory used by a key besides its items and KeyItems: the map node, the vectors and a wheel entry
+	static const Uint32 KEY_OVERHEAD = 96;
+	
+	static QHostAddress ToHostAddress(const Uint8* ip, int size)
+	{
+		if (size == 4)
+			return QHostAddress(ReadUint32(ip, 0));
+		
+		Q_IPV6ADDR addr;
+		memcpy(addr.c, ip, 16);
+		return QHostAddress(addr);
+	}
+	
+	Database::KeyItems::KeyItems(const dht::Key & key) : key(key), filters(0), expire_slot(0), prev(0), next(0)
+	{
+		seen[0] = seen[1] = 0;
+	}
+	
+	Database::KeyItems::~KeyItems()
+	{
+		delete filters;
+	}
 
 	Database::Database()
+		: wheel_slot(bt::CurrentTime() / WHEEL_SLOT_TIME),
+		lru_first(0),
+		lru_last(0),
+		num_ipv4(0),
+		num_ipv6(0),
+		num_filters(0),
+		memory_limit(DEFAULT_DB_MEMORY_LIMIT)
 	{
 		items.setAutoDelete(true);
 	}
@@ -85,46 +121,328 @@ namespace dht
 	Database::~Database()
 	{}
 
-	void Database::store(const dht::Key & key, const DBItem & dbi)
+	void Database::store(const dht::Key & key, const DBItem & dbi, bool seed)
 	{
-		DBItemList* dbl = items.find(key);
-		if (!dbl)
+		TimeStamp now = bt::CurrentTime();
+		KeyItems* ki = findOrCreate(key, now);
+		const net::Address & addr = dbi.getAddress();
+		bool full = false;
+		if (addr.ipVersion() == 4)
+		{
+			Uint8 ip[4];
+			WriteUint32(ip, 0, addr.toIPv4Address());
+			if (storeItem(ki->ipv4, ki->seen[0], ip, addr.port(), seed, now / 1000))
+				num_ipv4++;
+			full = ki->seen[0] > 0;
+		}
+		else
 		{
-			dbl = new DBItemList();
-			items.insert(key, dbl);
+			Q_IPV6ADDR ip = addr.toIPv6Address();
+			if (storeItem(ki->ipv6, ki->seen[1], ip.c, addr.port(), seed, now / 1000))
+				num_ipv6++;
+			full = ki->seen[1] > 0;
 		}
-		dbl->append(dbi);
+		
+		// when not every peer can be stored, the scrape filters need to see every announce
+		if (full && !ki->filters)
+		{
+			ki->filters = new ScrapeFilters();
+			ki->filters->started = now;
+			fillFilters(ki->ipv4, ki->filters->seeds[0], ki->filters->peers[0]);
+			fillFilters(ki->ipv6, ki->filters->seeds[0], ki->filters->peers[0]);
+			num_filters++;
+		}
+		
+		if (ki->filters)
+		{
+			if (seed)
+				ki->filters->seeds[0].insert(addr);
+			else
+				ki->filters->peers[0].insert(addr);
+		}
+		
+		touch(ki);
+		evict(ki);
+	}
+	
+	template <int N>
+	bool Database::storeItem(QVector<PackedItem<N> > & v, Uint32 & seen, const Uint8* ip, Uint16 port, bool seed, Uint32 now)
+	{
+		typename QVector<PackedItem<N> >::iterator i;
+		for (i = v.begin(); i != v.end(); i++)
+		{
+			if (i->port == port && memcmp(i->ip, ip, N) == 0)
+			{
+				// announced again
+				i->seed = seed;
+				i->announced = now;
+				return false;
+			}
+		}
+		
+		PackedItem<N> item;
+		memcpy(item.ip, ip, N);
+		item.port = port;
+		item.seed = seed;
+		item.announced = now;
+		if ((Uint32)v.size() < MAX_ITEMS_PER_KEY)
+		{
+			v.append(item);
+			seen = 0;
+			return true;
+		}
+		
+		// full, keep a random sample of everybody who announced
+		if (seen < (Uint32)v.size())
+			seen = v.size();
+		seen++;
+		Uint32 j = qrand() % seen;
+		if (j < (Uint32)v.size())
+			v[j] = item;
+		return false;
 	}
 
-	void Database::sample(const dht::Key & key, DBItemList & tdbl, bt::Uint32 max_entries, bt::Uint32 ip_version)
+	void Database::sample(const dht::Key & key, DBItemList & tdbl, bt::Uint32 max_entries, bt::Uint32 ip_version, bool no_seeds)
 	{
-		DBItemList* dbl = items.find(key);
-		if (!dbl)
+		KeyItems* ki = items.find(key);
+		if (!ki)
 			return;
 
-		DBItemList::iterator i = dbl->begin();
-		while (i != dbl->end() && tdbl.count() < (int)max_entries)
+		Uint32 now = bt::CurrentTime() / 1000;
+		if (ip_version == 4)
+			sampleItems(ki->ipv4, tdbl, max_entries, no_seeds, now);
+		else
+			sampleItems(ki->ipv6, tdbl, max_entries, no_seeds, now);
+	}
+	
+	template <int N>
+	void Database::sampleItems(const QVector<PackedItem<N> > & v, DBItemList & dbl, Uint32 max_entries, bool no_seeds, Uint32 now)
+	{
+		if (v.isEmpty())
+			return;
+		
+		// start at a random place, so everybody gets a chance to be returned
+		int start = qrand() % v.size();
+		for (int n = 0; n < v.size() && dbl.count() < (int)max_entries; n++)
+		{
+			const PackedItem<N> & item = v[(start + n) % v.size()];
+			// the wheel only visits a key once a minute, so items can be a bit too old
+			if ((no_seeds && item.seed) || item.announced + MAX_ITEM_AGE_SECS <= now)
+				continue;
+			
+			dbl.append(DBItem(net::Address(ToHostAddress(item.ip, N), item.port)));
+		}
+	}
+	
+	bool Database::scrape(const dht::Key & key, BloomFilter & seeds, BloomFilter & peers)
+	{
+		seeds.clear();
+		peers.clear();
+		KeyItems* ki = items.find(key);
+		if (!ki || (ki->ipv4.isEmpty() && ki->ipv6.isEmpty()))
+			return false;
+		
+		if (ki->filters)
+		{
+			seeds |= ki->filters->seeds[0];
+			seeds |= ki->filters->seeds[1];
+			peers |= ki->filters->peers[0];
+			peers |= ki->filters->peers[1];
+		}
+		else
+		{
+			fillFilters(ki->ipv4, seeds, peers);
+			fillFilters(ki->ipv6, seeds, peers);
+		}
+		return true;
+	}
+	
+	template <int N>
+	void Database::fillFilters(const QVector<PackedItem<N> > & v, BloomFilter & seeds, BloomFilter & peers)
+	{
+		typename QVector<PackedItem<N> >::const_iterator i;
+		for (i = v.begin(); i != v.end(); i++)
 		{
-			if (ip_version == (bt::Uint32)i->getAddress().ipVersion())
-				tdbl.append(*i);
-			i++;
+			if (i->seed)
+				seeds.insert(i->ip, N);
+			else
+				peers.insert(i->ip, N);
 		}
 	}
 
 	void Database::expire(bt::TimeStamp now)
 	{
-		bt::PtrMap<dht::Key, DBItemList>::iterator itr = items.begin();
-		while (itr != items.end())
+		Uint64 now_slot = now / WHEEL_SLOT_TIME;
+		if (now_slot <= wheel_slot)
+			return;
+		
+		// if more then a full turn has passed, every slot needs to be visited once
+		Uint64 first = now_slot - wheel_slot > WHEEL_SLOTS ? now_slot - WHEEL_SLOTS + 1 : wheel_slot + 1;
+		for (Uint64 s = first; s <= now_slot; s++)
+		{
+			QList<WheelEntry> & slot = wheel[s % WHEEL_SLOTS];
+			QList<WheelEntry> due = slot;
+			slot.clear();
+			wheel_slot = s;
+			foreach (const WheelEntry & e, due)
+			{
+				// skip keys which have been removed or rescheduled
+				KeyItems* ki = items.find(e.key);
+				if (!ki || ki->expire_slot != e.slot)
+					continue;
+				
+				if (e.slot > now_slot)
+					slot.append(e); // not yet, it is a turn further
+				else
+					purge(ki, now);
+			}
+		}
+		wheel_slot = now_slot;
+	}
+	
+	void Database::purge(KeyItems* ki, bt::TimeStamp now)
+	{
+		Uint32 oldest = now / 1000;
+		num_ipv4 -= purgeItems(ki->ipv4, now / 1000, oldest);
+		num_ipv6 -= purgeItems(ki->ipv6, now / 1000, oldest);
+		if (ki->ipv4.isEmpty() && ki->ipv6.isEmpty())
+		{
+			remove(ki);
+			return;
+		}
+		
+		TimeStamp deadline = (TimeStamp)oldest * 1000 + MAX_ITEM_AGE;
+		if (ki->filters)
+		{
+			ScrapeFilters* f = ki->filters;
+			if (now - f->started >= MAX_ITEM_AGE)
+			{
+				// start a new period
+				f->seeds[1] = f->seeds[0];
+				f->peers[1] = f->peers[0];
+				f->seeds[0].clear();
+				f->peers[0].clear();
+				f->started = now;
+			}
+			deadline = qMin(deadline, f->started + MAX_ITEM_AGE);
+		}
+		
+		ki->expire_slot = 0;
+		schedule(ki, deadline);
+	}
+	
+	template <int N>
+	Uint32 Database::purgeItems(QVector<PackedItem<N> > & v, Uint32 now, Uint32 & oldest)
+	{
+		Uint32 removed = 0;
+		int i = 0;
+		while (i < v.size())
 		{
-			DBItemList* dbl = itr->second;
-			// newer keys are inserted at the back
-			// so we can stop when we hit the first key which is not expired
-			while (dbl->count() > 0 && dbl->first().expired(now))
+			if (v[i].announced + MAX_ITEM_AGE_SECS <= now)
 			{
-				dbl->pop_front();
+				// the order doesn't matter, so move the last one in its place
+				v[i] = v.last();
+				v.pop_back();
+				removed++;
+			}
+			else
+			{
+				if (v[i].announced < oldest)
+					oldest = v[i].announced;
+				i++;
 			}
-			itr++;
 		}
+		
+		if (removed > 0 && v.capacity() > 2 * v.size())
+			v.squeeze();
+		return removed;
+	}
+	
+	void Database::schedule(KeyItems* ki, bt::TimeStamp deadline)
+	{
+		Uint64 slot = deadline / WHEEL_SLOT_TIME + 1;
+		if (slot <= wheel_slot)
+			slot = wheel_slot + 1;
+		
+		// if it is already due earlier, it will be rescheduled then
+		if (ki->expire_slot != 0 && ki->expire_slot <= slot)
+			return;
+		
+		ki->expire_slot = slot;
+		WheelEntry e;
+		e.key = ki->key;
+		e.slot = slot;
+		wheel[slot % WHEEL_SLOTS].append(e);
+	}
+	
+	Database::KeyItems* Database::findOrCreate(const dht::Key & key, bt::TimeStamp now)
+	{
+		KeyItems* ki = items.find(key);
+		if (!ki)
+		{
+			ki = new KeyItems(key);
+			items.insert(key, ki);
+			schedule(ki, now + MAX_ITEM_AGE);
+		}
+		return ki;
+	}
+	
+	void Database::remove(KeyItems* ki)
+	{
+		unlink(ki);
+		num_ipv4 -= ki->ipv4.size();
+		num_ipv6 -= ki->ipv6.size();
+		if (ki->filters)
+			num_filters--;
+		
+		dht::Key key = ki->key;
+		items.erase(key);
+	}
+	
+	void Database::touch(KeyItems* ki)
+	{
+		unlink(ki);
+		ki->prev = lru_last;
+		if (lru_last)
+			lru_last->next = ki;
+		else
+			lru_first = ki;
+		lru_last = ki;
+	}
+	
+	void Database::unlink(KeyItems* ki)
+	{
+		if (ki->prev)
+			ki->prev->next = ki->next;
+		else if (lru_first == ki)
+			lru_first = ki->next;
+		
+		if (ki->next)
+			ki->next->prev = ki->prev;
+		else if (lru_last == ki)
+			lru_last = ki->prev;
+		
+		ki->prev = ki->next = 0;
+	}
+	
+	void Database::evict(KeyItems* keep)
+	{
+		while (memoryUsage() > memory_limit && lru_first && lru_first != keep)
+			remove(lru_first);
+	}
+	
+	Uint64 Database::memoryUsage() const
+	{
+		return (Uint64)items.count() * (sizeof(KeyItems) + KEY_OVERHEAD) +
+			(Uint64)num_ipv4 * sizeof(PackedItem<4>) +
+			(Uint64)num_ipv6 * sizeof(PackedItem<16>) +
+			(Uint64)num_filters * sizeof(ScrapeFilters);
+	}
+	
+	void Database::setMemoryLimit(Uint64 limit)
+	{
+		memory_limit = limit;
+		evict(0);
 	}
 
 	dht::Key Database::genToken(const net::Address & addr)
@@ -215,11 +533,11 @@ namespace dht
 
 	void Database::insert(const dht::Key & key)
 	{
-		DBItemList* dbl = items.find(key);
-		if (!dbl)
+		if (!items.find(key))
 		{
-			dbl = new DBItemList();
-			items.insert(key, dbl);
+			KeyItems* ki = findOrCreate(key, bt::CurrentTime());
+			touch(ki);
+			evict(ki);
 		}
 	}
 }
@@ -22,11 +22,13 @@
 
 #include <qmap.h>
 #include <qlist.h>
+#include <qvector.h>
 #include <net/address.h>
 #include <util/ptrmap.h>
 #include <util/constants.h>
 #include <util/array.h>
 #include "key.h"
+#include "bloomfilter.h"
 
 
 
@@ -34,6 +36,12 @@ namespace dht
 {
 	/// Each item may only exist for 30 minutes
 	const bt::Uint32 MAX_ITEM_AGE = 30 * 60 * 1000;
+	
+	/// Maximum number of items per key and IP version
+	const bt::Uint32 MAX_ITEMS_PER_KEY = 256;
+	
+	/// Default maximum amount of memory used by the database
+	const bt::Uint64 DEFAULT_DB_MEMORY_LIMIT = 16 * 1024 * 1024;
 
 	/**
 	 * @author Joris Guisson
@@ -74,6 +82,11 @@ namespace dht
 	 * @author Joris Guisson
 	 *
 	 * Class where all the key value paires get stored.
+	 * Every key keeps at most MAX_ITEMS_PER_KEY items per IP version, when more peers
+	 * announce, a random sample of them is kept. Items are stored packed, and are expired
+	 * by a wheel with a slot per minute, so only the keys which have items due are visited.
+	 * When the database uses more memory then allowed, the least recently announced
+	 * keys are dropped.
 	*/
 	class Database
 	{
@@ -85,8 +98,9 @@ namespace dht
 		 * Store an entry in the database
 		 * @param key The key
 		 * @param dbi The DBItem to store
+		 * @param seed Whether or not the peer is a seed
 		 */
-		void store(const dht::Key & key, const DBItem & dbi);
+		void store(const dht::Key & key, const DBItem & dbi, bool seed = false);
 
 		/**
 		 * Get max_entries items from the database, which have
@@ -98,8 +112,20 @@ namespace dht
 		 * @param dbl The list to store the items in
 		 * @param max_entries The maximum number entries
 		 * @param ip_version Wanted IP version (4 or 6)
+		 * @param no_seeds Leave out the seeds
 		 */
-		void sample(const dht::Key & key, DBItemList & dbl, bt::Uint32 max_entries, bt::Uint32 ip_version);
+		void sample(const dht::Key & key, DBItemList & dbl, bt::Uint32 max_entries, bt::Uint32 ip_version, bool no_seeds = false);
+		
+		/**
+		 * Fill the bloom filters of a scrape (BEP 33) for a key. For keys which
+		 * got more announces then could be stored, all peers which announced during
+		 * the last 30 to 60 minutes are in the filters.
+		 * @param key The key
+		 * @param seeds Filter of the seeds
+		 * @param peers Filter of the peers which are not seeding
+		 * @return false if the key has no items
+		 */
+		bool scrape(const dht::Key & key, BloomFilter & seeds, BloomFilter & peers);
 
 		/**
 		 * Expire all items older then 30 minutes
@@ -130,9 +156,100 @@ namespace dht
 		/// Insert an empty item (only if it isn't already in the DB)
 		void insert(const dht::Key & key);
 		
+		/// Get the number of keys
+		bt::Uint32 numKeys() const {return items.count();}
+		
+		/// Get the number of stored items
+		bt::Uint32 numItems() const {return num_ipv4 + num_ipv6;}
+		
+		/// Get an estimate of the memory used by the keys and items
+		bt::Uint64 memoryUsage() const;
+		
+		/// Set the maximum amount of memory the keys and items may use
+		void setMemoryLimit(bt::Uint64 limit);
+		
+	private:
+		/// An item as it is stored, N is the size of the IP
+		template <int N>
+		struct PackedItem
+		{
+			bt::Uint8 ip[N];
+			bt::Uint16 port;
+			bool seed;
+			// time of the last announce in seconds
+			bt::Uint32 announced;
+		};
+		
+		typedef QVector<PackedItem<4> > IPv4Items;
+		typedef QVector<PackedItem<16> > IPv6Items;
+		
+		/// Filters of every peer which announced, the previous filter covers the MAX_ITEM_AGE before the current one
+		struct ScrapeFilters
+		{
+			BloomFilter seeds[2];
+			BloomFilter peers[2];
+			bt::TimeStamp started;
+		};
+		
+		/// All the items of a key
+		struct KeyItems
+		{
+			dht::Key key;
+			IPv4Items ipv4;
+			IPv6Items ipv6;
+			// number of announces seen while the IPv4 and IPv6 items were full
+			bt::Uint32 seen[2];
+			// only present for keys with more announces then can be stored
+			ScrapeFilters* filters;
+			// slot of the expire wheel, 0 if not in the wheel
+			bt::Uint64 expire_slot;
+			// least recently announced keys come first
+			KeyItems* prev;
+			KeyItems* next;
+			
+			KeyItems(const dht::Key & key);
+			~KeyItems();
+		};
+		
+		struct WheelEntry
+		{
+			dht::Key key;
+			bt::Uint64 slot;
+		};
+		
+		KeyItems* findOrCreate(const dht::Key & key, bt::TimeStamp now);
+		void schedule(KeyItems* ki, bt::TimeStamp deadline);
+		void purge(KeyItems* ki, bt::TimeStamp now);
+		void remove(KeyItems* ki);
+		void touch(KeyItems* ki);
+		void unlink(KeyItems* ki);
+		void evict(KeyItems* keep);
+		
+		template <int N>
+		static bool storeItem(QVector<PackedItem<N> > & v, bt::Uint32 & seen, const bt::Uint8* ip, bt::Uint16 port, bool seed, bt::Uint32 now);
+		
+		template <int N>
+		static void sampleItems(const QVector<PackedItem<N> > & v, DBItemList & dbl, bt::Uint32 max_entries, bool no_seeds, bt::Uint32 now);
+		
+		template <int N>
+		static bt::Uint32 purgeItems(QVector<PackedItem<N> > & v, bt::Uint32 now, bt::Uint32 & oldest);
+		
+		template <int N>
+		static void fillFilters(const QVector<PackedItem<N> > & v, BloomFilter & seeds, BloomFilter & peers);
+		
+		static const bt::Uint32 WHEEL_SLOTS = 32;
+		
 	private:
-		bt::PtrMap<dht::Key, DBItemList> items;
+		bt::PtrMap<dht::Key, KeyItems> items;
 		QMap<dht::Key, bt::TimeStamp> tokens;
+		QList<WheelEntry> wheel[WHEEL_SLOTS];
+		bt::Uint64 wheel_slot;
+		KeyItems* lru_first;
+		KeyItems* lru_last;
+		bt::Uint32 num_ipv4;
+		bt::Uint32 num_ipv6;
+		bt::Uint32 num_filters;
+		bt::Uint64 memory_limit;
 	};
 
 }
@@ -81,7 +81,7 @@ namespace dht
 		srv->start();
 		node->loadTable(table);
 		update_timer.start(1000);
-		expire_timer.start(5*60*1000);
+		expire_timer.start(60*1000);
 		started();
 		if (node->getNumEntriesInRoutingTable() > 0)
 		{
@@ -186,7 +186,7 @@ namespace dht
 			return;
 
 		// everything OK, so store the value
-		db->store(r.getInfoHash(), DBItem(r.getOrigin()));
+		db->store(r.getInfoHash(), DBItem(r.getOrigin()), r.isSeed());
 		// send a proper response to indicate everything is OK
 		AnnounceRsp rsp(r.getMTID(), node->getOurID());
 		rsp.setOrigin(r.getOrigin());
@@ -206,7 +206,7 @@ namespace dht
 
 		node->received(this, r);
 		DBItemList dbl;
-		db->sample(r.getInfoHash(), dbl, 50, r.getOrigin().ipVersion());
+		db->sample(r.getInfoHash(), dbl, 50, r.getOrigin().ipVersion(), r.noSeed());
 
 		// generate a token
 		dht::Key token = db->genToken(r.getOrigin());
@@ -224,6 +224,13 @@ namespace dht
 
 		GetPeersRsp fnr(r.getMTID(), node->getOurID(), dbl, token);
 		kns.pack(&fnr);
+		if (r.isScrape())
+		{
+			BloomFilter seeds;
+			BloomFilter peers;
+			if (db->scrape(r.getInfoHash(), seeds, peers))
+				fnr.setScrapeFilters(seeds, peers);
+		}
 		fnr.setOrigin(r.getOrigin());
 		srv->sendMsg(fnr);
 	}
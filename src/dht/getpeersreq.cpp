@@ -31,12 +31,12 @@ using namespace bt;
 namespace dht
 {
 	GetPeersReq::GetPeersReq()
-			: RPCMsg(QByteArray(), GET_PEERS, REQ_MSG, Key())
+			: RPCMsg(QByteArray(), GET_PEERS, REQ_MSG, Key()), scrape(false), noseed(false)
 	{
 	}
 
 	GetPeersReq::GetPeersReq(const Key & id, const Key & info_hash)
-			: RPCMsg(QByteArray(), GET_PEERS, REQ_MSG, id), info_hash(info_hash)
+			: RPCMsg(QByteArray(), GET_PEERS, REQ_MSG, id), info_hash(info_hash), scrape(false), noseed(false)
 	{}
 
 	GetPeersReq::~GetPeersReq()
@@ -85,6 +85,11 @@ namespace dht
 			for (bt::Uint32 i = 0; i < ln->getNumChildren(); i++)
 				want.append(ln->getString(i, 0));
 		}
+		
+		BValueNode* v = args->getValue("scrape");
+		scrape = v && v->data().toInt() == 1;
+		v = args->getValue("noseed");
+		noseed = v && v->data().toInt() == 1;
 	}
 	
 	bool GetPeersReq::wants(int ip_version) const
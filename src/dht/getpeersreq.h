@@ -40,6 +40,12 @@ namespace dht
 		const Key & getInfoHash() const {return info_hash;}
 		bool wants(int ip_version) const;
 		
+		/// Whether or not the sender wants the seed and peer bloom filters (BEP 33)
+		bool isScrape() const {return scrape;}
+		
+		/// Whether or not the sender only wants peers which are not seeding (BEP 33)
+		bool noSeed() const {return noseed;}
+		
 		virtual void apply(DHT* dh_table);
 		virtual void print();
 		virtual void encode(QByteArray & arr) const;
@@ -50,6 +56,8 @@ namespace dht
 	protected:
 		Key info_hash;
 		QStringList want;
+		bool scrape;
+		bool noseed;
 	};
 	
 }
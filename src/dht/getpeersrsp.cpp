@@ -62,6 +62,12 @@ namespace dht
 		.arg(mtid[0]).arg(id.toString()).arg(nodes.size() > 0 ? "nodes" : "values") << endl;
 	}
 
+	void GetPeersRsp::setScrapeFilters(const BloomFilter & seeds, const BloomFilter & peers)
+	{
+		bf_seeds = seeds.toByteArray();
+		bf_peers = peers.toByteArray();
+	}
+
 	void GetPeersRsp::encode(QByteArray & arr) const
 	{
 		BEncoder enc(new BEncoderBufferOutput(arr));
@@ -70,6 +76,18 @@ namespace dht
 			enc.write(RSP); 
 			enc.beginDict();
 			{
+				if (bf_peers.size() > 0)
+				{
+					enc.write(QString("BFpe"));
+					enc.write(bf_peers);
+				}
+				
+				if (bf_seeds.size() > 0)
+				{
+					enc.write(QString("BFsd"));
+					enc.write(bf_seeds);
+				}
+				
 				enc.write(QString("id")); enc.write(id.getData(), 20);
 				if (nodes.size() > 0)
 				{
@@ -140,6 +158,13 @@ namespace dht
 			}
 		}
 		
+		BValueNode* bf = args->getValue("BFsd");
+		if (bf)
+			bf_seeds = bf->data().toByteArray();
+		bf = args->getValue("BFpe");
+		if (bf)
+			bf_peers = bf->data().toByteArray();
+		
 		if (args->getValue("nodes") || args->getList("nodes6"))
 		{
 			BValueNode* v = args->getValue("nodes");
@@ -24,6 +24,7 @@
 
 #include "rpcmsg.h"
 #include "packednodecontainer.h"
+#include "bloomfilter.h"
 
 namespace dht
 {
@@ -48,11 +49,22 @@ namespace dht
 		const Key & getToken() const {return token;}
 		bool containsNodes() const {return nodes.size() > 0 || nodes6.size() > 0;}
 		bool containsValues() const {return nodes.size() == 0;}
+		
+		/// Set the seed and peer bloom filters of a scrape (BEP 33)
+		void setScrapeFilters(const BloomFilter & seeds, const BloomFilter & peers);
+		
+		/// Get the seed bloom filter of a scrape, empty if there was none
+		BloomFilter getSeedFilter() const {return BloomFilter(bf_seeds);}
+		
+		/// Get the peer bloom filter of a scrape, empty if there was none
+		BloomFilter getPeerFilter() const {return BloomFilter(bf_peers);}
 
 		typedef QSharedPointer<GetPeersRsp> Ptr;
 	private:
 		Key token;
 		DBItemList items;
+		QByteArray bf_seeds;
+		QByteArray bf_peers;
 	};
 
 }
@@ -90,7 +90,7 @@ namespace dht
 		KBucket::Ptr left(new KBucket(min_key, m, srv, our_id));
 		KBucket::Ptr right(new KBucket(m + 1, max_key, srv, our_id));
 
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 		for (i = entries.begin();i != entries.end();i++)
 		{
 			KBucketEntry & e = *i;
@@ -105,7 +105,7 @@ namespace dht
 
 	bool KBucket::insert(const KBucketEntry & entry)
 	{
-		QList<KBucketEntry>::iterator i = qFind(entries.begin(), entries.end(), entry);
+		QVector<KBucketEntry>::iterator i = qFind(entries.begin(), entries.end(), entry);
 
 		// If in the list, move it to the end
 		if (i != entries.end())
@@ -169,7 +169,7 @@ namespace dht
 		KBucketEntry entry = pending_entries_busy_pinging[c];
 
 		// replace the entry which timed out
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 		for (i = entries.begin();i != entries.end();i++)
 		{
 			KBucketEntry & e = *i;
@@ -200,7 +200,7 @@ namespace dht
 			return;
 		}
 
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 		// we haven't found any bad ones so try the questionable ones
 		for (i = entries.begin();i != entries.end();i++)
 		{
@@ -225,7 +225,7 @@ namespace dht
 
 	bool KBucket::replaceBadEntry(const KBucketEntry & entry)
 	{
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 		for (i = entries.begin();i != entries.end();i++)
 		{
 			KBucketEntry & e = *i;
@@ -248,7 +248,7 @@ namespace dht
 
 	void KBucket::findKClosestNodes(KClosestNodesSearch & kns)
 	{
-		QList<KBucketEntry>::iterator i = entries.begin();
+		QVector<KBucketEntry>::iterator i = entries.begin();
 		while (i != entries.end())
 		{
 			kns.tryInsert(*i);
@@ -258,7 +258,7 @@ namespace dht
 
 	bool KBucket::onTimeout(const net::Address & addr)
 	{
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 
 		for (i = entries.begin();i != entries.end();i++)
 		{
@@ -298,7 +298,7 @@ namespace dht
 		enc.write("max", max_key.toByteArray());
 		enc.write(QString("entries"));
 		enc.beginList();
-		QList<KBucketEntry>::iterator i;
+		QVector<KBucketEntry>::iterator i;
 		for (i = entries.begin();i != entries.end();i++)
 		{
 			enc.beginDict();
@@ -22,6 +22,7 @@
 
 #include <set>
 #include <QList>
+#include <QVector>
 #include <util/constants.h>
 #include <net/address.h>
 #include "key.h"
@@ -141,7 +142,8 @@ namespace dht
 		
 	private:
 		dht::Key min_key, max_key;
-		QList<KBucketEntry> entries, pending_entries;
+		QVector<KBucketEntry> entries;
+		QList<KBucketEntry> pending_entries;
 		RPCServerInterface* srv;
 		Key our_id;
 		QMap<RPCCall*, KBucketEntry> pending_entries_busy_pinging;
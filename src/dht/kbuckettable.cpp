@@ -50,40 +50,29 @@ namespace dht
 		if(buckets.empty())
 		{
 			KBucket::Ptr initial(new KBucket(srv, our_id));
-			buckets.push_back(initial);
+			buckets.append(initial);
 		}
 
-
-		KBucketList::iterator kb = findBucket(entry.getID());
-
-		// return if we can't find a bucket, should never happen'
-		if(kb == buckets.end())
-		{
-			Out(SYS_DHT | LOG_IMPORTANT) << "Unable to find bucket !" << endl;
-			return;
-		}
+		int idx = findBucket(entry.getID());
+		KBucket::Ptr kb = buckets[idx];
 
 		// insert it into the bucket
 		try
 		{
-			if((*kb)->insert(entry))
+			if(kb->insert(entry))
 			{
-				// Bucket needs to be splitted
-				std::pair<KBucket::Ptr, KBucket::Ptr> result = (*kb)->split();
-/*
-				Out(SYS_DHT | LOG_DEBUG) << "Splitting bucket " << (*kb)->minKey().toString() << "-" << (*kb)->maxKey().toString() << endl;
-				Out(SYS_DHT | LOG_DEBUG) << "L: " << result.first->minKey().toString() << "-" << result.first->maxKey().toString() << endl;
-				Out(SYS_DHT | LOG_DEBUG) << "L range: " << (result.first->maxKey() - result.first->minKey()).toString() << endl;
-				Out(SYS_DHT | LOG_DEBUG) << "R: " << result.second->minKey().toString() << "-" << result.second->maxKey().toString() << endl;
-				Out(SYS_DHT | LOG_DEBUG) << "R range: " << (result.second->maxKey() - result.second->minKey()).toString() << endl;
-*/
-				buckets.insert(kb, result.first);
-				buckets.insert(kb, result.second);
-				buckets.erase(kb);
-				if(result.first->keyInRange(entry.getID()))
-					result.first->insert(entry);
+				// Bucket needs to be splitted, only the last bucket contains our own ID,
+				// so the half with our ID becomes the new last bucket and the other half
+				// takes the place of the old one
+				std::pair<KBucket::Ptr, KBucket::Ptr> result = kb->split();
+				KBucket::Ptr home = result.first->keyInRange(our_id) ? result.first : result.second;
+				KBucket::Ptr other = home == result.first ? result.second : result.first;
+				buckets[idx] = other;
+				buckets.append(home);
+				if(home->keyInRange(entry.getID()))
+					home->insert(entry);
 				else
-					result.second->insert(entry);
+					other->insert(entry);
 			}
 		}
 		catch(const KBucket::UnableToSplit &)
@@ -106,15 +95,9 @@ namespace dht
 		return count;
 	}
 
-	KBucketTable::KBucketList::iterator KBucketTable::findBucket(const dht::Key& id)
+	int KBucketTable::findBucket(const dht::Key& id) const
 	{
-		for(KBucketList::iterator i = buckets.begin(); i != buckets.end(); i++)
-		{
-			if((*i)->keyInRange(id))
-				return i;
-		}
-
-		return buckets.end();
+		return qMin((int)Key::commonPrefixLength(our_id, id), buckets.size() - 1);
 	}
 
 	void KBucketTable::refreshBuckets(DHT* dh_table)
@@ -161,6 +144,8 @@ namespace dht
 			if(!bucket_list)
 				return;
 
+			KBucket::Ptr home;
+			KBucketList others;
 			for(bt::Uint32 i = 0; i < bucket_list->getNumChildren(); i++)
 			{
 				BDictNode* dict = bucket_list->getDict(i);
@@ -169,8 +154,34 @@ namespace dht
 
 				KBucket::Ptr bucket(new KBucket(srv, our_id));
 				bucket->load(dict);
-				buckets.push_back(bucket);
+				if(bucket->keyInRange(our_id) && !home)
+					home = bucket;
+				else
+					others.append(bucket);
 			}
+
+			if(!home)
+			{
+				Out(SYS_DHT | LOG_IMPORTANT) << "DHT: Bucket table in " << file << " has no bucket for our own ID, ignoring it" << endl;
+				return;
+			}
+
+			// put every bucket in the slot of the prefix it shares with our ID
+			int last = others.size();
+			KBucketList table(last + 1);
+			for(KBucketList::iterator i = others.begin(); i != others.end(); i++)
+			{
+				KBucket::Ptr b = *i;
+				int idx = Key::commonPrefixLength(our_id, b->minKey());
+				if(idx >= last || idx != (int)Key::commonPrefixLength(our_id, b->maxKey()) || table[idx])
+				{
+					Out(SYS_DHT | LOG_IMPORTANT) << "DHT: Bucket table in " << file << " is inconsistent, ignoring it" << endl;
+					return;
+				}
+				table[idx] = b;
+			}
+			table[last] = home;
+			buckets = table;
 		}
 		catch(bt::Error & e)
 		{
@@ -207,11 +218,26 @@ namespace dht
 
 	void KBucketTable::findKClosestNodes(KClosestNodesSearch& kns)
 	{
-		for(KBucketList::iterator i = buckets.begin(); i != buckets.end(); i++)
+		if(buckets.empty())
+			return;
+
+		// The bucket of the target holds the closest nodes. The nodes in the buckets
+		// after it all share exactly prefix bits with the target, and the nodes in
+		// bucket i before it share exactly i bits, so they get further away the
+		// lower we go and we can stop as soon as the search no longer wants them.
+		const Key & target = kns.getSearchTarget();
+		int prefix = Key::commonPrefixLength(our_id, target);
+		int idx = findBucket(target);
+		buckets[idx]->findKClosestNodes(kns);
+
+		if(kns.wants(prefix))
 		{
-			KBucket::Ptr b = *i;
-			b->findKClosestNodes(kns);
+			for(int i = idx + 1; i < buckets.size(); i++)
+				buckets[i]->findKClosestNodes(kns);
 		}
+
+		for(int i = idx - 1; i >= 0 && kns.wants(i); i--)
+			buckets[i]->findKClosestNodes(kns);
 	}
 
 }
@@ -21,7 +21,7 @@
 #ifndef DHT_KBUCKETTABLE_H
 #define DHT_KBUCKETTABLE_H
 
-#include <list>
+#include <QVector>
 #include <dht/kbucket.h>
 
 namespace dht
@@ -29,6 +29,10 @@ namespace dht
 	
 	/**
 	 * Holds a table of buckets.
+	 * The buckets are stored contiguously and indexed by the length of the
+	 * prefix their keys have in common with our own ID. Bucket i holds the nodes
+	 * sharing exactly i leading bits with us, the last bucket holds the nodes
+	 * closest to us and is the only one which can be split.
 	 */
 	class KBucketTable
 	{
@@ -57,9 +61,12 @@ namespace dht
 		/// FInd the K closest nodes
 		void findKClosestNodes(KClosestNodesSearch & kns);
 		
+		/// Get the number of buckets
+		int numBuckets() const {return buckets.size();}
+		
 	private:
-		typedef std::list<KBucket::Ptr> KBucketList;
-		KBucketList::iterator findBucket(const dht::Key & id);
+		typedef QVector<KBucket::Ptr> KBucketList;
+		int findBucket(const dht::Key & id) const;
 		
 	private:
 		Key our_id;
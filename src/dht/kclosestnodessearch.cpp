@@ -18,6 +18,7 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.             *
  ***************************************************************************/
 #include "kclosestnodessearch.h"
+#include <algorithm>
 #include <util/functions.h>
 #include "pack.h"
 #include "packednodecontainer.h"
@@ -26,51 +27,85 @@ using namespace bt;
 
 namespace dht
 {
-	typedef std::map<dht::Key, KBucketEntry>::iterator KNSitr;
+	static bool CloserThan(const KClosestNodesSearch::Item & a, const KClosestNodesSearch::Item & b)
+	{
+		return a.first < b.first;
+	}
 
 	KClosestNodesSearch::KClosestNodesSearch(const dht::Key & key, Uint32 max_entries)
-			: key(key), max_entries(max_entries)
-	{}
+			: key(key), sorted(false), max_entries(max_entries)
+	{
+		entries.reserve(max_entries);
+	}
 
 
 	KClosestNodesSearch::~KClosestNodesSearch()
 	{}
 
 
+	void KClosestNodesSearch::sort() const
+	{
+		if (!sorted)
+		{
+			std::sort_heap(entries.begin(), entries.end(), CloserThan);
+			sorted = true;
+		}
+	}
+
+	bool KClosestNodesSearch::wants(Uint32 prefix_length) const
+	{
+		if (entries.size() < max_entries)
+			return true;
+		else if (max_entries == 0)
+			return false;
+
+		// the furthest entry is the front of the heap, or the back when sorted
+		const dht::Key & worst = sorted ? entries.back().second.getID() : entries.front().second.getID();
+		return dht::Key::commonPrefixLength(key, worst) <= prefix_length;
+	}
+
 	void KClosestNodesSearch::tryInsert(const KBucketEntry & e)
 	{
+		if (max_entries == 0)
+			return;
+
+		if (sorted)
+		{
+			// the results have been looked at, restore the heap
+			std::make_heap(entries.begin(), entries.end(), CloserThan);
+			sorted = false;
+		}
+
 		// calculate distance between key and e
 		dht::Key d = dht::Key::distance(key, e.getID());
+		for (std::vector<Item>::const_iterator i = entries.begin(); i != entries.end(); i++)
+		{
+			// same distance means same node
+			if (i->first == d)
+				return;
+		}
 
-		if (emap.size() < max_entries)
+		if (entries.size() < max_entries)
 		{
-			// room in the map so just insert
-			emap.insert(std::make_pair(d, e));
+			// room in the heap so just insert
+			entries.push_back(std::make_pair(d, e));
+			std::push_heap(entries.begin(), entries.end(), CloserThan);
 		}
-		else
+		else if (d < entries.front().first)
 		{
-			// now find the max distance
-			// seeing that the last element of the map has also
-			// the biggest distance to key (std::map is sorted on the distance)
-			// we just take the last
-			const dht::Key & max = emap.rbegin()->first;
-			if (d < max)
-			{
-				// insert if d is smaller then max
-				emap.insert(std::make_pair(d, e));
-				// erase the old max value
-				emap.erase(max);
-			}
+			// replace the entry with the biggest distance, which is on top of the heap
+			std::pop_heap(entries.begin(), entries.end(), CloserThan);
+			entries.back() = std::make_pair(d, e);
+			std::push_heap(entries.begin(), entries.end(), CloserThan);
 		}
-
 	}
 
 	void KClosestNodesSearch::pack(PackedNodeContainer* cnt)
 	{
 		Uint32 j = 0;
 
-		KNSitr i = emap.begin();
-		while (i != emap.end())
+		Itr i = begin();
+		while (i != entries.end())
 		{
 			const KBucketEntry & e = i->second;
 			if (e.getAddress().ipVersion() == 4)
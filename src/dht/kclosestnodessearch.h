@@ -20,7 +20,7 @@
 #ifndef DHTKCLOSESTNODESSEARCH_H
 #define DHTKCLOSESTNODESSEARCH_H
 
-#include <map>
+#include <vector>
 #include "key.h"
 #include "kbucket.h"
 
@@ -32,14 +32,17 @@ namespace dht
 	 * @author Joris Guisson <joris.guisson@gmail.com>
 	 *
 	 * Class used to store the search results during a K closests nodes search
-	 * Note: we use a std::map because of lack of functionality in QMap
+	 * The results are kept in a fixed size max heap on the distance to the target,
+	 * so the worst of the K closest nodes can be replaced without reallocating.
+	 * Iterating over the results visits them from closest to furthest.
 	*/
 	class KClosestNodesSearch
 	{
-		dht::Key key;
-		std::map<dht::Key, KBucketEntry> emap;
-		bt::Uint32 max_entries;
 	public:
+		typedef std::pair<dht::Key, KBucketEntry> Item;
+		typedef std::vector<Item>::iterator Itr;
+		typedef std::vector<Item>::const_iterator CItr;
+
 		/**
 		 * Constructor sets the key to compare with
 		 * @param key The key to compare with
@@ -49,20 +52,27 @@ namespace dht
 		KClosestNodesSearch(const dht::Key & key, bt::Uint32 max_entries);
 		virtual ~KClosestNodesSearch();
 
-		typedef std::map<dht::Key, KBucketEntry>::iterator Itr;
-		typedef std::map<dht::Key, KBucketEntry>::const_iterator CItr;
+		Itr begin() {sort(); return entries.begin();}
+		Itr end() {sort(); return entries.end();}
 
-		Itr begin() {return emap.begin();}
-		Itr end() {return emap.end();}
-
-		CItr begin() const {return emap.begin();}
-		CItr end() const {return emap.end();}
+		CItr begin() const {sort(); return entries.begin();}
+		CItr end() const {sort(); return entries.end();}
 
 		/// Get the target key of the search3
 		const dht::Key & getSearchTarget() const {return key;}
 
 		/// Get the number of entries.
-		bt::Uint32 getNumEntries() const {return emap.size();}
+		bt::Uint32 getNumEntries() const {return entries.size();}
+
+		/// Whether or not the maximum number of entries has been found
+		bool isFull() const {return entries.size() >= max_entries;}
+
+		/**
+		 * Whether or not a node which shares prefix_length leading bits with the
+		 * search target could still make it into the results.
+		 * @param prefix_length The common prefix length of the node and the target
+		 */
+		bool wants(bt::Uint32 prefix_length) const;
 
 		/**
 		 * Try to insert an entry.
@@ -75,6 +85,15 @@ namespace dht
 		 * @param cnt Place to store IPv6 nodes
 		 */
 		void pack(PackedNodeContainer* cnt);
+
+	private:
+		void sort() const;
+
+	private:
+		dht::Key key;
+		mutable std::vector<Item> entries;
+		mutable bool sorted;
+		bt::Uint32 max_entries;
 	};
 
 }
@@ -145,6 +145,25 @@ namespace dht
 		return a ^ b;
 	}
 
+	Uint32 Key::commonPrefixLength(const Key & a, const Key & b)
+	{
+		for (int i = 0;i < 20;i++)
+		{
+			Uint8 x = a.hash[i] ^ b.hash[i];
+			if (x != 0)
+			{
+				Uint32 bits = i * 8;
+				while (!(x & 0x80))
+				{
+					x <<= 1;
+					bits++;
+				}
+				return bits;
+			}
+		}
+		return 160;
+	}
+
 	Key Key::random()
 	{
 		srand(time(0));
@@ -155,6 +155,15 @@ namespace dht
 		 */
 		static Key distance(const Key & a, const Key & b);
 
+		/**
+		 * Get the number of leading bits two keys have in common,
+		 * which is the number of leading zero bits of their distance.
+		 * @param a The first key
+		 * @param b The second key
+		 * @return A number from 0 up to and including 160
+		 */
+		static bt::Uint32 commonPrefixLength(const Key & a, const Key & b);
+
 		/**
 		 * Calculate the middle between two keys.
 		 * @param a The first key
@@ -0,0 +1,183 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <util/log.h>
+#include <util/functions.h>
+#include <dht/database.h>
+#include <dht/bloomfilter.h>
+
+using namespace dht;
+using namespace bt;
+
+#define NUM_KEYS 10000
+#define NUM_ANNOUNCES 100000
+
+static DBItem Item(Uint32 ip, Uint16 port)
+{
+	return DBItem(net::Address(QHostAddress(ip), port));
+}
+
+static Key KeyFromInt(Uint32 i)
+{
+	Uint8 data[20];
+	memset(data, 0, 20);
+	WriteUint32(data, 0, i);
+	return Key(data);
+}
+
+class DatabaseTest : public QObject
+{
+	Q_OBJECT
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("databasetest.log", false, true);
+	}
+	
+	void cleanupTestCase()
+	{
+	}
+	
+	void testBloomFilter()
+	{
+		// example from BEP 33
+		BloomFilter bf;
+		QVERIFY(bf.isEmpty());
+		for (int i = 0; i < 256; i++)
+			bf.insert(net::Address(QString("192.0.2.%1").arg(i), 6881));
+		for (int i = 0; i < 1000; i++)
+			bf.insert(net::Address(QString("2001:DB8::%1").arg(i, 0, 16), 6881));
+		QVERIFY(qAbs(bf.estimate() - 1224.93) < 0.01);
+		
+		BloomFilter copy(bf.toByteArray());
+		QVERIFY(copy.toByteArray() == bf.toByteArray());
+		QVERIFY(BloomFilter(QByteArray(10, 'x')).isEmpty());
+	}
+	
+	void testStore()
+	{
+		Database db;
+		Key key = KeyFromInt(1);
+		for (Uint32 i = 0; i < 10; i++)
+			db.store(key, Item(0x0A000000 + i, 6881), i % 2 == 0);
+		
+		// announcing again replaces the old item
+		db.store(key, Item(0x0A000000, 6881), false);
+		QVERIFY(db.numKeys() == 1);
+		QVERIFY(db.numItems() == 10);
+		
+		DBItemList dbl;
+		db.sample(key, dbl, 50, 4);
+		QVERIFY(dbl.count() == 10);
+		dbl.clear();
+		db.sample(key, dbl, 3, 4);
+		QVERIFY(dbl.count() == 3);
+		dbl.clear();
+		db.sample(key, dbl, 50, 4, true);
+		QVERIFY(dbl.count() == 6);
+		dbl.clear();
+		db.sample(key, dbl, 50, 6);
+		QVERIFY(dbl.count() == 0);
+		
+		BloomFilter seeds;
+		BloomFilter peers;
+		QVERIFY(db.scrape(key, seeds, peers));
+		QVERIFY(qRound(seeds.estimate()) == 4);
+		QVERIFY(qRound(peers.estimate()) == 6);
+		QVERIFY(!db.scrape(KeyFromInt(2), seeds, peers));
+	}
+	
+	void testReservoir()
+	{
+		Database db;
+		Key key = KeyFromInt(1);
+		for (Uint32 i = 0; i < 5000; i++)
+			db.store(key, Item(0x0A000000 + i, 6881), i < 1000);
+		QVERIFY(db.numItems() == MAX_ITEMS_PER_KEY);
+		
+		// the filters still count everybody
+		BloomFilter seeds;
+		BloomFilter peers;
+		QVERIFY(db.scrape(key, seeds, peers));
+		QVERIFY(seeds.estimate() > 900 && seeds.estimate() < 1100);
+		QVERIFY(peers.estimate() > 3000);
+	}
+	
+	void testExpire()
+	{
+		Database db;
+		TimeStamp now = bt::CurrentTime();
+		db.store(KeyFromInt(1), Item(0x0A000001, 6881));
+		db.insert(KeyFromInt(2));
+		QVERIFY(db.contains(KeyFromInt(2)));
+		
+		db.expire(now + 10 * 60 * 1000);
+		QVERIFY(db.numKeys() == 2);
+		QVERIFY(db.numItems() == 1);
+		
+		db.expire(now + MAX_ITEM_AGE + 2 * 60 * 1000);
+		QVERIFY(db.numKeys() == 0);
+		QVERIFY(db.numItems() == 0);
+		
+		// jumping far ahead must not leave anything behind
+		db.store(KeyFromInt(3), Item(0x0A000001, 6881));
+		db.expire(now + 5 * MAX_ITEM_AGE);
+		QVERIFY(!db.contains(KeyFromInt(3)));
+	}
+	
+	void testMemoryLimit()
+	{
+		Database db;
+		db.setMemoryLimit(100 * 1024);
+		for (Uint32 i = 0; i < NUM_ANNOUNCES; i++)
+			db.store(KeyFromInt(i % NUM_KEYS), Item(0x0A000000 + i, 6881));
+		
+		// the least recently announced keys are dropped
+		QVERIFY(db.memoryUsage() <= 100 * 1024);
+		QVERIFY(db.numKeys() > 0 && db.numKeys() < NUM_KEYS);
+		QVERIFY(db.contains(KeyFromInt((NUM_ANNOUNCES - 1) % NUM_KEYS)));
+		QVERIFY(!db.contains(KeyFromInt(NUM_ANNOUNCES % NUM_KEYS)));
+		
+		db.setMemoryLimit(0);
+		QVERIFY(db.numKeys() == 0);
+		QVERIFY(db.numItems() == 0);
+	}
+	
+	void testBenchmark()
+	{
+		Database db;
+		Uint32 i = 0;
+		QBENCHMARK
+		{
+			for (Uint32 j = 0; j < NUM_ANNOUNCES; j++, i++)
+				db.store(KeyFromInt(qrand() % NUM_KEYS), Item(0x0A000000 + i, 6881));
+		}
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Database with " << db.numKeys() << " keys and " << db.numItems() << " items uses " 
+			<< db.memoryUsage() << " bytes" << endl;
+		QVERIFY(db.memoryUsage() <= DEFAULT_DB_MEMORY_LIMIT);
+		QVERIFY(db.numItems() > 0);
+	}
+};
+
+QTEST_MAIN(DatabaseTest)
+
+#include "databasetest.moc"
@@ -0,0 +1,426 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <list>
+#include <map>
+#include <string.h>
+#include <QtTest>
+#include <util/log.h>
+#include <dht/kbuckettable.h>
+#include <dht/kclosestnodessearch.h>
+#include <dht/rpcserverinterface.h>
+
+using namespace dht;
+
+#define NUM_NODES 5000
+#define NUM_LOOKUPS 1000
+
+/// Key::random reseeds every call, so it returns the same key within a second
+static Key randomKey()
+{
+	bt::Uint8 data[20];
+	for (int i = 0; i < 20; i++)
+		data[i] = qrand() & 0xFF;
+	return Key(data);
+}
+
+class DummyServer : public RPCServerInterface
+{
+public:
+	virtual RPCCall* doCall(RPCMsg::Ptr msg)
+	{
+		Q_UNUSED(msg);
+		return 0;
+	}
+};
+
+/// The table as it was before, a list of buckets which all have to be visited
+class LegacyTable
+{
+public:
+	LegacyTable(const Key & our_id) : our_id(our_id)
+	{
+	}
+
+	void insert(const KBucketEntry & entry, RPCServerInterface* srv)
+	{
+		if (buckets.empty())
+			buckets.push_back(KBucket::Ptr(new KBucket(srv, our_id)));
+
+		std::list<KBucket::Ptr>::iterator kb = buckets.begin();
+		while (kb != buckets.end() && !(*kb)->keyInRange(entry.getID()))
+			kb++;
+
+		if (kb == buckets.end())
+			return;
+
+		try
+		{
+			if ((*kb)->insert(entry))
+			{
+				std::pair<KBucket::Ptr, KBucket::Ptr> result = (*kb)->split();
+				buckets.insert(kb, result.first);
+				buckets.insert(kb, result.second);
+				buckets.erase(kb);
+				if (result.first->keyInRange(entry.getID()))
+					result.first->insert(entry);
+				else
+					result.second->insert(entry);
+			}
+		}
+		catch (const KBucket::UnableToSplit &)
+		{
+		}
+	}
+
+	int numEntries() const
+	{
+		int count = 0;
+		for (std::list<KBucket::Ptr>::const_iterator i = buckets.begin(); i != buckets.end(); i++)
+			count += (*i)->getNumEntries();
+		return count;
+	}
+
+	int numBuckets() const
+	{
+		return buckets.size();
+	}
+
+	void findKClosestNodes(KClosestNodesSearch & kns)
+	{
+		for (std::list<KBucket::Ptr>::iterator i = buckets.begin(); i != buckets.end(); i++)
+			(*i)->findKClosestNodes(kns);
+	}
+
+private:
+	Key our_id;
+	std::list<KBucket::Ptr> buckets;
+};
+
+/// The search as it was before, a map sorted on distance
+class LegacySearch
+{
+public:
+	LegacySearch(const Key & key, bt::Uint32 max_entries) : key(key), max_entries(max_entries)
+	{
+	}
+
+	void tryInsert(const KBucketEntry & e)
+	{
+		Key d = Key::distance(key, e.getID());
+		if (emap.size() < max_entries)
+		{
+			emap.insert(std::make_pair(d, e));
+		}
+		else
+		{
+			const Key & max = emap.rbegin()->first;
+			if (d < max)
+			{
+				emap.insert(std::make_pair(d, e));
+				emap.erase(max);
+			}
+		}
+	}
+
+	bt::Uint32 getNumEntries() const
+	{
+		return emap.size();
+	}
+
+	QList<Key> distances() const
+	{
+		QList<Key> ret;
+		for (std::map<Key, KBucketEntry>::const_iterator i = emap.begin(); i != emap.end(); i++)
+			ret.append(i->first);
+		return ret;
+	}
+
+private:
+	Key key;
+	std::map<Key, KBucketEntry> emap;
+	bt::Uint32 max_entries;
+};
+
+class KBucketTableTest : public QObject
+{
+	Q_OBJECT
+public:
+	KBucketTableTest(QObject* parent = 0) : QObject(parent),our_id(randomKey())
+	{
+	}
+
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("kbuckettabletest.log", false, true);
+		for (int i = 0; i < NUM_NODES; i++)
+		{
+			// half of the nodes are random, the other half is close to us so the table gets deep
+			Key id = i % 2 == 0 ? randomKey() : closeTo(our_id, i % 160);
+			nodes.append(KBucketEntry(net::Address(0x0A000000 + i, 6881), id));
+		}
+
+		for (int i = 0; i < NUM_LOOKUPS; i++)
+			targets.append(i % 2 == 0 ? randomKey() : closeTo(our_id, i % 160));
+	}
+
+	void cleanupTestCase()
+	{
+	}
+
+	void testInsert()
+	{
+		KBucketTable table(our_id);
+		LegacyTable legacy(our_id);
+		foreach (const KBucketEntry & e, nodes)
+		{
+			table.insert(e, &srv);
+			legacy.insert(e, &srv);
+		}
+
+		// both tables split the same way, so they hold the same nodes
+		QVERIFY(table.numEntries() > 0);
+		QVERIFY(table.numEntries() == legacy.numEntries());
+		QVERIFY(table.numBuckets() == legacy.numBuckets());
+
+		// inserting the same nodes again changes nothing
+		int num_entries = table.numEntries();
+		foreach (const KBucketEntry & e, nodes)
+			table.insert(e, &srv);
+		QVERIFY(table.numEntries() == num_entries);
+	}
+
+	void testFindKClosestNodes()
+	{
+		KBucketTable table(our_id);
+		LegacyTable legacy(our_id);
+		foreach (const KBucketEntry & e, nodes)
+		{
+			table.insert(e, &srv);
+			legacy.insert(e, &srv);
+		}
+
+		QList<Key> keys = targets;
+		keys.append(our_id);
+		foreach (const Key & target, keys)
+		{
+			// compare with a search over every bucket
+			KClosestNodesSearch kns(target, K);
+			KClosestNodesSearch full(target, K);
+			table.findKClosestNodes(kns);
+			legacy.findKClosestNodes(full);
+			QVERIFY(kns.getNumEntries() == K);
+			QVERIFY(kns.getNumEntries() == full.getNumEntries());
+
+			KClosestNodesSearch::CItr i = kns.begin();
+			KClosestNodesSearch::CItr j = full.begin();
+			Key prev = Key::min();
+			for (; i != kns.end(); i++, j++)
+			{
+				QVERIFY(i->first == j->first);
+				QVERIFY(i->second.getID() == j->second.getID());
+				// closest first
+				QVERIFY(prev <= i->first);
+				prev = i->first;
+			}
+		}
+	}
+
+	void testSearch()
+	{
+		Key target = randomKey();
+		KClosestNodesSearch kns(target, K);
+		LegacySearch legacy(target, K);
+		foreach (const KBucketEntry & e, nodes)
+		{
+			kns.tryInsert(e);
+			legacy.tryInsert(e);
+		}
+		QVERIFY(kns.isFull());
+		QVERIFY(!kns.wants(0));
+
+		// same results, closest first
+		QList<Key> distances;
+		QList<KBucketEntry> found;
+		for (KClosestNodesSearch::CItr i = kns.begin(); i != kns.end(); i++)
+		{
+			distances.append(i->first);
+			found.append(i->second);
+		}
+		QVERIFY(distances == legacy.distances());
+
+		// duplicates are ignored, also after the results have been looked at
+		foreach (const KBucketEntry & e, found)
+			kns.tryInsert(e);
+		QVERIFY(kns.getNumEntries() == K);
+		distances.clear();
+		for (KClosestNodesSearch::CItr i = kns.begin(); i != kns.end(); i++)
+			distances.append(i->first);
+		QVERIFY(distances == legacy.distances());
+
+		KClosestNodesSearch empty(target, 0);
+		empty.tryInsert(nodes.first());
+		QVERIFY(empty.getNumEntries() == 0);
+	}
+
+	void testInsertBenchmark_data()
+	{
+		QTest::addColumn<bool>("flat");
+		QTest::newRow("prefix indexed table") << true;
+		QTest::newRow("list of buckets") << false;
+	}
+
+	void testInsertBenchmark()
+	{
+		QFETCH(bool, flat);
+		int num_entries = 0;
+		if (flat)
+		{
+			QBENCHMARK
+			{
+				KBucketTable table(our_id);
+				foreach (const KBucketEntry & e, nodes)
+					table.insert(e, &srv);
+				num_entries = table.numEntries();
+			}
+		}
+		else
+		{
+			QBENCHMARK
+			{
+				LegacyTable table(our_id);
+				foreach (const KBucketEntry & e, nodes)
+					table.insert(e, &srv);
+				num_entries = table.numEntries();
+			}
+		}
+		QVERIFY(num_entries > 0);
+	}
+
+	void testLookupBenchmark_data()
+	{
+		QTest::addColumn<bool>("flat");
+		QTest::newRow("prefix indexed table") << true;
+		QTest::newRow("list of buckets") << false;
+	}
+
+	void testLookupBenchmark()
+	{
+		QFETCH(bool, flat);
+		KBucketTable table(our_id);
+		LegacyTable legacy(our_id);
+		foreach (const KBucketEntry & e, nodes)
+		{
+			table.insert(e, &srv);
+			legacy.insert(e, &srv);
+		}
+
+		bt::Uint32 found = 0;
+		if (flat)
+		{
+			QBENCHMARK
+			{
+				foreach (const Key & target, targets)
+				{
+					KClosestNodesSearch kns(target, K);
+					table.findKClosestNodes(kns);
+					found += kns.getNumEntries();
+				}
+			}
+		}
+		else
+		{
+			QBENCHMARK
+			{
+				foreach (const Key & target, targets)
+				{
+					KClosestNodesSearch kns(target, K);
+					legacy.findKClosestNodes(kns);
+					found += kns.getNumEntries();
+				}
+			}
+		}
+		QVERIFY(found > 0 && found % (NUM_LOOKUPS * K) == 0);
+	}
+
+	void testSearchBenchmark_data()
+	{
+		QTest::addColumn<bool>("heap");
+		QTest::newRow("fixed size heap") << true;
+		QTest::newRow("map on distance") << false;
+	}
+
+	void testSearchBenchmark()
+	{
+		QFETCH(bool, heap);
+		bt::Uint32 found = 0;
+		if (heap)
+		{
+			QBENCHMARK
+			{
+				KClosestNodesSearch kns(targets.first(), K);
+				foreach (const KBucketEntry & e, nodes)
+					kns.tryInsert(e);
+				found += kns.getNumEntries();
+			}
+		}
+		else
+		{
+			QBENCHMARK
+			{
+				LegacySearch kns(targets.first(), K);
+				foreach (const KBucketEntry & e, nodes)
+					kns.tryInsert(e);
+				found += kns.getNumEntries();
+			}
+		}
+		QVERIFY(found > 0 && found % K == 0);
+	}
+
+private:
+	/// Create a random key which shares exactly prefix leading bits with key
+	static Key closeTo(const Key & key, int prefix)
+	{
+		bt::Uint8 data[20];
+		Key r = randomKey();
+		memcpy(data, r.getData(), 20);
+		const bt::Uint8* k = key.getData();
+		for (int i = 0; i <= prefix / 8; i++)
+		{
+			bt::Uint8 mask = i < prefix / 8 ? 0xFF : (0xFF00 >> (prefix % 8)) & 0xFF;
+			data[i] = (k[i] & mask) | (data[i] & ~mask);
+		}
+		// the first bit after the prefix must differ
+		bt::Uint8 bit = 0x80 >> (prefix % 8);
+		data[prefix / 8] = (data[prefix / 8] & ~bit) | (~k[prefix / 8] & bit);
+		return Key(data);
+	}
+
+private:
+	Key our_id;
+	DummyServer srv;
+	QList<KBucketEntry> nodes;
+	QList<Key> targets;
+};
+
+QTEST_MAIN(KBucketTableTest)
+
+#include "kbuckettabletest.moc"
@@ -106,6 +106,17 @@ private slots:
 		dht::Key b = a / 2;
 		QVERIFY(b == KeyFromHexString("2A803C"));
 	}
+	
+	void testCommonPrefixLength()
+	{
+		dht::Key a = KeyFromHexString("F0");
+		QVERIFY(dht::Key::commonPrefixLength(a, a) == 160);
+		QVERIFY(dht::Key::commonPrefixLength(a, KeyFromHexString("F1")) == 159);
+		QVERIFY(dht::Key::commonPrefixLength(a, KeyFromHexString("70")) == 152);
+		QVERIFY(dht::Key::commonPrefixLength(dht::Key::min(), dht::Key::max()) == 0);
+		QVERIFY(dht::Key::commonPrefixLength(dht::Key::max() / 2, dht::Key::max()) == 0);
+		QVERIFY(dht::Key::commonPrefixLength(dht::Key::max() / 4, dht::Key::max() / 2) == 1);
+	}
 };
 
 
@@ -24,6 +24,9 @@
 #include <dht/rpcmsgfactory.h>
 #include <dht/rpcmsg.h>
 #include <dht/errmsg.h>
+#include <dht/getpeersreq.h>
+#include <dht/getpeersrsp.h>
+#include <dht/announcereq.h>
 #include <bcodec/bdecoder.h>
 #include <bcodec/bnode.h>
 
@@ -206,6 +209,57 @@ private slots:
 		}
 	}
 
+	void testScrape()
+	{
+		current_method = dht::GET_PEERS;
+		try
+		{
+			const char* req = "d1:ad2:id20:abcdefghij01234567899:info_hash20:mnopqrstuvwxyz1234566:noseedi1e6:scrapei1ee1:q9:get_peers1:t2:aa1:y1:qe";
+			bt::BDecoder dec(QByteArray(req), false);
+			QScopedPointer<bt::BDictNode> dict(dec.decodeDict());
+			dht::GetPeersReq::Ptr gpr = factory.build(dict.data(), this).dynamicCast<dht::GetPeersReq>();
+			QVERIFY(gpr);
+			QVERIFY(gpr->isScrape());
+			QVERIFY(gpr->noSeed());
+			
+			// the bloom filters must survive encoding and parsing
+			dht::BloomFilter seeds;
+			dht::BloomFilter peers;
+			seeds.insert(net::Address("10.0.0.1", 6881));
+			peers.insert(net::Address("10.0.0.2", 6881));
+			dht::GetPeersRsp rsp(QByteArray("aa"), dht::Key(QByteArray("abcdefghij0123456789")), dht::Key());
+			rsp.setScrapeFilters(seeds, peers);
+			QByteArray data;
+			rsp.encode(data);
+			
+			bt::BDecoder rdec(data, false);
+			QScopedPointer<bt::BDictNode> rdict(rdec.decodeDict());
+			dht::GetPeersRsp::Ptr parsed = factory.build(rdict.data(), this).dynamicCast<dht::GetPeersRsp>();
+			QVERIFY(parsed);
+			QVERIFY(parsed->getSeedFilter().toByteArray() == seeds.toByteArray());
+			QVERIFY(parsed->getPeerFilter().toByteArray() == peers.toByteArray());
+		}
+		catch (bt::Error & e)
+		{
+			QFAIL(e.toString().toLocal8Bit().data());
+		}
+		
+		current_method = dht::ANNOUNCE_PEER;
+		try
+		{
+			const char* req = "d1:ad2:id20:abcdefghij01234567899:info_hash20:mnopqrstuvwxyz1234564:porti6881e4:seedi1e5:token8:aoeusnthe1:q13:announce_peer1:t2:aa1:y1:qe";
+			bt::BDecoder dec(QByteArray(req), false);
+			QScopedPointer<bt::BDictNode> dict(dec.decodeDict());
+			dht::AnnounceReq::Ptr ar = factory.build(dict.data(), this).dynamicCast<dht::AnnounceReq>();
+			QVERIFY(ar);
+			QVERIFY(ar->isSeed());
+		}
+		catch (bt::Error & e)
+		{
+			QFAIL(e.toString().toLocal8Bit().data());
+		}
+	}
+
 private:
 	dht::RPCMsgFactory factory;
 	dht::Method current_method;
@@ -35,9 +35,10 @@ namespace bt
 {
 	bool Cache::preallocate_files = true;
 	bool Cache::preallocate_fully = false;
+	bool Cache::direct_io = false;
 
 	Cache::Cache(Torrent & tor,const QString & tmpdir,const QString & datadir)
-	: tor(tor),tmpdir(tmpdir),datadir(datadir),mmap_failures(0)
+	: tor(tor),tmpdir(tmpdir),datadir(datadir),mmap_failures(0),access_pattern(ADVICE_NORMAL)
 	{
 		if (!datadir.endsWith(bt::DirSeparator()))
 			this->datadir += bt::DirSeparator();
@@ -73,6 +74,9 @@ namespace bt
 	
 	bool Cache::mappedModeAllowed()
 	{
+		if (direct_io)
+			return false;
+		
 #ifndef Q_WS_WIN
 		return MaxOpenFiles() - bt::PeerManager::connectionLimits().totalConnections() > 100;
 #else
@@ -22,6 +22,7 @@
 
 #include <ktorrent_export.h>
 #include <util/constants.h>
+#include <util/fileops.h>
 #include <torrent/torrent.h>
 #include <diskio/piecedata.h>
 #include <QString>
@@ -143,6 +144,56 @@ namespace bt
 		/// Does nothing, can be overridden to be alerted of download status changes of a TorrentFile
 		virtual void downloadStatusChanged(TorrentFile*, bool) {};
 		
+		/**
+		 * Set the expected access pattern of all data files.
+		 * Subclasses should call this version and apply it to their files.
+		 * @param pattern ADVICE_NORMAL, ADVICE_SEQUENTIAL or ADVICE_RANDOM
+		 */
+		virtual void setAccessPattern(AccessAdvice pattern) {access_pattern = pattern;}
+		
+		/// Get the expected access pattern of the data files
+		AccessAdvice accessPattern() const {return access_pattern;}
+		
+		/**
+		 * Tell the kernel we will (ADVICE_WILLNEED) or will not (ADVICE_DONTNEED)
+		 * need the data of a range of chunks. Does nothing by default.
+		 * @param from First chunk of the range
+		 * @param to Last chunk of the range
+		 * @param advice The advice
+		 */
+		virtual void adviseChunks(Uint32 from,Uint32 to,AccessAdvice advice) {Q_UNUSED(from);Q_UNUSED(to);Q_UNUSED(advice);}
+		
+		/**
+		 * Check if the diskspace for a chunk has been allocated, while a preallocation
+		 * is in progress. Returns true by default.
+		 * @param chunk Index of the chunk
+		 */
+		virtual bool isChunkAllocated(Uint32 chunk) {Q_UNUSED(chunk); return true;}
+		
+		/**
+		 * Get a file descriptor from which a piece can be sent directly (with sendfile),
+		 * so it does not need to be loaded into memory. Returns -1 by default.
+		 * @param c The Chunk
+		 * @param off The offset of the piece in the chunk
+		 * @param length The length of the piece
+		 * @param file_off The offset of the piece in the file
+		 * @return A duplicated file descriptor which the caller must close, -1 if not possible
+		 */
+		virtual int pieceFile(Chunk* c,Uint32 off,Uint32 length,Uint64 & file_off)
+		{
+			Q_UNUSED(c);
+			Q_UNUSED(off);
+			Q_UNUSED(length);
+			Q_UNUSED(file_off);
+			return -1;
+		}
+		
+		/**
+		 * Get the I/O statistics of all open files of the torrent.
+		 * @param stats Map of file paths and their statistics
+		 */
+		virtual void ioStats(QMap<QString,IOStats> & stats) {Q_UNUSED(stats);}
+		
 		/**
 		 * Prepare disksapce preallocation
 		 * @param prealloc The thread going to do the preallocation
@@ -220,6 +271,20 @@ namespace bt
 		 */
 		static bool preallocateFully() {return preallocate_fully;}
 		
+		/**
+		 * Enable or disable direct I/O. In direct I/O mode, data files are opened with O_DIRECT,
+		 * nothing gets mapped into memory and all data passes through the piece cache, so the
+		 * page cache doesn't get filled with torrent data.
+		 * @param on 
+		 */
+		static void setDirectIOEnabled(bool on) {direct_io = on;}
+		
+		/**
+		 * Check if direct I/O is enabled
+		 * @return true if it is
+		 */
+		static bool directIOEnabled() {return direct_io;}
+		
 		/**
 		 * Check memory usage and free all PieceData objects which are no longer needed.
 		 */
@@ -252,6 +317,7 @@ namespace bt
 		QString datadir;
 		bool preexisting_files;
 		Uint32 mmap_failures;
+		AccessAdvice access_pattern;
 		
 		typedef QMultiMap<Chunk*,PieceData::Ptr> PieceCache;
 		PieceCache piece_cache;
@@ -260,6 +326,7 @@ namespace bt
 	private:
 		static bool preallocate_files;
 		static bool preallocate_fully;
+		static bool direct_io;
 	};
 
 }
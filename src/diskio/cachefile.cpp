@@ -28,7 +28,9 @@
 #include <sys/mman.h>
 #include <unistd.h>
 #include <errno.h>
+#include <string.h>
 #include <qfile.h>
+#include <QAtomicInt>
 #include <kio/netaccess.h>
 #include <klocale.h>
 #include <kfileitem.h>
@@ -37,6 +39,7 @@
 #include <util/log.h>
 #include <util/error.h>
 #include <util/functions.h>
+#include <util/bufferpool.h>
 #include "preallocationthread.h"
 #include "cache.h"
 
@@ -50,16 +53,44 @@
 #define O_LARGEFILE (0)
 #endif
 
+// Offset, size and memory alignment required for O_DIRECT I/O,
+// 4K satisfies both 512 byte and 4K sector devices.
+#define DIRECT_IO_ALIGNMENT 4096
+
+// Size of the slices in which files are preallocated
+#define PREALLOCATION_SLICE_SIZE (32 * 1024 * 1024)
+
 
 
 
 namespace bt
 {
+	static QMutex direct_io_pool_mutex;
+	static BufferPool::Ptr direct_io_pool;
+	
+	// number of files in all torrents which are waiting for preallocation
+	static QAtomicInt num_pending_preallocations(0);
+	
+	/// Get the pool of aligned bounce buffers used for direct I/O
+	static BufferPool::Ptr DirectIOPool()
+	{
+		QMutexLocker lock(&direct_io_pool_mutex);
+		if (!direct_io_pool)
+		{
+			direct_io_pool = BufferPool::Ptr(new BufferPool());
+			direct_io_pool->setWeakPointer(direct_io_pool.toWeakRef());
+		}
+		return direct_io_pool;
+	}
 
 	CacheFile::CacheFile() : fptr(0),max_size(0),file_size(0),mutex(QMutex::Recursive)
 	{
 		read_only = false;
 		manual_close = false;
+		access_pattern = ADVICE_NORMAL;
+		direct_fd = -1;
+		allocation_pending = false;
+		allocated_bytes = 0;
 	}
 
 
@@ -67,11 +98,16 @@ namespace bt
 	{
 		if (fptr)
 			close();
+		setPreallocationPending(false);
 	}
 	
 	void CacheFile::changePath(const QString & npath)
 	{
+		QMutexLocker lock(&mutex);
 		path = npath;
+		io_stats.setPath(npath);
+		// the file might have been moved while it was open, make sure it gets reopened at the new location
+		closeTemporary();
 	}
 	
 	void CacheFile::openFile(Mode mode)
@@ -95,6 +131,34 @@ namespace bt
 		}
 		
 		file_size = fptr->size();
+		if (access_pattern != ADVICE_NORMAL)
+			AdviseFile(fptr->handle(),0,0,access_pattern);
+		
+		if (Cache::directIOEnabled())
+			openDirect();
+	}
+	
+	void CacheFile::openDirect()
+	{
+#if defined(O_DIRECT) && !defined(Q_WS_WIN)
+		int flags = read_only ? O_RDONLY : O_RDWR;
+		direct_fd = ::open(QFile::encodeName(path),flags | O_LARGEFILE | O_DIRECT);
+		if (direct_fd < 0)
+		{
+			// Not all filesystems support O_DIRECT (tmpfs for example), use normal I/O for those
+			Out(SYS_DIO|LOG_DEBUG) << "Cannot open " << path << " with O_DIRECT : " << QString(strerror(errno)) << endl;
+			direct_fd = -1;
+		}
+#endif
+	}
+	
+	void CacheFile::closeDirect()
+	{
+		if (direct_fd >= 0)
+		{
+			::close(direct_fd);
+			direct_fd = -1;
+		}
 	}
 	
 	void CacheFile::open(const QString & path,Uint64 size)
@@ -103,11 +167,16 @@ namespace bt
 		// only set the path and the max size, we only open the file when it is needed
 		this->path = path;
 		max_size = size;
+		io_stats.setPath(path);
 	}
 		
 	void* CacheFile::map(MMappeable* thing,Uint64 off,Uint32 size,Mode mode)
 	{
 		QMutexLocker lock(&mutex);
+		// mapping would bring the data into the page cache, which is what direct I/O is trying to avoid
+		if (Cache::directIOEnabled())
+			return 0;
+		
 		// reopen the file if necessary
 		if (!fptr)
 		{
@@ -173,6 +242,7 @@ namespace bt
 			if (ptr == MAP_FAILED) 
 			{
 				Out(SYS_DIO|LOG_DEBUG) << "mmap failed : " << QString(strerror(errno)) << endl;
+				io_stats.recordMap(false);
 				return 0;
 			}
 			else
@@ -184,7 +254,10 @@ namespace bt
 				e.ptr = ptr;
 				e.size = size + diff;
 				e.mode = mode;
+				if (access_pattern != ADVICE_NORMAL)
+					AdviseMemory(ptr,e.size,access_pattern);
 				mappings.insert((void*)(ptr + diff),e);
+				io_stats.recordMap(true);
 				return ptr + diff;
 			}
 		}
@@ -198,6 +271,7 @@ namespace bt
 			if (ptr == MAP_FAILED) 
 			{
 				Out(SYS_DIO|LOG_DEBUG) << "mmap failed : " << QString(strerror(errno)) << endl;
+				io_stats.recordMap(false);
 				return 0;
 			}
 			else
@@ -209,7 +283,10 @@ namespace bt
 				e.diff = 0;
 				e.size = size;
 				e.mode = mode;
+				if (access_pattern != ADVICE_NORMAL)
+					AdviseMemory(ptr,e.size,access_pattern);
 				mappings.insert(ptr,e);
+				io_stats.recordMap(true);
 				return ptr;
 			}
 		}
@@ -220,6 +297,7 @@ namespace bt
 		{
 			Out(SYS_DIO|LOG_DEBUG) << "mmap failed3 : " << fptr->handle() << " " << QString(strerror(errno)) << endl;
 			Out(SYS_DIO|LOG_DEBUG) << off << " " << size << endl;
+			io_stats.recordMap(false);
 			return 0;
 		}
 		else
@@ -232,6 +310,7 @@ namespace bt
 			e.size = size;
 			e.mode = mode;
 			mappings.insert(ptr,e);
+			io_stats.recordMap(true);
 			return ptr;
 		}
 #endif
@@ -315,6 +394,7 @@ namespace bt
 			manual_close = true;
 			fptr->deleteLater();
 			fptr = 0;
+			closeDirect();
 			manual_close = false;
 		}
 	}
@@ -359,6 +439,7 @@ namespace bt
 		fptr->close();
 		delete fptr;
 		fptr = 0;
+		closeDirect();
 		manual_close = false;
 	}
 	
@@ -380,6 +461,26 @@ namespace bt
 			throw Error(i18n("Error: Reading past the end of the file %1",path));
 		}
 		
+		Uint64 start = IOStatsCollector::now();
+		if (direct_fd >= 0)
+		{
+			try
+			{
+				directRead(buf,size,off);
+			}
+			catch (...)
+			{
+				if (close_again)
+					closeTemporary();
+				throw;
+			}
+			
+			io_stats.recordRead(size,start);
+			if (close_again)
+				closeTemporary();
+			return;
+		}
+		
 		// jump to right position
 		if (!fptr->seek(off))
 			throw Error(i18n("Failed to seek file %1: %2",path,fptr->errorString()));
@@ -393,6 +494,7 @@ namespace bt
 			throw Error(i18n("Error reading from %1",path));
 		}
 		
+		io_stats.recordRead(size,start);
 		if (close_again)
 			closeTemporary();
 	}
@@ -427,15 +529,24 @@ namespace bt
 		}
 		
 		
-		// jump to right position
-		if (!fptr->seek(off))
-			throw Error(i18n("Failed to seek file %1: %2",path,fptr->errorString()));
-		
-		if (fptr->write((const char*)buf,size) != size)
+		Uint64 start = IOStatsCollector::now();
+		if (direct_fd >= 0)
+		{
+			directWrite(buf,size,off);
+		}
+		else
 		{
-			throw Error(i18n("Failed to write to file %1: %2",path,fptr->errorString()));
+			// jump to right position
+			if (!fptr->seek(off))
+				throw Error(i18n("Failed to seek file %1: %2",path,fptr->errorString()));
+			
+			if (fptr->write((const char*)buf,size) != size)
+			{
+				throw Error(i18n("Failed to write to file %1: %2",path,fptr->errorString()));
+			}
 		}
 		
+		io_stats.recordWrite(size,start);
 		if (close_again)
 			closeTemporary();
 	
@@ -443,6 +554,132 @@ namespace bt
 			file_size = off + size;
 	}
 	
+	void CacheFile::directRead(Uint8* buf,Uint32 size,Uint64 off)
+	{
+#ifndef Q_WS_WIN
+		// O_DIRECT needs the offset, the size and the buffer to be aligned,
+		// so read the surrounding aligned region into a bounce buffer
+		Uint64 start = off & ~(Uint64)(DIRECT_IO_ALIGNMENT - 1);
+		Uint64 end = (off + size + DIRECT_IO_ALIGNMENT - 1) & ~(Uint64)(DIRECT_IO_ALIGNMENT - 1);
+		Uint32 len = end - start;
+		Uint32 diff = off - start;
+		
+		Buffer::Ptr bounce = DirectIOPool()->getAligned(len,DIRECT_IO_ALIGNMENT);
+		Uint32 done = 0;
+		while (done < diff + size)
+		{
+			ssize_t ret = ::pread(direct_fd,bounce->get() + done,len - done,start + done);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			else if (ret <= 0)
+				throw Error(i18n("Error reading from %1",path));
+			
+			done += ret;
+			if (done % DIRECT_IO_ALIGNMENT != 0)
+				break; // short read at the end of the file
+		}
+		
+		if (done < diff + size)
+			throw Error(i18n("Error reading from %1",path));
+		
+		memcpy(buf,bounce->get() + diff,size);
+#else
+		Q_UNUSED(buf);
+		Q_UNUSED(size);
+		Q_UNUSED(off);
+#endif
+	}
+	
+	void CacheFile::directWrite(const Uint8* buf,Uint32 size,Uint64 off)
+	{
+#ifndef Q_WS_WIN
+		Uint64 start = off & ~(Uint64)(DIRECT_IO_ALIGNMENT - 1);
+		Uint64 end = (off + size + DIRECT_IO_ALIGNMENT - 1) & ~(Uint64)(DIRECT_IO_ALIGNMENT - 1);
+		Uint32 len = end - start;
+		Uint32 diff = off - start;
+		
+		Buffer::Ptr bounce = DirectIOPool()->getAligned(len,DIRECT_IO_ALIGNMENT);
+		Uint8* data = bounce->get();
+		
+		// The first and last block might only be partially overwritten,
+		// so they need to be read in first (read-modify-write)
+		bool head_partial = diff != 0;
+		bool tail_partial = (off + size) != end;
+		if (head_partial || tail_partial)
+		{
+			memset(data,0,len);
+			if (head_partial && start < file_size)
+			{
+				if (::pread(direct_fd,data,DIRECT_IO_ALIGNMENT,start) < 0)
+					throw Error(i18n("Failed to write to file %1: %2",path,QString(strerror(errno))));
+			}
+			
+			Uint64 last = end - DIRECT_IO_ALIGNMENT;
+			if (tail_partial && last < file_size && !(head_partial && last == start))
+			{
+				if (::pread(direct_fd,data + (last - start),DIRECT_IO_ALIGNMENT,last) < 0)
+					throw Error(i18n("Failed to write to file %1: %2",path,QString(strerror(errno))));
+			}
+		}
+		
+		memcpy(data + diff,buf,size);
+		
+		Uint32 done = 0;
+		while (done < len)
+		{
+			ssize_t ret = ::pwrite(direct_fd,data + done,len - done,start + done);
+			if (ret < 0 && errno == EINTR)
+				continue;
+			else if (ret <= 0)
+				throw Error(i18n("Failed to write to file %1: %2",path,QString(strerror(errno))));
+			
+			done += ret;
+		}
+		
+		// Writing whole blocks might have extended the file past the data that was written
+		Uint64 real_size = qMax(file_size,off + size);
+		if (end > real_size)
+		{
+#ifdef HAVE_FTRUNCATE64
+			if (ftruncate64(direct_fd,real_size) == -1)
+#else
+			if (ftruncate(direct_fd,real_size) == -1)
+#endif
+				throw Error(i18n("Failed to write to file %1: %2",path,QString(strerror(errno))));
+		}
+#else
+		Q_UNUSED(buf);
+		Q_UNUSED(size);
+		Q_UNUSED(off);
+#endif
+	}
+	
+	int CacheFile::duplicateHandle()
+	{
+#ifndef Q_WS_WIN
+		QMutexLocker lock(&mutex);
+		bool close_again = false;
+		if (!fptr)
+		{
+			openFile(READ);
+			close_again = true;
+		}
+		
+		// the kernel needs to see everything we have written
+		fptr->flush();
+#ifdef F_DUPFD_CLOEXEC
+		int ret = fcntl(fptr->handle(),F_DUPFD_CLOEXEC,0);
+#else
+		int ret = dup(fptr->handle());
+#endif
+		if (close_again)
+			closeTemporary();
+		return ret;
+#else
+		return -1;
+#endif
+	}
+	
 	void CacheFile::closeTemporary()
 	{
 		if (!fptr || mappings.count() > 0)
@@ -450,38 +687,33 @@ namespace bt
 			
 		delete fptr;
 		fptr = 0;
+		closeDirect();
 	}
 	
 	
 		
 	void CacheFile::preallocate(PreallocationThread* prealloc)
 	{
-		QMutexLocker lock(&mutex);
-		
 		if (FileSize(path) == max_size)
 		{
 			Out(SYS_GEN|LOG_NOTICE) << "File " << path << " already big enough" << endl;
+			setPreallocationPending(false);
+			prealloc->written(max_size);
 			return;
 		}
 
 		Out(SYS_GEN|LOG_NOTICE) << "Preallocating file " << path << " (" << max_size << " bytes)" << endl;
-		bool close_again = false;
-		if (!fptr)
-		{
-			openFile(RW);
-			close_again = true;
-		}
 		
-		int fd = fptr->handle();
-		
-		if (read_only)
+		// Use a separate file descriptor, so we do not have to hold the mutex during
+		// the whole preallocation, and chunks in already allocated regions can be written.
+		int fd = ::open(QFile::encodeName(path),O_RDWR | O_LARGEFILE);
+		if (fd < 0)
 		{
-			if (close_again)
-				closeTemporary();
-			
-			throw Error(i18n("Cannot open %1 for writing: readonly filesystem",path));
+			setPreallocationPending(false);
+			throw Error(i18n("Cannot open %1 for writing: %2",path,strerror(errno)));
 		}
 
+		Uint64 reported = 0;
 		try
 		{
 			bool res = false;
@@ -493,19 +725,145 @@ namespace bt
 			}
 #endif
 			
-			if(! res)
+			if (!res && Cache::preallocateFully())
+			{
+				// allocate extents in slices, so progress can be reported,
+				// the allocated part can be used and we can stop in between
+				Uint64 off = 0;
+				while (off < max_size)
+				{
+					if (prealloc->isStopped())
+					{
+						prealloc->setNotFinished();
+						break;
+					}
+					
+					Uint64 len = qMin<Uint64>(PREALLOCATION_SLICE_SIZE,max_size - off);
+					if (!FallocateFile(fd,off,len))
+						break;
+					
+					off += len;
+					updateAllocated(off,FileSize(fd));
+					prealloc->written(len);
+					reported += len;
+				}
+				
+				res = off > 0;
+				if (res && off == max_size)
+				{
+					QMutexLocker lock(&mutex);
+					// fallocate keeps the file size, so set it to the full size
+					bt::TruncateFile(fd,max_size,true);
+					file_size = FileSize(fd);
+				}
+			}
+			
+			// when stopped, the preallocation is done again the next time, so leave the size alone
+			if(! res && !prealloc->isStopped())
 			{
-				bt::TruncateFile(fd,max_size,!Cache::preallocateFully());
+				QMutexLocker lock(&mutex);
+				bt::TruncateFile(fd,max_size,true);
+				file_size = FileSize(fd);
 			}
 		}
 		catch (bt::Error & e)
 		{
-			throw Error(i18n("Cannot preallocate diskspace: %1",strerror(errno)));
+			::close(fd);
+			setPreallocationPending(false);
+			throw Error(i18n("Cannot preallocate diskspace: %1",e.toString()));
 		}
 
-		file_size = FileSize(fd);
-		prealloc->written(file_size);
+		::close(fd);
+		setPreallocationPending(false);
+		if (reported < max_size && !prealloc->isStopped())
+			prealloc->written(max_size - reported);
 		Out(SYS_GEN|LOG_DEBUG) << "file_size = " << file_size << endl;
+	}
+	
+	void CacheFile::updateAllocated(Uint64 allocated,Uint64 real_size)
+	{
+		{
+			// posix_fallocate might have extended the file, keep file_size up to date
+			// or growFile will shrink the file again
+			QMutexLocker lock(&mutex);
+			if (real_size > file_size)
+				file_size = real_size;
+		}
+		
+		QMutexLocker lock(&alloc_mutex);
+		allocated_bytes = allocated;
+	}
+	
+	void CacheFile::setPreallocationPending(bool pending)
+	{
+		QMutexLocker lock(&alloc_mutex);
+		if (pending != allocation_pending)
+			num_pending_preallocations.fetchAndAddRelaxed(pending ? 1 : -1);
+		allocation_pending = pending;
+		allocated_bytes = 0;
+	}
+	
+	bool CacheFile::anyPreallocationPending()
+	{
+		return (int)num_pending_preallocations > 0;
+	}
+	
+	bool CacheFile::isAllocated(Uint64 off,Uint64 size) const
+	{
+		QMutexLocker lock(&alloc_mutex);
+		return !allocation_pending || off + size <= allocated_bytes;
+	}
+
+	void CacheFile::setAccessPattern(AccessAdvice pattern)
+	{
+		QMutexLocker lock(&mutex);
+		if (access_pattern == pattern)
+			return;
+		
+		access_pattern = pattern;
+		if (!fptr)
+			return; // will be applied when the file is opened
+		
+		AdviseFile(fptr->handle(),0,0,access_pattern);
+#ifndef Q_WS_WIN
+		QMap<void*,Entry>::iterator i = mappings.begin();
+		while (i != mappings.end())
+		{
+			AdviseMemory(i.value().ptr,i.value().size,access_pattern);
+			i++;
+		}
+#endif
+	}
+	
+	void CacheFile::advise(Uint64 off,Uint64 size,AccessAdvice advice)
+	{
+		QMutexLocker lock(&mutex);
+		bool close_again = false;
+		if (!fptr)
+		{
+			// it's only a hint, so don't bother with files which cannot be opened
+			if (!bt::Exists(path) || !OpenFileAllowed())
+				return;
+			
+			try
+			{
+				openFile(READ);
+				close_again = true;
+			}
+			catch (bt::Error &)
+			{
+				return;
+			}
+		}
+		
+		if (off < file_size)
+		{
+			if (off + size > file_size)
+				size = file_size - off;
+			
+			AdviseFile(fptr->handle(),off,size,advice);
+		}
+		
 		if (close_again)
 			closeTemporary();
 	}
@@ -25,6 +25,8 @@
 #include <QFile>
 #include <QSharedPointer>
 #include <util/constants.h>
+#include <util/fileops.h>
+#include <diskio/iostats.h>
 
 namespace bt
 {
@@ -116,13 +118,71 @@ namespace bt
 		void write(const Uint8* buf,Uint32 size,Uint64 off);
 		
 		/**
-		 * Preallocate disk space
+		 * Preallocate disk space. In full mode the file is allocated in slices,
+		 * while this is going on, the allocated part can be used (see isAllocated).
+		 * Can be called from multiple threads for different files.
 		 */
 		void preallocate(PreallocationThread* prealloc);
+		
+		/**
+		 * Mark the file as waiting for preallocation (or not). While pending,
+		 * isAllocated will only return true for the already allocated part.
+		 */
+		void setPreallocationPending(bool pending);
+		
+		/**
+		 * Check if a region of the file has been allocated on disk.
+		 * Always returns true when there is no preallocation pending.
+		 * @param off Offset of the region
+		 * @param size Size of the region
+		 */
+		bool isAllocated(Uint64 off,Uint64 size) const;
+		
+		/// Whether a file of any torrent is waiting for preallocation, if not everything is allocated
+		static bool anyPreallocationPending();
+		
+		/// Get the size the file will have once it is complete
+		Uint64 maxSize() const {return max_size;}
+
+		/**
+		 * Set the expected access pattern of the file. This will be applied
+		 * to the open file and all existing and future mappings.
+		 * @param pattern ADVICE_NORMAL, ADVICE_SEQUENTIAL or ADVICE_RANDOM
+		 */
+		void setAccessPattern(AccessAdvice pattern);
+		
+		/// Get the current access pattern
+		AccessAdvice accessPattern() const {return access_pattern;}
+		
+		/**
+		 * Tell the kernel we will (ADVICE_WILLNEED) or will not (ADVICE_DONTNEED)
+		 * need a region of the file in the near future.
+		 * @param off Offset of the region
+		 * @param size Size of the region
+		 * @param advice The advice
+		 */
+		void advise(Uint64 off,Uint64 size,AccessAdvice advice);
+
+		/**
+		 * Duplicate the file descriptor of the file, so data can be sent straight from it.
+		 * Pending buffered writes are flushed first.
+		 * @return The file descriptor which the caller must close, or -1 if not possible
+		 * @throw Error if the file cannot be opened
+		 */
+		int duplicateHandle();
 
 		/// Get the number of bytes this cache file is taking up
 		Uint64 diskUsage();
 		
+		/// Get the I/O statistics of this file
+		IOStatsCollector & ioStats() {return io_stats;}
+		
+		/// Get the I/O statistics of this file
+		const IOStatsCollector & ioStats() const {return io_stats;}
+		
+		/// Whether the file is accessed with O_DIRECT, only known once the file has been opened
+		bool directIO() const {return direct_fd >= 0;}
+		
 		typedef QSharedPointer<CacheFile> Ptr;
 		
 	private:
@@ -131,6 +191,11 @@ namespace bt
 		void openFile(Mode mode);
 		void unmapAll();
 		bool allocateBytes(bt::Uint64 off,bt::Uint64 size);
+		void openDirect();
+		void closeDirect();
+		void directRead(Uint8* buf,Uint32 size,Uint64 off);
+		void directWrite(const Uint8* buf,Uint32 size,Uint64 off);
+		void updateAllocated(Uint64 allocated,Uint64 real_size);
 
 	private slots:
 		void aboutToClose();
@@ -152,6 +217,12 @@ namespace bt
 		QMap<void*,Entry> mappings; // mappings where offset wasn't a multiple of 4K
 		mutable QMutex mutex;
 		bool manual_close;
+		AccessAdvice access_pattern;
+		int direct_fd; // file descriptor opened with O_DIRECT, -1 if not in direct I/O mode
+		mutable QMutex alloc_mutex;
+		bool allocation_pending;
+		Uint64 allocated_bytes; // allocated prefix of the file while preallocation is pending
+		IOStatsCollector io_stats;
 	};
 
 }
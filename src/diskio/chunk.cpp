@@ -48,6 +48,11 @@ namespace bt
 			return false;
 	}
 				
+	int Chunk::pieceFile(Uint32 off,Uint32 len,Uint64 & file_off)
+	{
+		return cache->pieceFile(this,off,len,file_off);
+	}
+	
 	bool Chunk::checkHash(const SHA1Hash & h)
 	{
 		PieceData::Ptr d = getPiece(0,size,true);
@@ -62,6 +62,15 @@ namespace bt
 		 */
 		bool readPiece(Uint32 off,Uint32 len,Uint8* data);
 		
+		/**
+		 * Get a file descriptor from which a piece can be sent directly (see Cache::pieceFile).
+		 * @param off Offset of the piece
+		 * @param len Length of the piece
+		 * @param file_off The offset of the piece in the file
+		 * @return A file descriptor the caller must close, or -1
+		 */
+		int pieceFile(Uint32 off,Uint32 len,Uint64 & file_off);
+		
 		/**
 		 * Get a pointer to the data of a piece.
 		 * If it isn't loaded, it will be loaded.
@@ -814,6 +814,41 @@ namespace bt
         return d->cache->diskUsage();
     }
 
+    void ChunkManager::setAccessPattern(AccessAdvice pattern)
+    {
+        if (d->cache->accessPattern() != pattern)
+            d->cache->setAccessPattern(pattern);
+    }
+
+    AccessAdvice ChunkManager::accessPattern() const
+    {
+        return d->cache->accessPattern();
+    }
+
+    void ChunkManager::adviseChunks(Uint32 from, Uint32 to, AccessAdvice advice)
+    {
+        if (from >= (Uint32)d->chunks.size() || from > to)
+            return;
+
+        if (to >= (Uint32)d->chunks.size())
+            to = d->chunks.size() - 1;
+
+        d->cache->adviseChunks(from, to, advice);
+    }
+
+    bool ChunkManager::isChunkAllocated(Uint32 i) const
+    {
+        if (i >= (Uint32)d->chunks.size())
+            return false;
+
+        return d->cache->isChunkAllocated(i);
+    }
+
+    void ChunkManager::ioStats(QMap<QString, IOStats> & stats) const
+    {
+        d->cache->ioStats(stats);
+    }
+
     Uint32 ChunkManager::previewChunkRangeSize(const TorrentFile& file) const
     {
         if (!file.isMultimedia())
@@ -26,6 +26,7 @@
 #include <QObject>
 #include <vector>
 #include <util/bitset.h>
+#include <util/fileops.h>
 #include <torrent/torrent.h>
 #include <ktorrent_export.h>
 #include "chunk.h"
@@ -323,6 +324,38 @@ namespace bt
         /// Is the storage mounted ?
         bool isStorageMounted(QStringList& missing);
 
+        /**
+         * Set the expected access pattern of the data files.
+         * Does nothing if the pattern is already in use.
+         * @param pattern ADVICE_NORMAL, ADVICE_SEQUENTIAL or ADVICE_RANDOM
+         */
+        void setAccessPattern(AccessAdvice pattern);
+
+        /// Get the expected access pattern of the data files
+        AccessAdvice accessPattern() const;
+
+        /**
+         * Tell the kernel we will (ADVICE_WILLNEED) or will not (ADVICE_DONTNEED)
+         * need the data of a range of chunks.
+         * @param from First chunk in range
+         * @param to Last chunk in range
+         * @param advice The advice
+         */
+        void adviseChunks(Uint32 from, Uint32 to, AccessAdvice advice);
+
+        /**
+         * Check if the diskspace of a chunk has been allocated. While a preallocation
+         * is running, only chunks in the already allocated parts of files should be downloaded.
+         * @param i Index of the chunk
+         */
+        bool isChunkAllocated(Uint32 i) const;
+
+        /**
+         * Get the disk I/O statistics of the files of the torrent.
+         * @param stats Map of file paths and their statistics
+         */
+        void ioStats(QMap<QString, IOStats> & stats) const;
+
     signals:
         /**
          * Emitted when a range of chunks has been excluded
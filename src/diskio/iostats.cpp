@@ -0,0 +1,323 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "iostats.h"
+#include <string.h>
+#include <sys/time.h>
+#include <QFileInfo>
+#include <QList>
+#include <QMutexLocker>
+#include <util/fileops.h>
+#ifdef Q_WS_WIN
+#include <util/win32.h>
+#endif
+
+namespace bt
+{
+	bool IOStatsCollector::enable = true;
+
+	// Number of directories of which the statistics of closed files are kept apart,
+	// older ones end up under an empty string, so the totals stay right
+	const int MAX_RETIRED_DIRS = 256;
+
+	// All living collectors, and the statistics of the ones which are gone (per directory)
+	static QMutex registry_mutex;
+	static QList<IOStatsCollector*> collectors;
+	static QMap<QString,IOStats> retired_stats;
+	static QList<QString> retired_dirs; // least recently used first
+
+	static QString DirOf(const QString & path)
+	{
+		return path.isEmpty() ? QString() : QFileInfo(path).absolutePath();
+	}
+
+	static void Retire(const QString & path,const IOStats & s)
+	{
+		QString dir = DirOf(path);
+		if (!dir.isEmpty())
+		{
+			retired_dirs.removeOne(dir);
+			retired_dirs.append(dir);
+			if (retired_dirs.count() > MAX_RETIRED_DIRS)
+				retired_stats[QString()] += retired_stats.take(retired_dirs.takeFirst());
+		}
+		retired_stats[dir] += s;
+	}
+
+	IOStats::IOStats()
+	{
+		reset();
+	}
+
+	void IOStats::reset()
+	{
+		bytes_read = bytes_written = 0;
+		read_ops = write_ops = 0;
+		mapped_bytes_read = mapped_bytes_written = 0;
+		mapped_read_ops = mapped_write_ops = 0;
+		mmaps = mmap_failures = 0;
+		sigbus_recoveries = 0;
+		read_time = write_time = 0;
+		memset(read_latency,0,sizeof(read_latency));
+		memset(write_latency,0,sizeof(write_latency));
+	}
+
+	IOStats & IOStats::operator += (const IOStats & s)
+	{
+		bytes_read += s.bytes_read;
+		bytes_written += s.bytes_written;
+		read_ops += s.read_ops;
+		write_ops += s.write_ops;
+		mapped_bytes_read += s.mapped_bytes_read;
+		mapped_bytes_written += s.mapped_bytes_written;
+		mapped_read_ops += s.mapped_read_ops;
+		mapped_write_ops += s.mapped_write_ops;
+		mmaps += s.mmaps;
+		mmap_failures += s.mmap_failures;
+		sigbus_recoveries += s.sigbus_recoveries;
+		read_time += s.read_time;
+		write_time += s.write_time;
+		for (Uint32 i = 0;i < IO_LATENCY_BUCKETS;i++)
+		{
+			read_latency[i] += s.read_latency[i];
+			write_latency[i] += s.write_latency[i];
+		}
+		return *this;
+	}
+
+	Uint64 IOStats::averageReadLatency() const
+	{
+		return read_ops > 0 ? read_time / read_ops : 0;
+	}
+
+	Uint64 IOStats::averageWriteLatency() const
+	{
+		return write_ops > 0 ? write_time / write_ops : 0;
+	}
+
+	static Uint64 Percentile(const Uint64* histogram,double p)
+	{
+		Uint64 total = 0;
+		for (Uint32 i = 0;i < IO_LATENCY_BUCKETS;i++)
+			total += histogram[i];
+
+		if (total == 0)
+			return 0;
+
+		Uint64 needed = (Uint64)(total * qBound(0.0,p,100.0) / 100.0);
+		Uint64 count = 0;
+		for (Uint32 i = 0;i < IO_LATENCY_BUCKETS;i++)
+		{
+			count += histogram[i];
+			if (count >= needed && count > 0)
+				return IOStats::bucketLimit(i);
+		}
+
+		return IOStats::bucketLimit(IO_LATENCY_BUCKETS - 1);
+	}
+
+	Uint64 IOStats::readLatencyPercentile(double p) const
+	{
+		return Percentile(read_latency,p);
+	}
+
+	Uint64 IOStats::writeLatencyPercentile(double p) const
+	{
+		return Percentile(write_latency,p);
+	}
+
+	Uint32 IOStats::latencyBucket(Uint64 usecs)
+	{
+		Uint32 bucket = 0;
+		while (usecs >= bucketLimit(bucket) && bucket < IO_LATENCY_BUCKETS - 1)
+			bucket++;
+		return bucket;
+	}
+
+	/////////////////////////////////////////
+
+	IOStatsCollector::IOStatsCollector()
+	{
+		QMutexLocker lock(&registry_mutex);
+		collectors.append(this);
+	}
+
+	IOStatsCollector::~IOStatsCollector()
+	{
+		QMutexLocker lock(&registry_mutex);
+		collectors.removeAll(this);
+		Retire(file_path,io_stats);
+	}
+
+	void IOStatsCollector::setPath(const QString & path)
+	{
+		QMutexLocker lock(&mutex);
+		file_path = path;
+	}
+
+	QString IOStatsCollector::path() const
+	{
+		QMutexLocker lock(&mutex);
+		return file_path;
+	}
+
+	void IOStatsCollector::setEnabled(bool on)
+	{
+		enable = on;
+	}
+
+	Uint64 IOStatsCollector::now()
+	{
+		if (!enable)
+			return 0;
+
+		struct timeval tv;
+		gettimeofday(&tv,0);
+		return (Uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+	}
+
+	void IOStatsCollector::recordLatency(Uint64* histogram,Uint64 & total,Uint64 start)
+	{
+		if (start == 0)
+			return;
+
+		Uint64 end = now();
+		Uint64 duration = end > start ? end - start : 0;
+		histogram[IOStats::latencyBucket(duration)]++;
+		total += duration;
+	}
+
+	void IOStatsCollector::recordRead(Uint32 bytes,Uint64 start)
+	{
+		if (!enable)
+			return;
+
+		QMutexLocker lock(&mutex);
+		io_stats.bytes_read += bytes;
+		io_stats.read_ops++;
+		recordLatency(io_stats.read_latency,io_stats.read_time,start);
+	}
+
+	void IOStatsCollector::recordWrite(Uint32 bytes,Uint64 start)
+	{
+		if (!enable)
+			return;
+
+		QMutexLocker lock(&mutex);
+		io_stats.bytes_written += bytes;
+		io_stats.write_ops++;
+		recordLatency(io_stats.write_latency,io_stats.write_time,start);
+	}
+
+	void IOStatsCollector::recordMappedRead(Uint32 bytes,Uint64 start)
+	{
+		if (!enable)
+			return;
+
+		QMutexLocker lock(&mutex);
+		io_stats.bytes_read += bytes;
+		io_stats.read_ops++;
+		io_stats.mapped_bytes_read += bytes;
+		io_stats.mapped_read_ops++;
+		recordLatency(io_stats.read_latency,io_stats.read_time,start);
+	}
+
+	void IOStatsCollector::recordMappedWrite(Uint32 bytes,Uint64 start)
+	{
+		if (!enable)
+			return;
+
+		QMutexLocker lock(&mutex);
+		io_stats.bytes_written += bytes;
+		io_stats.write_ops++;
+		io_stats.mapped_bytes_written += bytes;
+		io_stats.mapped_write_ops++;
+		recordLatency(io_stats.write_latency,io_stats.write_time,start);
+	}
+
+	void IOStatsCollector::recordMap(bool ok)
+	{
+		if (!enable)
+			return;
+
+		QMutexLocker lock(&mutex);
+		if (ok)
+			io_stats.mmaps++;
+		else
+			io_stats.mmap_failures++;
+	}
+
+	void IOStatsCollector::recordBusError()
+	{
+		// always count these, they are rare and important
+		QMutexLocker lock(&mutex);
+		io_stats.sigbus_recoveries++;
+	}
+
+	IOStats IOStatsCollector::stats() const
+	{
+		QMutexLocker lock(&mutex);
+		return io_stats;
+	}
+
+	QMap<QString,IOStats> IOStatsCollector::mountPointStats()
+	{
+		// Looking up mount points is expensive, so do it once per directory
+		QMap<QString,IOStats> per_dir;
+		{
+			QMutexLocker lock(&registry_mutex);
+			per_dir = retired_stats;
+			foreach (IOStatsCollector* c,collectors)
+				per_dir[DirOf(c->path())] += c->stats();
+		}
+
+		QMap<QString,IOStats> ret;
+		QMap<QString,IOStats>::iterator i = per_dir.begin();
+		while (i != per_dir.end())
+		{
+			QString mount_point;
+			if (!i.key().isEmpty())
+				mount_point = MountPoint(i.key());
+
+			ret[mount_point] += i.value();
+			i++;
+		}
+
+		return ret;
+	}
+
+	IOStats IOStatsCollector::totalStats()
+	{
+		QMutexLocker lock(&registry_mutex);
+		IOStats ret;
+		QMap<QString,IOStats>::iterator i = retired_stats.begin();
+		while (i != retired_stats.end())
+		{
+			ret += i.value();
+			i++;
+		}
+
+		foreach (IOStatsCollector* c,collectors)
+			ret += c->stats();
+
+		return ret;
+	}
+
+}
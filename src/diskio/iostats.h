@@ -0,0 +1,169 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef BT_IOSTATS_H
+#define BT_IOSTATS_H
+
+#include <QMap>
+#include <QMutex>
+#include <QString>
+#include <ktorrent_export.h>
+#include <util/constants.h>
+
+namespace bt
+{
+	/// Number of buckets in the latency histograms, bucket i holds operations which took less than 2^i microseconds
+	const Uint32 IO_LATENCY_BUCKETS = 24;
+
+	/**
+	 * Disk I/O statistics of a file or a group of files.
+	 */
+	struct KTORRENT_EXPORT IOStats
+	{
+		Uint64 bytes_read;
+		Uint64 bytes_written;
+		Uint64 read_ops;
+		Uint64 write_ops;
+		Uint64 mapped_bytes_read; // part of bytes_read which went through mmapped memory
+		Uint64 mapped_bytes_written; // part of bytes_written which went through mmapped memory
+		Uint64 mapped_read_ops;
+		Uint64 mapped_write_ops;
+		Uint64 mmaps;
+		Uint64 mmap_failures;
+		Uint64 sigbus_recoveries;
+		Uint64 read_time; // total time spent reading in microseconds
+		Uint64 write_time; // total time spent writing in microseconds
+		Uint64 read_latency[IO_LATENCY_BUCKETS];
+		Uint64 write_latency[IO_LATENCY_BUCKETS];
+
+		IOStats();
+
+		/// Set everything to 0
+		void reset();
+
+		/// Add the statistics of another file
+		IOStats & operator += (const IOStats & s);
+
+		/// Average read latency in microseconds
+		Uint64 averageReadLatency() const;
+
+		/// Average write latency in microseconds
+		Uint64 averageWriteLatency() const;
+
+		/**
+		 * Estimate a read latency percentile from the histogram.
+		 * @param p The percentile (0 - 100)
+		 * @return Upper bound in microseconds of the bucket containing the percentile
+		 */
+		Uint64 readLatencyPercentile(double p) const;
+
+		/**
+		 * Estimate a write latency percentile from the histogram.
+		 * @param p The percentile (0 - 100)
+		 * @return Upper bound in microseconds of the bucket containing the percentile
+		 */
+		Uint64 writeLatencyPercentile(double p) const;
+
+		/// Get the histogram bucket for a latency
+		static Uint32 latencyBucket(Uint64 usecs);
+
+		/// Get the upper bound in microseconds of a histogram bucket
+		static Uint64 bucketLimit(Uint32 bucket) {return (Uint64)1 << bucket;}
+	};
+
+	/**
+	 * Collects the I/O statistics of a single file. All collectors register themselves, so
+	 * statistics can be queried per mount point and for the whole process.
+	 * Recording something takes a mutex which is almost never contended, and one gettimeofday call
+	 * per timed operation, so this can stay enabled.
+	 */
+	class KTORRENT_EXPORT IOStatsCollector
+	{
+	public:
+		IOStatsCollector();
+		virtual ~IOStatsCollector();
+
+		/// Set the path of the file, used to find its mount point
+		void setPath(const QString & path);
+
+		/// Get the path of the file
+		QString path() const;
+
+		/// Get the current time in microseconds, to pass to the record functions, 0 if disabled
+		static Uint64 now();
+
+		/**
+		 * Record a buffered or direct read operation.
+		 * @param bytes The number of bytes read
+		 * @param start The time the operation started (see now())
+		 */
+		void recordRead(Uint32 bytes,Uint64 start);
+
+		/**
+		 * Record a buffered or direct write operation.
+		 * @param bytes The number of bytes written
+		 * @param start The time the operation started (see now())
+		 */
+		void recordWrite(Uint32 bytes,Uint64 start);
+
+		/// Record an access to mmapped memory
+		void recordMappedRead(Uint32 bytes,Uint64 start);
+
+		/// Record a write to mmapped memory
+		void recordMappedWrite(Uint32 bytes,Uint64 start);
+
+		/// Record the outcome of a mmap call
+		void recordMap(bool ok);
+
+		/// Record a SIGBUS which was caught while accessing mmapped memory
+		void recordBusError();
+
+		/// Get a snapshot of the statistics
+		IOStats stats() const;
+
+		/// Enable or disable statistics collection
+		static void setEnabled(bool on);
+
+		/// Is statistics collection enabled
+		static bool enabled() {return enable;}
+
+		/**
+		 * Get the statistics of all files grouped per mount point. Files of which the mount point is unknown,
+		 * and closed files in directories which have not been used for a long time, are under an empty string.
+		 */
+		static QMap<QString,IOStats> mountPointStats();
+
+		/// Get the statistics of all files
+		static IOStats totalStats();
+
+	private:
+		void recordLatency(Uint64* histogram,Uint64 & total,Uint64 start);
+
+	private:
+		QString file_path;
+		IOStats io_stats;
+		mutable QMutex mutex;
+
+		static bool enable;
+	};
+
+}
+
+#endif // BT_IOSTATS_H
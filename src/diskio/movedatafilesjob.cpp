@@ -26,6 +26,7 @@
 #include <util/fileops.h>
 #include <util/functions.h>
 #include <interfaces/torrentfileinterface.h>
+#include "movedatafilesthread.h"
 
 namespace bt
 {
@@ -34,26 +35,24 @@ namespace bt
 	MoveDataFilesJob::MoveDataFilesJob() 
 		: Job(true,0),
 		Resource(&move_data_files_slot,"MoveDataFilesJob"),
-		err(false),
-		active_job(0),
-		running_recovery_jobs(0),
+		move_thread(0),
 		bytes_moved(0),
 		total_bytes(0),
-		bytes_moved_current_file(0)
+		last_update(0)
 	{
+		connect(&progress_timer,SIGNAL(timeout()),this,SLOT(updateProgress()));
 	}
 
 	
 	MoveDataFilesJob::MoveDataFilesJob(const QMap< TorrentFileInterface*, QString >& fmap) 
 		: Job(true,0),
 		Resource(&move_data_files_slot,"MoveDataFilesJob"),
-		err(false),
-		active_job(0),
-		running_recovery_jobs(0),
+		move_thread(0),
 		bytes_moved(0),
 		total_bytes(0),
-		bytes_moved_current_file(0)
+		last_update(0)
 	{
+		connect(&progress_timer,SIGNAL(timeout()),this,SLOT(updateProgress()));
 		file_map = fmap;
 		QMap<TorrentFileInterface*,QString>::const_iterator i = file_map.constBegin();
 		while (i != file_map.constEnd())
@@ -81,48 +80,20 @@ namespace bt
 
 
 	MoveDataFilesJob::~MoveDataFilesJob()
-	{}
-
-	void MoveDataFilesJob::addMove(const QString & src,const QString & dst)
-	{
-		todo.insert(src,dst);
-	}
-		
-	void MoveDataFilesJob::onJobDone(KJob* j)
 	{
-		if (j->error() || err)
+		if (move_thread)
 		{
-			if (!err)
-				setError(KIO::ERR_INTERNAL);
-			
-			active_job = 0;
-			if (j->error())
-				((KIO::Job*)j)->ui()->showErrorMessage();
-	
-			// shit happened cancel all previous moves
-			err = true;
-			recover(j->error() != KIO::ERR_FILE_ALREADY_EXIST && j->error() != KIO::ERR_IDENTICAL_FILES);
-		}
-		else
-		{
-			bytes_moved += bytes_moved_current_file;
-			bytes_moved_current_file = 0;
-			success.insert(active_src,active_dst);
-			active_src = active_dst = QString();
-			active_job = 0;
-			startMoving();
+			move_thread->stop();
+			move_thread->wait();
+			delete move_thread;
 		}
 	}
-	
-	void MoveDataFilesJob::onCanceled(KJob* j)
+
+	void MoveDataFilesJob::addMove(const QString & src,const QString & dst)
 	{
-		Q_UNUSED(j);
-		setError(KIO::ERR_USER_CANCELED);
-		active_job = 0;
-		err = true;
-		recover(true);
+		todo.insert(src,dst);
 	}
-	
+		
 	void MoveDataFilesJob::start()
 	{
 		registerWithTracker();
@@ -135,11 +106,11 @@ namespace bt
 		}
 		setTotalAmount(KJob::Bytes,total_bytes);
 		move_data_files_slot.add(this);
-		if (!active_job)
+		if (!move_thread)
 		{
 			description(this, i18n("Waiting for other move jobs to finish"),
-				qMakePair(i18nc("The source of a file operation", "Source"), active_src),
-				qMakePair(i18nc("The destination of a file operation", "Destination"), active_dst));
+				qMakePair(i18nc("The source of a file operation", "Source"), QString()),
+				qMakePair(i18nc("The destination of a file operation", "Destination"), QString()));
 			emitSpeed(0);
 		}
 	}
@@ -151,8 +122,17 @@ namespace bt
 	
 	void MoveDataFilesJob::kill(bool quietly)
 	{
-		Q_UNUSED(quietly);
-		// don't do anything we cannot abort in the middle of this operation
+		// the copied data is kept, so the move can be resumed later
+		if (move_thread)
+		{
+			progress_timer.stop();
+			move_thread->disconnect(this);
+			move_thread->stop();
+			move_thread->wait();
+			delete move_thread;
+			move_thread = 0;
+		}
+		bt::Job::kill(quietly);
 	}
 
 	
@@ -163,73 +143,68 @@ namespace bt
 			emitResult();
 			return;
 		}
-			
-		QMap<QString,QString>::iterator i = todo.begin();
-		active_job = KIO::file_move(KUrl(i.key()),KUrl(i.value()),-1,KIO::HideProgressInfo);
-		active_src = i.key();
-		active_dst = i.value();
-		Out(SYS_GEN|LOG_DEBUG) << "Moving " << active_src << " -> " << active_dst << endl;
-		connect(active_job,SIGNAL(result(KJob*)),this,SLOT(onJobDone(KJob*)));
-		connect(active_job,SIGNAL(canceled(KJob*)),this,SLOT(onCanceled(KJob*)));
-		connect(active_job,SIGNAL(processedAmount(KJob*,KJob::Unit,qulonglong)),
-				this,SLOT(onTransferred(KJob*,KJob::Unit,qulonglong)));
-		connect(active_job,SIGNAL(speed(KJob*,ulong)),
-				this,SLOT(onSpeed(KJob*,ulong)));
-		todo.erase(i);
 		
+		QMap<QString,QString>::iterator i = todo.begin();
+		Out(SYS_GEN|LOG_DEBUG) << "Moving " << todo.count() << " files, first: " << i.key() << " -> " << i.value() << endl;
 		description(this, i18nc("@title job","Moving"),
-					qMakePair(i18nc("The source of a file operation", "Source"), active_src),
-					qMakePair(i18nc("The destination of a file operation", "Destination"), active_dst));
-		addSubjob(active_job);
+					qMakePair(i18nc("The source of a file operation", "Source"), i.key()),
+					qMakePair(i18nc("The destination of a file operation", "Destination"), i.value()));
+		
+		move_thread = new MoveDataFilesThread(todo);
+		connect(move_thread,SIGNAL(finished()),this,SLOT(onThreadFinished()),Qt::QueuedConnection);
+		last_update = bt::Now();
+		progress_timer.start(1000);
+		move_thread->start(QThread::IdlePriority);
 	}
 	
-	void MoveDataFilesJob::recover(bool delete_active)
+	void MoveDataFilesJob::onThreadFinished()
 	{
-		if (delete_active && bt::Exists(active_dst))
-			bt::Delete(active_dst,true);
+		if (!move_thread)
+			return;
 		
-		if (success.isEmpty())
+		progress_timer.stop();
+		if (move_thread->errorHappened())
 		{
-			emitResult();
-			return;
+			// nothing has been touched yet, so just remove what we copied
+			setError(move_thread->errorCode());
+			setErrorText(move_thread->errorMessage());
+			move_thread->cleanup();
+			ui()->showErrorMessage();
 		}
-		
-		running_recovery_jobs = 0;
-		QMap<QString,QString>::iterator i = success.begin();
-		while (i != success.end())
-		{	
-			KIO::Job* j = KIO::file_move(KUrl(i.value()),KUrl(i.key()),-1,KIO::HideProgressInfo);
-			connect(j,SIGNAL(result(KJob*)),this,SLOT(onRecoveryJobDone(KJob*)));
-			running_recovery_jobs++;
-			i++;
+		else if (move_thread->isStopped())
+		{
+			setError(KIO::ERR_USER_CANCELED);
 		}
-		success.clear();
-	}
-	
-	void MoveDataFilesJob::onRecoveryJobDone(KJob* j)
-	{
-		Q_UNUSED(j);
-		running_recovery_jobs--;
-		if (running_recovery_jobs <= 0)
-			emitResult();
-	}
-	
-	void MoveDataFilesJob::onTransferred(KJob *job, KJob::Unit unit, qulonglong amount)
-	{
-		Q_UNUSED(job);
-		if (unit == KJob::Bytes)
+		else if (!move_thread->switchOver())
 		{
-			bytes_moved_current_file = amount;
-			setProcessedAmount(unit, bytes_moved + bytes_moved_current_file);
+			// switchOver puts everything back if it fails
+			setError(move_thread->errorCode());
+			setErrorText(move_thread->errorMessage());
+			move_thread->cleanup();
+			ui()->showErrorMessage();
 		}
+		
+		updateProgress();
+		move_thread->deleteLater();
+		move_thread = 0;
+		emitResult();
 	}
 	
-	void MoveDataFilesJob::onSpeed(KJob* job, unsigned long speed)
+	void MoveDataFilesJob::updateProgress()
 	{
-		Q_UNUSED(job);
-		emitSpeed(speed);
+		if (!move_thread)
+			return;
+		
+		Uint64 moved = move_thread->bytesMoved();
+		TimeStamp now = bt::Now();
+		// the count goes down when a file has to be copied again
+		if (now > last_update)
+			emitSpeed(moved > bytes_moved ? (moved - bytes_moved) * 1000 / (now - last_update) : 0);
+		
+		bytes_moved = moved;
+		last_update = now;
+		setProcessedAmount(KJob::Bytes,bytes_moved);
 	}
 
-
 }
 #include "movedatafilesjob.moc"
@@ -20,16 +20,19 @@
 #ifndef BTMOVEDATAFILESJOB_H
 #define BTMOVEDATAFILESJOB_H
 
+#include <QTimer>
 #include <torrent/job.h>
 #include <util/resourcemanager.h>
 
 namespace bt
 {
 	class TorrentFileInterface;
+	class MoveDataFilesThread;
 
 	/**
 	 * @author Joris Guisson <joris.guisson@gmail.com>
-	 * KIO::Job to move all the files of a torrent.
+	 * KIO::Job to move all the files of a torrent. The actual moving is done by a MoveDataFilesThread,
+	 * the source files are only removed once everything has been copied.
 	*/
 	class MoveDataFilesJob : public Job, public Resource
 	{
@@ -58,29 +61,22 @@ namespace bt
 		const QMap<TorrentFileInterface*,QString> & fileMap() const {return file_map;}
 		
 	private slots:
-		void onJobDone(KJob* j);
-		void onCanceled(KJob* j);
-		void onRecoveryJobDone(KJob* j);
-		void onTransferred(KJob *job, KJob::Unit unit, qulonglong amount);
-		void onSpeed(KJob* job, unsigned long speed);
+		void onThreadFinished();
+		void updateProgress();
 		
 	private:
-		void recover(bool delete_active);
 		void startMoving();
 		virtual void acquired();
 
 	private:
-		bool err;
-		KIO::Job* active_job;
-		QString active_src,active_dst;
+		MoveDataFilesThread* move_thread;
+		QTimer progress_timer;
 		QMap<QString,QString> todo;
-		QMap<QString,QString> success;
-		int running_recovery_jobs;	
 		QMap<TorrentFileInterface*,QString> file_map;
 		
 		bt::Uint64 bytes_moved;
 		bt::Uint64 total_bytes;
-		bt::Uint64 bytes_moved_current_file;
+		bt::TimeStamp last_update;
 	};
 
 }
@@ -0,0 +1,462 @@
+/***************************************************************************
+ *   Copyright (C) 2005 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.             *
+ ***************************************************************************/
+#include "movedatafilesthread.h"
+#include <config-ktorrent.h>
+#include <errno.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/ioctl.h>
+#ifdef Q_OS_LINUX
+#include <linux/fs.h>
+#endif
+
+#include <QFile>
+#include <QFileInfo>
+#include <QList>
+#include <QPair>
+#include <qrunnable.h>
+#include <qthreadpool.h>
+#include <klocale.h>
+#include <kio/global.h>
+#include <util/log.h>
+#include <util/error.h>
+#include <util/array.h>
+#include <util/fileops.h>
+
+#ifndef O_LARGEFILE
+# define O_LARGEFILE 0
+#endif
+
+// Size of the blocks which are copied at once
+#define COPY_BLOCK_SIZE (8 * 1024 * 1024)
+
+// When resuming, the end of the temporary file is copied again, in case the last write was incomplete
+#define RESUME_OVERLAP (1024 * 1024)
+
+// Number of times a file is copied again when it changes during the copy, before giving up
+#define MAX_COPY_ATTEMPTS 3
+
+namespace bt
+{
+	Uint32 MoveDataFilesThread::max_parallel_files = 2;
+
+	/**
+	 * Relocates a single file in the thread pool of a MoveDataFilesThread
+	 */
+	class MoveDataFilesTask : public QRunnable
+	{
+	public:
+		MoveDataFilesTask(MoveDataFilesThread* thread,const QString & src,const QString & dst)
+			: thread(thread),src(src),dst(dst)
+		{}
+
+		virtual void run()
+		{
+			if (thread->isStopped())
+				return;
+
+			try
+			{
+				thread->relocate(src,dst);
+			}
+			catch (Error & err)
+			{
+				thread->setErrorMsg(err.toString(),KIO::ERR_COULD_NOT_WRITE);
+			}
+		}
+
+	private:
+		MoveDataFilesThread* thread;
+		QString src;
+		QString dst;
+	};
+
+	MoveDataFilesThread::MoveDataFilesThread(const QMap<QString,QString> & todo)
+		: todo(todo),stopped(false),error_code(0),bytes_moved(0)
+	{
+	}
+
+
+	MoveDataFilesThread::~MoveDataFilesThread()
+	{
+	}
+
+	void MoveDataFilesThread::setMaxParallelFiles(Uint32 num)
+	{
+		max_parallel_files = qMax<Uint32>(num,1);
+	}
+
+	void MoveDataFilesThread::run()
+	{
+		// Copying lots of files in parallel only makes the disks seek more,
+		// so keep the number of parallel copies small
+		QThreadPool pool;
+		pool.setMaxThreadCount(max_parallel_files);
+		QMap<QString,QString>::iterator i = todo.begin();
+		while (i != todo.end())
+		{
+			pool.start(new MoveDataFilesTask(this,i.key(),i.value()));
+			i++;
+		}
+
+		pool.waitForDone();
+		Out(SYS_DIO|LOG_NOTICE) << "MoveDataFilesThread has finished" << endl;
+	}
+
+	bool MoveDataFilesThread::sameFileSystem(const QString & src,const QString & dst) const
+	{
+		struct stat sb;
+		if (stat(QFile::encodeName(src),&sb) != 0)
+			return false;
+
+		struct stat db;
+		if (stat(QFile::encodeName(QFileInfo(dst).absolutePath()),&db) != 0)
+			return false;
+
+		return sb.st_dev == db.st_dev;
+	}
+
+	void MoveDataFilesThread::relocate(const QString & src,const QString & dst)
+	{
+		if (bt::Exists(dst))
+		{
+			setErrorMsg(i18n("Cannot move %1 to %2: destination already exists",src,dst),KIO::ERR_FILE_ALREADY_EXIST);
+			return;
+		}
+
+		MakeFilePath(dst);
+		if (sameFileSystem(src,dst))
+		{
+			// a rename is instantaneous, so this is done during the switch over
+			QMutexLocker lock(&mutex);
+			renames.insert(src);
+			return;
+		}
+
+		QString part = partialPath(dst);
+		int sfd = ::open(QFile::encodeName(src),O_RDONLY | O_LARGEFILE);
+		if (sfd < 0)
+			throw Error(i18n("Cannot open %1: %2",src,strerror(errno)));
+
+		int dfd = ::open(QFile::encodeName(part),O_WRONLY | O_CREAT | O_LARGEFILE,0644);
+		if (dfd < 0)
+		{
+			::close(sfd);
+			throw Error(i18n("Cannot open %1: %2",part,strerror(errno)));
+		}
+
+		try
+		{
+			bool done = false;
+			for (int attempt = 0; attempt < MAX_COPY_ATTEMPTS && !done && !isStopped(); attempt++)
+				done = copy(src,sfd,dst,dfd);
+
+			if (!done && !isStopped())
+				throw Error(i18n("Cannot move %1: it keeps changing while it is being copied",src));
+		}
+		catch (Error &)
+		{
+			::close(sfd);
+			::close(dfd);
+			throw;
+		}
+
+		::close(sfd);
+		::close(dfd);
+	}
+
+	bool MoveDataFilesThread::copy(const QString & src,int sfd,const QString & dst,int dfd)
+	{
+		QString part = partialPath(dst);
+		QString stamp = sourceStamp(sfd);
+		Uint64 size = FileSize(sfd);
+		Uint64 off = FileSize(dfd);
+		if (off > size)
+			off = 0;
+		else if (off > 0 && readStamp(dst) != stamp)
+		{
+			// the data in the temporary file is of no use if the source has been modified since
+			Out(SYS_DIO|LOG_NOTICE) << src << " has changed since the last attempt, starting over" << endl;
+			off = 0;
+		}
+		else if (off > 0)
+		{
+			off = off > RESUME_OVERLAP ? off - RESUME_OVERLAP : 0;
+			Out(SYS_DIO|LOG_NOTICE) << "Resuming copy of " << src << " at " << off << endl;
+		}
+
+		if (off == 0)
+		{
+			TruncateFile(dfd,0,true);
+			writeStamp(dst,stamp);
+		}
+		moved(off);
+
+		if (off == 0 && cloneFile(sfd,dfd))
+		{
+			Out(SYS_DIO|LOG_DEBUG) << "Cloned " << src << " -> " << part << endl;
+			moved(size);
+			off = size;
+		}
+
+		if (off < size)
+			off = kernelCopy(sfd,dfd,off,size);
+
+		if (off < size)
+			off = userCopy(sfd,dfd,off,size);
+
+		if (off < size)
+			return false; // stopped, the temporary file and stamp are kept for the next time
+
+		if (sourceStamp(sfd) != stamp)
+		{
+			Out(SYS_DIO|LOG_NOTICE) << src << " was modified while it was being copied, copying it again" << endl;
+			writeStamp(dst,QString());
+			// everything reported by this attempt (which is off bytes) will be copied again
+			unmoved(off);
+			return false;
+		}
+
+		// make sure everything is on disk before the sources get deleted
+		TruncateFile(dfd,size,true);
+		fdatasync(dfd);
+		return true;
+	}
+
+	QString MoveDataFilesThread::sourceStamp(int fd)
+	{
+		struct stat sb;
+		if (fstat(fd,&sb) != 0)
+			throw Error(i18n("Cannot stat file: %1",strerror(errno)));
+
+#ifdef Q_OS_LINUX
+		Uint64 nsec = sb.st_mtim.tv_nsec;
+#else
+		Uint64 nsec = 0;
+#endif
+		return QString("%1 %2 %3 %4").arg((Uint64)sb.st_size).arg((Uint64)sb.st_ino).arg((Uint64)sb.st_mtime).arg(nsec);
+	}
+
+	QString MoveDataFilesThread::readStamp(const QString & dst)
+	{
+		QFile fptr(stampPath(dst));
+		if (!fptr.open(QIODevice::ReadOnly))
+			return QString();
+
+		return QString::fromLatin1(fptr.readAll());
+	}
+
+	void MoveDataFilesThread::writeStamp(const QString & dst,const QString & stamp)
+	{
+		QFile fptr(stampPath(dst));
+		if (!fptr.open(QIODevice::WriteOnly | QIODevice::Truncate))
+			throw Error(i18n("Cannot open %1: %2",stampPath(dst),fptr.errorString()));
+
+		fptr.write(stamp.toLatin1());
+		fptr.flush();
+	}
+
+	bool MoveDataFilesThread::cloneFile(int sfd,int dfd)
+	{
+#ifdef FICLONE
+		return ioctl(dfd,FICLONE,sfd) == 0;
+#else
+		Q_UNUSED(sfd);
+		Q_UNUSED(dfd);
+		return false;
+#endif
+	}
+
+	Uint64 MoveDataFilesThread::kernelCopy(int sfd,int dfd,Uint64 off,Uint64 size)
+	{
+#ifdef HAVE_COPY_FILE_RANGE
+		while (off < size && !isStopped())
+		{
+			loff_t in = off;
+			loff_t out = off;
+			ssize_t ret = copy_file_range(sfd,&in,dfd,&out,qMin<Uint64>(COPY_BLOCK_SIZE,size - off),0);
+			if (ret < 0)
+			{
+				// Not supported between these files, let the caller fall back to a normal copy
+				if (errno == EXDEV || errno == ENOSYS || errno == EINVAL || errno == EOPNOTSUPP)
+					return off;
+
+				throw Error(i18n("Cannot copy data: %1",strerror(errno)));
+			}
+			else if (ret == 0)
+				throw Error(i18n("Cannot copy data: unexpected end of file"));
+
+			off += ret;
+			moved(ret);
+		}
+#else
+		Q_UNUSED(sfd);
+		Q_UNUSED(dfd);
+		Q_UNUSED(size);
+#endif
+		return off;
+	}
+
+	Uint64 MoveDataFilesThread::userCopy(int sfd,int dfd,Uint64 off,Uint64 size)
+	{
+		Array<Uint8> buf(COPY_BLOCK_SIZE);
+		while (off < size && !isStopped())
+		{
+			Uint32 len = qMin<Uint64>(COPY_BLOCK_SIZE,size - off);
+			ssize_t ret = pread(sfd,buf,len,off);
+			if (ret < 0)
+				throw Error(i18n("Cannot copy data: %1",strerror(errno)));
+			else if (ret == 0)
+				throw Error(i18n("Cannot copy data: unexpected end of file"));
+
+			Uint32 written = 0;
+			while (written < (Uint32)ret)
+			{
+				ssize_t w = pwrite(dfd,(Uint8*)buf + written,ret - written,off + written);
+				if (w < 0)
+					throw Error(i18n("Cannot copy data: %1",strerror(errno)));
+				written += w;
+			}
+
+			off += ret;
+			moved(ret);
+		}
+
+		return off;
+	}
+
+	bool MoveDataFilesThread::switchOver()
+	{
+		// renames done so far, so they can be undone
+		QList<QPair<QString,QString> > done;
+		QMap<QString,QString>::iterator i = todo.begin();
+		while (i != todo.end())
+		{
+			QString from = renames.contains(i.key()) ? i.key() : partialPath(i.value());
+			if (::rename(QFile::encodeName(from),QFile::encodeName(i.value())) != 0)
+			{
+				QString err = i18n("Cannot move %1 to %2: %3",from,i.value(),strerror(errno));
+				Out(SYS_DIO|LOG_IMPORTANT) << err << endl;
+
+				// put everything back
+				for (int j = done.count() - 1; j >= 0; j--)
+					::rename(QFile::encodeName(done[j].second),QFile::encodeName(done[j].first));
+
+				setErrorMsg(err,KIO::ERR_CANNOT_RENAME);
+				return false;
+			}
+
+			if (renames.contains(i.key()))
+				moved(FileSize(i.value()));
+			done.append(qMakePair(from,i.value()));
+			i++;
+		}
+
+		// everything is in place, so the sources can go
+		for (i = todo.begin(); i != todo.end(); i++)
+		{
+			if (!renames.contains(i.key()))
+			{
+				bt::Delete(i.key(),true);
+				bt::Delete(stampPath(i.value()),true);
+			}
+		}
+
+		return true;
+	}
+
+	void MoveDataFilesThread::cleanup()
+	{
+		QMap<QString,QString>::iterator i = todo.begin();
+		while (i != todo.end())
+		{
+			QString part = partialPath(i.value());
+			if (bt::Exists(part))
+				bt::Delete(part,true);
+			QString stamp = stampPath(i.value());
+			if (bt::Exists(stamp))
+				bt::Delete(stamp,true);
+			i++;
+		}
+	}
+
+	void MoveDataFilesThread::stop()
+	{
+		QMutexLocker lock(&mutex);
+		stopped = true;
+	}
+
+	bool MoveDataFilesThread::isStopped() const
+	{
+		QMutexLocker lock(&mutex);
+		return stopped;
+	}
+
+	void MoveDataFilesThread::setErrorMsg(const QString & msg,int code)
+	{
+		QMutexLocker lock(&mutex);
+		// only keep the first error
+		if (error_msg.isNull())
+		{
+			error_msg = msg;
+			error_code = code;
+		}
+		stopped = true;
+	}
+
+	bool MoveDataFilesThread::errorHappened() const
+	{
+		QMutexLocker lock(&mutex);
+		return !error_msg.isNull();
+	}
+
+	QString MoveDataFilesThread::errorMessage() const
+	{
+		QMutexLocker lock(&mutex);
+		return error_msg;
+	}
+
+	int MoveDataFilesThread::errorCode() const
+	{
+		QMutexLocker lock(&mutex);
+		return error_code;
+	}
+
+	void MoveDataFilesThread::moved(Uint64 nb)
+	{
+		QMutexLocker lock(&mutex);
+		bytes_moved += nb;
+	}
+
+	void MoveDataFilesThread::unmoved(Uint64 nb)
+	{
+		QMutexLocker lock(&mutex);
+		bytes_moved = nb < bytes_moved ? bytes_moved - nb : 0;
+	}
+
+	Uint64 MoveDataFilesThread::bytesMoved() const
+	{
+		QMutexLocker lock(&mutex);
+		return bytes_moved;
+	}
+}
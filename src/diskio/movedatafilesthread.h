@@ -0,0 +1,145 @@
+/***************************************************************************
+ *   Copyright (C) 2005 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.             *
+ ***************************************************************************/
+#ifndef BTMOVEDATAFILESTHREAD_H
+#define BTMOVEDATAFILESTHREAD_H
+
+#include <qmap.h>
+#include <qset.h>
+#include <qmutex.h>
+#include <qstring.h>
+#include <qthread.h>
+#include <util/constants.h>
+#include <ktorrent_export.h>
+
+namespace bt
+{
+
+	/**
+	 * Thread which relocates the data files of a torrent, using the cheapest method available:
+	 * - a rename when source and destination are on the same filesystem
+	 * - a reflink (FICLONE) on filesystems which support it (btrfs, xfs)
+	 * - copy_file_range, so the kernel does the copying
+	 * - a plain read/write copy
+	 *
+	 * Files are copied in parallel to a temporary file (destination + ".part"), the sources are
+	 * left alone until switchOver is called, so the torrent can keep seeding from them. An
+	 * interrupted copy will be resumed from the temporary file the next time, unless the size,
+	 * inode or modification time of the source (stored in destination + ".part.stamp") has changed.
+	 */
+	class KTORRENT_EXPORT MoveDataFilesThread : public QThread
+	{
+	public:
+		/**
+		 * Constructor.
+		 * @param todo Map of source files and their destination
+		 */
+		MoveDataFilesThread(const QMap<QString,QString> & todo);
+		virtual ~MoveDataFilesThread();
+
+		virtual void run();
+
+		/// Stop the thread, temporary files will be kept so the move can be resumed
+		void stop();
+
+		/// See if the thread has been stopped
+		bool isStopped() const;
+
+		/**
+		 * Set an error message, also calls stop
+		 * @param msg The message
+		 * @param code The KIO error code
+		 */
+		void setErrorMsg(const QString & msg,int code);
+
+		/// Did an error occur ?
+		bool errorHappened() const;
+
+		/// Get the error message
+		QString errorMessage() const;
+
+		/// Get the KIO error code
+		int errorCode() const;
+
+		/// nb Number of bytes have been moved
+		void moved(Uint64 nb);
+
+		/// Get the number of bytes moved
+		Uint64 bytesMoved() const;
+
+		/**
+		 * Relocate a single file to its temporary destination, called from the thread pool.
+		 * @param src The source file
+		 * @param dst The destination file
+		 * @throw Error when something goes wrong
+		 */
+		void relocate(const QString & src,const QString & dst);
+
+		/**
+		 * Put all files in their final location and remove the sources. Must be called
+		 * from the main thread once the thread has finished without errors. If something goes
+		 * wrong, all files are put back where they were.
+		 * @return true upon success
+		 */
+		bool switchOver();
+
+		/// Remove all temporary files, after an error
+		void cleanup();
+
+		/// Get the path of the temporary file used while copying to dst
+		static QString partialPath(const QString & dst) {return dst + ".part";}
+
+		/// Get the path of the file which records the state of the source of the temporary file
+		static QString stampPath(const QString & dst) {return dst + ".part.stamp";}
+
+		/**
+		 * Set the maximum number of files which are copied in parallel.
+		 * @param num The number of files, minimum is 1
+		 */
+		static void setMaxParallelFiles(Uint32 num);
+
+		/// Get the maximum number of files which are copied in parallel
+		static Uint32 maxParallelFiles() {return max_parallel_files;}
+
+	private:
+		bool sameFileSystem(const QString & src,const QString & dst) const;
+		bool copy(const QString & src,int sfd,const QString & dst,int dfd);
+		QString sourceStamp(int fd);
+		QString readStamp(const QString & dst);
+		void writeStamp(const QString & dst,const QString & stamp);
+		bool cloneFile(int sfd,int dfd);
+		void unmoved(Uint64 nb);
+		Uint64 kernelCopy(int sfd,int dfd,Uint64 off,Uint64 size);
+		Uint64 userCopy(int sfd,int dfd,Uint64 off,Uint64 size);
+
+	private:
+		QMap<QString,QString> todo;
+		QSet<QString> renames; // sources which will be renamed during the switch over
+		bool stopped;
+		QString error_msg;
+		int error_code;
+		Uint64 bytes_moved;
+		mutable QMutex mutex;
+
+		static Uint32 max_parallel_files;
+	};
+
+}
+
+#endif
@@ -166,6 +166,7 @@ namespace bt
 
 				CacheFile::Ptr fd(new CacheFile());
 				fd->open(tf.getPathOnDisk(), tf.getSize());
+				fd->setAccessPattern(access_pattern);
 				files.insert(i, fd);
 			}
 			else
@@ -687,6 +688,7 @@ namespace bt
 				dnd_files.remove(tf->getIndex());
 				CacheFile::Ptr fd(new CacheFile());
 				fd->open(tf->getPathOnDisk(), tf->getSize());
+				fd->setAccessPattern(access_pattern);
 				files.insert(tf->getIndex(), fd);
 			}
 		}
@@ -929,6 +931,107 @@ namespace bt
 	}
 
 
+	void MultiFileCache::setAccessPattern(AccessAdvice pattern)
+	{
+		Cache::setAccessPattern(pattern);
+		QMap<Uint32, CacheFile::Ptr>::iterator i = files.begin();
+		while(i != files.end())
+		{
+			if(i.value())
+				i.value()->setAccessPattern(pattern);
+			i++;
+		}
+	}
+
+	void MultiFileCache::adviseChunks(Uint32 from, Uint32 to, AccessAdvice advice)
+	{
+		open();
+
+		// byte range of the chunks in the torrent
+		Uint64 start = (Uint64)from * tor.getChunkSize();
+		Uint64 end = (to >= tor.getNumChunks() - 1) ? tor.getTotalSize() : (Uint64)(to + 1) * tor.getChunkSize();
+
+		QMap<Uint32, CacheFile::Ptr>::iterator i = files.begin();
+		while(i != files.end())
+		{
+			const TorrentFile & tf = tor.getFile(i.key());
+			Uint64 file_start = tf.getCacheOffset();
+			Uint64 file_end = file_start + tf.getSize();
+			if(i.value() && file_start < end && file_end > start)
+			{
+				Uint64 off = qMax(start, file_start);
+				Uint64 len = qMin(end, file_end) - off;
+				i.value()->advise(off - file_start, len, advice);
+			}
+			i++;
+		}
+	}
+
+	bool MultiFileCache::isChunkAllocated(Uint32 chunk)
+	{
+		// called for every candidate by the chunk selector, so skip the lookup when possible
+		if(!CacheFile::anyPreallocationPending())
+			return true;
+
+		Uint64 start = (Uint64)chunk * tor.getChunkSize();
+		Uint64 end = (chunk == tor.getNumChunks() - 1) ? tor.getTotalSize() : start + tor.getChunkSize();
+
+		QList<Uint32> file_list;
+		tor.calcChunkPos(chunk, file_list);
+		foreach(Uint32 idx, file_list)
+		{
+			CacheFile::Ptr fd = files.value(idx);
+			if(!fd)
+				continue;
+
+			const TorrentFile & tf = tor.getFile(idx);
+			Uint64 file_start = tf.getCacheOffset();
+			Uint64 off = qMax(start, file_start);
+			Uint64 len = qMin(end, file_start + tf.getSize()) - off;
+			if(!fd->isAllocated(off - file_start, len))
+				return false;
+		}
+
+		return true;
+	}
+
+	int MultiFileCache::pieceFile(Chunk* c, Uint32 off, Uint32 length, Uint64 & file_off)
+	{
+		open();
+
+		// only possible if the piece lies completely in one file
+		Uint64 start = (Uint64)c->getIndex() * tor.getChunkSize() + off;
+		QList<Uint32> file_list;
+		tor.calcChunkPos(c->getIndex(), file_list);
+		foreach(Uint32 idx, file_list)
+		{
+			const TorrentFile & tf = tor.getFile(idx);
+			Uint64 file_start = tf.getCacheOffset();
+			if(start < file_start || start + length > file_start + tf.getSize())
+				continue;
+
+			CacheFile::Ptr fd = files.value(idx);
+			if(!fd)
+				return -1;
+
+			file_off = start - file_start;
+			return fd->duplicateHandle();
+		}
+
+		return -1;
+	}
+
+	void MultiFileCache::ioStats(QMap<QString, IOStats> & stats)
+	{
+		QMap<Uint32, CacheFile::Ptr>::iterator i = files.begin();
+		while(i != files.end())
+		{
+			if(i.value())
+				stats.insert(tor.getFile(i.key()).getPathOnDisk(), i.value()->ioStats().stats());
+			i++;
+		}
+	}
+
 
 	///////////////////////////////
 
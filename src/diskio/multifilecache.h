@@ -62,6 +62,11 @@ namespace bt
 		virtual void loadFileMap();
 		virtual void saveFileMap();
 		virtual bool getMountPoints(QSet<QString>& mps);
+		virtual void setAccessPattern(AccessAdvice pattern);
+		virtual void adviseChunks(Uint32 from, Uint32 to, AccessAdvice advice);
+		virtual bool isChunkAllocated(Uint32 chunk);
+		virtual int pieceFile(Chunk* c, Uint32 off, Uint32 length, Uint64 & file_off);
+		virtual void ioStats(QMap<QString, IOStats> & stats);
 
 	private:
 		void touch(TorrentFile & tf);
@@ -29,6 +29,11 @@
 #include <util/sha1hashgen.h>
 #include <util/error.h>
 
+#ifndef Q_WS_WIN
+/// Like BUS_ERROR_WPROTECT and BUS_ERROR_RPROTECT, but also records the SIGBUS in the I/O statistics of the file
+#define PIECE_DATA_PROTECT(write_operation) BusErrorGuard bus_error_guard; if (sigsetjmp(bt::sigbus_env, 1)) busError(write_operation)
+#endif
+
 namespace bt
 {
 
@@ -69,9 +74,12 @@ namespace bt
 			throw bt::Error(i18n("Unable to write to a piece mapped read only"));
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_WPROTECT();
+		PIECE_DATA_PROTECT(true);
 #endif
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
 		memcpy(ptr + off, buf, buf_size);
+		if(mapped())
+			cache_file->ioStats().recordMappedWrite(buf_size, start);
 		return buf_size;
 	}
 
@@ -82,9 +90,12 @@ namespace bt
 			return 0;
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_RPROTECT();
+		PIECE_DATA_PROTECT(false);
 #endif
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
 		memcpy(buf, ptr + off, to_read);
+		if(mapped())
+			cache_file->ioStats().recordMappedRead(to_read, start);
 		return to_read;
 	}
 
@@ -94,9 +105,13 @@ namespace bt
 			return 0;
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_RPROTECT();
+		PIECE_DATA_PROTECT(false);
 #endif
-		return file.write(ptr + off, size);
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
+		Uint32 ret = file.write(ptr + off, size);
+		if(mapped())
+			cache_file->ioStats().recordMappedRead(ret, start);
+		return ret;
 	}
 
 	Uint32 PieceData::readFromFile(File& file, Uint32 size, Uint32 off)
@@ -108,9 +123,13 @@ namespace bt
 			throw bt::Error(i18n("Unable to write to a piece mapped read only"));
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_WPROTECT();
+		PIECE_DATA_PROTECT(true);
 #endif
-		return file.read(ptr + off, size);
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
+		Uint32 ret = file.read(ptr + off, size);
+		if(mapped())
+			cache_file->ioStats().recordMappedWrite(ret, start);
+		return ret;
 	}
 
 	void PieceData::updateHash(SHA1HashGen& hg)
@@ -119,9 +138,12 @@ namespace bt
 			return;
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_RPROTECT();
+		PIECE_DATA_PROTECT(false);
 #endif
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
 		hg.update(ptr, len);
+		if(mapped())
+			cache_file->ioStats().recordMappedRead(len, start);
 	}
 
 	SHA1Hash PieceData::generateHash() const
@@ -130,9 +152,13 @@ namespace bt
 			return SHA1Hash();
 
 #ifndef Q_WS_WIN
-		BUS_ERROR_RPROTECT();
+		PIECE_DATA_PROTECT(false);
 #endif
-		return SHA1Hash::generate(ptr, len);
+		Uint64 start = mapped() ? IOStatsCollector::now() : 0;
+		SHA1Hash hash = SHA1Hash::generate(ptr, len);
+		if(mapped())
+			cache_file->ioStats().recordMappedRead(len, start);
+		return hash;
 	}
 
 
@@ -141,4 +167,13 @@ namespace bt
 	{
 		ptr = 0;
 	}
+
+#ifndef Q_WS_WIN
+	void PieceData::busError(bool write_operation) const
+	{
+		if(cache_file)
+			cache_file->ioStats().recordBusError();
+		throw BusError(write_operation);
+	}
+#endif
 }
@@ -138,6 +138,7 @@ namespace bt
 
 	private:
 		virtual void unmapped();
+		void busError(bool write_operation) const;
 
 	private:
 		Chunk* chunk;
@@ -27,6 +27,8 @@
 #include <util/log.h>
 #include <util/error.h>
 #include <qfile.h>
+#include <qrunnable.h>
+#include <qthreadpool.h>
 #include <klocale.h>
 #include "chunkmanager.h"
 
@@ -36,12 +38,47 @@
 
 namespace bt
 {
+	Uint32 PreallocationThread::max_parallel_files = 4;
+	
+	/**
+	 * Preallocates a single CacheFile in the thread pool of a PreallocationThread
+	 */
+	class PreallocationTask : public QRunnable
+	{
+	public:
+		PreallocationTask(PreallocationThread* thread,CacheFile::Ptr cache_file) 
+			: thread(thread),cache_file(cache_file)
+		{}
+		
+		virtual void run()
+		{
+			if (thread->isStopped())
+			{
+				thread->setNotFinished();
+				return;
+			}
+			
+			try
+			{
+				cache_file->preallocate(thread);
+			}
+			catch(Error & err)
+			{
+				thread->setErrorMsg(err.toString());
+			}
+		}
+		
+	private:
+		PreallocationThread* thread;
+		CacheFile::Ptr cache_file;
+	};
 
 	PreallocationThread::PreallocationThread() : 
 		stopped(false), 
 		not_finished(false), 
 		done(false),
-		bytes_written(0)
+		bytes_written(0),
+		total_bytes(0)
 	{
 	}
 
@@ -52,32 +89,39 @@ namespace bt
 	void PreallocationThread::add(CacheFile::Ptr cache_file)
 	{
 		if(cache_file)
+		{
+			cache_file->setPreallocationPending(true);
 			todo.append(cache_file);
+			total_bytes += cache_file->maxSize();
+		}
+	}
+	
+	Uint64 PreallocationThread::totalBytes() const
+	{
+		QMutexLocker lock(&mutex);
+		return total_bytes;
+	}
+	
+	void PreallocationThread::setMaxParallelFiles(Uint32 num)
+	{
+		max_parallel_files = qMax<Uint32>(num,1);
 	}
 
 
 	void PreallocationThread::run()
 	{
-		try
-		{
-			foreach(CacheFile::Ptr cache_file, todo)
-			{
-				if(!isStopped())
-				{
-					cache_file->preallocate(this);
-				}
-				else
-				{
-					setNotFinished();
-					break;
-				}
-			}
-				
-		}
-		catch(Error & err)
-		{
-			setErrorMsg(err.toString());
-		}
+		// Files are on the same disk most of the time, but fallocate only updates
+		// metadata, so allocating a few files in parallel is still a lot faster.
+		QThreadPool pool;
+		pool.setMaxThreadCount(max_parallel_files);
+		foreach(CacheFile::Ptr cache_file, todo)
+			pool.start(new PreallocationTask(this,cache_file));
+		
+		pool.waitForDone();
+		
+		// Files which were skipped because we were stopped, should not block downloading
+		foreach(CacheFile::Ptr cache_file, todo)
+			cache_file->setPreallocationPending(false);
 
 		QMutexLocker lock(&mutex);
 		done = true;
@@ -47,6 +47,18 @@ namespace bt
 		
 		/// Add a CacheFile to preallocate
 		void add(CacheFile::Ptr cache_file);
+		
+		/// Get the total number of bytes which need to be preallocated
+		Uint64 totalBytes() const;
+		
+		/**
+		 * Set the maximum number of files which are preallocated in parallel.
+		 * @param num The number of files, minimum is 1
+		 */
+		static void setMaxParallelFiles(Uint32 num);
+		
+		/// Get the maximum number of files which are preallocated in parallel
+		static Uint32 maxParallelFiles() {return max_parallel_files;}
 
 		virtual void run();
 
@@ -92,7 +104,10 @@ namespace bt
 		bool stopped, not_finished, done;
 		QString error_msg;
 		Uint64 bytes_written;
+		Uint64 total_bytes;
 		mutable QMutex mutex;
+		
+		static Uint32 max_parallel_files;
 	};
 
 }
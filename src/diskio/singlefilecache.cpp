@@ -135,7 +135,7 @@ namespace bt
 
 		Uint64 piece_off = c->getIndex() * tor.getChunkSize() + off;
 		Uint8* buf = 0;
-		if(mmap_failures >= 3)
+		if(mmap_failures >= 3 || Cache::directIOEnabled())
 		{
 			buf = new Uint8[length];
 			PieceData::Ptr cp(new PieceData(c, off, length, buf, CacheFile::Ptr(), read_only));
@@ -250,6 +250,7 @@ namespace bt
 
 		CacheFile::Ptr tmp(new CacheFile());
 		tmp->open(output_file, tor.getTotalSize());
+		tmp->setAccessPattern(access_pattern);
 		fd = tmp;
 	}
 
@@ -285,4 +286,48 @@ namespace bt
 
 		return fd->diskUsage();
 	}
+
+	void SingleFileCache::setAccessPattern(AccessAdvice pattern)
+	{
+		Cache::setAccessPattern(pattern);
+		if(fd)
+			fd->setAccessPattern(pattern);
+	}
+
+	void SingleFileCache::adviseChunks(Uint32 from, Uint32 to, AccessAdvice advice)
+	{
+		if(!fd)
+			open();
+
+		Uint64 off = (Uint64)from * tor.getChunkSize();
+		Uint64 end = (to >= tor.getNumChunks() - 1) ? tor.getTotalSize() : (Uint64)(to + 1) * tor.getChunkSize();
+		if(off < end)
+			fd->advise(off, end - off, advice);
+	}
+
+	bool SingleFileCache::isChunkAllocated(Uint32 chunk)
+	{
+		if(!fd)
+			return true;
+
+		Uint64 off = (Uint64)chunk * tor.getChunkSize();
+		Uint64 end = (chunk == tor.getNumChunks() - 1) ? tor.getTotalSize() : off + tor.getChunkSize();
+		return fd->isAllocated(off, end - off);
+	}
+
+	int SingleFileCache::pieceFile(Chunk* c, Uint32 off, Uint32 length, Uint64 & file_off)
+	{
+		Q_UNUSED(length);
+		if(!fd)
+			open();
+
+		file_off = (Uint64)c->getIndex() * tor.getChunkSize() + off;
+		return fd->duplicateHandle();
+	}
+
+	void SingleFileCache::ioStats(QMap<QString, IOStats> & stats)
+	{
+		if(fd)
+			stats.insert(output_file, fd->ioStats().stats());
+	}
 }
@@ -0,0 +1,235 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <QFile>
+#include <time.h>
+#include <string.h>
+#include <unistd.h>
+#include <KGlobal>
+#include <KLocale>
+#include <KTempDir>
+#include <util/log.h>
+#include <util/error.h>
+#include <util/functions.h>
+#include <util/fileops.h>
+#include <diskio/cache.h>
+#include <diskio/cachefile.h>
+
+const bt::Uint32 TEST_FILE_SIZE = 1024 * 1024 + 1237;
+const bt::Uint32 BENCH_FILE_SIZE = 32 * 1024 * 1024;
+const bt::Uint32 BENCH_PIECE_SIZE = 16 * 1024;
+
+using namespace bt;
+
+class DummyMapping : public MMappeable
+{
+public:
+	virtual void unmapped() {}
+};
+
+class DirectIOTest : public QObject
+{
+	Q_OBJECT
+
+private:
+	/// Resident set size of this process in KiB
+	Uint64 residentSetSize()
+	{
+		QFile fptr("/proc/self/statm");
+		if (!fptr.open(QIODevice::ReadOnly))
+			return 0;
+
+		QList<QByteArray> fields = fptr.readAll().split(' ');
+		if (fields.count() < 2)
+			return 0;
+
+		return fields[1].toULongLong() * (sysconf(_SC_PAGESIZE) / 1024);
+	}
+
+	void roundTrip(bool direct)
+	{
+		Cache::setDirectIOEnabled(direct);
+		QString path = tmpdir.name() + (direct ? "direct" : "buffered");
+		bt::Touch(path);
+
+		QByteArray data(TEST_FILE_SIZE, 0);
+		for (Uint32 i = 0; i < TEST_FILE_SIZE; i++)
+			data[i] = qrand() % 256;
+
+		CacheFile cf;
+		cf.open(path, TEST_FILE_SIZE);
+
+		// write in odd sized pieces, so that offsets and sizes are not aligned
+		Uint32 off = 0;
+		while (off < TEST_FILE_SIZE)
+		{
+			Uint32 len = qMin<Uint32>(TEST_FILE_SIZE - off, 3001);
+			cf.write((const Uint8*)data.constData() + off, len, off);
+			off += len;
+		}
+
+		// the file is opened by the first write, check which path it is taking
+		if (direct && !cf.directIO())
+		{
+			cf.close();
+			Cache::setDirectIOEnabled(false);
+			QSKIP("Filesystem of the temporary directory does not support O_DIRECT", SkipSingle);
+		}
+		QVERIFY(cf.directIO() == direct);
+
+		// rewrite something in the middle of a block
+		data[5000] = data[5000] + 1;
+		cf.write((const Uint8*)data.constData() + 5000, 1, 5000);
+
+		QVERIFY(bt::FileSize(path) == TEST_FILE_SIZE);
+
+		QByteArray read_back(TEST_FILE_SIZE, 0);
+		off = 0;
+		while (off < TEST_FILE_SIZE)
+		{
+			Uint32 len = qMin<Uint32>(TEST_FILE_SIZE - off, 7919);
+			cf.read((Uint8*)read_back.data() + off, len, off);
+			off += len;
+		}
+		cf.close();
+
+		QVERIFY(read_back == data);
+		Cache::setDirectIOEnabled(false);
+	}
+
+	void benchmark(bool direct)
+	{
+		Cache::setDirectIOEnabled(direct);
+		QString path = tmpdir.name() + (direct ? "bench_direct" : "bench_buffered");
+		bt::Touch(path);
+
+		Uint8* piece = new Uint8[BENCH_PIECE_SIZE];
+		for (Uint32 i = 0; i < BENCH_PIECE_SIZE; i++)
+			piece[i] = qrand() % 256;
+
+		Uint64 rss_before = residentSetSize();
+		CacheFile cf;
+		cf.open(path, BENCH_FILE_SIZE);
+
+		TimeStamp start = bt::Now();
+		for (Uint32 off = 0; off < BENCH_FILE_SIZE; off += BENCH_PIECE_SIZE)
+			cf.write(piece, BENCH_PIECE_SIZE, off);
+		TimeStamp write_time = bt::Now() - start;
+
+		start = bt::Now();
+		for (Uint32 off = 0; off < BENCH_FILE_SIZE; off += BENCH_PIECE_SIZE)
+			cf.read(piece, BENCH_PIECE_SIZE, off);
+		TimeStamp read_time = bt::Now() - start;
+		bool direct_used = cf.directIO();
+		cf.close();
+
+		// without O_DIRECT support, the direct numbers are just buffered ones again
+		if (direct && !direct_used)
+			Out(SYS_GEN|LOG_DEBUG) << "Direct I/O not supported on " << tmpdir.name() << ", using buffered I/O" << endl;
+
+		Out(SYS_GEN|LOG_DEBUG) << (direct_used ? "Direct" : "Buffered") << " I/O: write "
+			<< BytesPerSecToString(BENCH_FILE_SIZE * 1000.0 / qMax<TimeStamp>(write_time, 1)) << ", read "
+			<< BytesPerSecToString(BENCH_FILE_SIZE * 1000.0 / qMax<TimeStamp>(read_time, 1)) << ", RSS growth "
+			<< ((Int64)residentSetSize() - (Int64)rss_before) << " KiB" << endl;
+
+		delete [] piece;
+		bt::Delete(path, true);
+		Cache::setDirectIOEnabled(false);
+	}
+
+	void benchmarkMapped()
+	{
+		QString path = tmpdir.name() + "bench_mapped";
+		bt::Touch(path);
+
+		Uint8* piece = new Uint8[BENCH_PIECE_SIZE];
+		for (Uint32 i = 0; i < BENCH_PIECE_SIZE; i++)
+			piece[i] = qrand() % 256;
+
+		Uint64 rss_before = residentSetSize();
+		CacheFile cf;
+		cf.open(path, BENCH_FILE_SIZE);
+		DummyMapping dm;
+
+		TimeStamp start = bt::Now();
+		Uint8* ptr = (Uint8*)cf.map(&dm, 0, BENCH_FILE_SIZE, CacheFile::RW);
+		QVERIFY(ptr);
+		for (Uint32 off = 0; off < BENCH_FILE_SIZE; off += BENCH_PIECE_SIZE)
+			memcpy(ptr + off, piece, BENCH_PIECE_SIZE);
+		cf.unmap(ptr, BENCH_FILE_SIZE);
+		TimeStamp write_time = bt::Now() - start;
+
+		start = bt::Now();
+		ptr = (Uint8*)cf.map(&dm, 0, BENCH_FILE_SIZE, CacheFile::READ);
+		QVERIFY(ptr);
+		for (Uint32 off = 0; off < BENCH_FILE_SIZE; off += BENCH_PIECE_SIZE)
+			memcpy(piece, ptr + off, BENCH_PIECE_SIZE);
+		Uint64 rss_mapped = residentSetSize();
+		cf.unmap(ptr, BENCH_FILE_SIZE);
+		TimeStamp read_time = bt::Now() - start;
+		cf.close();
+
+		Out(SYS_GEN|LOG_DEBUG) << "Mapped I/O: write "
+			<< BytesPerSecToString(BENCH_FILE_SIZE * 1000.0 / qMax<TimeStamp>(write_time, 1)) << ", read "
+			<< BytesPerSecToString(BENCH_FILE_SIZE * 1000.0 / qMax<TimeStamp>(read_time, 1)) << ", RSS growth "
+			<< ((Int64)rss_mapped - (Int64)rss_before) << " KiB" << endl;
+
+		delete [] piece;
+		bt::Delete(path, true);
+	}
+
+private slots:
+	void initTestCase()
+	{
+		KGlobal::setLocale(new KLocale("main"));
+		bt::InitLog("directiotest.log", false, true);
+		qsrand(time(0));
+	}
+
+	void cleanupTestCase()
+	{
+	}
+
+	void testBufferedRoundTrip()
+	{
+		roundTrip(false);
+	}
+
+	void testDirectRoundTrip()
+	{
+		roundTrip(true);
+	}
+
+	void testThroughput()
+	{
+		benchmarkMapped();
+		benchmark(false);
+		benchmark(true);
+	}
+
+private:
+	KTempDir tmpdir;
+};
+
+
+QTEST_MAIN(DirectIOTest)
+
+#include "directiotest.moc"
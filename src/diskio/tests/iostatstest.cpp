@@ -0,0 +1,160 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <KGlobal>
+#include <KLocale>
+#include <KTempDir>
+#include <util/log.h>
+#include <util/functions.h>
+#include <util/fileops.h>
+#include <diskio/iostats.h>
+#include <diskio/cachefile.h>
+
+using namespace bt;
+
+class DummyMapping : public MMappeable
+{
+public:
+	virtual void unmapped() {}
+};
+
+class IOStatsTest : public QObject
+{
+	Q_OBJECT
+
+private slots:
+	void initTestCase()
+	{
+		KGlobal::setLocale(new KLocale("main"));
+		bt::InitLog("iostatstest.log", false, true);
+	}
+
+	void cleanupTestCase()
+	{
+	}
+
+	void testHistogram()
+	{
+		QVERIFY(IOStats::latencyBucket(0) == 0);
+		QVERIFY(IOStats::latencyBucket(1) == 1);
+		QVERIFY(IOStats::latencyBucket(3) == 2);
+		QVERIFY(IOStats::latencyBucket(1000) == 10);
+		QVERIFY(IOStats::latencyBucket(Uint64(1) << 40) == IO_LATENCY_BUCKETS - 1);
+
+		IOStats s;
+		s.read_latency[3] = 90;
+		s.read_latency[10] = 10;
+		QVERIFY(s.readLatencyPercentile(50) == 8);
+		QVERIFY(s.readLatencyPercentile(90) == 8);
+		QVERIFY(s.readLatencyPercentile(99) == 1024);
+		QVERIFY(s.writeLatencyPercentile(99) == 0);
+
+		IOStats t;
+		t += s;
+		t += s;
+		QVERIFY(t.read_latency[3] == 180);
+	}
+
+	void testCacheFile()
+	{
+		QString path = tmpdir.name() + "iostats";
+		bt::Touch(path);
+
+		QByteArray data(64 * 1024, 'x');
+		IOStats before = IOStatsCollector::totalStats();
+		{
+			CacheFile cf;
+			cf.open(path, data.size());
+			cf.write((const Uint8*)data.constData(), data.size(), 0);
+			cf.read((Uint8*)data.data(), 1024, 0);
+			cf.read((Uint8*)data.data(), 1024, 1024);
+
+			DummyMapping dm;
+			void* ptr = cf.map(&dm, 0, 4096, CacheFile::READ);
+			if (ptr)
+				cf.unmap(ptr, 4096);
+
+			IOStats s = cf.ioStats().stats();
+			QVERIFY(s.write_ops == 1);
+			QVERIFY(s.bytes_written == (Uint64)data.size());
+			QVERIFY(s.read_ops == 2);
+			QVERIFY(s.bytes_read == 2048);
+			QVERIFY(s.mmaps + s.mmap_failures == 1);
+			QVERIFY(s.mapped_bytes_read == 0);
+
+			Uint64 ops = 0;
+			for (Uint32 i = 0; i < IO_LATENCY_BUCKETS; i++)
+				ops += s.read_latency[i];
+			QVERIFY(ops == 2);
+
+			QMap<QString,IOStats> mps = IOStatsCollector::mountPointStats();
+			Uint64 written = 0;
+			foreach (const IOStats & mp, mps)
+				written += mp.bytes_written;
+			QVERIFY(written >= (Uint64)data.size());
+			cf.close();
+		}
+
+		// Statistics of closed files are kept
+		IOStats after = IOStatsCollector::totalStats();
+		QVERIFY(after.bytes_written - before.bytes_written == (Uint64)data.size());
+		QVERIFY(after.read_ops - before.read_ops == 2);
+	}
+
+	void testManyClosedFiles()
+	{
+		// closed files in lots of directories may not pile up, but still count in the totals
+		IOStats before = IOStatsCollector::totalStats();
+		for (int i = 0; i < 1000; i++)
+		{
+			IOStatsCollector c;
+			c.setPath(QString("%1dir%2/file").arg(tmpdir.name()).arg(i));
+			c.recordWrite(100, IOStatsCollector::now());
+		}
+
+		IOStats after = IOStatsCollector::totalStats();
+		QVERIFY(after.write_ops - before.write_ops == 1000);
+		QVERIFY(after.bytes_written - before.bytes_written == 100000);
+	}
+
+	void testDisabled()
+	{
+		QString path = tmpdir.name() + "iostats_disabled";
+		bt::Touch(path);
+
+		IOStatsCollector::setEnabled(false);
+		QByteArray data(1024, 'x');
+		CacheFile cf;
+		cf.open(path, data.size());
+		cf.write((const Uint8*)data.constData(), data.size(), 0);
+		QVERIFY(cf.ioStats().stats().write_ops == 0);
+		cf.close();
+		IOStatsCollector::setEnabled(true);
+	}
+
+private:
+	KTempDir tmpdir;
+};
+
+
+QTEST_MAIN(IOStatsTest)
+
+#include "iostatstest.moc"
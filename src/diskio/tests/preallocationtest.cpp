@@ -99,7 +99,11 @@ private slots:
 		
 		PreallocationThread prealloc;
 		cache.preparePreallocation(&prealloc);
+		QVERIFY(prealloc.totalBytes() == multi_tor.getTotalSize());
+		QVERIFY(!cache.isChunkAllocated(0));
 		prealloc.run();
+		QVERIFY(cache.isChunkAllocated(0));
+		QVERIFY(cache.isChunkAllocated(multi_tor.getNumChunks() - 1));
 		
 		if(!prealloc.errorMessage().isEmpty())
 			Out(SYS_GEN|LOG_DEBUG) << "Preallocation failed: " << prealloc.errorMessage() << endl;
@@ -124,7 +128,11 @@ private slots:
 		
 		PreallocationThread prealloc;
 		cache.preparePreallocation(&prealloc);
+		QVERIFY(prealloc.totalBytes() == single_tor.getTotalSize());
+		QVERIFY(!cache.isChunkAllocated(0));
 		prealloc.run();
+		QVERIFY(cache.isChunkAllocated(0));
+		QVERIFY(cache.isChunkAllocated(single_tor.getNumChunks() - 1));
 		
 		if(!prealloc.errorMessage().isEmpty())
 			Out(SYS_GEN|LOG_DEBUG) << "Preallocation failed: " << prealloc.errorMessage() << endl;
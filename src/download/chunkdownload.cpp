@@ -286,6 +286,19 @@ namespace bt
 		if (!ds || pd->isChoked())
 			return false;
 		
+		// when multiple peers are downloading this chunk (e.g. in endgame mode), do not
+		// give requests to peers which will answer them much later then the fastest one
+		Uint32 latency = pd->expectedLatency();
+		if (latency > 0 && pdown.count() > 1)
+		{
+			foreach (PieceDownloader* other,pdown)
+			{
+				Uint32 l = other->expectedLatency();
+				if (other != pd && l > 0 && latency > 4 * l + 1000 && !other->isChoked() && other->canAddRequest())
+					return false;
+			}
+		}
+		
 		// get the best piece to download
 		Uint32 bp = bestPiece(pd);
 		if (bp >= total_pieces_number)
@@ -161,7 +161,7 @@ namespace bt
 				itr++;
 				chunks.erase(tmp);
 			}
-			else if (pd->hasChunk(i))
+			else if (pd->hasChunk(i) && cman->isChunkAllocated(i))
 			{
 				// pd has to have the selected chunk and it needs to be not excluded
 				if (!downer->isChunkDownloading(i))
@@ -317,6 +317,10 @@ namespace bt
 		Uint32 chunk_index = 0;
 		if (chunk_selector->select(pd,chunk_index))
 		{
+			// wait until the diskspace for the chunk has been preallocated
+			if (!cman.isChunkAllocated(chunk_index))
+				return false;
+			
 			bool b = assignPieceDownloaderToChunk(pd, chunk_index);
 			Out(SYS_DIO|LOG_DEBUG) << "\tDownloader::downloadFrom: Chunk " << chunk_index << " was selected. Assigned to PeerDownloader: " << b << endl;
 			return b;
@@ -222,14 +222,14 @@ namespace bt
 				status = i18n("Connected");
 				state = ACTIVE;
 				net::SocketMonitor::instance().add(sock);
-				net::SocketMonitor::instance().signalPacketReady();
+				net::SocketMonitor::instance().signalPacketReady(sock);
 			}
 			else if (sock->socketDevice()->state() == net::SocketDevice::CONNECTING)
 			{
 				status = i18n("Connecting");
 				state = CONNECTING;
 				net::SocketMonitor::instance().add(sock);
-				net::SocketMonitor::instance().signalPacketReady();
+				net::SocketMonitor::instance().signalPacketReady(sock);
 				// 60 second connect timeout
 				connect_timer.start(60000);
 			}
@@ -470,7 +470,10 @@ namespace bt {
 		
 		for (QList<PieceDownloader*>::iterator peer = peers_sorted.begin(); peer != peers_sorted.end(); )
 		{
-			if ((*peer)->hasChunk(chunk.getIndex()))
+			// peers which cannot deliver before the chunk is needed are of no use
+			Uint32 latency = (*peer)->expectedLatency();
+			bool in_time = time_until_chunk_required == 0 || latency == 0 || latency < chunk.getTimeUntilRequired();
+			if ((*peer)->hasChunk(chunk.getIndex()) && in_time)
 			{
 				downloader->stopAndReassignPieceDownloader((*peer), chunk.getIndex());
 				actual_peer_download_rate = qMin<Uint64>((*peer)->getDownloadRate(), (*peer)->getAverageDownloadRate());
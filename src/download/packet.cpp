@@ -19,7 +19,10 @@
  ***************************************************************************/
 #include "packet.h"
 #include <qstring.h>
+#include <qatomic.h>
 #include <string.h>
+#include <errno.h>
+#include <unistd.h>
 #include <net/socketdevice.h>
 #include <util/log.h>
 #include <util/bitset.h>
@@ -30,23 +33,44 @@
 
 namespace bt
 {
+	// length, type, index and begin of a piece packet
+	const Uint32 PIECE_HEADER_SIZE = 13;
+	
+	// file backed packets each keep a file descriptor open, so limit them
+	const int MAX_FILE_BACKED_PACKETS = 256;
+	static QAtomicInt num_file_backed(0);
+
+	// messages without payload (choke, unchoke, interested, ...) are the same for everybody
+	static const Uint8 preencoded_messages[16][5] = 
+	{
+		{0,0,0,1,0},{0,0,0,1,1},{0,0,0,1,2},{0,0,0,1,3},
+		{0,0,0,1,4},{0,0,0,1,5},{0,0,0,1,6},{0,0,0,1,7},
+		{0,0,0,1,8},{0,0,0,1,9},{0,0,0,1,10},{0,0,0,1,11},
+		{0,0,0,1,12},{0,0,0,1,13},{0,0,0,1,14},{0,0,0,1,15}
+	};
 
 	static Uint8* AllocPacket(Uint32 size,Uint8 type)
 	{
-		Uint8* data = new Uint8[size];
+		Uint8* data = (Uint8*)PacketArena::allocate(size);
 		WriteUint32(data,0,size - 4);
 		data[4] = type;
 		return data;
 	}
 
 
-	Packet::Packet(Uint8 type) : type(type),data(0),size(0),written(0)
+	Packet::Packet(Uint8 type) : type(type),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 5;
-		data = AllocPacket(size,type);
+		if (type < 16)
+		{
+			data = (Uint8*)preencoded_messages[type];
+			shared_data = true;
+		}
+		else
+			data = AllocPacket(size,type);
 	}
 	
-	Packet::Packet(Uint16 port) : type(PORT),data(0),size(0),written(0)
+	Packet::Packet(Uint16 port) : type(PORT),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 7;
 		data = AllocPacket(size,PORT);
@@ -54,21 +78,21 @@ namespace bt
 		
 	}
 	
-	Packet::Packet(Uint32 chunk,Uint8 type) : type(type),data(0),size(0),written(0)
+	Packet::Packet(Uint32 chunk,Uint8 type) : type(type),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 9;
 		data = AllocPacket(size,type);
 		WriteUint32(data,5,chunk);
 	}
 	
-	Packet::Packet(const BitSet & bs) : type(BITFIELD),data(0),size(0),written(0)
+	Packet::Packet(const BitSet & bs) : type(BITFIELD),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 5 + bs.getNumBytes();
 		data = AllocPacket(size,BITFIELD);
 		memcpy(data+5,bs.getData(),bs.getNumBytes());
 	}
 	
-	Packet::Packet(const Request & r,Uint8 type) : type(type),data(0),size(0),written(0)
+	Packet::Packet(const Request & r,Uint8 type) : type(type),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 17;
 		data = AllocPacket(size,type);
@@ -77,7 +101,7 @@ namespace bt
 		WriteUint32(data,13,r.getLength());
 	}
 	
-	Packet::Packet(Uint32 index,Uint32 begin,Uint32 len,Chunk* ch) : type(PIECE),data(0),size(0),written(0)
+	Packet::Packet(Uint32 index,Uint32 begin,Uint32 len,Chunk* ch) : type(PIECE),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 13 + len;
 		data = AllocPacket(size,PIECE);
@@ -86,7 +110,19 @@ namespace bt
 		ch->readPiece(begin,len,data + 13);
 	}
 
-	Packet::Packet(Uint8 ext_id,const QByteArray & ext_data) :  type(EXTENDED),data(0),size(0),written(0)
+	Packet::Packet(Uint32 index,Uint32 begin,Uint32 len,int file_fd,Uint64 file_off) 
+		: type(PIECE),data(0),size(0),written(0),file_fd(file_fd),file_off(file_off),shared_data(false)
+	{
+		size = 13 + len;
+		data = AllocPacket(PIECE_HEADER_SIZE,PIECE);
+		WriteUint32(data,0,size - 4);
+		WriteUint32(data,5,index);
+		WriteUint32(data,9,begin);
+		if (file_fd >= 0)
+			num_file_backed.ref();
+	}
+
+	Packet::Packet(Uint8 ext_id,const QByteArray & ext_data) :  type(EXTENDED),data(0),size(0),written(0),file_fd(-1),file_off(0),shared_data(false)
 	{
 		size = 6 + ext_data.size();
 		data = AllocPacket(size,EXTENDED);
@@ -96,7 +132,38 @@ namespace bt
 
 	Packet::~Packet()
 	{
-		delete [] data;
+		freeData();
+		if (file_fd >= 0)
+		{
+			::close(file_fd);
+			num_file_backed.deref();
+		}
+	}
+	
+	void Packet::freeData()
+	{
+		if (!shared_data)
+			PacketArena::free(data);
+		data = 0;
+		shared_data = false;
+	}
+	
+	Uint8* Packet::getData()
+	{
+		if (shared_data)
+		{
+			// somebody wants to modify it (e.g. encryption), so make a private copy
+			Uint8* buf = (Uint8*)PacketArena::allocate(size);
+			memcpy(buf,data,size);
+			data = buf;
+			shared_data = false;
+		}
+		return data;
+	}
+	
+	bool Packet::fileBackedAllowed()
+	{
+		return (int)num_file_backed < MAX_FILE_BACKED_PACKETS;
 	}
 	
 	bool Packet::isPiece(const Request & req) const
@@ -159,12 +226,69 @@ namespace bt
 		return true;
 	}
 
+	bool Packet::readFileData()
+	{
+		if (file_fd < 0)
+			return true;
+		
+		Uint8* buf = (Uint8*)PacketArena::allocate(size);
+		memcpy(buf,data,PIECE_HEADER_SIZE);
+		Uint32 len = size - PIECE_HEADER_SIZE;
+		Uint32 done = 0;
+		while (done < len)
+		{
+			ssize_t ret = pread(file_fd,buf + PIECE_HEADER_SIZE + done,len - done,file_off + done);
+			if (ret <= 0)
+			{
+				Out(SYS_CON|LOG_NOTICE) << "Failed to read piece data: " << QString(strerror(errno)) << endl;
+				PacketArena::free(buf);
+				return false;
+			}
+			done += ret;
+		}
+		
+		freeData();
+		data = buf;
+		::close(file_fd);
+		file_fd = -1;
+		num_file_backed.deref();
+		return true;
+	}
+	
+	int Packet::sendFromFile(net::SocketDevice* sock, Uint32 max_to_send)
+	{
+		Uint32 bw = size - written;
+		if (bw > max_to_send && max_to_send > 0)
+			bw = max_to_send;
+		
+		Uint32 header = written < PIECE_HEADER_SIZE ? qMin(PIECE_HEADER_SIZE - written,bw) : 0;
+		Uint32 payload = bw - header;
+		Uint64 off = file_off + (written > PIECE_HEADER_SIZE ? written - PIECE_HEADER_SIZE : 0);
+		int ret = sock->sendFile(data + (header > 0 ? written : 0),header,file_fd,off,payload);
+		if (ret < 0)
+		{
+			// sending from the file is not possible, so do it the old way
+			if (!readFileData())
+			{
+				sock->close();
+				return 0;
+			}
+			return send(sock,max_to_send);
+		}
+		
+		written += ret;
+		return ret;
+	}
+	
 	int Packet::send(net::SocketDevice* sock, Uint32 max_to_send)
 	{
 		Uint32 bw = size - written;
 		if (!bw) // nothing to write
 			return 0;
 		
+		if (file_fd >= 0)
+			return sendFromFile(sock,max_to_send);
+		
 		if (bw > max_to_send && max_to_send > 0)
 			bw = max_to_send;
 		int ret = sock->send(data + written, bw);
@@ -20,8 +20,9 @@
 #ifndef BTPACKET_H
 #define BTPACKET_H
 
-#include <QSharedPointer>
+#include <QAtomicInt>
 #include <util/constants.h>
+#include <download/packetarena.h>
 
 namespace net {
 class SocketDevice;
@@ -49,6 +50,12 @@ namespace bt
 		Packet(const BitSet & bs);
 		Packet(const Request & req,Uint8 type);
 		Packet(Uint32 index,Uint32 begin,Uint32 len,Chunk* ch);
+		
+		/**
+		 * Piece packet which only holds the header, the data will be sent straight
+		 * from the file (see net::SocketDevice::sendFile). Takes ownership of the file descriptor.
+		 */
+		Packet(Uint32 index,Uint32 begin,Uint32 len,int file_fd,Uint64 file_off);
 		Packet(Uint8 ext_id,const QByteArray & ext_data); // extension protocol packet
 		virtual ~Packet();
 
@@ -58,7 +65,9 @@ namespace bt
 		bool isOK() const;
 		
 		const Uint8* getData() const {return data;}
-		Uint8* getData() {return data;}
+		
+		/// Get the data for modification, packets without payload share their data, so this makes a private copy first
+		Uint8* getData();
 		Uint32 getDataLength() const {return size;}
 
 		/// Is the packet sent ?
@@ -73,6 +82,28 @@ namespace bt
 		/// Are we sending this packet ?
 		bool sending() const {return written > 0;}
 		
+		/// Get the part of the packet which has not been sent yet (not for file backed packets)
+		const Uint8* unsentData() const {return data + written;}
+		
+		/// Get the number of bytes which have not been sent yet
+		Uint32 unsentLength() const {return size - written;}
+		
+		/// Mark bytes as sent, when unsentData was sent by somebody else (e.g. a vectored send)
+		void markSent(Uint32 bytes) {written += bytes;}
+		
+		/// Is the data of this piece packet still in a file (getData only returns the header)
+		bool isFileBacked() const {return file_fd >= 0;}
+		
+		/**
+		 * Read the data of a file backed piece packet into memory, after
+		 * this the packet is a normal packet.
+		 * @return false if the data cannot be read
+		 */
+		bool readFileData();
+		
+		/// Check if another file backed packet can be created, each one keeps a file descriptor open
+		static bool fileBackedAllowed();
+		
 		/**
 		 * Is this a piece packet which matches a request
 		 * @param req The request
@@ -88,13 +119,31 @@ namespace bt
 		 **/
 		int send(net::SocketDevice* sock, Uint32 max_to_send);
 		
-		typedef QSharedPointer<Packet> Ptr;
+		typedef IntrusivePtr<Packet> Ptr;
+		
+		/// Increase the reference count (see IntrusivePtr)
+		void ref() {ref_count.ref();}
+		
+		/// Decrease the reference count, returns false if it dropped to 0 (see IntrusivePtr)
+		bool deref() {return ref_count.deref();}
+		
+		// packets are allocated from the PacketArena
+		static void* operator new(size_t size) {return PacketArena::allocate(size);}
+		static void operator delete(void* ptr) {PacketArena::free(ptr);}
+		
+	private:
+		int sendFromFile(net::SocketDevice* sock,Uint32 max_to_send);
+		void freeData();
 		
 	private:
 		Uint8 type;
 		Uint8* data;
 		Uint32 size;
 		Uint32 written;
+		int file_fd;
+		Uint64 file_off;
+		bool shared_data; // data points to a preencoded message
+		QAtomicInt ref_count;
 	};
 
 }
@@ -0,0 +1,282 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "packetarena.h"
+#include <stdlib.h>
+#include <new>
+#include <QList>
+#include <QMutex>
+#include <QMutexLocker>
+#include <QThreadStorage>
+
+namespace bt
+{
+	// sizes of the blocks, piece packets have a class of their own
+	static const Uint32 size_classes[] = {32, 64, 128, 256, 512, 1024, 4096, 16 * 1024 + 32, 32 * 1024 + 32};
+	static const Uint32 NUM_SIZE_CLASSES = sizeof(size_classes) / sizeof(Uint32);
+	
+	// memory a thread cache and the shared list may keep per size class
+	static const Uint32 MAX_THREAD_CACHE_SIZE = 1024 * 1024;
+	static const Uint32 MAX_SHARED_SIZE = 4 * 1024 * 1024;
+	
+	/// Header in front of every block
+	union BlockHeader
+	{
+		Uint32 size_class;
+		double align[2];
+	};
+	
+	/// Free blocks are linked together through their memory
+	struct FreeBlock
+	{
+		FreeBlock* next;
+	};
+	
+	struct FreeList
+	{
+		FreeBlock* head;
+		Uint32 count;
+		
+		FreeList() : head(0),count(0) {}
+		
+		void push(FreeBlock* b)
+		{
+			b->next = head;
+			head = b;
+			count++;
+		}
+		
+		FreeBlock* pop()
+		{
+			FreeBlock* b = head;
+			if (b)
+			{
+				head = b->next;
+				count--;
+			}
+			return b;
+		}
+	};
+	
+	static Uint32 SizeClass(size_t size)
+	{
+		for (Uint32 i = 0;i < NUM_SIZE_CLASSES;i++)
+			if (size <= size_classes[i])
+				return i;
+		
+		return NUM_SIZE_CLASSES;
+	}
+	
+	static Uint32 MaxBlocks(Uint32 size_class,Uint32 max_size)
+	{
+		Uint32 n = max_size / size_classes[size_class];
+		return n < 16 ? 16 : n;
+	}
+	
+	static FreeBlock* SystemAllocate(Uint32 size_class,Uint32 size)
+	{
+		BlockHeader* hdr = (BlockHeader*)malloc(sizeof(BlockHeader) + size);
+		if (!hdr)
+			throw std::bad_alloc();
+		
+		hdr->size_class = size_class;
+		return (FreeBlock*)(hdr + 1);
+	}
+	
+	static void SystemFree(FreeBlock* b)
+	{
+		::free((BlockHeader*)b - 1);
+	}
+	
+	class ThreadCache;
+	
+	/// State shared by all threads
+	struct SharedState
+	{
+		QMutex mutex;
+		FreeList lists[NUM_SIZE_CLASSES];
+		QList<ThreadCache*> caches;
+		Uint64 retired_allocations;
+		Uint64 retired_system_allocations;
+		QThreadStorage<ThreadCache*> thread_caches;
+		
+		SharedState() : retired_allocations(0),retired_system_allocations(0) {}
+	};
+	
+	// never deleted, threads can still exit when static objects are being destroyed
+	static SharedState* Shared()
+	{
+		static SharedState* state = new SharedState();
+		return state;
+	}
+	
+	/// Free blocks of one thread
+	class ThreadCache
+	{
+	public:
+		ThreadCache() : allocations(0),system_allocations(0)
+		{
+			SharedState* s = Shared();
+			QMutexLocker lock(&s->mutex);
+			s->caches.append(this);
+		}
+		
+		~ThreadCache()
+		{
+			SharedState* s = Shared();
+			QMutexLocker lock(&s->mutex);
+			for (Uint32 i = 0;i < NUM_SIZE_CLASSES;i++)
+			{
+				while (FreeBlock* b = lists[i].pop())
+				{
+					if (s->lists[i].count < MaxBlocks(i,MAX_SHARED_SIZE))
+						s->lists[i].push(b);
+					else
+						SystemFree(b);
+				}
+			}
+			
+			s->caches.removeAll(this);
+			s->retired_allocations += allocations;
+			s->retired_system_allocations += system_allocations;
+		}
+		
+		void* allocate(Uint32 size_class)
+		{
+			allocations++;
+			FreeList & fl = lists[size_class];
+			if (!fl.head)
+			{
+				// get half a cache worth of blocks from the shared list
+				SharedState* s = Shared();
+				Uint32 batch = MaxBlocks(size_class,MAX_THREAD_CACHE_SIZE) / 2;
+				QMutexLocker lock(&s->mutex);
+				FreeList & sfl = s->lists[size_class];
+				while (fl.count < batch && sfl.head)
+					fl.push(sfl.pop());
+			}
+			
+			FreeBlock* b = fl.pop();
+			if (!b)
+			{
+				system_allocations++;
+				b = SystemAllocate(size_class,size_classes[size_class]);
+			}
+			return b;
+		}
+		
+		void free(FreeBlock* b,Uint32 size_class)
+		{
+			FreeList & fl = lists[size_class];
+			fl.push(b);
+			
+			Uint32 max = MaxBlocks(size_class,MAX_THREAD_CACHE_SIZE);
+			if (fl.count > max)
+			{
+				// too many, hand half of them over to the other threads
+				SharedState* s = Shared();
+				QMutexLocker lock(&s->mutex);
+				FreeList & sfl = s->lists[size_class];
+				Uint32 max_shared = MaxBlocks(size_class,MAX_SHARED_SIZE);
+				while (fl.count > max / 2)
+				{
+					FreeBlock* f = fl.pop();
+					if (sfl.count < max_shared)
+						sfl.push(f);
+					else
+						SystemFree(f);
+				}
+			}
+		}
+		
+		static ThreadCache* current()
+		{
+			QThreadStorage<ThreadCache*> & tc = Shared()->thread_caches;
+			if (!tc.hasLocalData())
+				tc.setLocalData(new ThreadCache());
+			return tc.localData();
+		}
+		
+	public:
+		FreeList lists[NUM_SIZE_CLASSES];
+		Uint64 allocations;
+		Uint64 system_allocations;
+	};
+	
+	
+	void* PacketArena::allocate(size_t size)
+	{
+		Uint32 size_class = SizeClass(size);
+		if (size_class == NUM_SIZE_CLASSES)
+		{
+			ThreadCache* tc = ThreadCache::current();
+			tc->allocations++;
+			tc->system_allocations++;
+			return SystemAllocate(size_class,size);
+		}
+		
+		return ThreadCache::current()->allocate(size_class);
+	}
+	
+	void PacketArena::free(void* ptr)
+	{
+		if (!ptr)
+			return;
+		
+		FreeBlock* b = (FreeBlock*)ptr;
+		Uint32 size_class = ((BlockHeader*)b - 1)->size_class;
+		if (size_class == NUM_SIZE_CLASSES)
+			SystemFree(b);
+		else
+			ThreadCache::current()->free(b,size_class);
+	}
+	
+	Uint64 PacketArena::numAllocations()
+	{
+		SharedState* s = Shared();
+		QMutexLocker lock(&s->mutex);
+		Uint64 ret = s->retired_allocations;
+		foreach (ThreadCache* tc,s->caches)
+			ret += tc->allocations;
+		return ret;
+	}
+	
+	Uint64 PacketArena::numSystemAllocations()
+	{
+		SharedState* s = Shared();
+		QMutexLocker lock(&s->mutex);
+		Uint64 ret = s->retired_system_allocations;
+		foreach (ThreadCache* tc,s->caches)
+			ret += tc->system_allocations;
+		return ret;
+	}
+	
+	void PacketArena::clear()
+	{
+		SharedState* s = Shared();
+		QMutexLocker lock(&s->mutex);
+		for (Uint32 i = 0;i < NUM_SIZE_CLASSES;i++)
+		{
+			while (FreeBlock* b = s->lists[i].pop())
+				SystemFree(b);
+		}
+	}
+
+}
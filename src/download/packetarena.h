@@ -0,0 +1,120 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef BT_PACKETARENA_H
+#define BT_PACKETARENA_H
+
+#include <stddef.h>
+#include <ktorrent_export.h>
+#include <util/constants.h>
+
+namespace bt
+{
+
+	/**
+	 * Recycles the memory of outgoing packets and their data. Memory is divided into
+	 * size classes, each thread keeps a small cache of free blocks per class, so most
+	 * allocations and frees do not need a lock. Threads which free more then they allocate
+	 * (the network threads) hand their surplus over to a shared list, where the
+	 * threads which create packets pick it up again.
+	 *
+	 * Blocks bigger then the largest size class are allocated and freed normally.
+	 */
+	class KTORRENT_EXPORT PacketArena
+	{
+	public:
+		/**
+		 * Allocate a block of memory.
+		 * @param size The size of the block
+		 * @return The block
+		 */
+		static void* allocate(size_t size);
+		
+		/**
+		 * Free a block allocated with allocate.
+		 * @param ptr The block (may be 0)
+		 */
+		static void free(void* ptr);
+		
+		/// Number of blocks handed out since the start
+		static Uint64 numAllocations();
+		
+		/// Number of blocks which had to be allocated from the system since the start
+		static Uint64 numSystemAllocations();
+		
+		/// Release all unused memory in the shared lists
+		static void clear();
+	};
+	
+	/**
+	 * Smart pointer for objects with an intrusive reference count. The object must
+	 * have a ref function, and a deref function which returns false when the count drops to 0.
+	 */
+	template<class T>
+	class IntrusivePtr
+	{
+	public:
+		IntrusivePtr() : ptr(0) {}
+		
+		explicit IntrusivePtr(T* p) : ptr(p)
+		{
+			if (ptr)
+				ptr->ref();
+		}
+		
+		IntrusivePtr(const IntrusivePtr<T> & other) : ptr(other.ptr)
+		{
+			if (ptr)
+				ptr->ref();
+		}
+		
+		~IntrusivePtr()
+		{
+			if (ptr && !ptr->deref())
+				delete ptr;
+		}
+		
+		IntrusivePtr<T> & operator = (const IntrusivePtr<T> & other)
+		{
+			if (other.ptr)
+				other.ptr->ref();
+			
+			T* old = ptr;
+			ptr = other.ptr;
+			if (old && !old->deref())
+				delete old;
+			return *this;
+		}
+		
+		T* data() const {return ptr;}
+		T* operator -> () const {return ptr;}
+		T & operator * () const {return *ptr;}
+		bool operator ! () const {return ptr == 0;}
+		operator bool () const {return ptr != 0;}
+		bool operator == (const IntrusivePtr<T> & other) const {return ptr == other.ptr;}
+		bool operator != (const IntrusivePtr<T> & other) const {return ptr != other.ptr;}
+		
+	private:
+		T* ptr;
+	};
+
+}
+
+#endif // BT_PACKETARENA_H
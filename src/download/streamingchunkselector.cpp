@@ -56,6 +56,9 @@ namespace bt
 			
 		manager_of_stream = new ManagerOfStream(this, downer);
 		manager_of_stream->Init();
+		
+		// the stream is read from front to back, so let the kernel read ahead
+		cman->setAccessPattern(ADVICE_SEQUENTIAL);
 	}
 
 	
@@ -66,6 +69,7 @@ namespace bt
 		{
 			cursor = chunk;
 			updateRange();
+			prefetchCriticalWindow();
 			emit anotherChunkAsked(cursor);
 		}
 	}
@@ -76,6 +80,17 @@ namespace bt
 		range_end = to;
 		cursor = from;
 		initRange();
+		prefetchCriticalWindow();
+	}
+	
+	void StreamingChunkSelector::prefetchCriticalWindow()
+	{
+		// Start reading the chunks the player is going to need next
+		Uint32 last = cursor + critical_window_size - 1;
+		if (last > range_end)
+			last = range_end;
+		
+		cman->adviseChunks(cursor, last, ADVICE_WILLNEED);
 	}
 	
 	void StreamingChunkSelector::initRange()
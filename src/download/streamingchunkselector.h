@@ -71,6 +71,7 @@ namespace bt
 	private:
 		void updateRange();
 		void initRange();
+		void prefetchCriticalWindow();
 		bool selectFromPreview(bt::PieceDownloader* pd, bt::Uint32& chunk);
 		
 	signals:
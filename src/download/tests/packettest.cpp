@@ -0,0 +1,377 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <sys/time.h>
+#include <sys/resource.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <QtTest>
+#include <QThread>
+#include <QMutex>
+#include <QWaitCondition>
+#include <KTempDir>
+#include <util/log.h>
+#include <util/functions.h>
+#include <util/fileops.h>
+#include <net/socket.h>
+#include <download/packet.h>
+#include <download/request.h>
+
+using namespace bt;
+
+const Uint32 PIECE_SIZE = 16 * 1024;
+const Uint32 TEST_FILE_SIZE = 16 * 1024 * 1024;
+
+/// Reads everything from a socket until it is closed
+class Drain : public QThread
+{
+public:
+	Drain(int fd) : sock(fd,4),received(0)
+	{
+		sock.setBlocking(true);
+	}
+	
+	virtual void run()
+	{
+		Uint8 buf[64 * 1024];
+		int ret = 0;
+		while ((ret = sock.recv(buf,sizeof(buf))) > 0)
+			received += ret;
+	}
+	
+	net::Socket sock;
+	Uint64 received;
+};
+
+/// CPU time used by the calling thread in microseconds
+static Uint64 ThreadCPUTime()
+{
+	struct rusage ru;
+#ifdef RUSAGE_THREAD
+	getrusage(RUSAGE_THREAD,&ru);
+#else
+	getrusage(RUSAGE_SELF,&ru);
+#endif
+	return (Uint64)(ru.ru_utime.tv_sec + ru.ru_stime.tv_sec) * 1000000 + ru.ru_utime.tv_usec + ru.ru_stime.tv_usec;
+}
+
+/// Frees packets in another thread, like the upload thread does after sending them
+class Sender : public QThread
+{
+public:
+	Sender() : stopped(false),freed(0)
+	{
+	}
+	
+	void queue(QList<Packet::Ptr> & packets)
+	{
+		QMutexLocker lock(&mutex);
+		pending += packets;
+		packets.clear();
+		cond.wakeOne();
+	}
+	
+	void stop()
+	{
+		QMutexLocker lock(&mutex);
+		stopped = true;
+		cond.wakeOne();
+	}
+	
+	virtual void run()
+	{
+		QList<Packet::Ptr> packets;
+		while (true)
+		{
+			{
+				QMutexLocker lock(&mutex);
+				while (pending.isEmpty() && !stopped)
+					cond.wait(&mutex);
+				
+				if (pending.isEmpty())
+					break;
+				
+				packets.swap(pending);
+			}
+			
+			freed += packets.size();
+			packets.clear();
+		}
+	}
+	
+	QMutex mutex;
+	QWaitCondition cond;
+	QList<Packet::Ptr> pending;
+	bool stopped;
+	Uint64 freed;
+};
+
+/// Wall clock time in microseconds
+static Uint64 WallTime()
+{
+	struct timeval tv;
+	gettimeofday(&tv,0);
+	return (Uint64)tv.tv_sec * 1000000 + tv.tv_usec;
+}
+
+class PacketTest : public QObject
+{
+	Q_OBJECT
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("packettest.log");
+		path = tmpdir.name() + "data";
+		
+		QFile f(path);
+		QVERIFY(f.open(QIODevice::WriteOnly));
+		QByteArray block(PIECE_SIZE,0);
+		for (Uint32 i = 0;i < TEST_FILE_SIZE / PIECE_SIZE;i++)
+		{
+			for (Uint32 j = 0;j < PIECE_SIZE;j++)
+				block[j] = (char)(i + j);
+			f.write(block);
+		}
+		f.close();
+	}
+	
+	void cleanupTestCase()
+	{
+	}
+	
+	void testFileBackedPiece()
+	{
+		int fd = ::open(QFile::encodeName(path),O_RDONLY);
+		QVERIFY(fd >= 0);
+		
+		Packet p(3,PIECE_SIZE,PIECE_SIZE,fd,4 * PIECE_SIZE);
+		QVERIFY(p.isFileBacked());
+		QVERIFY(p.getDataLength() == PIECE_SIZE + 13);
+		QVERIFY(ReadUint32(p.getData(),0) == PIECE_SIZE + 9);
+		QVERIFY(p.getData()[4] == PIECE);
+		QVERIFY(ReadUint32(p.getData(),5) == 3);
+		QVERIFY(ReadUint32(p.getData(),9) == PIECE_SIZE);
+		
+		QVERIFY(p.readFileData());
+		QVERIFY(!p.isFileBacked());
+		QVERIFY(p.getData()[13] == (char)4);
+		QVERIFY(p.getData()[14] == (char)5);
+	}
+	
+	void testSend()
+	{
+		net::Socket server(true,4);
+		QVERIFY(server.bind("127.0.0.1",0,true));
+		net::Socket client(true,4);
+		client.setBlocking(true);
+		QVERIFY(client.connectTo(server.getSockName()));
+		net::Address dummy;
+		net::Socket reader(server.accept(dummy),4);
+		reader.setBlocking(true);
+		
+		int fd = ::open(QFile::encodeName(path),O_RDONLY);
+		QVERIFY(fd >= 0);
+		Packet p(0,0,PIECE_SIZE,fd,PIECE_SIZE);
+		// send in small bits, so the header is split up
+		while (!p.isSent())
+			QVERIFY(p.send(&client,5) > 0);
+		
+		Uint8 buf[PIECE_SIZE + 13];
+		Uint32 received = 0;
+		while (received < sizeof(buf))
+		{
+			int ret = reader.recv(buf + received,sizeof(buf) - received);
+			QVERIFY(ret > 0);
+			received += ret;
+		}
+		
+		QVERIFY(ReadUint32(buf,0) == PIECE_SIZE + 9);
+		for (Uint32 j = 0;j < PIECE_SIZE;j++)
+			QVERIFY(buf[13 + j] == (Uint8)(1 + j));
+	}
+	
+	void testPreencoded()
+	{
+		Packet::Ptr a(new Packet(UNCHOKE));
+		Packet::Ptr b(new Packet(UNCHOKE));
+		const Packet* ca = a.data();
+		const Packet* cb = b.data();
+		QVERIFY(ca->getData() == cb->getData());
+		QVERIFY(ca->getDataLength() == 5);
+		QVERIFY(ReadUint32(ca->getData(),0) == 1);
+		QVERIFY(ca->getData()[4] == UNCHOKE);
+		
+		// modifying one of them must not change the other
+		a->getData()[4] = 0xFF;
+		QVERIFY(ca->getData() != cb->getData());
+		QVERIFY(cb->getData()[4] == UNCHOKE);
+	}
+	
+	void testIntrusivePtr()
+	{
+		Packet::Ptr a(new Packet(Uint32(5),HAVE));
+		Packet::Ptr b = a;
+		QVERIFY(a == b);
+		a = Packet::Ptr();
+		QVERIFY(!a);
+		QVERIFY(b);
+		QVERIFY(ReadUint32(b->getData(),5) == 5);
+	}
+	
+	void testArenaRecycling()
+	{
+		for (int round = 0;round < 2;round++)
+		{
+			Uint64 before = PacketArena::numSystemAllocations();
+			QList<Packet::Ptr> packets;
+			for (Uint32 i = 0;i < 1000;i++)
+			{
+				packets.append(Packet::Ptr(new Packet(i,HAVE)));
+				packets.append(Packet::Ptr(new Packet(Request(i,0,PIECE_SIZE,0),REQUEST)));
+			}
+			packets.clear();
+			
+			// the second time everything should come out of the thread cache
+			if (round == 1)
+				QVERIFY(PacketArena::numSystemAllocations() == before);
+		}
+	}
+	
+	void testSwarm()
+	{
+		// simulate a swarm of 500 peers, the main thread creates packets and the upload thread frees them
+		const Uint32 num_peers = 500;
+		const Uint32 num_rounds = 200;
+		QByteArray piece_data(PIECE_SIZE,0);
+		
+		Sender sender;
+		sender.start();
+		
+		Uint64 allocations = PacketArena::numAllocations();
+		Uint64 system_allocations = PacketArena::numSystemAllocations();
+		Uint64 num_packets = 0;
+		Uint64 worst = 0;
+		QList<Packet::Ptr> packets;
+		TimeStamp start = bt::Now();
+		for (Uint32 round = 0;round < num_rounds;round++)
+		{
+			for (Uint32 peer = 0;peer < num_peers;peer++)
+			{
+				Uint64 t = WallTime();
+				// we got a chunk, tell everybody
+				packets.append(Packet::Ptr(new Packet(round,HAVE)));
+				if (peer % 4 == 0)
+				{
+					packets.append(Packet::Ptr(new Packet(INTERESTED)));
+					for (Uint32 i = 0;i < 4;i++)
+						packets.append(Packet::Ptr(new Packet(Request(round,i * PIECE_SIZE,PIECE_SIZE,0),REQUEST)));
+				}
+				
+				if (peer % 10 == 0)
+				{
+					packets.append(Packet::Ptr(new Packet(UNCHOKE)));
+					packets.append(Packet::Ptr(new Packet(1,piece_data)));
+				}
+				
+				t = WallTime() - t;
+				if (t > worst)
+					worst = t;
+			}
+			
+			num_packets += packets.size();
+			sender.queue(packets);
+		}
+		
+		sender.stop();
+		sender.wait();
+		TimeStamp duration = bt::Now() - start;
+		QVERIFY(sender.freed == num_packets);
+		
+		allocations = PacketArena::numAllocations() - allocations;
+		system_allocations = PacketArena::numSystemAllocations() - system_allocations;
+		Out(SYS_GEN|LOG_DEBUG) << "Swarm of " << num_peers << " peers: " << num_packets << " packets in " << duration << " ms, "
+			<< allocations << " arena allocations, " << system_allocations << " system allocations" << endl;
+		if (duration > 0)
+			Out(SYS_GEN|LOG_DEBUG) << "Allocations per second: " << allocations * 1000 / duration 
+				<< ", average latency per packet: " << duration * 1000000 / num_packets << " ns, worst per peer: " << worst << " us" << endl;
+	}
+	
+	void testCPUUsage()
+	{
+		Uint64 zero_copy = upload(true);
+		Uint64 copy = upload(false);
+		Out(SYS_GEN|LOG_DEBUG) << "CPU time per Gbit uploaded: sendfile " << zero_copy << " us, copy " << copy << " us" << endl;
+	}
+	
+private:
+	/// Upload the test file a number of times, and return the CPU time used per Gbit
+	Uint64 upload(bool zero_copy)
+	{
+		net::Socket server(true,4);
+		if (!server.bind("127.0.0.1",0,true))
+			return 0;
+		
+		net::Socket client(true,4);
+		client.setBlocking(true);
+		if (!client.connectTo(server.getSockName()))
+			return 0;
+		
+		net::Address dummy;
+		Drain drain(server.accept(dummy));
+		drain.start();
+		
+		const Uint32 rounds = 8;
+		Uint64 start = ThreadCPUTime();
+		Uint64 sent = 0;
+		for (Uint32 r = 0;r < rounds;r++)
+		{
+			for (Uint32 i = 0;i < TEST_FILE_SIZE / PIECE_SIZE;i++)
+			{
+				Packet p(i,0,PIECE_SIZE,::open(QFile::encodeName(path),O_RDONLY),(Uint64)i * PIECE_SIZE);
+				if (!zero_copy)
+					p.readFileData();
+				
+				while (!p.isSent())
+				{
+					int ret = p.send(&client,0);
+					if (ret <= 0)
+						break;
+					sent += ret;
+				}
+			}
+		}
+		Uint64 used = ThreadCPUTime() - start;
+		
+		client.close();
+		drain.wait();
+		
+		Uint64 gbits = sent * 8 / 1000000;
+		return gbits > 0 ? used * 1000 / gbits : 0;
+	}
+	
+private:
+	KTempDir tmpdir;
+	QString path;
+};
+
+QTEST_MAIN(PacketTest)
+
+#include "packettest.moc"
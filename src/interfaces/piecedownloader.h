@@ -97,6 +97,13 @@ namespace bt
 		 */
 		virtual bt::Uint32 getDownloadRate(Uint32 chunk_index) const = 0;
 		
+		/**
+		 * Estimate how long it will take before a new request is answered,
+		 * can be overwritten by subclasses.
+		 * @return The time in ms, 0 if unknown
+		 */
+		virtual bt::Uint32 expectedLatency() const {return 0;}
+		
 		/**
 		 * See if the PieceDownloader is choked, can be overwritten by subclasses.
 		 * @return Whether or not the PieceDownloader is choked
@@ -290,7 +290,21 @@ namespace mse
 	void EncryptedPacketSocket::preProcess(Packet::Ptr packet)
 	{
 		if (enc)
+		{
+			// data which is still in a file cannot be encrypted
+			if (packet->isFileBacked() && !packet->readFileData())
+			{
+				sock->close();
+				return;
+			}
 			enc->encryptReplace(packet->getData(), packet->getDataLength());
+		}
+	}
+	
+	bool EncryptedPacketSocket::preProcessIsStateful() const
+	{
+		// the packets are encrypted with a stream cipher
+		return enc != 0;
 	}
 	
 	void EncryptedPacketSocket::postProcess(Uint8* data, Uint32 size)
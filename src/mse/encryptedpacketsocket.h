@@ -147,6 +147,7 @@ namespace mse
 		
 	private:
 		virtual void preProcess(bt::Packet::Ptr packet);
+		virtual bool preProcessIsStateful() const;
 		virtual void postProcess(Uint8* data, Uint32 size);
 		
 	private:
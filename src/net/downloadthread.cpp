@@ -18,12 +18,11 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
  ***************************************************************************/
 #include "downloadthread.h"
-#include <math.h>
 #include <QtGlobal>
 #include <util/functions.h>
 #include <util/log.h>
 #include "socketgroup.h"
-#include "socketmonitor.h"
+#include "socketshard.h"
 #include "trafficshapedsocket.h"
 #include "wakeuppipe.h"
 		
@@ -32,9 +31,9 @@ using namespace bt;
 namespace net
 {
 	Uint32 DownloadThread::dcap = 0;
-	Uint32 DownloadThread::sleep_time = 50;
+	TokenBucket DownloadThread::bucket;
 
-	DownloadThread::DownloadThread(SocketMonitor* sm) : NetworkThread(sm),wake_up(new WakeUpPipe())
+	DownloadThread::DownloadThread(SocketShard* shard) : NetworkThread(shard,Poll::INPUT),wake_up(new WakeUpPipe())
 	{
 	}
 
@@ -47,13 +46,30 @@ namespace net
 	{
 		if (waitForSocketReady() > 0)
 		{
-			bool group_limits = false;
-			sm->lock();
+			shard->lock();
 			
 			TimeStamp now = bt::Now();
 			Uint32 num_ready = 0;
-			SocketMonitor::Itr itr = sm->begin();
-			while (itr != sm->end())
+			bool epoll = backend() == EPOLL_BACKEND;
+			if (epoll)
+			{
+				// only the watched sockets which are ready
+				const std::vector<Uint64> & ready = readyWatches();
+				for (std::vector<Uint64>::const_iterator i = ready.begin();i != ready.end();i++)
+				{
+					TrafficShapedSocket* s = shard->find(*i);
+					if (s && s->socketDevice())
+					{
+						addReadySocket(s);
+						num_ready++;
+					}
+				}
+			}
+			
+			// with epoll, only the sockets which cannot be watched are prepared in every round
+			SocketShard::Itr itr = epoll ? shard->beginUnwatched() : shard->begin();
+			SocketShard::Itr end = epoll ? shard->endUnwatched() : shard->end();
+			while (itr != end)
 			{
 				TrafficShapedSocket* s = *itr;
 				if (!s->socketDevice())
@@ -64,40 +80,45 @@ namespace net
 				
 				if (s->socketDevice()->ready(this,Poll::INPUT))
 				{
-					// add to the correct group
-					Uint32 gid = s->downloadGroupID();
-					if (gid > 0)
-						group_limits = true;
-					
-					SocketGroup* g = groups.find(gid);
-					if (!g)
-						g = groups.find(0);
-						
-					g->add(s);
+					addReadySocket(s);
 					num_ready++;
 				}
 				itr++;
 			}
 			
 			if (num_ready > 0)
-				doGroups(num_ready,now,dcap);
-			sm->unlock();
+				doGroups(num_ready,now,bucket);
 			
-			// to prevent huge CPU usage sleep a bit if we are limited (either by a global limit or a group limit)
-			if (dcap > 0 || group_limits)
-			{
-				TimeStamp diff = now - prev_run_time;
-				if (diff < sleep_time)
-					msleep(sleep_time - diff);
-			}
-			prev_run_time = now;
+			// the watches which fired are disarmed, watch the sockets again if they are allowed to receive
+			if (epoll)
+				watchReadySockets(TokenBucket::now());
+			shard->unlock();
 		}
 	}
 	
 	
-	void DownloadThread::setSleepTime(Uint32 stime)
+	void DownloadThread::addReadySocket(TrafficShapedSocket* s)
 	{
-		sleep_time = stime;
+		// add to the correct group
+		SocketGroup* g = groups.find(s->downloadGroupID());
+		if (!g)
+			g = groups.find(0);
+		
+		g->add(s);
+	}
+	
+	NetworkThread::Interest DownloadThread::interest(TrafficShapedSocket* sock,bt::Uint64 now)
+	{
+		if (!sock->socketDevice() || !sock->socketDevice()->ok())
+			return NOT_INTERESTED;
+		else
+			return canTransfer(sock->downloadGroupID(),bucket,now) ? INTERESTED : LIMITED;
+	}
+	
+	void DownloadThread::setCap(Uint32 cap)
+	{
+		dcap = cap;
+		bucket.setRate(cap);
 	}
 	
 	bool DownloadThread::doGroup(SocketGroup* g,Uint32 & allowance,bt::TimeStamp now)
@@ -107,25 +128,33 @@ namespace net
 	
 	int DownloadThread::waitForSocketReady()
 	{
-		sm->lock();
+		shard->lock();
 		
 		reset();
 		// Add the wake up pipe
 		add(qSharedPointerCast<PollClient>(wake_up));
 	
-		// fill the poll vector with all sockets
-		SocketMonitor::Itr itr = sm->begin();
-		while (itr != sm->end())
+		// fill the poll vector with all sockets which are allowed to receive,
+		// the poll will wake up when the others are allowed again
+		Uint64 now = TokenBucket::now();
+		bool epoll = backend() == EPOLL_BACKEND;
+		if (epoll)
+			watchSockets(now);
+		
+		// with epoll, only the sockets which cannot be watched are prepared in every round
+		SocketShard::Itr itr = epoll ? shard->beginUnwatched() : shard->begin();
+		SocketShard::Itr end = epoll ? shard->endUnwatched() : shard->end();
+		while (itr != end)
 		{
 			TrafficShapedSocket* s = *itr;
-			if (s && s->socketDevice())
+			if (s && s->socketDevice() && canTransfer(s->downloadGroupID(),bucket,now))
 			{
 				s->socketDevice()->prepare(this,Poll::INPUT);
 			}
 			itr++;
 		}
-		sm->unlock();
-		return poll();
+		shard->unlock();
+		return pollSockets();
 	}
 	
 	void DownloadThread::wakeUp()
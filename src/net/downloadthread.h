@@ -35,30 +35,30 @@ namespace net
 	class DownloadThread : public NetworkThread
 	{
 	public:
-		DownloadThread(SocketMonitor* sm);
+		DownloadThread(SocketShard* shard);
 		virtual ~DownloadThread();
 		
 		/// Wake up the download thread
 		void wakeUp();
 	
 		/// Set the download cap
-		static void setCap(bt::Uint32 cap) {dcap = cap;}
+		static void setCap(bt::Uint32 cap);
 		
 		/// Get the download cap
 		static Uint32 cap() {return dcap;}
-		
-		/// Set the sleep time when using download caps
-		static void setSleepTime(bt::Uint32 stime);
+
 	private:	
 		virtual void update();
 		virtual bool doGroup(SocketGroup* g,Uint32 & allowance,bt::TimeStamp now);
+		virtual Interest interest(TrafficShapedSocket* sock,bt::Uint64 now);
+		void addReadySocket(TrafficShapedSocket* s);
 		int waitForSocketReady();
 		
 	private:
 		WakeUpPipe::Ptr wake_up;
 		
 		static bt::Uint32 dcap;
-		static bt::Uint32 sleep_time;
+		static TokenBucket bucket; // shared by the download threads of all shards
 	};
 
 }
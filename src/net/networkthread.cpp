@@ -22,18 +22,21 @@
 #include <util/functions.h>
 #include <util/log.h>
 #include "socketgroup.h"
-#include "socketmonitor.h"
+#include "socketshard.h"
+#include "trafficshapedsocket.h"
 		
 using namespace bt;
 
 namespace net
 {
+	// sockets which are limited, are woken up when this many bytes can be transferred
+	const Uint32 WAKE_UP_AMOUNT = 1500;
 
-	NetworkThread::NetworkThread(SocketMonitor* sm)
-		: sm(sm),running(false)
+	NetworkThread::NetworkThread(SocketShard* shard,Poll::Mode mode)
+		: shard(shard),running(false),wait_time(0),mode(mode),all_changed(false)
 	{
 		groups.setAutoDelete(true);
-		groups.insert(0,new SocketGroup(0,0));
+		groups.insert(0,new SocketGroup(TokenBucket::Ptr(new TokenBucket()),TokenBucket::Ptr(new TokenBucket())));
 	}
 
 
@@ -43,23 +46,21 @@ namespace net
 	void NetworkThread::run()
 	{
 		running = true;
-		prev_run_time = bt::Now();
 		while (running)
 			update();
 	}
 
-	void NetworkThread::addGroup(Uint32 gid,Uint32 limit,Uint32 assured_rate)
+	void NetworkThread::addGroup(Uint32 gid,TokenBucket::Ptr limit,TokenBucket::Ptr assured)
 	{
-		// if group already exists, just change the limit
+		// if group already exists, just change the buckets
 		SocketGroup* g = groups.find(gid);
 		if (g)
 		{
-			g->setLimit(limit);
-			g->setAssuredRate(assured_rate);
+			g->setBuckets(limit,assured);
 		}
 		else
 		{
-			g = new SocketGroup(limit,assured_rate);
+			g = new SocketGroup(limit,assured);
 			groups.insert(gid,g);
 		}
 	}
@@ -70,24 +71,7 @@ namespace net
 		if (gid != 0)
 			groups.erase(gid);
 	}
-		
-	void NetworkThread::setGroupLimit(Uint32 gid,Uint32 limit)
-	{
-		SocketGroup* g = groups.find(gid);
-		if (g)
-		{
-			g->setLimit(limit);
-		}
-	}
-	
-	void NetworkThread::setGroupAssuredRate(Uint32 gid,Uint32 as)
-	{
-		SocketGroup* g = groups.find(gid);
-		if (g)
-		{
-			g->setAssuredRate(as);
-		}
-	}
+
 	
 	Uint32 NetworkThread::doGroupsLimited(Uint32 num_ready,bt::TimeStamp now,Uint32 & allowance)
 	{
@@ -125,8 +109,11 @@ namespace net
 		return num_still_ready > 0;
 	}
 	
-	void NetworkThread::doGroups(Uint32 num_ready,bt::TimeStamp now,bt::Uint32 limit)
+	void NetworkThread::doGroups(Uint32 num_ready,bt::TimeStamp now,TokenBucket & global)
 	{
+		Uint64 bucket_time = TokenBucket::now();
+		Uint32 num_shards = qMax<Uint32>(shard->numShards(),1);
+		Uint32 limit = global.rate();
 		if (limit == 0)
 		{
 			// calculate group allowance for each group and check for assured rate groups
@@ -134,12 +121,13 @@ namespace net
 			while (itr != groups.end())
 			{
 				SocketGroup* g = itr->second;
-				g->calcAllowance(now);
+				g->calcAllowance(bucket_time,num_shards);
 				if (g->numSockets() > 0 && g->getAssuredAllowance() > 0)
 				{
 					// lets make sure that the assured rate is done first
 					Uint32 as = g->getAssuredAllowance();
 					doGroup(g,as,now);
+					g->assuredAllowanceLeft(as);
 				}
 				itr++;
 			}
@@ -160,15 +148,18 @@ namespace net
 		}
 		else
 		{
-			Uint32 allowance = (Uint32)ceil(1.0 * limit * (now - prev_run_time) * 0.001);
+			// the other shards take from the same bucket, so the global limit is respected,
+			// only take a share of it so one shard can't starve the others, the rest is given back below
+			Uint32 allowance = global.take(qMax<Uint32>(global.capacity() / num_shards,1),bucket_time);
 			
 			// calculate group allowance for each group
 			bt::PtrMap<Uint32,SocketGroup>::iterator itr = groups.begin();
 			while (itr != groups.end())
 			{
 				SocketGroup* g = itr->second;
-				g->calcAllowance(now);
-				if (g->numSockets() > 0 && g->getAssuredAllowance() > 0)
+				g->calcAllowance(bucket_time,num_shards);
+				// an allowance of 0 means unlimited, so skip this when the global bucket is empty
+				if (g->numSockets() > 0 && g->getAssuredAllowance() > 0 && allowance > 0)
 				{
 					// do assured stuff
 					Uint32 as = g->getAssuredAllowance();
@@ -178,6 +169,7 @@ namespace net
 					Uint32 tmp = as;
 					doGroup(g,as,now);
 					allowance -= (tmp - as); // subtract from allowance
+					g->assuredAllowanceLeft(g->getAssuredAllowance() - (tmp - as));
 				}
 				itr++;
 			}
@@ -198,6 +190,122 @@ namespace net
 				g->clear();
 				itr++;
 			}
+			
+			global.giveBack(allowance);
 		}
+		
+		// give what wasn't used back to the buckets, so other shards can use it
+		bt::PtrMap<Uint32,SocketGroup>::iterator itr = groups.begin();
+		while (itr != groups.end())
+		{
+			itr->second->giveBackAllowance();
+			itr++;
+		}
+	}
+	
+	bool NetworkThread::canTransfer(Uint32 gid,TokenBucket & global,bt::Uint64 now)
+	{
+		Uint64 t = global.timeUntilAvailable(WAKE_UP_AMOUNT,now);
+		SocketGroup* g = groups.find(gid);
+		if (g)
+			t = qMax(t,g->timeUntilAllowed(WAKE_UP_AMOUNT,now));
+		
+		if (t == 0)
+			return true;
+		
+		if (wait_time == 0 || t < wait_time)
+			wait_time = t;
+		return false;
+	}
+	
+	void NetworkThread::socketChanged(TrafficShapedSocket* sock)
+	{
+		if (backend() != EPOLL_BACKEND)
+			return;
+		
+		QMutexLocker lock(&changed_mutex);
+		if (sock)
+			changed.insert(sock);
+		else
+			all_changed = true;
+	}
+	
+	void NetworkThread::watchSocket(TrafficShapedSocket* sock,bt::Uint64 cookie,bt::Uint64 now)
+	{
+		switch (interest(sock,now))
+		{
+			case INTERESTED:
+				watch(sock->socketDevice()->fd(),mode,cookie);
+				break;
+			case LIMITED:
+				limited.insert(cookie);
+				break;
+			case NOT_INTERESTED:
+				break;
+		}
+	}
+	
+	void NetworkThread::watchSockets(bt::Uint64 now)
+	{
+		// the limited sockets are only watched again once the buckets allow it
+		if (!limited.isEmpty())
+		{
+			QSet<Uint64> tmp = limited;
+			limited.clear();
+			foreach (Uint64 cookie,tmp)
+			{
+				TrafficShapedSocket* s = shard->find(cookie);
+				if (s)
+					watchSocket(s,cookie,now);
+			}
+		}
+		
+		QSet<TrafficShapedSocket*> tmp;
+		bool all = false;
+		changed_mutex.lock();
+		tmp = changed;
+		changed.clear();
+		all = all_changed;
+		all_changed = false;
+		changed_mutex.unlock();
+		
+		if (all)
+		{
+			for (SocketShard::Itr i = shard->begin();i != shard->end();i++)
+			{
+				Uint64 cookie = shard->cookie(*i);
+				if (cookie)
+					watchSocket(*i,cookie,now);
+			}
+		}
+		else
+		{
+			// sockets which have been removed from the shard don't have a cookie anymore
+			foreach (TrafficShapedSocket* s,tmp)
+			{
+				Uint64 cookie = shard->cookie(s);
+				if (cookie)
+					watchSocket(s,cookie,now);
+			}
+		}
+	}
+	
+	void NetworkThread::watchReadySockets(bt::Uint64 now)
+	{
+		const std::vector<Uint64> & ready = readyWatches();
+		for (std::vector<Uint64>::const_iterator i = ready.begin();i != ready.end();i++)
+		{
+			TrafficShapedSocket* s = shard->find(*i);
+			if (s)
+				watchSocket(s,*i,now);
+		}
+	}
+	
+	int NetworkThread::pollSockets()
+	{
+		// poll only has millisecond resolution, so round up
+		int timeout = wait_time > 0 ? (int)((wait_time + 999) / 1000) : -1;
+		wait_time = 0;
+		return poll(timeout);
 	}
 }
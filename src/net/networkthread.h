@@ -21,42 +21,52 @@
 #define NETNETWORKTHREAD_H
 
 #include <qthread.h>
+#include <QMutex>
+#include <QSet>
 #include <util/constants.h>
 #include <util/ptrmap.h>
 #include <net/socketgroup.h>
 #include <net/poll.h>
+#include <net/tokenbucket.h>
 
 using bt::Uint32;
 
 namespace net
 {
-	class SocketMonitor;
+	class SocketShard;
+	class TrafficShapedSocket;
 	
 	/**
 		@author Joris Guisson <joris.guisson@gmail.com>
 	
-		Base class for the 2 networking threads. Handles the socket groups.
+		Base class for the 2 networking threads of a SocketShard. Handles the socket groups.
+		
+		With the epoll backend, sockets with a file descriptor are watched, instead of being
+		added to the poll in every round. A watch fires only once, so a socket is only watched
+		again when it has been handled, when its state changes (see socketChanged), or when the
+		buckets allow it to go again. That way, the cost of a round does not depend on the number
+		of idle sockets.
 	*/
 	class NetworkThread : public QThread, public Poll
 	{
 	protected:
-		SocketMonitor* sm;
+		SocketShard* shard;
 		bool running;
 		bt::PtrMap<Uint32,SocketGroup> groups;
-		bt::TimeStamp prev_run_time;
+		bt::Uint64 wait_time; // time in microseconds until the buckets allow sockets to go again, 0 if none are waiting
 		
 	public:
-		NetworkThread(SocketMonitor* sm);
+		NetworkThread(SocketShard* shard,Poll::Mode mode);
 		virtual ~NetworkThread();
 
 		
 		/**
-		 * Add a new group with a given limit
+		 * Add a new group, the limits are shared with the same group in other shards
 		 * @param gid The group ID (cannot be 0, 0 is the default group)
-		 * @param limit The limit in bytes per sec
-		 * @param assured_rate The assured rate for this group in bytes per second
+		 * @param limit Bucket of the group limit
+		 * @param assured Bucket of the assured rate
  		 */
-		void addGroup(Uint32 gid,Uint32 limit,Uint32 assured_rate);
+		void addGroup(Uint32 gid,TokenBucket::Ptr limit,TokenBucket::Ptr assured);
 		
 		/**
 		 * Remove a group 
@@ -64,20 +74,6 @@ namespace net
 		 */
 		void removeGroup(Uint32 gid);
 		
-		/**
-		 * Set the limit for a group
-		 * @param gid The group ID 
-		 * @param limit The limit 
-		 */
-		void setGroupLimit(Uint32 gid,Uint32 limit);
-		
-		/**
-		 * Set the assured rate for a group
-		 * @param gid The group ID 
-		 * @param as The assured rate
-		 */
-		void setGroupAssuredRate(Uint32 gid,Uint32 as);
-		
 		/**
 		 * The main function of the thread
 		 */
@@ -103,17 +99,73 @@ namespace net
 		/// Is the thread running
 		bool isRunning() const {return running;}
 		
+		/**
+		 * The state of a socket has changed, so check if it needs to be watched in the next round.
+		 * Can be called from any thread, but the socket must not be deleted before it is removed
+		 * from the shard.
+		 * @param sock The socket, 0 means all sockets
+		 */
+		void socketChanged(TrafficShapedSocket* sock);
+		
 	protected:
+		enum Interest
+		{
+			NOT_INTERESTED, LIMITED, INTERESTED
+		};
+		
+		/**
+		 * Check if a watched socket wants to be watched, subclasses must implement this.
+		 * @param sock The socket
+		 * @param now The current time in microseconds (see TokenBucket::now)
+		 * @return LIMITED if it wants to be, but the buckets don't allow it yet (use canTransfer)
+		 */
+		virtual Interest interest(TrafficShapedSocket* sock,bt::Uint64 now) = 0;
+		
+		/**
+		 * Watch the sockets which have changed and the limited ones which are allowed to go again,
+		 * the shard must be locked.
+		 * @param now The current time in microseconds (see TokenBucket::now)
+		 */
+		void watchSockets(bt::Uint64 now);
+		
+		/**
+		 * Check if the sockets which were ready in the last poll need to be watched again,
+		 * the shard must be locked.
+		 * @param now The current time in microseconds (see TokenBucket::now)
+		 */
+		void watchReadySockets(bt::Uint64 now);
+		
 		/**
 		 * Go over all groups and do them
 		 * @param num_ready The number of ready sockets
 		 * @param now The current time
-		 * @param limit The global limit in bytes per sec
+		 * @param global The bucket of the global limit
 		 */
-		void doGroups(Uint32 num_ready,bt::TimeStamp now,bt::Uint32 limit);
+		void doGroups(Uint32 num_ready,bt::TimeStamp now,TokenBucket & global);
+		
+		/**
+		 * Check if the sockets of a group are allowed to transfer data. If not, the time until
+		 * they are is remembered, so the poll can wake up when the buckets have enough tokens.
+		 * @param gid The group ID
+		 * @param global The bucket of the global limit
+		 * @param now The current time in microseconds (see TokenBucket::now)
+		 * @return true if the sockets of the group can go
+		 */
+		bool canTransfer(Uint32 gid,TokenBucket & global,bt::Uint64 now);
+		
+		/// Poll the sockets, until one is ready or the buckets have enough tokens again
+		int pollSockets();
 		
 	private:
 		Uint32 doGroupsLimited(Uint32 num_ready,bt::TimeStamp now,Uint32 & allowance);
+		void watchSocket(TrafficShapedSocket* sock,bt::Uint64 cookie,bt::Uint64 now);
+		
+	private:
+		Poll::Mode mode;
+		QSet<bt::Uint64> limited; // watched sockets waiting for the buckets
+		QMutex changed_mutex;
+		QSet<TrafficShapedSocket*> changed; // protected by changed_mutex
+		bool all_changed; // protected by changed_mutex
 	};
 
 }
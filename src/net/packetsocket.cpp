@@ -26,10 +26,16 @@ using namespace bt;
 
 namespace net
 {
+	// maximum number of packets and bytes gathered in one vectored write
+	const int MAX_PACKETS_PER_WRITE = 64;
+	const Uint32 MAX_BYTES_PER_WRITE = 128 * 1024;
+	
+	bool PacketSocket::vectored_writes = true;
 
 	PacketSocket::PacketSocket(SocketDevice* sock) : 
 		TrafficShapedSocket(sock),
 		ctrl_packets_sent(0),
+		num_in_flight(0),
 		uploaded_data_bytes(0)
 	{
 	}
@@ -38,6 +44,7 @@ namespace net
 	PacketSocket::PacketSocket(int fd,int ip_version) : 
 		TrafficShapedSocket(fd, ip_version),
 		ctrl_packets_sent(0),
+		num_in_flight(0),
 		uploaded_data_bytes(0)
 	{
 	}
@@ -45,6 +52,7 @@ namespace net
 	PacketSocket::PacketSocket(bool tcp,int ip_version) : 
 		TrafficShapedSocket(tcp, ip_version),
 		ctrl_packets_sent(0),
+		num_in_flight(0),
 		uploaded_data_bytes(0)
 	{
 	}
@@ -74,76 +82,222 @@ namespace net
 		else
 		{
 			if (data_packets.size() > 0)
-			{
-				ctrl_packets_sent = 0;
 				ret = data_packets.front();
-			}
 			else if (control_packets.size() > 0)
 				ret = control_packets.front();
 		}
 		
-		if (ret)
-			preProcess(ret);
+		if (!ret)
+			return ret;
+		
+		// once selected, a packet will be sent, so take it out of the queue
+		if (ret->getType() == PIECE)
+		{
+			data_packets.pop_front();
+			// reset ctrl_packets_sent so the next packet should be a ctrl packet
+			ctrl_packets_sent = 0;
+		}
+		else
+		{
+			control_packets.pop_front();
+			ctrl_packets_sent++;
+		}
 		
+		preProcess(ret);
+		selected_packets.push_back(ret);
 		return ret;
 	}
 	
+	void PacketSocket::selectPackets(Uint32 max_bytes)
+	{
+		QMutexLocker locker(&mutex);
+		Uint32 bytes = 0;
+		Uint32 count = 0;
+		std::list<Packet::Ptr>::iterator i = selected_packets.begin();
+		while (i != selected_packets.end())
+		{
+			bytes += (*i)->unsentLength();
+			count++;
+			i++;
+		}
+		
+		Uint32 max_packets = vectored_writes ? MAX_PACKETS_PER_WRITE : 1;
+		while (count < max_packets && bytes < max_bytes)
+		{
+			Packet::Ptr p = selectPacket();
+			if (!p)
+				break;
+			
+			bytes += p->unsentLength();
+			count++;
+		}
+	}
+	
+	Uint32 PacketSocket::sendPackets(Uint32 max,bt::TimeStamp now)
+	{
+		// gather as many packets as the allowance permits, file backed packets are sent on their own
+		Packet::Ptr packets[MAX_PACKETS_PER_WRITE];
+		SendBuffer bufs[MAX_PACKETS_PER_WRITE];
+		int count = 0;
+		Packet::Ptr first;
+		{
+			QMutexLocker locker(&mutex);
+			if (selected_packets.empty())
+				return 0;
+			
+			first = selected_packets.front();
+			Uint32 gathered = 0;
+			std::list<Packet::Ptr>::iterator i = selected_packets.begin();
+			while (i != selected_packets.end() && count < MAX_PACKETS_PER_WRITE && (max == 0 || gathered < max))
+			{
+				Packet::Ptr p = *i;
+				if (p->isFileBacked())
+					break;
+				
+				Uint32 len = p->unsentLength();
+				if (max > 0 && len > max - gathered)
+					len = max - gathered;
+				
+				packets[count] = p;
+				bufs[count].data = p->unsentData();
+				bufs[count].len = len;
+				gathered += len;
+				count++;
+				i++;
+			}
+			
+			// these are being written, so they cannot be dropped anymore
+			num_in_flight = qMax(count,1);
+		}
+		
+		int ret = 0;
+		if (count <= 1)
+			ret = first->send(sock,max);
+		else
+			ret = sock->sendv(bufs,count);
+		
+		QMutexLocker locker(&mutex);
+		num_in_flight = 0;
+		if (ret <= 0)
+			return 0;
+		
+		// update statistics and remove the packets which are sent
+		if (count <= 1)
+		{
+			onPacketData(first,ret,now);
+		}
+		else
+		{
+			Uint32 left = ret;
+			for (int j = 0;j < count && left > 0;j++)
+			{
+				Uint32 n = qMin(left,bufs[j].len);
+				packets[j]->markSent(n);
+				onPacketData(packets[j],n,now);
+				left -= n;
+			}
+		}
+		
+		while (!selected_packets.empty() && selected_packets.front()->isSent())
+			selected_packets.pop_front();
+		
+		return ret;
+	}
+	
+	void PacketSocket::onPacketData(Packet::Ptr packet,Uint32 bytes,bt::TimeStamp now)
+	{
+		if (packet->getType() == PIECE)
+		{
+			up_speed->onData(bytes, now);
+			uploaded_data_bytes += bytes;
+		}
+	}
+	
 	Uint32 PacketSocket::write(Uint32 max, bt::TimeStamp now)
 	{
 		if (sock->state() == net::SocketDevice::CONNECTING && !sock->connectSuccesFull())
 			return 0;
 		
-		if (!curr_packet)
-			curr_packet = selectPacket();
-		
 		Uint32 written = 0;
-		while (curr_packet && (written < max || max == 0))
+		while (written < max || max == 0)
 		{
 			Uint32 limit = (max == 0) ? 0 : max - written;
-			int ret = curr_packet->send(sock, limit);
-			if (ret > 0)
+			selectPackets(limit == 0 ? MAX_BYTES_PER_WRITE : qMin(limit,MAX_BYTES_PER_WRITE));
+			Uint32 ret = sendPackets(limit, now);
+			if (ret == 0)
+				break; // Nothing to send or socket buffer full, so stop sending for now
+			
+			written += ret;
+			QMutexLocker locker(&mutex);
+			if (!selected_packets.empty() && selected_packets.front()->sending())
+				break; // we can't write everything, so break out of loop
+		}
+		
+		return written;
+	}
+	
+	bool PacketSocket::onlyControlSelected() const
+	{
+		std::list<Packet::Ptr>::const_iterator i = selected_packets.begin();
+		while (i != selected_packets.end())
+		{
+			if ((*i)->getType() == PIECE)
+				return false;
+			i++;
+		}
+		return true;
+	}
+	
+	bool PacketSocket::controlReadyToWrite() const
+	{
+		QMutexLocker locker(&mutex);
+		// control packets cannot overtake a piece which has already been selected
+		return !control_packets.empty() && onlyControlSelected();
+	}
+	
+	Uint32 PacketSocket::writeControl(bt::TimeStamp now)
+	{
+		if (sock->state() == net::SocketDevice::CONNECTING && !sock->connectSuccesFull())
+			return 0;
+		
+		Uint32 written = 0;
+		while (true)
+		{
 			{
-				written += ret;
 				QMutexLocker locker(&mutex);
-				if (curr_packet->getType() == PIECE)
+				if (!onlyControlSelected())
+					break;
+				
+				Uint32 count = selected_packets.size();
+				Uint32 max_packets = vectored_writes ? MAX_PACKETS_PER_WRITE : 1;
+				while (!control_packets.empty() && count < max_packets)
 				{
-					up_speed->onData(ret, now);
-					uploaded_data_bytes += ret;
+					Packet::Ptr p = control_packets.front();
+					control_packets.pop_front();
+					preProcess(p);
+					selected_packets.push_back(p);
+					count++;
 				}
 			}
-			else
-				break; // Socket buffer full, so stop sending for now
 			
-			if (curr_packet->isSent())
-			{
-				// packet sent, so remove it
-				if (curr_packet->getType() == PIECE)
-				{
-					QMutexLocker locker(&mutex);
-					if (!data_packets.empty())
-						data_packets.pop_front();
-					// reset ctrl_packets_sent so the next packet should be a ctrl packet
-					ctrl_packets_sent = 0;  
-				}
-				else
-				{
-					QMutexLocker locker(&mutex);
-					if (!control_packets.empty())
-						control_packets.pop_front();
-					ctrl_packets_sent++;
-				}
-				curr_packet = selectPacket();
-			}
-			else
-			{
-				// we can't write it fully, so break out of loop
+			Uint32 ret = sendPackets(0,now);
+			if (ret == 0)
+				break; // Nothing to send or socket buffer full
+			
+			written += ret;
+			QMutexLocker locker(&mutex);
+			if (!selected_packets.empty())
 				break;
-			}
 		}
 		
 		return written;
 	}
 	
+	void PacketSocket::setVectoredWrites(bool on)
+	{
+		vectored_writes = on;
+	}
+	
 	void PacketSocket::addPacket(Packet::Ptr packet)
 	{
 		QMutexLocker locker(&mutex);
@@ -152,13 +306,26 @@ namespace net
 		else
 			control_packets.push_back(packet);
 		// tell upload thread we have data ready should it be sleeping
-		net::SocketMonitor::instance().signalPacketReady();
+		net::SocketMonitor::instance().signalPacketReady(this);
+	}
+	
+	void PacketSocket::addPackets(const QList<Packet::Ptr> & packets)
+	{
+		QMutexLocker locker(&mutex);
+		foreach (Packet::Ptr packet,packets)
+		{
+			if (packet->getType() == PIECE)
+				data_packets.push_back(packet);
+			else
+				control_packets.push_back(packet);
+		}
+		net::SocketMonitor::instance().signalPacketReady(this);
 	}
 	
 	bool PacketSocket::bytesReadyToWrite() const
 	{
 		QMutexLocker locker(&mutex);
-		return !data_packets.empty() || !control_packets.empty();
+		return !data_packets.empty() || !control_packets.empty() || !selected_packets.empty();
 	}
 
 	void PacketSocket::preProcess(Packet::Ptr packet)
@@ -166,6 +333,11 @@ namespace net
 		Q_UNUSED(packet);
 	}
 	
+	bool PacketSocket::preProcessIsStateful() const
+	{
+		return false;
+	}
+	
 	Uint32 PacketSocket::dataBytesUploaded()
 	{
 		QMutexLocker locker(&mutex);
@@ -182,7 +354,7 @@ namespace net
 		while (i != data_packets.end())
 		{
 			Packet::Ptr p = *i;
-			if (p->getType() == bt::PIECE && !p->sending() && curr_packet != p)
+			if (p->getType() == bt::PIECE)
 			{
 				if (reject)
 					addPacket(Packet::Ptr(p->makeRejectOfPiece()));
@@ -194,6 +366,8 @@ namespace net
 				i++;
 			}
 		}
+		
+		dropSelectedPieces(0,reject);
 	}
 	
 	void PacketSocket::doNotSendPiece(const bt::Request& req, bool reject)
@@ -203,7 +377,7 @@ namespace net
 		while (i != data_packets.end())
 		{
 			Packet::Ptr p = *i;
-			if (p->isPiece(req) && !p->sending() && p != curr_packet)
+			if (p->isPiece(req))
 			{
 				i = data_packets.erase(i);
 				if (reject)
@@ -217,12 +391,49 @@ namespace net
 				i++;
 			}
 		}
+		
+		dropSelectedPieces(&req,reject);
+	}
+	
+	void PacketSocket::dropSelectedPieces(const bt::Request* req,bool reject)
+	{
+		// preprocessed data which changed the state of the stream has to go out
+		if (preProcessIsStateful())
+			return;
+		
+		// skip the packets which are being written
+		std::list<Packet::Ptr>::iterator i = selected_packets.begin();
+		for (Uint32 j = 0;j < num_in_flight && i != selected_packets.end();j++)
+			i++;
+		
+		while (i != selected_packets.end())
+		{
+			Packet::Ptr p = *i;
+			if (p->getType() == bt::PIECE && !p->sending() && (!req || p->isPiece(*req)))
+			{
+				i = selected_packets.erase(i);
+				if (reject)
+					addPacket(Packet::Ptr(p->makeRejectOfPiece()));
+			}
+			else
+			{
+				i++;
+			}
+		}
 	}
 
 	Uint32 PacketSocket::numPendingPieceUploads() const
 	{
 		QMutexLocker locker(&mutex);
-		return data_packets.size();
+		Uint32 ret = data_packets.size();
+		std::list<Packet::Ptr>::const_iterator i = selected_packets.begin();
+		while (i != selected_packets.end())
+		{
+			if ((*i)->getType() == PIECE)
+				ret++;
+			i++;
+		}
+		return ret;
 	}
 
 
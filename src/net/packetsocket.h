@@ -21,6 +21,7 @@
 #define NETBUFFEREDSOCKET_H
 
 #include <list>
+#include <QList>
 #include <QMutex>
 #include <net/socket.h>
 #include <download/request.h>
@@ -56,9 +57,17 @@ namespace net
 		 **/
 		void addPacket(bt::Packet::Ptr packet);
 		
+		/**
+		 * Add multiple packets at once, they will be sent together if possible
+		 * @param packets The packets
+		 **/
+		void addPackets(const QList<bt::Packet::Ptr> & packets);
+		
 		
 		virtual Uint32 write(Uint32 max, bt::TimeStamp now);
 		virtual bool bytesReadyToWrite() const;
+		virtual Uint32 writeControl(bt::TimeStamp now);
+		virtual bool controlReadyToWrite() const;
 		
 		/// Get the number of data bytes uploaded
 		Uint32 dataBytesUploaded();
@@ -79,6 +88,12 @@ namespace net
 		
 		/// Get the number of pending piece uploads
 		Uint32 numPendingPieceUploads() const;
+		
+		/// Enable or disable sending multiple queued packets with one system call
+		static void setVectoredWrites(bool on);
+		
+		/// Are vectored writes enabled
+		static bool vectoredWrites() {return vectored_writes;}
  		
 	protected:
 		/**
@@ -86,17 +101,33 @@ namespace net
 		 * @param packet The packet
 		 **/
 		virtual void preProcess(bt::Packet::Ptr packet);
+		
+		/**
+		 * Whether preProcess changes the state of the stream (encryption for example), in which
+		 * case a preprocessed packet has to be sent and cannot be dropped anymore.
+		 * Default implementation returns false.
+		 */
+		virtual bool preProcessIsStateful() const;
 
 	private:
 		bt::Packet::Ptr selectPacket();
+		void selectPackets(Uint32 max_bytes);
+		bool onlyControlSelected() const;
+		Uint32 sendPackets(Uint32 max,bt::TimeStamp now);
+		void onPacketData(bt::Packet::Ptr packet,Uint32 bytes,bt::TimeStamp now);
+		void dropSelectedPieces(const bt::Request* req,bool reject);
 		
 	protected:
 		std::list<bt::Packet::Ptr> control_packets;
 		std::list<bt::Packet::Ptr> data_packets;
-		bt::Packet::Ptr curr_packet;
+		// packets which have been selected and preprocessed, in the order they will be sent
+		std::list<bt::Packet::Ptr> selected_packets;
 		Uint32 ctrl_packets_sent;
+		Uint32 num_in_flight; // number of selected packets which are being written
 		
 		Uint32 uploaded_data_bytes;
+		
+		static bool vectored_writes;
 	};
 
 }
@@ -19,6 +19,12 @@
  ***************************************************************************/
 
 #include "poll.h"
+#include <config-ktorrent.h>
+#include <errno.h>
+#include <string.h>
+#include <QAtomicInt>
+#include <QList>
+#include <QMutex>
 #include <util/log.h>
 
 #ifndef Q_WS_WIN
@@ -27,22 +33,104 @@
 #include <util/win32.h>
 #endif
 
+#ifdef HAVE_SYS_EPOLL_H
+#include <sys/epoll.h>
+#include <fcntl.h>
+#include <unistd.h>
+#else
+struct epoll_event {};
+#endif
+
 using namespace bt;
 
 namespace net
 {
+#ifdef HAVE_SYS_EPOLL_H
+	Poll::Backend Poll::default_backend = Poll::EPOLL_BACKEND;
+#else
+	Poll::Backend Poll::default_backend = Poll::POLL_BACKEND;
+#endif
 	
-	Poll::Poll() : num_sockets(0)
+	static QAtomicInt registration_keys(0);
+	
+	// all polls using epoll, so closed file descriptors can be removed from them
+	static QMutex instances_mutex;
+	static QList<Poll*> instances;
+	
+	// maximum number of events handled by one wait, the others stay pending until the next one
+	const int MAX_EPOLL_EVENTS = 256;
+	
+	// set in the event data of watched file descriptors, the others store their fd
+	const Uint64 WATCH_FLAG = Q_UINT64_C(0x8000000000000000);
+	
+	PollClient::PollClient() : poll_key(Poll::newRegistrationKey())
 	{
-
+	}
+	
+	Poll::Poll(Backend backend) : num_sockets(0),epoll_fd(-1),round(0),watching(false)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		if (backend == EPOLL_BACKEND)
+		{
+			epoll_fd = epoll_create(64);
+			if (epoll_fd < 0)
+				Out(SYS_CON|LOG_NOTICE) << "epoll_create failed, falling back to poll: " << QString(strerror(errno)) << endl;
+			else
+			{
+				fcntl(epoll_fd,F_SETFD,FD_CLOEXEC);
+				epoll_events.resize(MAX_EPOLL_EVENTS);
+				QMutexLocker lock(&instances_mutex);
+				instances.append(this);
+			}
+		}
+#else
+		Q_UNUSED(backend);
+#endif
 	}
 
 	Poll::~Poll()
 	{
-
+#ifdef HAVE_SYS_EPOLL_H
+		if (epoll_fd >= 0)
+		{
+			QMutexLocker lock(&instances_mutex);
+			instances.removeAll(this);
+			::close(epoll_fd);
+		}
+#endif
+	}
+	
+	Uint32 Poll::newRegistrationKey()
+	{
+		Uint32 key = 0;
+		// 0 means no key, so skip it when wrapping around
+		while (key == 0)
+			key = (Uint32)registration_keys.fetchAndAddRelaxed(1) + 1;
+		return key;
+	}
+	
+	void Poll::unregister(int fd,Uint32 key)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		if (fd < 0)
+			return;
+		
+		QMutexLocker lock(&instances_mutex);
+		foreach (Poll* p,instances)
+		{
+			// the fd is still open, so this cannot remove a reused one,
+			// the poll itself forgets about it in its next wait
+			struct epoll_event ev;
+			epoll_ctl(p->epoll_fd,EPOLL_CTL_DEL,fd,&ev);
+			p->closed.push_back(std::make_pair(fd,key));
+		}
+#else
+		Q_UNUSED(fd);
+		Q_UNUSED(key);
+#endif
 	}
 
-	int Poll::add(int fd, Poll::Mode mode)
+	int Poll::add(int fd, Poll::Mode mode, Uint32 key)
 	{
 		if (fd_vec.size() <= num_sockets)
 		{
@@ -62,6 +150,55 @@ namespace net
 			pfd.events = mode == INPUT ? POLLIN : POLLOUT;
 		}
 		
+		if (epoll_fd >= 0)
+		{
+			Uint32 events = mode == INPUT ? POLLIN : POLLOUT;
+			QHash<int,Registration>::iterator i = registrations.find(fd);
+			if (i == registrations.end())
+			{
+				Registration r;
+				r.wanted = 0;
+				r.armed = 0;
+				r.key = key;
+				r.round = round - 1;
+				r.index = -1;
+				r.shared = false;
+				r.registered = false;
+				r.changed = false;
+				i = registrations.insert(fd,r);
+			}
+			
+			Registration & r = i.value();
+			// A different key (or no key) means the fd might have been closed and reused,
+			// in which case the kernel has dropped the old registration
+			if (key == 0 || key != r.key)
+			{
+				r.registered = false;
+				r.armed = 0;
+				r.key = key;
+			}
+			
+			if (r.round != round)
+			{
+				r.wanted = events;
+				r.round = round;
+				r.index = num_sockets;
+				r.shared = false;
+			}
+			else
+			{
+				r.wanted |= events;
+				r.shared = true;
+			}
+			
+			// only a change of interest, or an event which has fired, needs a system call
+			if (r.armed != r.wanted && !r.changed)
+			{
+				r.changed = true;
+				changed.push_back(fd);
+			}
+		}
+		
 		int ret = num_sockets;
 		num_sockets++;
 		return ret;
@@ -70,7 +207,7 @@ namespace net
 	
 	int Poll::add(PollClient::Ptr pc)
 	{
-		int idx = add(pc->fd(),INPUT);
+		int idx = add(pc->fd(),INPUT,pc->pollKey());
 		poll_clients[idx] = pc;
 		return idx;
 	}
@@ -78,7 +215,7 @@ namespace net
 
 	bool Poll::ready(int index, Poll::Mode mode) const
 	{
-		if (index < 0 || index >= num_sockets)
+		if (index < 0 || index >= (int)num_sockets)
 			return false;
 		
 		return fd_vec[index].revents & (mode == INPUT ? POLLIN : POLLOUT);
@@ -87,19 +224,60 @@ namespace net
 	void Poll::reset()
 	{
 		num_sockets = 0;
+		round++;
+	}
+
+	bool Poll::watch(int fd,Poll::Mode mode,Uint64 cookie)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		if (epoll_fd < 0 || fd < 0)
+			return false;
+		
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.data.u64 = cookie | WATCH_FLAG;
+		ev.events = EPOLLONESHOT | (mode == INPUT ? EPOLLIN : EPOLLOUT);
+		
+		// most of the time the fd is already known, so try to modify it first
+		int ret = epoll_ctl(epoll_fd,EPOLL_CTL_MOD,fd,&ev);
+		if (ret < 0 && errno == ENOENT)
+			ret = epoll_ctl(epoll_fd,EPOLL_CTL_ADD,fd,&ev);
+		
+		if (ret < 0)
+		{
+			Out(SYS_CON|LOG_DEBUG) << "epoll_ctl failed for " << fd << ": " << QString(strerror(errno)) << endl;
+			return false;
+		}
+		
+		watching = true;
+		return true;
+#else
+		Q_UNUSED(fd);
+		Q_UNUSED(mode);
+		Q_UNUSED(cookie);
+		return false;
+#endif
 	}
 
 	int Poll::poll(int timeout)
 	{
-		if (num_sockets == 0)
+		ready_watches.clear();
+		if (num_sockets == 0 && !watching)
 			return 0;
 		
 		int ret = 0;
+		if (epoll_fd >= 0)
+		{
+			ret = epollWait(timeout);
+		}
+		else
+		{
 #ifndef Q_WS_WIN
-		ret = ::poll(&fd_vec[0],num_sockets,timeout);
+			ret = ::poll(&fd_vec[0],num_sockets,timeout);
 #else
-		ret = ::mingw_poll(&fd_vec[0],num_sockets,timeout);
+			ret = ::mingw_poll(&fd_vec[0],num_sockets,timeout);
 #endif
+		}
 		
 		std::map<int,PollClient::Ptr>::iterator itr = poll_clients.begin();
 		while (itr != poll_clients.end())
@@ -114,7 +292,126 @@ namespace net
 		return ret;
 	}
 	
+	bool Poll::epollRegister(int fd,Uint32 events,bool registered)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		struct epoll_event ev;
+		memset(&ev,0,sizeof(ev));
+		ev.data.u64 = (Uint64)fd;
+		ev.events = EPOLLONESHOT;
+		if (events & POLLIN)
+			ev.events |= EPOLLIN;
+		if (events & POLLOUT)
+			ev.events |= EPOLLOUT;
+		
+		int ret = epoll_ctl(epoll_fd,registered ? EPOLL_CTL_MOD : EPOLL_CTL_ADD,fd,&ev);
+		if (ret < 0 && (errno == EEXIST || errno == ENOENT))
+		{
+			// our view of the kernel's registrations was wrong (fd was closed or reused), try the other way
+			ret = epoll_ctl(epoll_fd,registered ? EPOLL_CTL_ADD : EPOLL_CTL_MOD,fd,&ev);
+		}
+		
+		if (ret < 0)
+		{
+			Out(SYS_CON|LOG_DEBUG) << "epoll_ctl failed for " << fd << ": " << QString(strerror(errno)) << endl;
+			return false;
+		}
+		return true;
+#else
+		Q_UNUSED(fd);
+		Q_UNUSED(events);
+		Q_UNUSED(registered);
+		return false;
+#endif
+	}
 	
+	int Poll::epollWait(int timeout)
+	{
+#ifdef HAVE_SYS_EPOLL_H
+		// forget about the fds which have been closed
+		std::vector<std::pair<int,Uint32> > to_forget;
+		instances_mutex.lock();
+		to_forget.swap(closed);
+		instances_mutex.unlock();
+		for (std::vector<std::pair<int,Uint32> >::iterator i = to_forget.begin();i != to_forget.end();i++)
+		{
+			QHash<int,Registration>::iterator r = registrations.find(i->first);
+			// if the key differs, the fd has already been reused
+			if (r != registrations.end() && r.value().key == i->second)
+				registrations.erase(r);
+		}
+		
+		// Only sync the registrations which have changed in this round with the kernel
+		for (std::vector<int>::iterator i = changed.begin();i != changed.end();i++)
+		{
+			QHash<int,Registration>::iterator r = registrations.find(*i);
+			if (r == registrations.end())
+				continue;
+			
+			Registration & reg = r.value();
+			reg.changed = false;
+			if (epollRegister(*i,reg.wanted,reg.registered))
+			{
+				reg.registered = true;
+				reg.armed = reg.wanted;
+			}
+			else
+			{
+				reg.registered = false;
+				reg.armed = 0;
+			}
+		}
+		changed.clear();
+		
+		int ret = epoll_wait(epoll_fd,&epoll_events[0],epoll_events.size(),timeout);
+		int num_ready = 0;
+		for (int j = 0;j < ret;j++)
+		{
+			const struct epoll_event & ev = epoll_events[j];
+			if (ev.data.u64 & WATCH_FLAG)
+			{
+				// one shot as well, the owner decides when to watch it again
+				ready_watches.push_back(ev.data.u64 & ~WATCH_FLAG);
+				num_ready++;
+				continue;
+			}
+			
+			int fd = (int)ev.data.u64;
+			QHash<int,Registration>::iterator i = registrations.find(fd);
+			if (i == registrations.end())
+				continue;
+			
+			// one shot, so the kernel has disarmed it
+			Registration & r = i.value();
+			r.armed = 0;
+			// not interested in this round, it will be armed again when it is added
+			if (r.round != round)
+				continue;
+			
+			Uint32 revents = 0;
+			if (ev.events & EPOLLIN)
+				revents |= POLLIN;
+			if (ev.events & EPOLLOUT)
+				revents |= POLLOUT;
+			// let the socket find out about errors and hangups when reading or writing
+			if (ev.events & (EPOLLERR | EPOLLHUP))
+				revents |= POLLIN | POLLOUT;
+			
+			fd_vec[r.index].revents = revents & fd_vec[r.index].events;
+			if (r.shared)
+			{
+				// added more than once, so update all the slots
+				for (Uint32 k = r.index + 1;k < num_sockets;k++)
+					if (fd_vec[k].fd == fd)
+						fd_vec[k].revents = revents & fd_vec[k].events;
+			}
+			num_ready++;
+		}
+		return ret < 0 ? ret : num_ready;
+#else
+		Q_UNUSED(timeout);
+		return -1;
+#endif
+	}
 
 }
-
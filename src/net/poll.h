@@ -23,6 +23,7 @@
 
 #include <map>
 #include <vector>
+#include <QHash>
 #include <QSharedPointer>
 #include <util/constants.h>
 #include <ktorrent_export.h>
@@ -32,6 +33,7 @@
 #endif
 
 struct pollfd;
+struct epoll_event;
 
 namespace net
 {
@@ -42,12 +44,15 @@ namespace net
 	class KTORRENT_EXPORT PollClient
 	{
 	public:
-		PollClient() {}
+		PollClient();
 		virtual ~PollClient() {}
 		
 		/// Get the filedescriptor to poll
 		virtual int fd() const = 0;
 		
+		/// Get the key used to register the filedescriptor with the poll (see Poll::add)
+		bt::Uint32 pollKey() const {return poll_key;}
+		
 		/// Handle data
 		virtual void handleData() = 0;
 		
@@ -55,15 +60,46 @@ namespace net
 		virtual void reset() = 0;
 		
 		typedef QSharedPointer<PollClient> Ptr;
+		
+	private:
+		bt::Uint32 poll_key;
 	};
 	
 	/**
-		Class which does polling of sockets
+		Class which does polling of sockets.
+		
+		There are two backends: the classic poll backend, which passes all file descriptors
+		to the kernel every time, and an epoll backend (Linux only). With epoll, file descriptors
+		stay registered between polls, and the kernel only has to be told when the interest in
+		a file descriptor changes. Registrations are one shot, so a file descriptor which was
+		reported ready is armed again when it is added in a later round, and a wait only has to
+		look at the file descriptors which are ready. Events of file descriptors which are not
+		added in the current round are ignored, they disarm themselves when they fire.
+		
+		Because file descriptor numbers get reused, a registration key can be passed to add,
+		when the key of a file descriptor changes, it is registered again. File descriptors added
+		without a key are registered again in every round. File descriptors which have a key,
+		should be unregistered before they are closed.
+		
+		The epoll backend can also watch file descriptors. A watched file descriptor is not added
+		in every round, it stays armed until it fires, and then the cookie it was watched with is
+		put in the list of ready watches. So the cost of a poll only depends on the number of
+		file descriptors which are ready, not on the number which are idle. A file descriptor
+		should not be added and watched by the same poll.
 	*/
 	class KTORRENT_EXPORT Poll
 	{
 	public:
-		Poll();
+		enum Backend
+		{
+			POLL_BACKEND, EPOLL_BACKEND
+		};
+		
+		/**
+		 * Constructor, if the backend is not available, the poll backend will be used.
+		 * @param backend The backend to use
+		 */
+		Poll(Backend backend = defaultBackend());
 		virtual ~Poll();
 		
 		enum Mode
@@ -72,7 +108,7 @@ namespace net
 		};
 		
 		/// Add a file descriptor to the poll (returns the index of it)
-		int add(int fd,Mode mode);
+		int add(int fd,Mode mode,bt::Uint32 key = 0);
 		
 		/// Add a poll client
 		int add(PollClient::Ptr pc);
@@ -86,10 +122,70 @@ namespace net
 		/// Reset the poll
 		void reset();
 		
+		/**
+		 * Watch a file descriptor (epoll backend only). The watch is one shot, once the file
+		 * descriptor is reported ready, it has to be watched again to get the next event.
+		 * Watching a file descriptor again, also changes the mode or the cookie.
+		 * @param fd The file descriptor
+		 * @param mode What to wait for
+		 * @param cookie Identifies the file descriptor in readyWatches (only the lower 63 bits are used)
+		 * @return false if the backend does not support watches or the fd could not be watched
+		 */
+		bool watch(int fd,Mode mode,bt::Uint64 cookie);
+		
+		/// Get the cookies of the watched file descriptors which were ready in the last poll
+		const std::vector<bt::Uint64> & readyWatches() const {return ready_watches;}
+		
+		/// Get the backend in use
+		Backend backend() const {return epoll_fd >= 0 ? EPOLL_BACKEND : POLL_BACKEND;}
+		
+		/// Set the backend used by default for new Poll objects
+		static void setDefaultBackend(Backend b) {default_backend = b;}
+		
+		/// Get the backend used by default
+		static Backend defaultBackend() {return default_backend;}
+		
+		/// Create a new unique registration key, for use with add
+		static bt::Uint32 newRegistrationKey();
+		
+		/**
+		 * Remove a file descriptor from all epoll sets, must be called before it is closed.
+		 * Can be called from any thread.
+		 * @param fd The file descriptor
+		 * @param key The registration key it was added with
+		 */
+		static void unregister(int fd,bt::Uint32 key);
+		
 	private:
+		int epollWait(int timeout);
+		bool epollRegister(int fd,bt::Uint32 events,bool registered);
+		
+	private:
+		struct Registration
+		{
+			bt::Uint32 wanted; // events wanted in this round
+			bt::Uint32 armed; // events armed in the kernel, 0 once the one shot event has fired
+			bt::Uint32 key;
+			bt::Uint32 round;
+			int index; // index in fd_vec in this round
+			bool shared; // added more than once in this round
+			bool registered; // known by the kernel
+			bool changed; // in the list of registrations to sync with the kernel
+		};
+		
 		std::vector<struct pollfd> fd_vec;
 		bt::Uint32 num_sockets;
 		std::map<int,PollClient::Ptr> poll_clients;
+		int epoll_fd;
+		bt::Uint32 round;
+		QHash<int,Registration> registrations;
+		std::vector<int> changed;
+		std::vector<std::pair<int,bt::Uint32> > closed; // protected by the instances mutex
+		std::vector<struct epoll_event> epoll_events;
+		std::vector<bt::Uint64> ready_watches;
+		bool watching;
+		
+		static Backend default_backend;
 	};
 
 }
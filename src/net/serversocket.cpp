@@ -21,6 +21,7 @@
 #include "serversocket.h"
 
 #include <QSocketNotifier>
+#include <string.h>
 #include <util/log.h>
 #include "socket.h"
 
@@ -29,19 +30,34 @@ using namespace bt;
 
 namespace net
 {
+	// number of datagrams read with one system call
+	const int RECV_BATCH_SIZE = 32;
+	// any UDP datagram fits in a slot, and so do the datagrams the kernel coalesces with receive offload,
+	// a datagram which doesn't fit in its slot is lost, because recvmmsg cannot stop in front of it
+	const int SLOT_SIZE = 65536;
+	// only the pages which datagrams are received in take up memory, so most of the slab never does
+	const int SLAB_SIZE = RECV_BATCH_SIZE * SLOT_SIZE;
+	
+	void ServerSocket::DataHandler::dataReceived(const ServerSocket::PacketList& packets)
+	{
+		foreach (const ServerSocket::PacketList::value_type & p,packets)
+			dataReceived(p.first,p.second);
+	}
+	
 	class ServerSocket::Private
 	{
 	public:
-		Private(ConnectionHandler* chandler) : sock(0),rsn(0),wsn(0),chandler(chandler),dhandler(0)
+		Private(ConnectionHandler* chandler) : sock(0),rsn(0),wsn(0),chandler(chandler),dhandler(0),slab(0)
 		{}
 		
-		Private(DataHandler* dhandler) : sock(0),rsn(0),wsn(0),chandler(0),dhandler(dhandler),pool(new BufferPool())
+		Private(DataHandler* dhandler) : sock(0),rsn(0),wsn(0),chandler(0),dhandler(dhandler),pool(new BufferPool()),slab(0)
 		{
 			pool->setWeakPointer(pool.toWeakRef());
 		}
 		
 		~Private()
 		{
+			delete [] slab;
 			delete rsn;
 			delete wsn;
 			delete sock;
@@ -59,12 +75,27 @@ namespace net
 		
 		bool isTCP() const {return chandler != 0;}
 		
+		void readDatagram()
+		{
+			// The first packet may be 0 bytes in size
+			net::Address addr;
+			bt::Uint32 ba = sock->bytesAvailable();
+			Buffer::Ptr buf = pool->get(ba < 1500 ? 1500 : ba);
+			if (sock->recvFrom(buf->get(), ba, addr) == (int)ba && ba > 0)
+			{
+				buf->setSize(ba);
+				dhandler->dataReceived(buf, addr);
+			}
+		}
+		
 		net::Socket* sock;
 		QSocketNotifier* rsn;
 		QSocketNotifier* wsn;
 		ConnectionHandler* chandler;
 		DataHandler* dhandler;
 		bt::BufferPool::Ptr pool;
+		// datagrams are received in here, and then copied into a buffer of the right size
+		bt::Uint8* slab;
 	};
 	
 	ServerSocket::ServerSocket(ConnectionHandler* chandler) : d(new Private(chandler))
@@ -126,19 +157,54 @@ namespace net
 
 	void ServerSocket::readyToRead(int)
 	{
-		net::Address addr;
-		bt::Uint32 ba = 0;
-		bool first = true;
-		while ((ba = d->sock->bytesAvailable()) > 0 || first)
+		if (!d->slab)
+			d->slab = new bt::Uint8[SLAB_SIZE];
+		
+		Datagram dgrams[RECV_BATCH_SIZE];
+		int ret = 0;
+		bool truncated = false;
+		do
 		{
-			// The first packet may be 0 bytes in size
-			Buffer::Ptr buf = d->pool->get(ba < 1500 ? 1500 : ba);
-			if (d->sock->recvFrom(buf->get(), ba, addr) == (int)ba && ba > 0)
+			for (int i = 0;i < RECV_BATCH_SIZE;i++)
 			{
-				buf->setSize(ba);
-				d->dhandler->dataReceived(buf, addr);
+				dgrams[i].data = d->slab + i * SLOT_SIZE;
+				dgrams[i].size = SLOT_SIZE;
 			}
-			first = false;
+			
+			ret = d->sock->recvFromBatch(dgrams,RECV_BATCH_SIZE);
+			
+			PacketList packets;
+			for (int i = 0;i < ret;i++)
+			{
+				// empty and truncated packets are dropped
+				if (dgrams[i].size < 0)
+					truncated = true;
+				if (dgrams[i].size <= 0)
+					continue;
+				
+				// split coalesced datagrams, only the last one can be smaller then the segment size
+				int segment_size = dgrams[i].segment_size > 0 ? dgrams[i].segment_size : dgrams[i].size;
+				for (int off = 0;off < dgrams[i].size;off += segment_size)
+				{
+					int size = qMin(segment_size,dgrams[i].size - off);
+					Buffer::Ptr buf = d->pool->get(size);
+					memcpy(buf->get(),dgrams[i].data + off,size);
+					buf->setSize(size);
+					packets.append(qMakePair(buf,dgrams[i].addr));
+				}
+			}
+			
+			if (!packets.isEmpty())
+				d->dhandler->dataReceived(packets);
+		}
+		while (ret == RECV_BATCH_SIZE && !truncated);
+		
+		// cannot happen with UDP, but if it does, read the rest one by one in buffers of the right size
+		if (truncated)
+		{
+			Out(SYS_CON|LOG_DEBUG) << "Datagram bigger then " << SLOT_SIZE << " bytes truncated" << endl;
+			while (d->sock->bytesAvailable() > 0)
+				d->readDatagram();
 		}
 	}
 	
@@ -178,6 +244,15 @@ namespace net
 		return d->sock->sendTo(buf,size,addr);
 	}
 	
+	int ServerSocket::sendToBatch(const net::Datagram* dgrams,int count)
+	{
+		// Only UDP server socket can send
+		if (!d->dhandler)
+			return 0;
+		
+		return d->sock->sendToBatch(dgrams,count);
+	}
+	
 	bool ServerSocket::setTOS(unsigned char type_of_service)
 	{
 		if (d->sock)
@@ -185,6 +260,22 @@ namespace net
 		else
 			return false;
 	}
+	
+	bool ServerSocket::setDontFragment(bool on)
+	{
+		if (d->sock)
+			return d->sock->setDontFragment(on);
+		else
+			return false;
+	}
+	
+	bool ServerSocket::setSegmentationOffload(bool on)
+	{
+		if (d->sock)
+			return d->sock->setSegmentationOffload(on);
+		else
+			return false;
+	}
 
 
 }
@@ -22,15 +22,18 @@
 #ifndef NET_SERVERSOCKET_H
 #define NET_SERVERSOCKET_H
 
+#include <QList>
+#include <QPair>
 #include <QObject>
 #include <QSharedPointer>
 #include <ktorrent_export.h>
 #include <util/constants.h>
 #include <util/bufferpool.h>
+#include <net/address.h>
 
 namespace net 
 {
-	class Address;
+	struct Datagram;
 	
 
 	
@@ -43,6 +46,7 @@ namespace net
 		Q_OBJECT
 	public:
 		typedef QSharedPointer<ServerSocket> Ptr;
+		typedef QList<QPair<bt::Buffer::Ptr,net::Address> > PacketList;
 		
 		/**
 			Interface class to handle new connections
@@ -76,6 +80,13 @@ namespace net
 			*/
 			virtual void dataReceived(bt::Buffer::Ptr buffer,const net::Address & addr) = 0;
 			
+			/**
+				Multiple UDP packets were received in one go. The default implementation
+				calls dataReceived for each packet, override it to handle them together.
+				@param packets The packets, in the order they were received
+			*/
+			virtual void dataReceived(const PacketList & packets);
+			
 			/**
 				Socket has become writeable
 				@param sock The socket 
@@ -131,6 +142,15 @@ namespace net
 		*/
 		int sendTo(const bt::Uint8* buf,int size,const net::Address & addr);
 		
+		/**
+			Send multiple datagrams at once. Only use this when 
+			the socket is a UDP socket. It will fail for TCP server sockets.
+			@param dgrams The datagrams
+			@param count The number of datagrams
+			@return The number of datagrams sent, or an error code of net::Socket
+		*/
+		int sendToBatch(const net::Datagram* dgrams,int count);
+		
 		/**
 			Enable write notifications.
 			@param on On or not
@@ -150,6 +170,20 @@ namespace net
 		*/
 		bool setTOS(unsigned char type_of_service);
 		
+		/**
+			Set the don't fragment bit on outgoing datagrams, see Socket::setDontFragment.
+			@param on On or not
+			@return true upon success, false otherwise
+		*/
+		bool setDontFragment(bool on);
+		
+		/**
+			Enable UDP segmentation and receive offload, see Socket::setSegmentationOffload.
+			@param on On or not
+			@return true if it is supported
+		*/
+		bool setSegmentationOffload(bool on);
+		
 	private slots:
 		void readyToAccept(int fd);
 		void readyToRead(int fd);
@@ -19,15 +19,22 @@
  ***************************************************************************/
 #include "socket.h"
 #include <qglobal.h>
+#include <config-ktorrent.h>
 
 #include <unistd.h>
 #include <string.h>
 #include <sys/types.h>
 #include <sys/socket.h>
 #include <sys/ioctl.h>
+#ifndef Q_WS_WIN
+#include <sys/uio.h>
+#endif
 #include <errno.h>
 #include <netinet/in.h>
 #include <netinet/tcp.h>
+#ifndef Q_WS_WIN
+#include <netinet/udp.h>
+#endif
 #include <arpa/inet.h>
 #include <netdb.h>
 
@@ -39,10 +46,20 @@
 #include <sys/filio.h>
 #endif
 
+#ifdef HAVE_SYS_SENDFILE_H
+#include <sys/sendfile.h>
+#endif
+
 #ifndef MSG_NOSIGNAL
 #define MSG_NOSIGNAL 0
 #endif
 
+// maximum number of datagrams in one sendmmsg or recvmmsg call
+#define MAX_DATAGRAM_BATCH 64
+// maximum amount of data passed to the kernel in one go with segmentation offload,
+// the UDP payload limit of IPv6 which is also safe for IPv4
+#define MAX_SEGMENTED_SIZE (65535 - 48)
+
 #include <fcntl.h>
 
 #include <util/log.h>
@@ -60,7 +77,7 @@ namespace net
 {
 
 	Socket::Socket(int fd,int ip_version) 
-		: SocketDevice(bt::TCP), m_fd(fd),m_ip_version(ip_version),r_poll_index(-1),w_poll_index(-1)
+		: SocketDevice(bt::TCP), m_fd(fd),m_ip_version(ip_version),r_poll_index(-1),w_poll_index(-1),poll_key(Poll::newRegistrationKey()),m_gso(false),m_gro(false)
 	{
 		// check if the IP version is 4 or 6
 		if (m_ip_version != 4 && m_ip_version != 6)
@@ -77,7 +94,7 @@ namespace net
 	}
 	
 	Socket::Socket(bool tcp,int ip_version) 
-		: SocketDevice(bt::TCP),m_fd(-1),m_ip_version(ip_version),r_poll_index(-1),w_poll_index(-1)
+		: SocketDevice(bt::TCP),m_fd(-1),m_ip_version(ip_version),r_poll_index(-1),w_poll_index(-1),poll_key(Poll::newRegistrationKey()),m_gso(false),m_gro(false)
 	{
 		// check if the IP version is 4 or 6
 		if (m_ip_version != 4 && m_ip_version != 6)
@@ -101,6 +118,7 @@ namespace net
 	{
 		if (m_fd >= 0)
 		{
+			Poll::unregister(m_fd,poll_key);
 			shutdown(m_fd, SHUT_RDWR);
 #ifdef Q_WS_WIN
 			::closesocket(m_fd);
@@ -117,6 +135,8 @@ namespace net
 		if (fd < 0)
 			Out(SYS_GEN|LOG_IMPORTANT) << QString("Cannot create socket : %1").arg(strerror(errno)) << endl;
 		m_fd = fd;
+		// new fd, so it needs to be registered again in the poll
+		poll_key = Poll::newRegistrationKey();
 		
 #if defined(Q_OS_MACX) || defined(Q_OS_DARWIN)
 		int val = 1;
@@ -132,6 +152,7 @@ namespace net
 	{
 		if (m_fd >= 0)
 		{
+			Poll::unregister(m_fd,poll_key);
 			shutdown(m_fd, SHUT_RDWR);
 #ifdef Q_WS_WIN
 			::closesocket(m_fd);
@@ -247,6 +268,92 @@ namespace net
 		return ret;
 	}
 	
+	int Socket::sendFile(const bt::Uint8* header,bt::Uint32 header_len,int fd,bt::Uint64 off,bt::Uint32 len)
+	{
+#ifdef HAVE_SYS_SENDFILE_H
+		int ret = 0;
+		if (header_len > 0)
+		{
+			// tell the kernel more is coming, so the header and the data end up in the same segment
+			int flags = MSG_NOSIGNAL;
+#ifdef MSG_MORE
+			if (len > 0)
+				flags |= MSG_MORE;
+#endif
+			ret = ::send(m_fd,header,header_len,flags);
+			if (ret < 0)
+			{
+				if (errno != EAGAIN && errno != EWOULDBLOCK)
+					close();
+				return 0;
+			}
+			
+			if ((Uint32)ret < header_len || len == 0)
+				return ret;
+		}
+		
+#ifdef HAVE_SENDFILE64
+		off64_t foff = off;
+		ssize_t sent = ::sendfile64(m_fd,fd,&foff,len);
+#else
+		off_t foff = off;
+		ssize_t sent = ::sendfile(m_fd,fd,&foff,len);
+#endif
+		if (sent < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return ret;
+			
+			// not supported for this file, let the caller fall back to a normal send
+			if (errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)
+				return ret > 0 ? ret : -1;
+			
+			close();
+			return ret;
+		}
+		else if (sent == 0)
+		{
+			// file is shorter then expected, reading it will fail in the same way
+			return ret > 0 ? ret : -1;
+		}
+		
+		return ret + sent;
+#else
+		return SocketDevice::sendFile(header,header_len,fd,off,len);
+#endif
+	}
+	
+	int Socket::sendv(const SendBuffer* bufs,int count)
+	{
+#ifndef Q_WS_WIN
+		// sendmsg has a limit on the number of buffers
+		struct iovec iov[64];
+		if (count > 64)
+			count = 64;
+		
+		for (int i = 0;i < count;i++)
+		{
+			iov[i].iov_base = (void*)bufs[i].data;
+			iov[i].iov_len = bufs[i].len;
+		}
+		
+		struct msghdr msg;
+		memset(&msg,0,sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = count;
+		int ret = ::sendmsg(m_fd,&msg,MSG_NOSIGNAL);
+		if (ret < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				close();
+			return 0;
+		}
+		return ret;
+#else
+		return SocketDevice::sendv(bufs,count);
+#endif
+	}
+	
 	int Socket::recv(bt::Uint8* buf,int max_len)
 	{
 #ifndef Q_WS_WIN
@@ -284,6 +391,8 @@ namespace net
 		{
 			if (errno == EAGAIN || errno == EWOULDBLOCK)
 				return SEND_WOULD_BLOCK;
+			else if (errno == EMSGSIZE)
+				return SEND_TOO_BIG;
 			
 			Out(SYS_CON|LOG_DEBUG) << "Send error : " << QString(strerror(errno)) << endl;
 			return SEND_FAILURE;
@@ -310,6 +419,195 @@ namespace net
 		return ret;
 	}
 	
+	int Socket::sendToBatch(const Datagram* dgrams,int count)
+	{
+#ifdef HAVE_SENDMMSG
+		struct mmsghdr msgs[MAX_DATAGRAM_BATCH];
+		struct iovec iov[MAX_DATAGRAM_BATCH];
+		struct sockaddr_storage ss[MAX_DATAGRAM_BATCH];
+		// number of datagrams in each message
+		int segments[MAX_DATAGRAM_BATCH];
+#ifdef UDP_SEGMENT
+		char control[MAX_DATAGRAM_BATCH][CMSG_SPACE(sizeof(Uint16))];
+#endif
+		if (count > MAX_DATAGRAM_BATCH)
+			count = MAX_DATAGRAM_BATCH;
+		
+		memset(msgs,0,sizeof(struct mmsghdr) * count);
+		int num_msgs = 0;
+		int i = 0;
+		while (i < count)
+		{
+			struct msghdr & hdr = msgs[num_msgs].msg_hdr;
+			int alen = 0;
+			dgrams[i].addr.toSocketAddress(&ss[num_msgs],alen);
+			hdr.msg_name = &ss[num_msgs];
+			hdr.msg_namelen = alen;
+			hdr.msg_iov = &iov[i];
+			iov[i].iov_base = (void*)dgrams[i].data;
+			iov[i].iov_len = dgrams[i].size;
+			
+			int n = 1;
+#ifdef UDP_SEGMENT
+			if (m_gso)
+			{
+				// Datagrams to the same address can go as one message, they all need
+				// to be the same size, except for the last one which may be smaller
+				int total = dgrams[i].size;
+				while (i + n < count && 
+					dgrams[i + n - 1].size == dgrams[i].size && 
+					dgrams[i + n].size > 0 && dgrams[i + n].size <= dgrams[i].size &&
+					total + dgrams[i + n].size <= MAX_SEGMENTED_SIZE &&
+					dgrams[i + n].addr == dgrams[i].addr)
+				{
+					iov[i + n].iov_base = (void*)dgrams[i + n].data;
+					iov[i + n].iov_len = dgrams[i + n].size;
+					total += dgrams[i + n].size;
+					n++;
+				}
+				
+				if (n > 1)
+				{
+					hdr.msg_control = control[num_msgs];
+					hdr.msg_controllen = sizeof(control[num_msgs]);
+					struct cmsghdr* cmsg = CMSG_FIRSTHDR(&hdr);
+					cmsg->cmsg_level = IPPROTO_UDP;
+					cmsg->cmsg_type = UDP_SEGMENT;
+					cmsg->cmsg_len = CMSG_LEN(sizeof(Uint16));
+					Uint16 segment_size = dgrams[i].size;
+					memcpy(CMSG_DATA(cmsg),&segment_size,sizeof(Uint16));
+				}
+			}
+#endif
+			hdr.msg_iovlen = n;
+			segments[num_msgs++] = n;
+			i += n;
+		}
+		
+		int ret = ::sendmmsg(m_fd,msgs,num_msgs,0);
+		if (ret < 0)
+		{
+			if (errno == EAGAIN || errno == EWOULDBLOCK)
+				return SEND_WOULD_BLOCK;
+			
+			if (segments[0] > 1 && (errno == EIO || errno == EINVAL || errno == EMSGSIZE))
+			{
+				// The kernel refused to segment the first message, EIO means
+				// the device can't do it at all, so stop using segmentation offload
+				if (errno == EIO)
+				{
+					Out(SYS_CON|LOG_NOTICE) << "UDP segmentation offload not supported, disabling it" << endl;
+					m_gso = false;
+					return sendToBatch(dgrams,segments[0]);
+				}
+				
+				m_gso = false;
+				ret = sendToBatch(dgrams,segments[0]);
+				m_gso = true;
+				return ret;
+			}
+			else if (errno == EMSGSIZE)
+			{
+				// Bigger then the MTU of the interface and the don't fragment bit is set
+				return SEND_TOO_BIG;
+			}
+			
+			Out(SYS_CON|LOG_DEBUG) << "Send error : " << QString(strerror(errno)) << endl;
+			return SEND_FAILURE;
+		}
+		
+		int sent = 0;
+		for (int j = 0;j < ret;j++)
+			sent += segments[j];
+		return sent;
+#else
+		for (int i = 0;i < count;i++)
+		{
+			int ret = sendTo(dgrams[i].data,dgrams[i].size,dgrams[i].addr);
+			if (ret <= 0)
+				return i > 0 ? i : ret;
+		}
+		return count;
+#endif
+	}
+	
+	int Socket::recvFromBatch(Datagram* dgrams,int count)
+	{
+#ifdef HAVE_RECVMMSG
+		struct mmsghdr msgs[MAX_DATAGRAM_BATCH];
+		struct iovec iov[MAX_DATAGRAM_BATCH];
+		struct sockaddr_storage ss[MAX_DATAGRAM_BATCH];
+#ifdef UDP_GRO
+		char control[MAX_DATAGRAM_BATCH][CMSG_SPACE(sizeof(int))];
+#endif
+		if (count > MAX_DATAGRAM_BATCH)
+			count = MAX_DATAGRAM_BATCH;
+		
+		memset(msgs,0,sizeof(struct mmsghdr) * count);
+		for (int i = 0;i < count;i++)
+		{
+			iov[i].iov_base = dgrams[i].data;
+			iov[i].iov_len = dgrams[i].size;
+			msgs[i].msg_hdr.msg_name = &ss[i];
+			msgs[i].msg_hdr.msg_namelen = sizeof(struct sockaddr_storage);
+			msgs[i].msg_hdr.msg_iov = &iov[i];
+			msgs[i].msg_hdr.msg_iovlen = 1;
+#ifdef UDP_GRO
+			if (m_gro)
+			{
+				msgs[i].msg_hdr.msg_control = control[i];
+				msgs[i].msg_hdr.msg_controllen = sizeof(control[i]);
+			}
+#endif
+		}
+		
+		int ret = ::recvmmsg(m_fd,msgs,count,MSG_DONTWAIT,0);
+		if (ret < 0)
+		{
+			if (errno != EAGAIN && errno != EWOULDBLOCK)
+				Out(SYS_CON|LOG_DEBUG) << "Receive error : " << QString(strerror(errno)) << endl;
+			return 0;
+		}
+		
+		for (int i = 0;i < ret;i++)
+		{
+			dgrams[i].size = (msgs[i].msg_hdr.msg_flags & MSG_TRUNC) ? -1 : (int)msgs[i].msg_len;
+			dgrams[i].addr = ss[i];
+			dgrams[i].segment_size = 0;
+#ifdef UDP_GRO
+			if (!m_gro)
+				continue;
+			
+			struct cmsghdr* cmsg = CMSG_FIRSTHDR(&msgs[i].msg_hdr);
+			for (;cmsg;cmsg = CMSG_NXTHDR(&msgs[i].msg_hdr,cmsg))
+			{
+				if (cmsg->cmsg_level == IPPROTO_UDP && cmsg->cmsg_type == UDP_GRO)
+				{
+					int segment_size = 0;
+					memcpy(&segment_size,CMSG_DATA(cmsg),sizeof(int));
+					if (segment_size < dgrams[i].size)
+						dgrams[i].segment_size = segment_size;
+					break;
+				}
+			}
+#endif
+		}
+		return ret;
+#else
+		// the first datagram may be 0 bytes in size, so always read one
+		int i = 0;
+		Uint32 ba = 0;
+		while (i < count && ((ba = bytesAvailable()) > 0 || i == 0))
+		{
+			int ret = recvFrom(dgrams[i].data,dgrams[i].size,dgrams[i].addr);
+			dgrams[i].size = ba > (Uint32)ret ? -1 : ret;
+			dgrams[i].segment_size = 0;
+			i++;
+		}
+		return i;
+#endif
+	}
+	
 	int Socket::accept(Address & a)
 	{
 		struct sockaddr_storage ss;
@@ -367,6 +665,103 @@ namespace net
 		return true;
 	}
 	
+	bool Socket::setDontFragment(bool on)
+	{
+		int val = 0;
+		int ret = -1;
+		bool supported = false;
+		if (m_ip_version == 4)
+		{
+#if defined(IP_MTU_DISCOVER) && defined(IP_PMTUDISC_PROBE)
+			// probe mode sets the DF bit, but doesn't limit datagrams to the cached path MTU
+			val = on ? IP_PMTUDISC_PROBE : IP_PMTUDISC_DONT;
+			ret = setsockopt(m_fd,IPPROTO_IP,IP_MTU_DISCOVER,&val,sizeof(val));
+			supported = true;
+#elif defined(IP_DONTFRAG)
+			val = on ? 1 : 0;
+			ret = setsockopt(m_fd,IPPROTO_IP,IP_DONTFRAG,&val,sizeof(val));
+			supported = true;
+#endif
+		}
+		else
+		{
+#if defined(IPV6_MTU_DISCOVER) && defined(IPV6_PMTUDISC_PROBE)
+			val = on ? IPV6_PMTUDISC_PROBE : IPV6_PMTUDISC_DONT;
+			ret = setsockopt(m_fd,IPPROTO_IPV6,IPV6_MTU_DISCOVER,&val,sizeof(val));
+			supported = true;
+#elif defined(IPV6_DONTFRAG)
+			val = on ? 1 : 0;
+			ret = setsockopt(m_fd,IPPROTO_IPV6,IPV6_DONTFRAG,&val,sizeof(val));
+			supported = true;
+#endif
+		}
+		
+		if (!supported)
+		{
+			Out(SYS_CON|LOG_NOTICE) << "Setting the don't fragment bit is not supported" << endl;
+			return false;
+		}
+		else if (ret < 0)
+		{
+			Out(SYS_CON|LOG_NOTICE) << QString("Failed to set the don't fragment bit : %1").arg(strerror(errno)) << endl;
+			return false;
+		}
+		
+		return true;
+	}
+	
+	int Socket::maxDatagramSize(const Address & addr)
+	{
+		int ret = 0;
+#if defined(IP_MTU) && defined(IPV6_MTU)
+		// connecting an UDP socket doesn't send anything, but it does look up the route
+		int fd = ::socket(addr.ipVersion() == 4 ? PF_INET : PF_INET6,SOCK_DGRAM,0);
+		if (fd < 0)
+			return 0;
+		
+		int alen = 0;
+		struct sockaddr_storage ss;
+		addr.toSocketAddress(&ss,alen);
+		int mtu = 0;
+		socklen_t len = sizeof(mtu);
+		if (::connect(fd,(struct sockaddr*)&ss,alen) == 0)
+		{
+			if (addr.ipVersion() == 4 && getsockopt(fd,IPPROTO_IP,IP_MTU,&mtu,&len) == 0)
+				ret = mtu - 28; // IPv4 and UDP header
+			else if (addr.ipVersion() == 6 && getsockopt(fd,IPPROTO_IPV6,IPV6_MTU,&mtu,&len) == 0)
+				ret = mtu - 48; // IPv6 and UDP header
+		}
+		::close(fd);
+#else
+		Q_UNUSED(addr);
+#endif
+		return ret > 0 ? ret : 0;
+	}
+	
+	bool Socket::setSegmentationOffload(bool on)
+	{
+		m_gso = m_gro = false;
+#ifdef UDP_SEGMENT
+		if (on)
+		{
+			// a segment size of 0 turns it off for the socket, but it fails if the kernel doesn't know about it
+			int val = 0;
+			m_gso = setsockopt(m_fd,IPPROTO_UDP,UDP_SEGMENT,&val,sizeof(val)) == 0;
+		}
+#endif
+#ifdef UDP_GRO
+		int val = on ? 1 : 0;
+		m_gro = setsockopt(m_fd,IPPROTO_UDP,UDP_GRO,&val,sizeof(val)) == 0 && on;
+#endif
+		if (on && !m_gso && !m_gro)
+		{
+			Out(SYS_CON|LOG_NOTICE) << "UDP segmentation offload is not supported" << endl;
+			return false;
+		}
+		
+		return true;
+	}
+	
 	Uint32 Socket::bytesAvailable() const
 	{
 		int ret = 0;
@@ -428,6 +823,7 @@ namespace net
 	int Socket::take()
 	{
 		int ret = m_fd;
+		Poll::unregister(m_fd,poll_key);
 		m_fd = -1;
 		return ret;
 	}
@@ -438,9 +834,9 @@ namespace net
 		if (m_fd >= 0)
 		{
 			if (mode == Poll::OUTPUT)
-				w_poll_index = p->add(m_fd,mode);
+				w_poll_index = p->add(m_fd,mode,poll_key);
 			else
-				r_poll_index = p->add(m_fd,mode);
+				r_poll_index = p->add(m_fd,mode,poll_key);
 		}
 	}
 
@@ -29,6 +29,18 @@ namespace net
 {
 	const int SEND_FAILURE = 0;
 	const int SEND_WOULD_BLOCK = -1;
+	const int SEND_TOO_BIG = -2;
+	
+	/**
+		A datagram for batched UDP I/O.
+	*/
+	struct Datagram
+	{
+		bt::Uint8* data;
+		int size; // when receiving, the size of the buffer before, and the size of the datagram after
+		Address addr;
+		int segment_size; // when receiving, the size of the coalesced datagrams in the buffer, 0 if there is only one
+	};
 	
 	/**
 		@author Joris Guisson <joris.guisson@gmail.com>
@@ -47,6 +59,8 @@ namespace net
 		virtual Uint32 bytesAvailable() const;
 		virtual int send(const bt::Uint8* buf,int len);
 		virtual int recv(bt::Uint8* buf,int max_len);
+		virtual int sendFile(const bt::Uint8* header,bt::Uint32 header_len,int fd,bt::Uint64 off,bt::Uint32 len);
+		virtual int sendv(const SendBuffer* bufs,int count);
 		virtual bool ok() const {return m_fd >= 0;}
 		virtual int fd() const {return m_fd;}
 		virtual bool setTOS(unsigned char type_of_service);
@@ -64,12 +78,62 @@ namespace net
 		int sendTo(const bt::Uint8* buf,int size,const Address & addr);
 		int recvFrom(bt::Uint8* buf,int max_size,Address & addr);
 		
+		/**
+		 * Send multiple datagrams, with one system call if sendmmsg is available.
+		 * @param dgrams The datagrams
+		 * @param count The number of datagrams
+		 * @return The number of datagrams sent, SEND_WOULD_BLOCK if the socket buffer is full,
+		 * SEND_TOO_BIG if the first datagram is bigger then the MTU and may not be fragmented,
+		 * or SEND_FAILURE if the first datagram could not be sent
+		 */
+		int sendToBatch(const Datagram* dgrams,int count);
+		
+		/**
+		 * Receive multiple datagrams, with one system call if recvmmsg is available.
+		 * Datagrams which did not fit in their buffer get size -1, their data is lost.
+		 * Check bytesAvailable() first to read a big datagram with a buffer of the right size.
+		 * @param dgrams The datagrams, data and size should be filled in
+		 * @param count The number of datagrams
+		 * @return The number of datagrams received
+		 */
+		int recvFromBatch(Datagram* dgrams,int count);
+		
+		/**
+		 * Set the don't fragment bit on outgoing datagrams, needed for path MTU discovery.
+		 * Where the OS allows it, the path MTU the kernel has cached is ignored,
+		 * so datagrams bigger then it can still be sent as probes.
+		 * @param on On or not
+		 * @return true upon success, false otherwise
+		 */
+		bool setDontFragment(bool on);
+		
+		/**
+		 * Enable UDP segmentation and receive offload (only available on Linux).
+		 * With segmentation offload, sendToBatch passes consecutive datagrams of the same size
+		 * to the same address to the kernel in one go. With receive offload, recvFromBatch
+		 * can return multiple datagrams in one buffer, see Datagram::segment_size.
+		 * @param on On or not
+		 * @return true if one of them is supported
+		 */
+		bool setSegmentationOffload(bool on);
+		
+		/// Whether or not recvFromBatch can return coalesced datagrams
+		bool receiveOffload() const {return m_gro;}
+		
 		bool isIPv4() const {return m_ip_version == 4;}
 		bool isIPv6() const {return m_ip_version == 6;}
 
 		/// Take the filedescriptor from the socket
 		int take();
 		
+		/**
+		 * Get the biggest UDP payload which can be sent to an address without fragmenting it,
+		 * based on the MTU of the interface the route to the address goes over.
+		 * @param addr The address
+		 * @return The size, or 0 if it is not known
+		 */
+		static int maxDatagramSize(const Address & addr);
+		
 		typedef QSharedPointer<Socket> Ptr;
 		
 	private:
@@ -80,6 +144,9 @@ namespace net
 		int m_ip_version;
 		int r_poll_index;
 		int w_poll_index;
+		bt::Uint32 poll_key;
+		bool m_gso;
+		bool m_gro;
 	};
 
 }
@@ -32,6 +32,32 @@ namespace net
 	{
 
 	}
+	
+	int SocketDevice::sendFile(const bt::Uint8* header,bt::Uint32 header_len,int fd,bt::Uint64 off,bt::Uint32 len)
+	{
+		Q_UNUSED(header);
+		Q_UNUSED(header_len);
+		Q_UNUSED(fd);
+		Q_UNUSED(off);
+		Q_UNUSED(len);
+		return -1;
+	}
+	
+	int SocketDevice::sendv(const SendBuffer* bufs,int count)
+	{
+		int sent = 0;
+		for (int i = 0;i < count;i++)
+		{
+			int ret = send(bufs[i].data,bufs[i].len);
+			if (ret <= 0)
+				break;
+			
+			sent += ret;
+			if ((bt::Uint32)ret < bufs[i].len)
+				break;
+		}
+		return sent;
+	}
 
 }
 
@@ -28,6 +28,13 @@
 
 namespace net
 {
+	/// A buffer for vectored sends
+	struct SendBuffer
+	{
+		const bt::Uint8* data;
+		bt::Uint32 len;
+	};
+	
 	class SocketDevice
 	{
 	public:
@@ -47,6 +54,27 @@ namespace net
 		virtual bool ok() const = 0;
 		virtual int send(const bt::Uint8* buf,int len) = 0;
 		virtual int recv(bt::Uint8* buf,int max_len) = 0;
+		
+		/**
+		 * Send a header from memory followed by data straight from a file, without copying
+		 * the file data into user space. Not supported by default.
+		 * @param header The header
+		 * @param header_len Length of the header (can be 0)
+		 * @param fd The file descriptor of the file
+		 * @param off Offset of the data in the file
+		 * @param len Length of the data
+		 * @return The number of bytes sent (header included), 0 if the socket is full or -1 if not supported
+		 */
+		virtual int sendFile(const bt::Uint8* header,bt::Uint32 header_len,int fd,bt::Uint64 off,bt::Uint32 len);
+		
+		/**
+		 * Send multiple buffers in one go. The default implementation calls send
+		 * for each buffer, until one is not sent completely.
+		 * @param bufs The buffers
+		 * @param count The number of buffers
+		 * @return The number of bytes sent
+		 */
+		virtual int sendv(const SendBuffer* bufs,int count);
 		virtual void close() = 0;
 		virtual void setBlocking(bool on) = 0;
 		virtual Uint32 bytesAvailable() const = 0;
@@ -18,7 +18,6 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
  ***************************************************************************/
 #include "socketgroup.h"
-#include <math.h>
 #include <util/log.h>
 #include <util/functions.h>
 #include "trafficshapedsocket.h"
@@ -27,12 +26,14 @@ using namespace bt;
 
 namespace net
 {
+	// the smallest amount a socket gets in a round, to avoid lots of tiny writes
+	const Uint32 MIN_QUANTUM = 1500;
 
-	SocketGroup::SocketGroup(Uint32 limit,Uint32 assured_rate) : limit(limit),assured_rate(assured_rate)
+	SocketGroup::SocketGroup(TokenBucket::Ptr limit,TokenBucket::Ptr assured) : limit_bucket(limit),assured_bucket(assured),limit(0)
 	{
-		prev_run_time = bt::CurrentTime();
 		group_allowance = 0;
 		group_assured = 0;
+		round = 0;
 	}
 
 
@@ -58,38 +59,51 @@ namespace net
 	
 	bool SocketGroup::processLimited(bool up,bt::TimeStamp now,Uint32 & allowance)
 	{
-		Uint32 bslot = allowance / sockets.size() + 1;
-	
+		if (sockets.empty())
+			return false;
+		
+		Uint32 quantum = qMax<Uint32>(allowance / sockets.size(),MIN_QUANTUM);
+		
+		// start each round at another socket, so small allowances do not always go to the same sockets
+		Uint32 start = round++ % sockets.size();
 		std::list<TrafficShapedSocket*>::iterator itr = sockets.begin();
+		while (start-- > 0)
+			itr++;
+		sockets.splice(sockets.end(),sockets,sockets.begin(),itr);
+		itr = sockets.begin();
 		
 		// while we can send and there are sockets left to send
 		while (sockets.size() > 0 && allowance > 0)
 		{
-			Uint32 as = bslot;
-			if (as > allowance)
-				as = allowance;
-			
 			TrafficShapedSocket* s = *itr;
 			if (s)
 			{
+				Uint32 & deficit = s->deficit(up);
+				deficit = qMin(deficit + quantum,2 * quantum);
+				Uint32 as = qMin(deficit,allowance);
+				
 				Uint32 ret = 0;
 				if (up)
 					ret = s->write(as,now);
 				else
 					ret = s->read(as,now);
 				
+				deficit -= qMin(ret,deficit);
+				if (ret > allowance)
+					allowance = 0;
+				else
+					allowance -= ret;
+				
 				// if this socket did what it was supposed to do, 
 				// it can have another go if stuff is leftover
-				// if it doesn't, we erase it from the list
+				// if it doesn't, it has nothing more to do, so it loses its deficit
 				if (ret != as) 
+				{
+					deficit = 0;
 					itr = sockets.erase(itr);
+				}
 				else
 					itr++;
-			
-				if (ret > allowance)
-					allowance = 0;
-				else
-					allowance -= ret;
 			}
 			else
 			{
@@ -115,19 +129,49 @@ namespace net
 		return process(true,now,global_allowance);
 	}
 	
-	void SocketGroup::calcAllowance(bt::TimeStamp now)
+	void SocketGroup::setBuckets(TokenBucket::Ptr limit,TokenBucket::Ptr assured)
 	{
+		giveBackAllowance();
+		limit_bucket = limit;
+		assured_bucket = assured;
+	}
+	
+	void SocketGroup::calcAllowance(bt::Uint64 now,Uint32 num_shards)
+	{
+		// take this shard's share, what is not used is given back afterwards
+		limit = limit_bucket->rate();
 		if (limit > 0)
-			group_allowance = (Uint32)ceil(1.0 * limit * (now - prev_run_time) * 0.001);
+			group_allowance = limit_bucket->take(qMax<Uint32>(limit_bucket->capacity() / num_shards,1),now);
 		else
 			group_allowance = 0;
 		
-		if (assured_rate > 0)
-			group_assured = (Uint32)ceil(1.0 * assured_rate * (now - prev_run_time) * 0.001);
+		if (assured_bucket->rate() > 0)
+			group_assured = assured_bucket->take(qMax<Uint32>(assured_bucket->capacity() / num_shards,1),now);
 		else
 			group_assured = 0;
+	}
+	
+	Uint64 SocketGroup::timeUntilAllowed(Uint32 amount,bt::Uint64 now)
+	{
+		if (limit_bucket->rate() == 0)
+			return 0;
 		
-		prev_run_time = now;
+		// the assured rate also allows the group to go
+		Uint64 t = limit_bucket->timeUntilAvailable(amount,now);
+		if (t > 0 && assured_bucket->rate() > 0)
+			t = qMin(t,assured_bucket->timeUntilAvailable(amount,now));
+		return t;
+	}
+	
+	void SocketGroup::giveBackAllowance()
+	{
+		if (limit > 0 && group_allowance > 0)
+			limit_bucket->giveBack(group_allowance);
+		if (group_assured > 0)
+			assured_bucket->giveBack(group_assured);
+		
+		group_allowance = 0;
+		group_assured = 0;
 	}
 	
 	bool SocketGroup::process(bool up,bt::TimeStamp now,Uint32 & global_allowance)
@@ -22,6 +22,7 @@
 		
 #include <list>
 #include <util/constants.h>
+#include <net/tokenbucket.h>
 
 namespace net
 {
@@ -31,17 +32,23 @@ namespace net
 
 	/**
 		@author Joris Guisson <joris.guisson@gmail.com>
+		
+		The limit and assured rate of a group are token buckets, which are shared
+		with the same group in other shards. The allowance is divided over the sockets
+		with deficit round robin, what a socket could not use because the allowance ran out
+		is remembered, and the next round starts at another socket.
 	*/
 	class SocketGroup
 	{
+		TokenBucket::Ptr limit_bucket;
+		TokenBucket::Ptr assured_bucket;
 		Uint32 limit;
-		Uint32 assured_rate;
 		std::list<TrafficShapedSocket*> sockets;
-		bt::TimeStamp prev_run_time;
 		Uint32 group_allowance;
 		Uint32 group_assured;
+		Uint32 round;
 	public:
-		SocketGroup(Uint32 limit,Uint32 assured_rate);
+		SocketGroup(TokenBucket::Ptr limit,TokenBucket::Ptr assured);
 		virtual ~SocketGroup();
 		
 		/// Clear the lists of sockets
@@ -67,30 +74,45 @@ namespace net
 		bool upload(Uint32 & global_allowance,bt::TimeStamp now);
 		
 		/**
-		 * Set the group limit in bytes per sec
-		 * @param lim The limit
-		 */
-		void setLimit(Uint32 lim) {limit = lim;}
-		
-		/**
-		 * Set the assured rate for the gorup in bytes per sec
-		 * @param as The assured rate
+		 * Set the buckets of the group limit and assured rate
+		 * @param limit Bucket of the limit
+		 * @param assured Bucket of the assured rate
 		 */
-		void setAssuredRate(Uint32 as) {assured_rate = as;}
+		void setBuckets(TokenBucket::Ptr limit,TokenBucket::Ptr assured);
 		
 		/// Get the number of sockets 
 		Uint32 numSockets() const {return sockets.size();}
 		
 		/**
-		 * Calculate the allowance for this group
-		 * @param now Current timestamp
+		 * Calculate the allowance for this group, by taking tokens from the buckets
+		 * @param now Current time in microseconds (see TokenBucket::now)
+		 * @param num_shards Number of shards taking from the same buckets, each one takes its share of them
+		 */
+		void calcAllowance(bt::Uint64 now,Uint32 num_shards);
+		
+		/**
+		 * Calculate how long it takes before the group can transfer data again.
+		 * @param amount The amount of data to wait for
+		 * @param now Current time in microseconds
+		 * @return The time in microseconds, 0 if the group can go now
 		 */
-		void calcAllowance(bt::TimeStamp now);
+		bt::Uint64 timeUntilAllowed(Uint32 amount,bt::Uint64 now);
 		
 		/**
 		 * Get the assured allowance .
 		 */
 		Uint32 getAssuredAllowance() const {return group_assured;}
+		
+		/**
+		 * Set how much of the assured allowance is left after doing the group.
+		 * @param left The amount left
+		 */
+		void assuredAllowanceLeft(Uint32 left) {group_assured = qMin(left,group_assured);}
+		
+		/**
+		 * Put the unused allowance back in the buckets.
+		 */
+		void giveBackAllowance();
 	private:
 		void processUnlimited(bool up,bt::TimeStamp now);
 		bool processLimited(bool up,bt::TimeStamp now,Uint32 & allowance);
@@ -20,26 +20,36 @@
 #include "socketmonitor.h"
 #include <math.h>
 #include <unistd.h>
+#include <QList>
+#include <QMap>
 #include <util/functions.h>
 #include <util/log.h>
 #include <torrent/globals.h>
 #include "trafficshapedsocket.h"
 #include "uploadthread.h"
 #include "downloadthread.h"
+#include "socketshard.h"
+#include "tokenbucket.h"
 
 using namespace bt;
 
 namespace net
 {
 	SocketMonitor SocketMonitor::self;
+	Uint32 SocketMonitor::num_shards = 1;
+	
+	/// The token buckets of a group, shared by all shards
+	struct GroupBuckets
+	{
+		TokenBucket::Ptr limit;
+		TokenBucket::Ptr assured;
+	};
 	
 	class SocketMonitor::Private
 	{
 	public:
-		Private(SocketMonitor* p) : mutex(QMutex::Recursive),ut(0),dt(0),next_group_id(1)
+		Private() : mutex(QMutex::Recursive),next_group_id(1),num_sockets(0),shut_down(false)
 		{
-			dt = new DownloadThread(p);
-			ut = new UploadThread(p);
 		}
 		
 		~Private()
@@ -48,14 +58,28 @@ namespace net
 		}
 		
 		void shutdown();
+		void createShards();
+		QList<SocketShard*> takeShards();
+		
+		SocketShard* shard(TrafficShapedSocket* sock) const
+		{
+			if (shards.isEmpty())
+				return 0;
+			
+			// pointers are aligned, so throw away the low bits and mix the rest
+			Uint32 h = (Uint32)((quintptr)sock >> 4) * 2654435761U;
+			return shards[(h >> 8) % shards.count()];
+		}
 		
 		QMutex mutex;
-		UploadThread* ut;
-		DownloadThread* dt;
+		QList<SocketShard*> shards;
+		QMap<Uint32,GroupBuckets> groups[2];
 		Uint32 next_group_id;
+		Uint32 num_sockets;
+		bool shut_down;
 	};
 
-	SocketMonitor::SocketMonitor() : d(new Private(this))
+	SocketMonitor::SocketMonitor() : d(new Private())
 	{
 		
 	}
@@ -73,44 +97,42 @@ namespace net
 	
 	void SocketMonitor::Private::shutdown()
 	{
-		if (ut && ut->isRunning())
+		QList<SocketShard*> tmp;
 		{
-			ut->stop();
-			ut->signalDataReady(); // kick it in the nuts, if the thread is waiting for data
-			if (!ut->wait(250))
-			{
-				ut->terminate();
-				ut->wait();
-			}
+			QMutexLocker lock(&mutex);
+			shut_down = true;
+			tmp = takeShards();
 		}
 		
-		
-		if (dt && dt->isRunning())
-		{
-			dt->stop();
-			dt->wakeUp(); // wake it up if necessary
-			if (!dt->wait(250))
-			{
-				dt->terminate();
-				dt->wait();
-			}
-		}
-		
-		delete ut;
-		delete dt;
-		ut = 0;
-		dt = 0;
+		// threads might be waiting on the mutex, so stop them without holding it
+		qDeleteAll(tmp);
 	}
-
 	
-	void SocketMonitor::lock()
+	QList<SocketShard*> SocketMonitor::Private::takeShards()
 	{
-		d->mutex.lock();
+		QList<SocketShard*> tmp = shards;
+		shards.clear();
+		return tmp;
 	}
 	
-	void SocketMonitor::unlock()
+	void SocketMonitor::Private::createShards()
 	{
-		d->mutex.unlock();
+		for (Uint32 i = 0;i < SocketMonitor::num_shards;i++)
+		{
+			SocketShard* s = new SocketShard(i,SocketMonitor::num_shards);
+			for (int type = UPLOAD_GROUP;type <= DOWNLOAD_GROUP;type++)
+			{
+				QMap<Uint32,GroupBuckets>::iterator g = groups[type].begin();
+				while (g != groups[type].end())
+				{
+					s->addGroup((GroupType)type,g.key(),g.value().limit,g.value().assured);
+					g++;
+				}
+			}
+			shards.append(s);
+		}
+		
+		Out(SYS_CON|LOG_DEBUG) << "SocketMonitor: using " << shards.count() << " shards" << endl;
 	}
 	
 	void SocketMonitor::setDownloadCap(Uint32 bytes_per_sec)
@@ -137,97 +159,130 @@ namespace net
 	
 	void SocketMonitor::setSleepTime(Uint32 sleep_time)
 	{
-		DownloadThread::setSleepTime(sleep_time);
-		UploadThread::setSleepTime(sleep_time);
+		// the network threads wake up when the token buckets allow it, they no longer sleep
+		Q_UNUSED(sleep_time);
+	}
+	
+	void SocketMonitor::setNumShards(Uint32 num)
+	{
+		QList<SocketShard*> tmp;
+		{
+			QMutexLocker lock(&self.d->mutex);
+			num_shards = qMax<Uint32>(num,1);
+			if (self.d->num_sockets == 0 && self.d->shards.count() != (int)num_shards)
+				tmp = self.d->takeShards();
+		}
+		qDeleteAll(tmp);
 	}
 	
 	void SocketMonitor::add(TrafficShapedSocket* sock)
 	{
-		QMutexLocker lock(&d->mutex);
-		
-		if (!d->dt || !d->ut)
-			return;
-		
-		bool start_threads = sockets.size() == 0;
-		sockets.push_back(sock);
-		
-		if (start_threads)
+		SocketShard* s = 0;
+		QList<SocketShard*> old;
 		{
-			Out(SYS_CON|LOG_DEBUG) << "Starting socketmonitor threads" << endl;
-				
-			if (!d->dt->isRunning())
-				d->dt->start(QThread::IdlePriority);
-			if (!d->ut->isRunning())
-				d->ut->start(QThread::IdlePriority);
+			QMutexLocker lock(&d->mutex);
+			if (d->shut_down)
+				return;
+			
+			if (d->num_sockets == 0 && d->shards.count() != (int)num_shards)
+			{
+				old = d->takeShards();
+				d->createShards();
+			}
+			
+			d->num_sockets++;
+			s = d->shard(sock);
 		}
-		// wake up download thread so that it can start polling the new socket
-		d->dt->wakeUp();
+		
+		qDeleteAll(old);
+		// The shard is locked by its threads while they process sockets, so add it without holding our mutex
+		s->add(sock);
 	}
 	
 	void SocketMonitor::remove(TrafficShapedSocket* sock)
 	{
-		QMutexLocker lock(&d->mutex);
-		if (sockets.size() == 0)
-			return;
+		SocketShard* s = 0;
+		{
+			QMutexLocker lock(&d->mutex);
+			if (d->num_sockets == 0)
+				return;
+			
+			s = d->shard(sock);
+		}
 		
-		sockets.remove(sock);
+		if (s && s->remove(sock))
+		{
+			QMutexLocker lock(&d->mutex);
+			d->num_sockets--;
+		}
 	}
 	
 	void SocketMonitor::signalPacketReady()
 	{
-		if (d->ut)
-			d->ut->signalDataReady();
+		QMutexLocker lock(&d->mutex);
+		foreach (SocketShard* s,d->shards)
+			s->signalPacketReady();
 	}
 	
-	Uint32 SocketMonitor::newGroup(GroupType type,Uint32 limit,Uint32 assured_rate)
+	void SocketMonitor::signalPacketReady(TrafficShapedSocket* sock)
 	{
 		QMutexLocker lock(&d->mutex);
-		if (!d->dt || !d->ut)
-			return 0;
+		SocketShard* s = d->shard(sock);
+		if (s)
+			s->signalPacketReady(sock);
+	}
+	
+	Uint32 SocketMonitor::newGroup(GroupType type,Uint32 limit,Uint32 assured_rate)
+	{
+		QList<SocketShard*> shards;
+		GroupBuckets g;
+		Uint32 gid = 0;
+		{
+			QMutexLocker lock(&d->mutex);
+			if (d->shut_down)
+				return 0;
+			
+			gid = d->next_group_id++;
+			g.limit = TokenBucket::Ptr(new TokenBucket(limit));
+			g.assured = TokenBucket::Ptr(new TokenBucket(assured_rate));
+			d->groups[type].insert(gid,g);
+			shards = d->shards;
+		}
 		
-		Uint32 gid = d->next_group_id++;
-		if (type == UPLOAD_GROUP)
-			d->ut->addGroup(gid,limit,assured_rate);
-		else
-			d->dt->addGroup(gid,limit,assured_rate);
+		foreach (SocketShard* s,shards)
+			s->addGroup(type,gid,g.limit,g.assured);
 		
 		return gid;
 	}
 		
 	void SocketMonitor::setGroupLimit(GroupType type,Uint32 gid,Uint32 limit)
 	{
+		// buckets are shared by all shards
 		QMutexLocker lock(&d->mutex);
-		if (!d->dt || !d->ut)
-			return;
-		
-		if (type == UPLOAD_GROUP)
-			d->ut->setGroupLimit(gid,limit);
-		else
-			d->dt->setGroupLimit(gid,limit);
+		QMap<Uint32,GroupBuckets>::iterator i = d->groups[type].find(gid);
+		if (i != d->groups[type].end())
+			i.value().limit->setRate(limit);
 	}
 	
 	void SocketMonitor::setGroupAssuredRate(GroupType type,Uint32 gid,Uint32 as)
 	{
 		QMutexLocker lock(&d->mutex);
-		if (!d->dt || !d->ut)
-			return;
-		
-		if (type == UPLOAD_GROUP)
-			d->ut->setGroupAssuredRate(gid,as);
-		else
-			d->dt->setGroupAssuredRate(gid,as);
+		QMap<Uint32,GroupBuckets>::iterator i = d->groups[type].find(gid);
+		if (i != d->groups[type].end())
+			i.value().assured->setRate(as);
 	}
 		
 	void SocketMonitor::removeGroup(GroupType type,Uint32 gid)
 	{
-		QMutexLocker lock(&d->mutex);
-		if (!d->dt || !d->ut)
-			return;
+		QList<SocketShard*> shards;
+		{
+			QMutexLocker lock(&d->mutex);
+			d->groups[type].remove(gid);
+			shards = d->shards;
+		}
 		
-		if (type == UPLOAD_GROUP)
-			d->ut->removeGroup(gid);
-		else
-			d->dt->removeGroup(gid);
+		foreach (SocketShard* s,shards)
+			s->removeGroup(type,gid);
 	}
 
 }
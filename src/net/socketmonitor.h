@@ -21,7 +21,6 @@
 #define NETSOCKETMONITOR_H
 
 
-#include <list>
 #include <qmutex.h>
 #include <util/constants.h>
 #include <ktorrent_export.h>
@@ -32,8 +31,6 @@ namespace net
 	using bt::Uint32;
 	
 	class TrafficShapedSocket;
-	class UploadThread;
-	class DownloadThread;
 	
 	
 
@@ -41,7 +38,9 @@ namespace net
 	 * @author Joris Guisson <joris.guisson@gmail.com>
 	 * 
 	 * Monitors all sockets for upload and download traffic.
-	 * It uses two threads to do this.
+	 * The sockets are spread over a number of shards (see SocketShard), each shard has
+	 * an upload and a download thread. Global and group limits are shared between the
+	 * shards using token buckets.
 	*/
 	class KTORRENT_EXPORT SocketMonitor 
 	{
@@ -52,26 +51,15 @@ namespace net
 		/// Add a new socket, will start the threads if necessary
 		void add(TrafficShapedSocket* sock);
 		
-		/// Remove a socket, will stop threads if no more sockets are left
+		/// Remove a socket
 		void remove(TrafficShapedSocket* sock);
 		
-		typedef std::list<TrafficShapedSocket*>::iterator Itr;
-		
-		/// Get the begin of the list of sockets
-		Itr begin() {return sockets.begin();}
-		
-		/// Get the end of the list of sockets
-		Itr end() {return sockets.end();}
-		
-		/// lock the monitor
-		void lock();
-		
-		/// unlock the monitor
-		void unlock();
-		
-		/// Tell upload thread a packet is ready
+		/// Tell all upload threads a packet is ready
 		void signalPacketReady();
 		
+		/// Tell the upload thread of the shard of a socket, that the socket has a packet ready
+		void signalPacketReady(TrafficShapedSocket* sock);
+		
 		enum GroupType
  		{
  			UPLOAD_GROUP,
@@ -120,14 +108,25 @@ namespace net
 		static Uint32 getDownloadCap();
 		static void setUploadCap(Uint32 bytes_per_sec);
 		static Uint32 getUploadCap();
+		/// Obsolete, kept for compatibility, limited sockets are woken up when the limits allow it
 		static void setSleepTime(Uint32 sleep_time);
 		static SocketMonitor & instance() {return self;}
 		
+		/**
+		 * Set the number of shards (pairs of upload and download threads). This takes effect
+		 * the next time the monitor has no sockets.
+		 * @param num The number of shards, minimum is 1
+		 */
+		static void setNumShards(Uint32 num);
+		
+		/// Get the number of shards
+		static Uint32 numShards() {return num_shards;}
+		
 	private:
 		class Private;
 		Private* d;
-		std::list<TrafficShapedSocket*> sockets;
 		static SocketMonitor self;
+		static Uint32 num_shards;
 	};
 
 }
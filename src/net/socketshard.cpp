@@ -0,0 +1,188 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+#include "socketshard.h"
+#include <util/log.h>
+#include "uploadthread.h"
+#include "downloadthread.h"
+#include "trafficshapedsocket.h"
+
+using namespace bt;
+
+namespace net
+{
+
+	SocketShard::SocketShard(Uint32 id,Uint32 num_shards) : shard_id(id),num_shards(num_shards),mutex(QMutex::Recursive),ut(0),dt(0)
+	{
+		dt = new DownloadThread(this);
+		ut = new UploadThread(this);
+	}
+
+
+	SocketShard::~SocketShard()
+	{
+		shutdown();
+	}
+	
+	void SocketShard::shutdown()
+	{
+		if (ut && ut->isRunning())
+		{
+			ut->stop();
+			ut->signalDataReady(); // kick it in the nuts, if the thread is waiting for data
+			if (!ut->wait(250))
+			{
+				ut->terminate();
+				ut->wait();
+			}
+		}
+		
+		
+		if (dt && dt->isRunning())
+		{
+			dt->stop();
+			dt->wakeUp(); // wake it up if necessary
+			if (!dt->wait(250))
+			{
+				dt->terminate();
+				dt->wait();
+			}
+		}
+		
+		delete ut;
+		delete dt;
+		ut = 0;
+		dt = 0;
+	}
+	
+	void SocketShard::lock()
+	{
+		mutex.lock();
+	}
+	
+	void SocketShard::unlock()
+	{
+		mutex.unlock();
+	}
+	
+	void SocketShard::add(TrafficShapedSocket* sock)
+	{
+		QMutexLocker lock(&mutex);
+		if (!dt || !ut)
+			return;
+		
+		bool start_threads = sockets.size() == 0;
+		sockets.push_back(sock);
+		if (sock->socketDevice() && sock->socketDevice()->fd() >= 0)
+		{
+			Uint32 idx = 0;
+			if (free_slots.empty())
+			{
+				idx = slots.size();
+				slots.push_back(std::make_pair(sock,(Uint32)1));
+			}
+			else
+			{
+				idx = free_slots.back();
+				free_slots.pop_back();
+				slots[idx].first = sock;
+			}
+			cookies.insert(sock,((Uint64)slots[idx].second << 32) | idx);
+			// the download thread watches it right away, the upload thread once it has something to send
+			dt->socketChanged(sock);
+			ut->signalDataReady(sock);
+		}
+		else
+			unwatched.push_back(sock);
+		
+		if (start_threads)
+		{
+			Out(SYS_CON|LOG_DEBUG) << "Starting threads of socket shard " << shard_id << endl;
+			
+			if (!dt->isRunning())
+				dt->start(QThread::IdlePriority);
+			if (!ut->isRunning())
+				ut->start(QThread::IdlePriority);
+		}
+		// wake up download thread so that it can start polling the new socket
+		dt->wakeUp();
+	}
+	
+	bool SocketShard::remove(TrafficShapedSocket* sock)
+	{
+		QMutexLocker lock(&mutex);
+		Uint32 before = sockets.size();
+		sockets.remove(sock);
+		unwatched.remove(sock);
+		
+		QHash<TrafficShapedSocket*,Uint64>::iterator i = cookies.find(sock);
+		if (i != cookies.end())
+		{
+			Uint32 idx = (Uint32)(i.value() & 0xFFFFFFFF);
+			slots[idx].first = 0;
+			// the cookie ends up in an epoll_event, which only has room for 63 bits
+			slots[idx].second = (slots[idx].second + 1) & 0x7FFFFFFF;
+			if (slots[idx].second == 0)
+				slots[idx].second = 1;
+			free_slots.push_back(idx);
+			cookies.erase(i);
+		}
+		return sockets.size() != before;
+	}
+	
+	TrafficShapedSocket* SocketShard::find(Uint64 cookie) const
+	{
+		Uint32 idx = (Uint32)(cookie & 0xFFFFFFFF);
+		if (idx >= slots.size() || slots[idx].second != (Uint32)(cookie >> 32))
+			return 0;
+		else
+			return slots[idx].first;
+	}
+	
+	void SocketShard::signalPacketReady(TrafficShapedSocket* sock)
+	{
+		if (ut)
+			ut->signalDataReady(sock);
+	}
+	
+	void SocketShard::addGroup(SocketMonitor::GroupType type,Uint32 gid,TokenBucket::Ptr limit,TokenBucket::Ptr assured)
+	{
+		QMutexLocker lock(&mutex);
+		if (!dt || !ut)
+			return;
+		
+		if (type == SocketMonitor::UPLOAD_GROUP)
+			ut->addGroup(gid,limit,assured);
+		else
+			dt->addGroup(gid,limit,assured);
+	}
+	
+	void SocketShard::removeGroup(SocketMonitor::GroupType type,Uint32 gid)
+	{
+		QMutexLocker lock(&mutex);
+		if (!dt || !ut)
+			return;
+		
+		if (type == SocketMonitor::UPLOAD_GROUP)
+			ut->removeGroup(gid);
+		else
+			dt->removeGroup(gid);
+	}
+
+}
@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+#ifndef NET_SOCKETSHARD_H
+#define NET_SOCKETSHARD_H
+
+#include <list>
+#include <vector>
+#include <QHash>
+#include <QMutex>
+#include <util/constants.h>
+#include <net/socketmonitor.h>
+#include <net/tokenbucket.h>
+
+namespace net
+{
+	using bt::Uint32;
+	
+	class TrafficShapedSocket;
+	class UploadThread;
+	class DownloadThread;
+	
+	/**
+		A part of the sockets of the SocketMonitor, with its own upload and download thread.
+		Each thread has its own poll and wake up pipe. The shards only share the token buckets
+		of the global and group limits.
+	*/
+	class SocketShard
+	{
+	public:
+		SocketShard(Uint32 id,Uint32 num_shards);
+		virtual ~SocketShard();
+		
+		/// Get the ID of the shard
+		Uint32 id() const {return shard_id;}
+		
+		/// Get the number of shards which share the token buckets with this one
+		Uint32 numShards() const {return num_shards;}
+		
+		/// Add a socket, will start the threads if necessary
+		void add(TrafficShapedSocket* sock);
+		
+		/// Remove a socket, returns false if the socket was not part of the shard
+		bool remove(TrafficShapedSocket* sock);
+		
+		typedef std::list<TrafficShapedSocket*>::iterator Itr;
+		
+		/// Get the begin of the list of sockets
+		Itr begin() {return sockets.begin();}
+		
+		/// Get the end of the list of sockets
+		Itr end() {return sockets.end();}
+		
+		/// Get the begin of the list of sockets without a file descriptor, which cannot be watched (uTP sockets)
+		Itr beginUnwatched() {return unwatched.begin();}
+		
+		/// Get the end of the list of sockets without a file descriptor
+		Itr endUnwatched() {return unwatched.end();}
+		
+		/**
+		 * Get the cookie a socket is watched with by the threads, the shard must be locked.
+		 * @param sock The socket
+		 * @return The cookie, 0 if the socket is not part of the shard or cannot be watched
+		 */
+		bt::Uint64 cookie(TrafficShapedSocket* sock) const {return cookies.value(sock,0);}
+		
+		/**
+		 * Find a socket by its cookie, the shard must be locked.
+		 * @param cookie The cookie
+		 * @return The socket, 0 if it has been removed
+		 */
+		TrafficShapedSocket* find(bt::Uint64 cookie) const;
+		
+		/// lock the shard
+		void lock();
+		
+		/// unlock the shard
+		void unlock();
+		
+		/// Tell upload thread a packet is ready for a socket (0 means any socket), does not lock the shard
+		void signalPacketReady(TrafficShapedSocket* sock = 0);
+		
+		/**
+		 * Add a group or change the buckets of an existing group
+		 * @param type Upload or download group
+		 * @param gid The group ID
+		 * @param limit Bucket of the group limit
+		 * @param assured Bucket of the assured rate
+		 */
+		void addGroup(SocketMonitor::GroupType type,Uint32 gid,TokenBucket::Ptr limit,TokenBucket::Ptr assured);
+		
+		/**
+		 * Remove a group
+		 * @param type Upload or download group
+		 * @param gid The group ID
+		 */
+		void removeGroup(SocketMonitor::GroupType type,Uint32 gid);
+		
+		/// Stop the threads
+		void shutdown();
+		
+	private:
+		Uint32 shard_id;
+		Uint32 num_shards;
+		QMutex mutex;
+		std::list<TrafficShapedSocket*> sockets;
+		std::list<TrafficShapedSocket*> unwatched;
+		// the cookies are the index in slots, and the generation of the slot in the upper half,
+		// so a removed socket is not mistaken for one which got the same slot later
+		std::vector<std::pair<TrafficShapedSocket*,Uint32> > slots;
+		std::vector<Uint32> free_slots;
+		QHash<TrafficShapedSocket*,bt::Uint64> cookies;
+		UploadThread* ut;
+		DownloadThread* dt;
+	};
+
+}
+
+#endif // NET_SOCKETSHARD_H
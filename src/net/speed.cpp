@@ -19,60 +19,81 @@
  ***************************************************************************/
 #include "speed.h"
 #include <util/log.h>
-#include <util/timer.h>
-#include <util/functions.h>
 
 using namespace bt;
 
 namespace net
 {
-	const Uint64 SPEED_INTERVAL = 5000;
+	const Uint64 SPEED_INTERVAL = Speed::BUCKET_SIZE * Speed::NUM_BUCKETS;
 
-	Speed::Speed() : rate(0),bytes(0)
-	{}
+	Speed::Speed() : rate(0),bytes(0),oldest_slot(0),newest_slot(0)
+	{
+		clear();
+	}
 
 
 	Speed::~Speed()
 	{}
 	
+	void Speed::clear()
+	{
+		for (Uint32 i = 0;i < NUM_BUCKETS;i++)
+		{
+			buckets[i] = 0;
+			bucket_slot[i] = 0;
+		}
+		bytes = 0;
+	}
+	
 	void Speed::onData(Uint32 b,bt::TimeStamp ts)
 	{
-		dlrate.append(qMakePair(b,ts));
+		Uint64 slot = ts / BUCKET_SIZE;
+		Uint32 idx = slot % NUM_BUCKETS;
+		if (slot < oldest_slot || bucket_slot[idx] > slot)
+			return; // already outside the window
+		
+		if (bucket_slot[idx] != slot)
+		{
+			// the bucket still holds data of the previous round
+			bytes -= buckets[idx];
+			buckets[idx] = 0;
+			bucket_slot[idx] = slot;
+		}
+		
+		buckets[idx] += b;
 		bytes += b;
+		if (slot > newest_slot)
+			newest_slot = slot;
 	}
 
 	void Speed::update(bt::TimeStamp now)
 	{	
-		QLinkedList<QPair<Uint32,TimeStamp> >::iterator i = dlrate.begin();
-		while (i != dlrate.end())
-		{
-			QPair<Uint32,TimeStamp> & p = *i;
-			if (now - p.second > SPEED_INTERVAL || now < p.second)
-			{
-				if (bytes >= p.first) // make sure we don't wrap around
-					bytes -= p.first; // subtract bytes
-				else
-					bytes = 0;
-				i = dlrate.erase(i);
-			}
-			else
-			{	
-				// seeing that newer entries are appended, they are in the list chronologically
-				// so once we hit an entry which is in the interval, we can just break out of the loop
-				// because all following entries will be in the interval
-				break;
-			}
-		}
-			
-		if (bytes == 0)
+		Uint64 current = now / BUCKET_SIZE;
+		if (newest_slot > current)
 		{
-			rate = 0;
+			// the clock went backwards, everything we have is from the future
+			clear();
+			newest_slot = current;
+			oldest_slot = 0;
 		}
-		else
+		
+		// a bucket expires once all of it is older then the interval
+		Uint64 first_valid = current >= NUM_BUCKETS ? current - NUM_BUCKETS + 1 : 0;
+		if (first_valid > oldest_slot + NUM_BUCKETS)
+			oldest_slot = first_valid - NUM_BUCKETS; // no need to visit a slot more then once
+		
+		while (oldest_slot < first_valid)
 		{
-			//	Out() << "bytes = " << bytes << " d = " << d << endl;
-			rate =  bytes / (SPEED_INTERVAL / 1000);
+			Uint32 idx = oldest_slot % NUM_BUCKETS;
+			if (bucket_slot[idx] == oldest_slot)
+			{
+				bytes -= buckets[idx];
+				buckets[idx] = 0;
+			}
+			oldest_slot++;
 		}
+		
+		rate = (int)(bytes * 1000 / SPEED_INTERVAL);
 	}
 
 }
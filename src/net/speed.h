@@ -20,8 +20,8 @@
 #ifndef NETSPEED_H
 #define NETSPEED_H
 
-#include <QPair>
-#include <QLinkedList>
+#include <QAtomicInt>
+#include <ktorrent_export.h>
 #include <util/constants.h>
 
 namespace net
@@ -31,19 +31,42 @@ namespace net
 		@author Joris Guisson <joris.guisson@gmail.com>
 		
 		Measures the download and upload speed.
+		
+		The bytes of the last 5 seconds are counted in a ring of buckets of 100 ms each,
+		so recording data never allocates memory and updating only has to clear the buckets
+		which fell out of the window. The rate can be read from any thread.
 	*/
-	class Speed
+	class KTORRENT_EXPORT Speed
 	{
-		QAtomicInt rate;
-		bt::Uint32 bytes;
-		QLinkedList<QPair<bt::Uint32,bt::TimeStamp> > dlrate;
 	public:
 		Speed();
 		virtual ~Speed();
 		
+		/// Record bytes sent or received at time ts
 		void onData(bt::Uint32 bytes,bt::TimeStamp ts);
+		
+		/// Drop everything older then the window and recalculate the rate
 		void update(bt::TimeStamp now);
+		
+		/// Get the rate in bytes per second
 		int getRate() const {return rate;}
+		
+		/// Number of milliseconds covered by one bucket
+		static const bt::Uint32 BUCKET_SIZE = 100;
+		
+		/// Number of buckets in the window
+		static const bt::Uint32 NUM_BUCKETS = 50;
+		
+	private:
+		void clear();
+		
+	private:
+		QAtomicInt rate;
+		bt::Uint64 bytes;
+		bt::Uint32 buckets[NUM_BUCKETS];
+		bt::Uint64 bucket_slot[NUM_BUCKETS];
+		bt::Uint64 oldest_slot;
+		bt::Uint64 newest_slot;
 	};
 
 }
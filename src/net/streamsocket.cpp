@@ -38,7 +38,7 @@ namespace net
 	{
 		QMutexLocker lock(&mutex);
 		buffer.append(data);
-		net::SocketMonitor::instance().signalPacketReady();
+		net::SocketMonitor::instance().signalPacketReady(this);
 	}
 
 
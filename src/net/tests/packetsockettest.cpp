@@ -0,0 +1,333 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <QtTest>
+#include <QObject>
+#include <KTempDir>
+#include <util/log.h>
+#include <util/functions.h>
+#include <net/socket.h>
+#include <net/packetsocket.h>
+#include <download/packet.h>
+
+using namespace net;
+using namespace bt;
+
+#define NUM_CONNECTIONS 8
+#define PIECE_LENGTH 16 * 1024
+
+/// Socket which counts the system calls used for sending
+class CountingSocket : public Socket
+{
+public:
+	CountingSocket() : Socket(true,4)
+	{
+	}
+	
+	virtual int send(const bt::Uint8* buf,int len)
+	{
+		syscalls++;
+		if (budget >= 0)
+			return spend(Socket::send(buf,qMin(len,budget)));
+		return Socket::send(buf,len);
+	}
+	
+	virtual int sendv(const SendBuffer* bufs,int count)
+	{
+		syscalls++;
+		if (budget >= 0)
+			return spend(Socket::send(bufs[0].data,qMin<int>(bufs[0].len,budget)));
+		return Socket::sendv(bufs,count);
+	}
+	
+	virtual int sendFile(const bt::Uint8* header,bt::Uint32 header_len,int fd,bt::Uint64 off,bt::Uint32 len)
+	{
+		// the header is sent with a separate call
+		syscalls += header_len > 0 ? 2 : 1;
+		if (budget >= 0)
+			return spend(Socket::send(header,qMin<int>(header_len,budget)));
+		return Socket::sendFile(header,header_len,fd,off,len);
+	}
+	
+	/// Pretend the socket buffer is full once budget bytes have been sent
+	int spend(int ret)
+	{
+		budget -= ret;
+		return ret;
+	}
+	
+	static Uint32 syscalls;
+	static int budget; // bytes which can still be sent, negative means unlimited
+};
+
+Uint32 CountingSocket::syscalls = 0;
+int CountingSocket::budget = -1;
+
+struct Connection
+{
+	PacketSocket* sender;
+	Socket* receiver;
+	QByteArray received;
+	
+	Connection(Socket & server) : sender(0),receiver(0)
+	{
+		CountingSocket* s = new CountingSocket();
+		s->setBlocking(true);
+		s->connectTo(server.getSockName());
+		s->setBlocking(false);
+		sender = new PacketSocket(s);
+		
+		Address addr;
+		receiver = new Socket(server.accept(addr),4);
+		receiver->setBlocking(false);
+	}
+	
+	~Connection()
+	{
+		delete sender;
+		delete receiver;
+	}
+	
+	void drain()
+	{
+		Uint8 buf[64 * 1024];
+		int ret = 0;
+		while ((ret = receiver->recv(buf,sizeof(buf))) > 0)
+			received.append((const char*)buf,ret);
+	}
+};
+
+class PacketSocketTest : public QObject
+{
+	Q_OBJECT
+public:
+	PacketSocketTest(QObject* parent = 0) : QObject(parent),server(true,4)
+	{
+	}
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("packetsockettest.log");
+		path = tmpdir.name() + "data";
+		QFile f(path);
+		QVERIFY(f.open(QIODevice::WriteOnly));
+		f.write(QByteArray(PIECE_LENGTH,'x'));
+		f.close();
+		
+		QVERIFY(server.bind("127.0.0.1",0,true));
+	}
+	
+	void cleanupTestCase()
+	{
+		PacketSocket::setVectoredWrites(true);
+	}
+	
+	void testOrder_data()
+	{
+		QTest::addColumn<bool>("vectored");
+		QTest::newRow("vectored") << true;
+		QTest::newRow("one by one") << false;
+	}
+	
+	void testOrder()
+	{
+		QFETCH(bool,vectored);
+		PacketSocket::setVectoredWrites(vectored);
+		
+		Connection c(server);
+		for (Uint32 i = 0;i < 5;i++)
+			c.sender->addPacket(Packet::Ptr(new Packet(i,HAVE)));
+		for (Uint32 i = 0;i < 2;i++)
+			c.sender->addPacket(piece(i));
+		
+		QVERIFY(c.sender->numPendingPieceUploads() == 2);
+		send(c);
+		QVERIFY(c.sender->numPendingPieceUploads() == 0);
+		
+		// at least 3 control packets should go before every piece
+		QString expected = "HHHPHHP";
+		QString order;
+		int off = 0;
+		while (off + 5 <= c.received.size())
+		{
+			Uint32 len = ReadUint32((const Uint8*)c.received.constData(),off);
+			order += c.received[off + 4] == (char)PIECE ? 'P' : 'H';
+			off += 4 + len;
+		}
+		QVERIFY(off == c.received.size());
+		QCOMPARE(order,expected);
+	}
+	
+	void testPartialWrites()
+	{
+		PacketSocket::setVectoredWrites(true);
+		Connection c(server);
+		for (Uint32 i = 0;i < 100;i++)
+			c.sender->addPacket(Packet::Ptr(new Packet(i,HAVE)));
+		
+		// the allowance splits packets, nothing may get lost or reordered
+		while (c.sender->bytesReadyToWrite())
+		{
+			c.sender->write(7,bt::Now());
+			c.drain();
+		}
+		while (c.received.size() < 100 * 9)
+			c.drain();
+		
+		QVERIFY(c.received.size() == 100 * 9);
+		for (Uint32 i = 0;i < 100;i++)
+			QVERIFY(ReadUint32((const Uint8*)c.received.constData(),i * 9 + 5) == i);
+	}
+	
+	void testControlBypass()
+	{
+		Connection c(server);
+		c.sender->addPacket(piece(0));
+		for (Uint32 i = 0;i < 3;i++)
+			c.sender->addPacket(Packet::Ptr(new Packet(i,HAVE)));
+		
+		// control packets can go without the piece
+		QVERIFY(c.sender->controlReadyToWrite());
+		QVERIFY(c.sender->writeControl(bt::Now()) == 3 * 9);
+		QVERIFY(!c.sender->controlReadyToWrite());
+		QVERIFY(c.sender->numPendingPieceUploads() == 1);
+		for (int i = 0;i < 100 && c.received.size() < 3 * 9;i++)
+		{
+			usleep(1000);
+			c.drain();
+		}
+		QVERIFY(c.received.size() == 3 * 9);
+		
+		// but once the piece is being sent, they have to wait for it
+		QVERIFY(c.sender->write(100,bt::Now()) == 100);
+		c.sender->addPacket(Packet::Ptr(new Packet(3,HAVE)));
+		QVERIFY(!c.sender->controlReadyToWrite());
+		QVERIFY(c.sender->writeControl(bt::Now()) == 0);
+	}
+	
+	void testCancelSelected()
+	{
+		PacketSocket::setVectoredWrites(true);
+		Connection c(server);
+		for (Uint32 i = 0;i < 3;i++)
+			c.sender->addPacket(piece(i));
+		
+		// the socket buffer fills up during the first piece, the others stay selected
+		CountingSocket::budget = 5;
+		QVERIFY(c.sender->write(0,bt::Now()) == 5);
+		QVERIFY(c.sender->numPendingPieceUploads() == 3);
+		
+		// choke and cancel, only the piece which is being sent has to be finished
+		c.sender->doNotSendPiece(Request(1,0,PIECE_LENGTH,0),true);
+		QVERIFY(c.sender->numPendingPieceUploads() == 2);
+		c.sender->clearPieces(true);
+		QVERIFY(c.sender->numPendingPieceUploads() == 1);
+		
+		CountingSocket::budget = -1;
+		send(c);
+		
+		QString order;
+		int off = 0;
+		while (off + 5 <= c.received.size())
+		{
+			Uint32 len = ReadUint32((const Uint8*)c.received.constData(),off);
+			order += c.received[off + 4] == (char)PIECE ? 'P' : (c.received[off + 4] == (char)REJECT_REQUEST ? 'R' : '?');
+			off += 4 + len;
+		}
+		QVERIFY(off == c.received.size());
+		QCOMPARE(order,QString("PRR"));
+	}
+	
+	void testSwarm()
+	{
+		Uint32 plain = swarm(false);
+		Uint32 vectored = swarm(true);
+		Out(SYS_GEN|LOG_DEBUG) << "Send system calls: one by one " << plain << ", vectored " << vectored << endl;
+		QVERIFY(vectored < plain);
+	}
+	
+private:
+	Packet::Ptr piece(Uint32 index)
+	{
+		return Packet::Ptr(new Packet(index,0,PIECE_LENGTH,::open(QFile::encodeName(path),O_RDONLY),0));
+	}
+	
+	void send(Connection & c)
+	{
+		while (c.sender->bytesReadyToWrite())
+		{
+			c.sender->write(0,bt::Now());
+			c.drain();
+		}
+		// wait for everything to arrive
+		for (int i = 0;i < 100;i++)
+		{
+			usleep(1000);
+			c.drain();
+		}
+	}
+	
+	/// Simulate the traffic of a swarm: lots of HAVE, REQUEST, CANCEL and INTERESTED messages and some pieces
+	Uint32 swarm(bool vectored)
+	{
+		PacketSocket::setVectoredWrites(vectored);
+		CountingSocket::syscalls = 0;
+		
+		QList<Connection*> conns;
+		for (int i = 0;i < NUM_CONNECTIONS;i++)
+			conns.append(new Connection(server));
+		
+		for (Uint32 round = 0;round < 100;round++)
+		{
+			foreach (Connection* c,conns)
+			{
+				for (Uint32 i = 0;i < 10;i++)
+					c->sender->addPacket(Packet::Ptr(new Packet(round * 10 + i,HAVE)));
+				for (Uint32 i = 0;i < 4;i++)
+					c->sender->addPacket(Packet::Ptr(new Packet(Request(round,i * PIECE_LENGTH,PIECE_LENGTH,0),REQUEST)));
+				c->sender->addPacket(Packet::Ptr(new Packet(Request(round,0,PIECE_LENGTH,0),CANCEL)));
+				c->sender->addPacket(Packet::Ptr(new Packet(INTERESTED)));
+				if (round % 10 == 0)
+					c->sender->addPacket(piece(round));
+				
+				while (c->sender->bytesReadyToWrite())
+				{
+					c->sender->write(0,bt::Now());
+					c->drain();
+				}
+			}
+		}
+		
+		qDeleteAll(conns);
+		return CountingSocket::syscalls;
+	}
+	
+private:
+	KTempDir tmpdir;
+	QString path;
+	Socket server;
+};
+
+QTEST_MAIN(PacketSocketTest)
+
+#include "packetsockettest.moc"
@@ -20,6 +20,7 @@
 
 #include <QtTest>
 #include <QObject>
+#include <QTime>
 #include <util/log.h>
 #include <util/pipe.h>
 #include <net/poll.h>
@@ -49,9 +50,22 @@ private slots:
 	{
 	}
 	
+	void addBackends()
+	{
+		QTest::addColumn<int>("backend");
+		QTest::newRow("poll") << (int)Poll::POLL_BACKEND;
+		QTest::newRow("epoll") << (int)Poll::EPOLL_BACKEND;
+	}
+	
+	void testInput_data()
+	{
+		addBackends();
+	}
+	
 	void testInput()
 	{
-		Poll p;
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
 		Pipe pipe;
 		
 		QVERIFY(pipe.readerSocket() >= 0);
@@ -67,9 +81,15 @@ private slots:
 		QVERIFY(memcmp(tmp,test,4) == 0);
 	}
 	
+	void testOutput_data()
+	{
+		addBackends();
+	}
+	
 	void testOutput()
 	{
-		Poll p;
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
 		Pipe pipe;
 		
 		QVERIFY(pipe.readerSocket() >= 0);
@@ -78,9 +98,15 @@ private slots:
 		QVERIFY(p.poll() == 1);
 	}
 	
+	void testMultiplePolls_data()
+	{
+		addBackends();
+	}
+	
 	void testMultiplePolls()
 	{
-		Poll p;
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
 		Pipe pipe;
 		
 		QVERIFY(pipe.readerSocket() >= 0);
@@ -103,9 +129,15 @@ private slots:
 		QVERIFY(p.poll(100) == 0);
 	}
 	
+	void testTimeout_data()
+	{
+		addBackends();
+	}
+	
 	void testTimeout()
 	{
-		Poll p;
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
 		Pipe pipe;
 		
 		QVERIFY(pipe.readerSocket() >= 0);
@@ -114,8 +146,14 @@ private slots:
 		QVERIFY(p.poll(100) == 0);
 	}
 	
+	void testSocket_data()
+	{
+		addBackends();
+	}
+	
 	void testSocket()
 	{
+		QFETCH(int,backend);
 		net::Socket sock(true,4);
 		QVERIFY(sock.bind("127.0.0.1",0,true));
 		
@@ -125,7 +163,7 @@ private slots:
 		writer.connectTo(local_addr);
 		
 		net::Address dummy;
-		net::Poll poll;
+		net::Poll poll((Poll::Backend)backend);
 		sock.prepare(&poll,net::Poll::INPUT);
 		
 		QVERIFY(poll.poll(1000) > 0);
@@ -149,6 +187,248 @@ private slots:
 		QVERIFY(memcmp(tmp,data,20) == 0);
 	}
 	
+	void testChangeInterest_data()
+	{
+		addBackends();
+	}
+	
+	void testChangeInterest()
+	{
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
+		Pipe pipe;
+		
+		char test[] = "TEST";
+		QVERIFY(pipe.write((const bt::Uint8*)test,4) == 4);
+		
+		// the reader is ready, but we are not interested anymore
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,1) == 0);
+		QVERIFY(p.poll(100) == 1);
+		p.reset();
+		QVERIFY(p.add(pipe.writerSocket(),Poll::OUTPUT,2) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::OUTPUT));
+		p.reset();
+		
+		// and interested again
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,1) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::INPUT));
+	}
+	
+	void testFdReuse_data()
+	{
+		addBackends();
+	}
+	
+	void testFdReuse()
+	{
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
+		int fd = -1;
+		{
+			Pipe pipe;
+			fd = pipe.readerSocket();
+			QVERIFY(p.add(fd,Poll::INPUT,Poll::newRegistrationKey()) == 0);
+			QVERIFY(p.poll(10) == 0);
+			p.reset();
+		}
+		
+		// a new pipe will get the same fd, which the kernel dropped from the epoll set
+		Pipe pipe;
+		QVERIFY(pipe.readerSocket() == fd);
+		char test[] = "TEST";
+		QVERIFY(pipe.write((const bt::Uint8*)test,4) == 4);
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,Poll::newRegistrationKey()) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::INPUT));
+	}
+	
+	void testNotPolledEvent_data()
+	{
+		addBackends();
+	}
+	
+	void testNotPolledEvent()
+	{
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
+		Pipe pipe;
+		
+		// armed in the first round, but it only becomes ready when nobody is interested
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,1) == 0);
+		QVERIFY(p.poll(10) == 0);
+		p.reset();
+		
+		char test[] = "TEST";
+		QVERIFY(pipe.write((const bt::Uint8*)test,4) == 4);
+		QVERIFY(p.add(pipe.writerSocket(),Poll::OUTPUT,2) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::OUTPUT));
+		p.reset();
+		
+		// the event is not lost
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,1) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::INPUT));
+	}
+	
+	void testUnregister_data()
+	{
+		addBackends();
+	}
+	
+	void testUnregister()
+	{
+		QFETCH(int,backend);
+		Poll p((Poll::Backend)backend);
+		int fd = -1;
+		{
+			Pipe pipe;
+			fd = pipe.readerSocket();
+			QVERIFY(p.add(fd,Poll::INPUT,1) == 0);
+			QVERIFY(p.poll(10) == 0);
+			p.reset();
+			Poll::unregister(fd,1);
+		}
+		
+		Pipe pipe;
+		QVERIFY(pipe.readerSocket() == fd);
+		char test[] = "TEST";
+		QVERIFY(pipe.write((const bt::Uint8*)test,4) == 4);
+		QVERIFY(p.add(pipe.readerSocket(),Poll::INPUT,2) == 0);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.ready(0,Poll::INPUT));
+	}
+	
+	void testScaling()
+	{
+		// Poll a large number of idle pipes of which only a few are ready, the way
+		// the network threads do with lots of idle peers
+		const int num_pipes = 400;
+		const int num_ready = 4;
+		const int rounds = 1000;
+		
+		QList<Pipe*> pipes;
+		QList<Uint32> keys;
+		for (int i = 0;i < num_pipes;i++)
+		{
+			pipes.append(new Pipe());
+			keys.append(Poll::newRegistrationKey());
+		}
+		
+		char test[] = "TEST";
+		for (int i = 0;i < num_ready;i++)
+			QVERIFY(pipes[i * num_pipes / num_ready]->write((const bt::Uint8*)test,4) == 4);
+		
+		int elapsed[2];
+		for (int b = Poll::POLL_BACKEND;b <= Poll::EPOLL_BACKEND;b++)
+		{
+			Poll p((Poll::Backend)b);
+			QTime timer;
+			timer.start();
+			for (int r = 0;r < rounds;r++)
+			{
+				p.reset();
+				for (int i = 0;i < num_pipes;i++)
+					p.add(pipes[i]->readerSocket(),Poll::INPUT,keys[i]);
+				QVERIFY(p.poll(0) == num_ready);
+				
+				int ready = 0;
+				for (int i = 0;i < num_pipes;i++)
+					if (p.ready(i,Poll::INPUT))
+						ready++;
+				QVERIFY(ready == num_ready);
+			}
+			elapsed[b] = timer.elapsed();
+		}
+		
+		Out(SYS_GEN|LOG_DEBUG) << num_pipes << " fds, " << num_ready << " ready, " << rounds << " rounds: poll "
+			<< elapsed[Poll::POLL_BACKEND] << " ms, epoll " << elapsed[Poll::EPOLL_BACKEND] << " ms" << endl;
+		
+		qDeleteAll(pipes);
+	}
+	
+	void testWatch()
+	{
+		Poll p(Poll::EPOLL_BACKEND);
+		Pipe pipe;
+		if (p.backend() != Poll::EPOLL_BACKEND)
+		{
+			QVERIFY(!p.watch(pipe.readerSocket(),Poll::INPUT,1));
+			QSKIP("No epoll backend",SkipAll);
+		}
+		
+		QVERIFY(p.watch(pipe.readerSocket(),Poll::INPUT,42));
+		QVERIFY(p.poll(10) == 0);
+		QVERIFY(p.readyWatches().empty());
+		
+		char test[] = "TEST";
+		QVERIFY(pipe.write((const bt::Uint8*)test,4) == 4);
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.readyWatches().size() == 1);
+		QVERIFY(p.readyWatches()[0] == 42);
+		
+		// one shot, so it stays quiet until it is watched again
+		QVERIFY(p.poll(10) == 0);
+		QVERIFY(p.readyWatches().empty());
+		QVERIFY(p.watch(pipe.readerSocket(),Poll::INPUT,43));
+		QVERIFY(p.poll(100) == 1);
+		QVERIFY(p.readyWatches().size() == 1);
+		QVERIFY(p.readyWatches()[0] == 43);
+		
+		// watches and added file descriptors can be mixed
+		Pipe other;
+		QVERIFY(other.write((const bt::Uint8*)test,4) == 4);
+		p.reset();
+		QVERIFY(p.add(other.readerSocket(),Poll::INPUT,Poll::newRegistrationKey()) == 0);
+		QVERIFY(p.watch(pipe.readerSocket(),Poll::INPUT,44));
+		QVERIFY(p.poll(100) == 2);
+		QVERIFY(p.ready(0,Poll::INPUT));
+		QVERIFY(p.readyWatches().size() == 1);
+		QVERIFY(p.readyWatches()[0] == 44);
+	}
+	
+	void testWatchScaling_data()
+	{
+		QTest::addColumn<int>("num_idle");
+		QTest::newRow("10 idle") << 10;
+		QTest::newRow("100 idle") << 100;
+		QTest::newRow("400 idle") << 400;
+	}
+	
+	void testWatchScaling()
+	{
+		// One busy pipe between lots of idle ones, the way the network threads watch their
+		// sockets, the cost of a wake up should not depend on the number of idle pipes
+		QFETCH(int,num_idle);
+		Poll p(Poll::EPOLL_BACKEND);
+		if (p.backend() != Poll::EPOLL_BACKEND)
+			QSKIP("No epoll backend",SkipAll);
+		
+		QList<Pipe*> pipes;
+		for (int i = 0;i <= num_idle;i++)
+		{
+			pipes.append(new Pipe());
+			QVERIFY(p.watch(pipes[i]->readerSocket(),Poll::INPUT,i));
+		}
+		
+		int busy = num_idle / 2;
+		char test[] = "TEST";
+		QVERIFY(pipes[busy]->write((const bt::Uint8*)test,4) == 4);
+		
+		QBENCHMARK
+		{
+			QVERIFY(p.poll(0) == 1);
+			QVERIFY(p.readyWatches().size() == 1);
+			QVERIFY(p.readyWatches()[0] == (Uint64)busy);
+			// the data is not read, so it fires again once it is watched again
+			p.watch(pipes[busy]->readerSocket(),Poll::INPUT,busy);
+		}
+		
+		qDeleteAll(pipes);
+	}
+	
 private:
 };
 
@@ -0,0 +1,367 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <QObject>
+#include <QList>
+#include <QMutex>
+#include <util/log.h>
+#include <util/functions.h>
+#include <net/socket.h>
+#include <net/socketmonitor.h>
+#include <net/tokenbucket.h>
+#include <net/trafficshapedsocket.h>
+
+using namespace net;
+using namespace bt;
+
+#define NUM_CONNECTIONS 16
+
+static Uint8 source_data[64 * 1024];
+
+/// Socket which always has data to send
+class Source : public TrafficShapedSocket
+{
+public:
+	Source(int fd) : TrafficShapedSocket(fd,4)
+	{
+	}
+	
+	virtual bool bytesReadyToWrite() const
+	{
+		return true;
+	}
+	
+	virtual Uint32 write(Uint32 max,TimeStamp now)
+	{
+		Q_UNUSED(now);
+		Uint32 to_send = (max == 0 || max > sizeof(source_data)) ? sizeof(source_data) : max;
+		int ret = sock->send(source_data,to_send);
+		return ret > 0 ? ret : 0;
+	}
+};
+
+/// Socket which counts the received data
+class Sink : public TrafficShapedSocket,public SocketReader
+{
+public:
+	Sink(int fd) : TrafficShapedSocket(fd,4),received(0)
+	{
+		setReader(this);
+	}
+	
+	virtual bool bytesReadyToWrite() const
+	{
+		return false;
+	}
+	
+	virtual Uint32 write(Uint32 max,TimeStamp now)
+	{
+		Q_UNUSED(max);
+		Q_UNUSED(now);
+		return 0;
+	}
+	
+	virtual void onDataReady(Uint8* buf,Uint32 size)
+	{
+		Q_UNUSED(buf);
+		QMutexLocker lock(&counter_mutex);
+		received += size;
+	}
+	
+	Uint64 bytesReceived() const
+	{
+		QMutexLocker lock(&counter_mutex);
+		return received;
+	}
+	
+private:
+	Uint64 received;
+	mutable QMutex counter_mutex;
+};
+
+class SocketMonitorTest : public QObject
+{
+	Q_OBJECT
+public:
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("socketmonitortest.log");
+	}
+	
+	void cleanupTestCase()
+	{
+		SocketMonitor::instance().shutdown();
+	}
+	
+	void testTokenBucket()
+	{
+		TokenBucket b(1000);
+		Uint64 now = TokenBucket::now();
+		QVERIFY(b.take(1000,now + 500000) == 500);
+		QVERIFY(b.take(1000,now + 500000) == 0);
+		b.giveBack(200);
+		QVERIFY(b.take(1000,now + 500000) == 200);
+		
+		// fractions of tokens are not lost
+		Uint32 taken = 0;
+		for (Uint32 i = 1;i <= 1000;i++)
+			taken += b.take(1000,now + 500000 + i * 500);
+		QVERIFY(taken == 500);
+		
+		// one token per ms (minus the bit of time between creating the bucket and getting now)
+		Uint64 t = b.timeUntilAvailable(1,now + 1000000);
+		QVERIFY(t > 900 && t <= 1000);
+		t = b.timeUntilAvailable(2,now + 1000500);
+		QVERIFY(t > 1400 && t <= 1500);
+		
+		// never more then the capacity
+		QVERIFY(b.take(100000,now + 100000000) == b.capacity());
+		
+		b.setRate(0);
+		QVERIFY(b.take(1000,now + 200000000) == 0);
+		QVERIFY(b.timeUntilAvailable(1000,now + 200000000) == 0);
+	}
+	
+	void testBucketAccuracy_data()
+	{
+		QTest::addColumn<uint>("rate");
+		QTest::newRow("10 KiB/s") << 10u * 1024;
+		QTest::newRow("1 MiB/s") << 1024u * 1024;
+		QTest::newRow("100 MiB/s") << 100u * 1024 * 1024;
+	}
+	
+	void testBucketAccuracy()
+	{
+		// do what the network threads do: wait until enough tokens are available
+		// with the resolution of poll, and then take everything
+		QFETCH(uint,rate);
+		TokenBucket b(rate);
+		Uint64 start = TokenBucket::now();
+		Uint64 now = start;
+		Uint64 end = start + 10 * 1000000;
+		Uint64 taken = 0;
+		Uint32 wake_ups = 0;
+		while (now < end)
+		{
+			Uint64 wait = b.timeUntilAvailable(1500,now);
+			if (wait > 0)
+				now += (wait + 999) / 1000 * 1000;
+			
+			taken += b.take(b.capacity(),now);
+			wake_ups++;
+			now += 20; // time spent sending
+		}
+		
+		// no tokens may get lost or created because of the rounding
+		double expected = (double)rate * (now - start) / 1000000.0;
+		double error = qAbs(taken + b.available(now) - expected) / expected;
+		Out(SYS_GEN|LOG_DEBUG) << "Bucket at " << rate << " B/s: error " << error << ", " << wake_ups << " wake ups" << endl;
+		QVERIFY(error < 0.001);
+	}
+	
+	void testThroughput()
+	{
+		Uint64 rates[4];
+		Uint32 shards[] = {1,2,4,8};
+		for (int i = 0;i < 4;i++)
+		{
+			SocketMonitor::setNumShards(shards[i]);
+			rates[i] = transfer(NUM_CONNECTIONS,1000) / 1024;
+			Out(SYS_GEN|LOG_DEBUG) << shards[i] << " shards: " << rates[i] << " KiB/s over " << NUM_CONNECTIONS << " connections" << endl;
+			QVERIFY(rates[i] > 0);
+		}
+		SocketMonitor::setNumShards(1);
+	}
+	
+	void testGlobalLimit()
+	{
+		SocketMonitor::setNumShards(4);
+		SocketMonitor::setUploadCap(256 * 1024);
+		Uint64 rate = transfer(NUM_CONNECTIONS,2000);
+		SocketMonitor::setUploadCap(0);
+		SocketMonitor::setNumShards(1);
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Global limit of 256 KiB/s over 4 shards: " << rate / 1024 << " KiB/s" << endl;
+		QVERIFY(rate > 0);
+		// allow for the initial burst
+		QVERIFY(rate < 256 * 1024 * 3 / 2);
+	}
+	
+	void testShardFairness()
+	{
+		// every shard takes its share of the global bucket, so connections in other shards don't starve
+		SocketMonitor::setNumShards(4);
+		SocketMonitor::setUploadCap(256 * 1024);
+		QList<Uint64> received;
+		transfer(NUM_CONNECTIONS,3000,0,&received);
+		SocketMonitor::setUploadCap(0);
+		SocketMonitor::setNumShards(1);
+		
+		QVERIFY(received.count() == NUM_CONNECTIONS);
+		Uint64 total = 0;
+		foreach (Uint64 r,received)
+			total += r;
+		
+		Uint64 mean = total / received.count();
+		foreach (Uint64 r,received)
+		{
+			Out(SYS_GEN|LOG_DEBUG) << "Connection got " << r << " bytes over 4 shards, mean " << mean << endl;
+			QVERIFY(r >= mean / 4);
+		}
+	}
+	
+	void testGlobalLimitAccuracy_data()
+	{
+		QTest::addColumn<uint>("cap");
+		QTest::newRow("10 KiB/s") << 10u * 1024;
+		QTest::newRow("1 MiB/s") << 1024u * 1024;
+		QTest::newRow("100 MiB/s") << 100u * 1024 * 1024;
+	}
+	
+	void testGlobalLimitAccuracy()
+	{
+		QFETCH(uint,cap);
+		SocketMonitor::setNumShards(2);
+		SocketMonitor::setUploadCap(cap);
+		Uint64 rate = transfer(NUM_CONNECTIONS,3000);
+		SocketMonitor::setUploadCap(0);
+		SocketMonitor::setNumShards(1);
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Global limit of " << cap / 1024 << " KiB/s: " << rate / 1024 << " KiB/s" << endl;
+		QVERIFY(rate <= cap * 1.05);
+		// loopback may not be able to do 100 MiB/s on a slow machine
+		if (cap < 100 * 1024 * 1024)
+			QVERIFY(rate >= cap * 0.9);
+		else
+			QVERIFY(rate > 0);
+	}
+	
+	void testFairness()
+	{
+		// all sockets in a group should get an equal share of a low limit
+		SocketMonitor & sm = SocketMonitor::instance();
+		Uint32 gid = sm.newGroup(SocketMonitor::UPLOAD_GROUP,32 * 1024,0);
+		QList<Uint64> received;
+		transfer(NUM_CONNECTIONS,3000,gid,&received);
+		sm.removeGroup(SocketMonitor::UPLOAD_GROUP,gid);
+		
+		QVERIFY(received.count() == NUM_CONNECTIONS);
+		Uint64 total = 0;
+		foreach (Uint64 r,received)
+			total += r;
+		
+		Uint64 mean = total / received.count();
+		foreach (Uint64 r,received)
+		{
+			Out(SYS_GEN|LOG_DEBUG) << "Connection got " << r << " bytes, mean " << mean << endl;
+			QVERIFY(r >= mean / 2);
+			QVERIFY(r <= mean * 2);
+		}
+	}
+	
+	void testGroupLimit()
+	{
+		SocketMonitor & sm = SocketMonitor::instance();
+		SocketMonitor::setNumShards(4);
+		Uint32 gid = sm.newGroup(SocketMonitor::UPLOAD_GROUP,128 * 1024,0);
+		QVERIFY(gid > 0);
+		Uint64 rate = transfer(NUM_CONNECTIONS,2000,gid);
+		sm.removeGroup(SocketMonitor::UPLOAD_GROUP,gid);
+		SocketMonitor::setNumShards(1);
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Group limit of 128 KiB/s over 4 shards: " << rate / 1024 << " KiB/s" << endl;
+		QVERIFY(rate > 0);
+		QVERIFY(rate < 128 * 1024 * 3 / 2);
+	}
+	
+private:
+	/// Send data over loopback connections for some time, returns the rate in bytes per second
+	Uint64 transfer(int num_connections,int duration,Uint32 up_gid = 0,QList<Uint64>* per_connection = 0)
+	{
+		net::Socket server(true,4);
+		if (!server.bind("127.0.0.1",0,true))
+			return 0;
+		
+		net::Address addr = server.getSockName();
+		QList<Source*> sources;
+		QList<Sink*> sinks;
+		for (int i = 0;i < num_connections;i++)
+		{
+			net::Socket* client = new net::Socket(true,4);
+			if (!client->connectTo(addr))
+			{
+				delete client;
+				break;
+			}
+			
+			net::Address dummy;
+			int fd = server.accept(dummy);
+			if (fd < 0)
+			{
+				delete client;
+				break;
+			}
+			
+			Source* src = new Source(client->take());
+			src->socketDevice()->setBlocking(false);
+			src->setGroupID(up_gid,true);
+			Sink* sink = new Sink(fd);
+			sink->socketDevice()->setBlocking(false);
+			sources.append(src);
+			sinks.append(sink);
+			delete client;
+		}
+		
+		SocketMonitor & sm = SocketMonitor::instance();
+		foreach (Sink* s,sinks)
+			sm.add(s);
+		foreach (Source* s,sources)
+		{
+			sm.add(s);
+			sm.signalPacketReady(s);
+		}
+		
+		QTest::qSleep(duration);
+		
+		foreach (Source* s,sources)
+			sm.remove(s);
+		foreach (Sink* s,sinks)
+			sm.remove(s);
+		
+		Uint64 received = 0;
+		foreach (Sink* s,sinks)
+		{
+			received += s->bytesReceived();
+			if (per_connection)
+				per_connection->append(s->bytesReceived());
+		}
+		
+		qDeleteAll(sources);
+		qDeleteAll(sinks);
+		return received * 1000 / duration;
+	}
+};
+
+QTEST_MAIN(SocketMonitorTest)
+
+#include "socketmonitortest.moc"
@@ -0,0 +1,187 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <QObject>
+#include <QLinkedList>
+#include <util/log.h>
+#include <util/functions.h>
+#include <net/speed.h>
+
+using namespace net;
+using namespace bt;
+
+/// The list based implementation Speed used to have, the new one should give the same rates
+class ListSpeed
+{
+public:
+	ListSpeed() : rate(0),bytes(0) {}
+	
+	void onData(Uint32 b,TimeStamp ts)
+	{
+		samples.append(qMakePair(b,ts));
+		bytes += b;
+	}
+	
+	void update(TimeStamp now)
+	{
+		QLinkedList<QPair<Uint32,TimeStamp> >::iterator i = samples.begin();
+		while (i != samples.end())
+		{
+			if (now - i->second > 5000 || now < i->second)
+			{
+				bytes -= i->first;
+				i = samples.erase(i);
+			}
+			else
+				break;
+		}
+		rate = (int)(bytes / 5);
+	}
+	
+	int rate;
+	Uint64 bytes;
+	QLinkedList<QPair<Uint32,TimeStamp> > samples;
+};
+
+class SpeedTest : public QObject
+{
+	Q_OBJECT
+public:
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("speedtest.log",false,true);
+		qsrand(42);
+	}
+	
+	void cleanupTestCase()
+	{
+	}
+	
+	void testAccuracy_data()
+	{
+		QTest::addColumn<int>("pattern");
+		QTest::newRow("constant") << 0;
+		QTest::newRow("bursts") << 1;
+		QTest::newRow("sparse") << 2;
+	}
+	
+	void testAccuracy()
+	{
+		QFETCH(int,pattern);
+		Speed s;
+		ListSpeed ls;
+		TimeStamp now = 1000000;
+		double max_error = 0;
+		for (Uint32 ms = 0;ms < 60000;ms++,now++)
+		{
+			Uint32 b = 0;
+			switch (pattern)
+			{
+			case 0: b = 100; break; // 100 KB/s
+			case 1: b = (ms / 3000) % 2 ? 0 : qrand() % 2000; break; // on and off every 3 seconds
+			default: b = qrand() % 10 == 0 ? qrand() % (16 * 1024) : 0; break;
+			}
+			
+			if (b > 0)
+			{
+				s.onData(b,now);
+				ls.onData(b,now);
+			}
+			
+			if (ms % 250 == 0)
+			{
+				s.update(now);
+				ls.update(now);
+				// the window is 100 ms shorter at most, so the rates should be close
+				if (ms > 6000 && ls.rate > 10000)
+					max_error = qMax(max_error,qAbs((double)s.getRate() - ls.rate) / ls.rate);
+			}
+		}
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Pattern " << pattern << ": max error " << max_error << endl;
+		QVERIFY(max_error < 0.1);
+	}
+	
+	void testWindow()
+	{
+		Speed s;
+		s.onData(5000,10000);
+		s.update(10000);
+		QVERIFY(s.getRate() == 1000);
+		s.update(14900);
+		QVERIFY(s.getRate() == 1000);
+		s.update(15100);
+		QVERIFY(s.getRate() == 0);
+		
+		// a long time without updates
+		s.onData(5000,100000);
+		s.update(1000000);
+		QVERIFY(s.getRate() == 0);
+		s.onData(5000,1000000);
+		s.update(1000000);
+		QVERIFY(s.getRate() == 1000);
+	}
+	
+	void testClockGoesBackwards()
+	{
+		Speed s;
+		s.onData(5000,20000);
+		s.update(100);
+		QVERIFY(s.getRate() == 0);
+		s.onData(5000,150);
+		s.update(200);
+		QVERIFY(s.getRate() == 1000);
+	}
+	
+	void testBenchmark()
+	{
+		const Uint32 NUM_SAMPLES = 10000000;
+		Speed s;
+		TimeStamp start = bt::Now();
+		for (Uint32 i = 0;i < NUM_SAMPLES;i++)
+		{
+			s.onData(1400,i / 1000);
+			if (i % 1000 == 0)
+				s.update(i / 1000);
+		}
+		TimeStamp ring_time = bt::Now() - start;
+		
+		ListSpeed ls;
+		start = bt::Now();
+		for (Uint32 i = 0;i < NUM_SAMPLES;i++)
+		{
+			ls.onData(1400,i / 1000);
+			if (i % 1000 == 0)
+				ls.update(i / 1000);
+		}
+		TimeStamp list_time = bt::Now() - start;
+		
+		Out(SYS_GEN|LOG_DEBUG) << "Ring: " << ring_time << " ms, list: " << list_time << " ms for " << NUM_SAMPLES << " samples" << endl;
+		QVERIFY(qAbs(s.getRate() - ls.rate) < ls.rate / 100);
+		QVERIFY(ring_time <= list_time);
+	}
+};
+
+QTEST_MAIN(SpeedTest)
+
+#include "speedtest.moc"
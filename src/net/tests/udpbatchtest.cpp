@@ -0,0 +1,375 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <unistd.h>
+#include <QtTest>
+#include <QObject>
+#include <util/log.h>
+#include <util/functions.h>
+#include <net/socket.h>
+#include <net/serversocket.h>
+
+using namespace net;
+using namespace bt;
+
+#define BATCH_SIZE 32
+#define PACKET_SIZE 1000
+#define NUM_PACKETS 20000
+#define BIG_PACKET_SIZE 20000
+
+class DatagramCollector : public ServerSocket::DataHandler
+{
+public:
+	virtual void dataReceived(bt::Buffer::Ptr buffer,const net::Address & addr)
+	{
+		Q_UNUSED(addr);
+		sizes.append(buffer->size());
+		data.append(buffer->get()[0]);
+	}
+	
+	virtual void readyToWrite(net::ServerSocket* sock)
+	{
+		Q_UNUSED(sock);
+	}
+	
+	QList<int> sizes;
+	QList<int> data;
+};
+
+class UDPBatchTest : public QObject
+{
+	Q_OBJECT
+public:
+	UDPBatchTest(QObject* parent = 0) : QObject(parent),sender(false,4),receiver(false,4)
+	{
+	}
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("udpbatchtest.log");
+		QVERIFY(sender.bind("127.0.0.1",0,false));
+		QVERIFY(receiver.bind("127.0.0.1",0,false));
+		sender.setBlocking(false);
+		receiver.setBlocking(false);
+		dest = receiver.getSockName();
+	}
+	
+	void testBatch()
+	{
+		Uint8 out[BATCH_SIZE][PACKET_SIZE];
+		Datagram dgrams[BATCH_SIZE];
+		for (int i = 0;i < BATCH_SIZE;i++)
+		{
+			memset(out[i],i,PACKET_SIZE);
+			dgrams[i].data = out[i];
+			// every packet has a different size
+			dgrams[i].size = PACKET_SIZE - i;
+			dgrams[i].addr = dest;
+		}
+		QVERIFY(sender.sendToBatch(dgrams,BATCH_SIZE) == BATCH_SIZE);
+		
+		Uint8 in[BATCH_SIZE][PACKET_SIZE];
+		int received = 0;
+		for (int tries = 0;tries < 100 && received < BATCH_SIZE;tries++)
+		{
+			received += receive(in,received,BATCH_SIZE - received);
+			if (received < BATCH_SIZE)
+				usleep(1000);
+		}
+		QVERIFY(received == BATCH_SIZE);
+	}
+	
+	void testEmptyDatagram()
+	{
+		Uint8 data[PACKET_SIZE];
+		memset(data,0xAB,PACKET_SIZE);
+		Datagram dgrams[3];
+		for (int i = 0;i < 3;i++)
+		{
+			dgrams[i].data = data;
+			dgrams[i].addr = dest;
+		}
+		dgrams[0].size = 0;
+		dgrams[1].size = 10;
+		dgrams[2].size = 0;
+		QVERIFY(sender.sendToBatch(dgrams,3) == 3);
+		usleep(10000);
+		
+		// empty datagrams may not block the ones behind them
+		Uint8 in[3][PACKET_SIZE];
+		int sizes[3] = {-1,-1,-1};
+		int received = 0;
+		for (int tries = 0;tries < 10 && received < 3;tries++)
+		{
+			Datagram r[3];
+			for (int i = 0;i < 3;i++)
+			{
+				r[i].data = in[i];
+				r[i].size = PACKET_SIZE;
+			}
+			int ret = receiver.recvFromBatch(r,3 - received);
+			for (int i = 0;i < ret;i++)
+				sizes[received + i] = r[i].size;
+			received += ret;
+		}
+		QVERIFY(received == 3);
+		QVERIFY(sizes[0] == 0);
+		QVERIFY(sizes[1] == 10);
+		QVERIFY(sizes[2] == 0);
+		
+		// nothing left
+		Datagram r;
+		r.data = in[0];
+		r.size = PACKET_SIZE;
+		QVERIFY(receiver.recvFromBatch(&r,1) == 0 || r.size == 0);
+	}
+	
+	void testTruncated()
+	{
+		Uint8 data[PACKET_SIZE];
+		memset(data,0xCD,PACKET_SIZE);
+		Datagram dgrams[2];
+		for (int i = 0;i < 2;i++)
+		{
+			dgrams[i].data = data;
+			dgrams[i].addr = dest;
+		}
+		dgrams[0].size = 100;
+		dgrams[1].size = PACKET_SIZE;
+		QVERIFY(sender.sendToBatch(dgrams,2) == 2);
+		usleep(10000);
+		
+		// the second one doesn't fit and must be reported, not passed on as a smaller datagram
+		Uint8 in[2][PACKET_SIZE / 2];
+		Datagram r[2];
+		for (int i = 0;i < 2;i++)
+		{
+			r[i].data = in[i];
+			r[i].size = PACKET_SIZE / 2;
+		}
+		int received = receiver.recvFromBatch(r,2);
+		if (received == 1)
+			received += receiver.recvFromBatch(&r[1],1);
+		QVERIFY(received == 2);
+		QVERIFY(r[0].size == 100);
+		QVERIFY(r[1].size == -1);
+		
+		// a big datagram at the front can be spotted before reading it
+		QVERIFY(sender.sendToBatch(&dgrams[1],1) == 1);
+		usleep(10000);
+		QVERIFY(receiver.bytesAvailable() == PACKET_SIZE);
+		Uint8 big[PACKET_SIZE];
+		Address addr;
+		QVERIFY(receiver.recvFrom(big,PACKET_SIZE,addr) == PACKET_SIZE);
+	}
+	
+	void testBigDatagramInBatch()
+	{
+		DatagramCollector collector;
+		ServerSocket server(&collector);
+		QVERIFY(server.bind("127.0.0.1",0));
+		
+		// the server socket doesn't tell its port, so let it send something to find out
+		QVERIFY(server.sendTo(QByteArray("port"),sender.getSockName()) == 4);
+		Address server_addr;
+		Uint8 tmp[PACKET_SIZE];
+		for (int tries = 0;tries < 100 && sender.recvFrom(tmp,PACKET_SIZE,server_addr) != 4;tries++)
+			usleep(1000);
+		QVERIFY(server_addr.port() != 0);
+		
+		// a big datagram in the middle of a batch must arrive whole, like the others
+		static Uint8 out[3][BIG_PACKET_SIZE];
+		Datagram dgrams[3];
+		for (int i = 0;i < 3;i++)
+		{
+			memset(out[i],i,BIG_PACKET_SIZE);
+			dgrams[i].data = out[i];
+			dgrams[i].size = i == 1 ? BIG_PACKET_SIZE : 100;
+			dgrams[i].addr = server_addr;
+		}
+		QVERIFY(sender.sendToBatch(dgrams,3) == 3);
+		
+		for (int tries = 0;tries < 100 && collector.sizes.count() < 3;tries++)
+			QTest::qWait(10);
+		
+		QVERIFY(collector.sizes.count() == 3);
+		QVERIFY(collector.sizes[0] == 100 && collector.data[0] == 0);
+		QVERIFY(collector.sizes[1] == BIG_PACKET_SIZE && collector.data[1] == 1);
+		QVERIFY(collector.sizes[2] == 100 && collector.data[2] == 2);
+	}
+	
+	void testSegmentation()
+	{
+		Socket gso_sender(false,4);
+		Socket gro_receiver(false,4);
+		QVERIFY(gso_sender.bind("127.0.0.1",0,false));
+		QVERIFY(gro_receiver.bind("127.0.0.1",0,false));
+		gso_sender.setBlocking(false);
+		gro_receiver.setBlocking(false);
+		if (!gso_sender.setSegmentationOffload(true) || !gro_receiver.setSegmentationOffload(true))
+			QSKIP("UDP segmentation offload not supported",SkipAll);
+		
+		// same size datagrams, with a smaller one at the end, and one to another address
+		Uint8 out[12][PACKET_SIZE];
+		Datagram dgrams[12];
+		for (int i = 0;i < 12;i++)
+		{
+			memset(out[i],i,PACKET_SIZE);
+			dgrams[i].data = out[i];
+			dgrams[i].size = i == 10 ? PACKET_SIZE / 2 : PACKET_SIZE;
+			dgrams[i].addr = i < 11 ? gro_receiver.getSockName() : dest;
+		}
+		QVERIFY(gso_sender.sendToBatch(dgrams,12) == 12);
+		usleep(10000);
+		
+		// the receiver may get them coalesced, but the contents must be the same
+		static Uint8 in[4][65536];
+		int received = 0;
+		for (int tries = 0;tries < 10 && received < 11;tries++)
+		{
+			Datagram r[4];
+			for (int i = 0;i < 4;i++)
+			{
+				r[i].data = in[i];
+				r[i].size = 65536;
+			}
+			
+			int ret = gro_receiver.recvFromBatch(r,4);
+			for (int i = 0;i < ret;i++)
+			{
+				int segment_size = r[i].segment_size > 0 ? r[i].segment_size : r[i].size;
+				for (int off = 0;off < r[i].size;off += segment_size)
+				{
+					int size = qMin(segment_size,r[i].size - off);
+					QVERIFY(size == (received == 10 ? PACKET_SIZE / 2 : PACKET_SIZE));
+					for (int j = 0;j < size;j++)
+						QVERIFY(r[i].data[off + j] == received);
+					received++;
+				}
+			}
+		}
+		QVERIFY(received == 11);
+		
+		Datagram r;
+		r.data = in[0];
+		r.size = PACKET_SIZE;
+		for (int tries = 0;tries < 10 && receiver.recvFromBatch(&r,1) == 0;tries++)
+			usleep(1000);
+		QVERIFY(r.size == PACKET_SIZE && r.data[0] == 11);
+	}
+	
+	void testBenchmark()
+	{
+		double plain = packetsPerSecond(false);
+		double batched = packetsPerSecond(true);
+		Out(SYS_GEN|LOG_DEBUG) << "Loopback packets per second: one by one " << plain << ", batched " << batched << endl;
+		QVERIFY(plain > 0 && batched > 0);
+	}
+	
+private:
+	/// Receive up to count packets sent by testBatch, and check their contents
+	int receive(Uint8 in[][PACKET_SIZE],int first,int count)
+	{
+		Datagram dgrams[BATCH_SIZE];
+		for (int i = 0;i < count;i++)
+		{
+			dgrams[i].data = in[first + i];
+			dgrams[i].size = PACKET_SIZE;
+		}
+		
+		int ret = receiver.recvFromBatch(dgrams,count);
+		for (int i = 0;i < ret;i++)
+		{
+			int idx = first + i;
+			if (dgrams[i].size != PACKET_SIZE - idx || dgrams[i].addr.port() != sender.getSockName().port())
+				return -1000;
+			
+			for (int j = 0;j < dgrams[i].size;j++)
+				if (in[idx][j] != idx)
+					return -1000;
+		}
+		return ret;
+	}
+	
+	/// Send NUM_PACKETS packets over the loopback and measure how many went through per second
+	double packetsPerSecond(bool batched)
+	{
+		static Uint8 out[BATCH_SIZE][PACKET_SIZE];
+		static Uint8 in[BATCH_SIZE][PACKET_SIZE];
+		Datagram dgrams[BATCH_SIZE];
+		
+		Uint32 received = 0;
+		bt::TimeStamp start = bt::Now();
+		for (Uint32 sent = 0;sent < NUM_PACKETS;sent += BATCH_SIZE)
+		{
+			// send a batch, and drain the receiver before its socket buffer overflows
+			if (batched)
+			{
+				for (int i = 0;i < BATCH_SIZE;i++)
+				{
+					dgrams[i].data = out[i];
+					dgrams[i].size = PACKET_SIZE;
+					dgrams[i].addr = dest;
+				}
+				sender.sendToBatch(dgrams,BATCH_SIZE);
+			}
+			else
+			{
+				for (int i = 0;i < BATCH_SIZE;i++)
+					sender.sendTo(out[i],PACKET_SIZE,dest);
+			}
+			
+			if (batched)
+			{
+				int ret = 0;
+				do
+				{
+					for (int i = 0;i < BATCH_SIZE;i++)
+					{
+						dgrams[i].data = in[i];
+						dgrams[i].size = PACKET_SIZE;
+					}
+					ret = receiver.recvFromBatch(dgrams,BATCH_SIZE);
+					received += ret;
+				}
+				while (ret == BATCH_SIZE);
+			}
+			else
+			{
+				Address addr;
+				while (receiver.bytesAvailable() > 0 && receiver.recvFrom(in[0],PACKET_SIZE,addr) > 0)
+					received++;
+			}
+		}
+		
+		bt::TimeStamp elapsed = bt::Now() - start;
+		return received * 1000.0 / (elapsed > 0 ? elapsed : 1);
+	}
+	
+private:
+	Socket sender;
+	Socket receiver;
+	Address dest;
+};
+
+QTEST_MAIN(UDPBatchTest)
+
+#include "udpbatchtest.moc"
@@ -0,0 +1,133 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+#include "tokenbucket.h"
+#include <sys/time.h>
+#include <QtGlobal>
+
+using namespace bt;
+
+namespace net
+{
+	const Uint64 MICRO = 1000000;
+	// the bucket holds at most this many milliseconds of tokens
+	const Uint64 BURST_TIME = 100;
+	// but always enough for a couple of full sized packets
+	const Uint32 MIN_BURST = 4096;
+
+	TokenBucket::TokenBucket(Uint32 rate) : bucket_rate(rate),tokens(0)
+	{
+		last_refill = now();
+	}
+
+
+	TokenBucket::~TokenBucket()
+	{
+	}
+	
+	Uint64 TokenBucket::now()
+	{
+		struct timeval tv;
+		gettimeofday(&tv,0);
+		return (Uint64)tv.tv_sec * MICRO + tv.tv_usec;
+	}
+	
+	void TokenBucket::setRate(Uint32 rate)
+	{
+		QMutexLocker lock(&mutex);
+		refill(now());
+		bucket_rate = rate;
+		tokens = qMin(tokens,maxTokens());
+	}
+	
+	Uint32 TokenBucket::rate() const
+	{
+		QMutexLocker lock(&mutex);
+		return bucket_rate;
+	}
+	
+	Uint32 TokenBucket::capacity() const
+	{
+		QMutexLocker lock(&mutex);
+		return maxTokens() / MICRO;
+	}
+	
+	Uint64 TokenBucket::maxTokens() const
+	{
+		return qMax<Uint64>((Uint64)bucket_rate * BURST_TIME / 1000,MIN_BURST) * MICRO;
+	}
+	
+	void TokenBucket::refill(Uint64 now)
+	{
+		if (now < last_refill || bucket_rate == 0)
+		{
+			last_refill = now;
+			return;
+		}
+		
+		Uint64 elapsed = now - last_refill;
+		Uint64 max = maxTokens();
+		if (elapsed >= MICRO)
+			tokens = max; // a second is more then enough to fill the bucket, and prevents overflows
+		else
+			tokens = qMin(tokens + (Uint64)bucket_rate * elapsed,max);
+		last_refill = now;
+	}
+	
+	Uint32 TokenBucket::take(Uint32 max,Uint64 now)
+	{
+		QMutexLocker lock(&mutex);
+		if (bucket_rate == 0)
+			return 0;
+		
+		refill(now);
+		Uint32 ret = (Uint32)qMin<Uint64>(tokens / MICRO,max);
+		tokens -= (Uint64)ret * MICRO;
+		return ret;
+	}
+	
+	void TokenBucket::giveBack(Uint32 amount)
+	{
+		QMutexLocker lock(&mutex);
+		tokens = qMin(tokens + (Uint64)amount * MICRO,maxTokens());
+	}
+	
+	Uint32 TokenBucket::available(Uint64 now)
+	{
+		QMutexLocker lock(&mutex);
+		refill(now);
+		return tokens / MICRO;
+	}
+	
+	Uint64 TokenBucket::timeUntilAvailable(Uint32 amount,Uint64 now)
+	{
+		QMutexLocker lock(&mutex);
+		if (bucket_rate == 0)
+			return 0;
+		
+		refill(now);
+		Uint64 needed = qMin((Uint64)amount * MICRO,maxTokens());
+		if (tokens >= needed)
+			return 0;
+		
+		// round up, so the tokens are there when we wake up
+		return (needed - tokens + bucket_rate - 1) / bucket_rate;
+	}
+
+}
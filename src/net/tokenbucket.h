@@ -0,0 +1,94 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+#ifndef NET_TOKENBUCKET_H
+#define NET_TOKENBUCKET_H
+
+#include <QMutex>
+#include <QSharedPointer>
+#include <util/constants.h>
+#include <ktorrent_export.h>
+
+namespace net
+{
+	/**
+		Thread safe token bucket, used to share a rate limit between several network threads.
+		Tokens (bytes) flow into the bucket at the rate, with microsecond precision, and the bucket
+		can hold at most 100 ms worth of tokens, so output stays smooth after an idle period.
+		Threads take what they need before they send or receive, and give back what they did not use.
+	*/
+	class KTORRENT_EXPORT TokenBucket
+	{
+	public:
+		TokenBucket(bt::Uint32 rate = 0);
+		virtual ~TokenBucket();
+		
+		/// Set the rate in bytes per second (0 is unlimited)
+		void setRate(bt::Uint32 rate);
+		
+		/// Get the rate
+		bt::Uint32 rate() const;
+		
+		/// Get the maximum number of tokens the bucket can hold
+		bt::Uint32 capacity() const;
+		
+		/**
+		 * Take tokens out of the bucket.
+		 * @param max The maximum number of tokens to take
+		 * @param now The current time in microseconds (see now())
+		 * @return The number of tokens taken, 0 if the bucket is empty or unlimited
+		 */
+		bt::Uint32 take(bt::Uint32 max,bt::Uint64 now);
+		
+		/**
+		 * Put unused tokens back.
+		 * @param amount The number of tokens
+		 */
+		void giveBack(bt::Uint32 amount);
+		
+		/// Get the number of tokens in the bucket
+		bt::Uint32 available(bt::Uint64 now);
+		
+		/**
+		 * Calculate how long it takes before there are enough tokens in the bucket.
+		 * @param amount The number of tokens needed (if larger then the capacity, a full bucket is enough)
+		 * @param now The current time in microseconds
+		 * @return The time in microseconds, 0 if the tokens are available or the bucket is unlimited
+		 */
+		bt::Uint64 timeUntilAvailable(bt::Uint32 amount,bt::Uint64 now);
+		
+		/// Get the current time in microseconds
+		static bt::Uint64 now();
+		
+		typedef QSharedPointer<TokenBucket> Ptr;
+		
+	private:
+		void refill(bt::Uint64 now);
+		bt::Uint64 maxTokens() const;
+		
+	private:
+		mutable QMutex mutex;
+		bt::Uint32 bucket_rate;
+		bt::Uint64 tokens; // in millionths of a token, so no fractions are lost between refills
+		bt::Uint64 last_refill;
+	};
+
+}
+
+#endif // NET_TOKENBUCKET_H
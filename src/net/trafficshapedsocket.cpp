@@ -34,6 +34,8 @@ namespace net
 		rdr(0),
 		up_gid(0),
 		down_gid(0),
+		up_deficit(0),
+		down_deficit(0),
 		sock(sock),
 		mutex(QMutex::Recursive)
 	{
@@ -45,6 +47,8 @@ namespace net
 		rdr(0),
 		up_gid(0),
 		down_gid(0),
+		up_deficit(0),
+		down_deficit(0),
 		mutex(QMutex::Recursive)
 	{
 		sock = new Socket(fd, ip_version);
@@ -56,6 +60,8 @@ namespace net
 		rdr(0),
 		up_gid(0),
 		down_gid(0),
+		up_deficit(0),
+		down_deficit(0),
 		mutex(QMutex::Recursive)
 	{
 		sock = new Socket(tcp, ip_version);
@@ -98,10 +104,10 @@ namespace net
 		mutex.unlock();
 	}
 	
-	static bt::Uint8 input_buffer[OUTPUT_BUFFER_SIZE];
-	
 	Uint32 TrafficShapedSocket::read(bt::Uint32 max_bytes_to_read, bt::TimeStamp now)
 	{
+		// on the stack, sockets of different shards are read at the same time
+		bt::Uint8 input_buffer[OUTPUT_BUFFER_SIZE];
 		Uint32 br = 0;
 		bool no_limit = (max_bytes_to_read == 0);
 		Uint32 ba = sock->bytesAvailable();
@@ -148,6 +154,17 @@ namespace net
 	}
 
 
+	Uint32 TrafficShapedSocket::writeControl(bt::TimeStamp now)
+	{
+		Q_UNUSED(now);
+		return 0;
+	}
+	
+	bool TrafficShapedSocket::controlReadyToWrite() const
+	{
+		return false;
+	}
+
 	void TrafficShapedSocket::postProcess(Uint8* data, Uint32 size)
 	{
 		Q_UNUSED(data);
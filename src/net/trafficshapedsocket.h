@@ -84,6 +84,16 @@ namespace net
 		/// See if the socket has something ready to write
 		virtual bool bytesReadyToWrite() const = 0;
 		
+		/**
+		 * Write only control data, which is not subject to rate limits. Default implementation does nothing.
+		 * @param now Current time stamp
+		 * @return The number of bytes written
+		 */
+		virtual Uint32 writeControl(bt::TimeStamp now);
+		
+		/// See if the socket has control data which can be written right away
+		virtual bool controlReadyToWrite() const;
+		
 		/// Get the current download rate
 		int getDownloadRate() const;
 		
@@ -105,6 +115,9 @@ namespace net
 		
 		/// Get the upload group ID
 		Uint32 uploadGroupID() const {return up_gid;}
+		
+		/// Get the bytes the socket is still owed by the round robin of its upload or download group
+		Uint32 & deficit(bool upload) {return upload ? up_deficit : down_deficit;}
 	protected:
 		/**
 		 * Post process received data. Default implementation does nothing.
@@ -119,6 +132,8 @@ namespace net
 		Speed* up_speed;
 		Uint32 up_gid;
 		Uint32 down_gid; // group id which this torrent belongs to, group 0 means the default group
+		Uint32 up_deficit;
+		Uint32 down_deficit;
 		SocketDevice* sock;
 		mutable QMutex mutex;
 	};
@@ -18,9 +18,8 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
  ***************************************************************************/
 #include "uploadthread.h"
-#include <math.h>
 #include <util/functions.h>
-#include "socketmonitor.h"
+#include "socketshard.h"
 #include "trafficshapedsocket.h"
 #include "socketgroup.h"
 		
@@ -29,9 +28,9 @@ using namespace bt;
 namespace net
 {
 	Uint32 UploadThread::ucap = 0;
-	Uint32 UploadThread::sleep_time = 50;
+	TokenBucket UploadThread::bucket;
 	
-	UploadThread::UploadThread(SocketMonitor* sm) : NetworkThread(sm),wake_up(new WakeUpPipe())
+	UploadThread::UploadThread(SocketShard* shard) : NetworkThread(shard,Poll::OUTPUT),wake_up(new WakeUpPipe())
 	{
 	}
 
@@ -45,13 +44,27 @@ namespace net
 		if (waitForSocketsReady() <= 0)
 			return;
 		
-		bool group_limits = false;
-		sm->lock();
+		shard->lock();
 		
 		TimeStamp now = bt::Now();
 		Uint32 num_ready = 0;
-		SocketMonitor::Itr itr = sm->begin();
-		while (itr != sm->end())
+		bool epoll = backend() == EPOLL_BACKEND;
+		if (epoll)
+		{
+			// only the watched sockets which are ready
+			const std::vector<Uint64> & ready = readyWatches();
+			for (std::vector<Uint64>::const_iterator i = ready.begin();i != ready.end();i++)
+			{
+				TrafficShapedSocket* s = shard->find(*i);
+				if (s && s->socketDevice() && s->socketDevice()->ok() && addReadySocket(s,now))
+					num_ready++;
+			}
+		}
+		
+		// with epoll, only the sockets which cannot be watched are prepared in every round
+		SocketShard::Itr itr = epoll ? shard->beginUnwatched() : shard->begin();
+		SocketShard::Itr end = epoll ? shard->endUnwatched() : shard->end();
+		while (itr != end)
 		{
 			TrafficShapedSocket* s = *itr;
 			if (!s->socketDevice() || !s->socketDevice()->ok())
@@ -60,45 +73,58 @@ namespace net
 				continue;
 			}
 			
-			if (s->socketDevice()->ready(this,Poll::OUTPUT))
-			{
-				// add to the correct group
-				Uint32 gid = s->uploadGroupID();
-				if (gid > 0)
-					group_limits = true;
-				
-				SocketGroup* g = groups.find(gid);
-				if (!g)
-					g = groups.find(0);
-				
-				g->add(s);
+			if (s->socketDevice()->ready(this,Poll::OUTPUT) && addReadySocket(s,now))
 				num_ready++;
-			}
 			itr++;
 		}
 		
 		if (num_ready > 0)
-			doGroups(num_ready,now,ucap);
-		sm->unlock();
+			doGroups(num_ready,now,bucket);
 		
-		// to prevent huge CPU usage sleep a bit if we are limited (either by a global limit or a group limit)
-		if (ucap > 0 || group_limits)
-		{
-			TimeStamp diff = now - prev_run_time;
-			if (diff < sleep_time)
-				msleep(sleep_time - diff);
-		}
-		prev_run_time = now;
+		// the watches which fired are disarmed, watch the sockets again if they still have something to send
+		if (epoll)
+			watchReadySockets(TokenBucket::now());
+		shard->unlock();
 	}
 	
-	void UploadThread::signalDataReady()
+	bool UploadThread::addReadySocket(TrafficShapedSocket* s,bt::TimeStamp now)
 	{
+		// control packets are small and latency sensitive, so they bypass the limits
+		s->writeControl(now);
+		if (!s->bytesReadyToWrite())
+			return false;
+		
+		// add to the correct group
+		SocketGroup* g = groups.find(s->uploadGroupID());
+		if (!g)
+			g = groups.find(0);
+		
+		g->add(s);
+		return true;
+	}
+	
+	void UploadThread::signalDataReady(TrafficShapedSocket* sock)
+	{
+		socketChanged(sock);
 		wake_up->wakeUp();
 	}
 	
-	void UploadThread::setSleepTime(Uint32 stime)
+	NetworkThread::Interest UploadThread::interest(TrafficShapedSocket* sock,bt::Uint64 now)
 	{
-		sleep_time = stime;
+		if (!sock->socketDevice() || !sock->socketDevice()->ok())
+			return NOT_INTERESTED;
+		else if (sock->controlReadyToWrite())
+			return INTERESTED;
+		else if (!sock->bytesReadyToWrite())
+			return NOT_INTERESTED;
+		else
+			return canTransfer(sock->uploadGroupID(),bucket,now) ? INTERESTED : LIMITED;
+	}
+	
+	void UploadThread::setCap(Uint32 uc)
+	{
+		ucap = uc;
+		bucket.setRate(uc);
 	}
 	
 	bool UploadThread::doGroup(SocketGroup* g,Uint32 & allowance,bt::TimeStamp now)
@@ -109,24 +135,33 @@ namespace net
 	
 	int UploadThread::waitForSocketsReady()
 	{
-		sm->lock();
+		shard->lock();
 		reset();
 		// Add the wake up pipe
 		add(qSharedPointerCast<PollClient>(wake_up));
 		
-		// fill the poll vector with all sockets
-		SocketMonitor::Itr itr = sm->begin();
-		while (itr != sm->end())
+		// fill the poll vector with all sockets which have something to send and are allowed to send it,
+		// the poll will wake up when the others are allowed again
+		Uint64 now = TokenBucket::now();
+		bool epoll = backend() == EPOLL_BACKEND;
+		if (epoll)
+			watchSockets(now);
+		
+		// with epoll, only the sockets which cannot be watched are prepared in every round
+		SocketShard::Itr itr = epoll ? shard->beginUnwatched() : shard->begin();
+		SocketShard::Itr end = epoll ? shard->endUnwatched() : shard->end();
+		while (itr != end)
 		{
 			TrafficShapedSocket* s = *itr;
-			if (s && s->socketDevice()->ok() && s->bytesReadyToWrite())
+			if (s && s->socketDevice()->ok())
 			{
-				s->socketDevice()->prepare(this,Poll::OUTPUT);
+				if (s->controlReadyToWrite() || (s->bytesReadyToWrite() && canTransfer(s->uploadGroupID(),bucket,now)))
+					s->socketDevice()->prepare(this,Poll::OUTPUT);
 			}
 			itr++;
 		}
-		sm->unlock();
-		return poll();
+		shard->unlock();
+		return pollSockets();
 	}
 
 }
@@ -28,7 +28,7 @@
 
 namespace net
 {
-	class SocketMonitor;
+	class SocketShard;
 	
 	/**
 		@author Joris Guisson <joris.guisson@gmail.com>
@@ -36,27 +36,26 @@ namespace net
 	class UploadThread : public NetworkThread
 	{
 		static bt::Uint32 ucap;
-		static bt::Uint32 sleep_time;
+		static TokenBucket bucket; // shared by the upload threads of all shards
 		
 		WakeUpPipe::Ptr wake_up;
 	public:
-		UploadThread(SocketMonitor* sm);
+		UploadThread(SocketShard* shard);
 		virtual ~UploadThread();
 
-		/// Wake up thread, data is ready to be sent
-  		void signalDataReady();
+		/// Wake up thread, data is ready to be sent by a socket (0 means it could be any socket)
+  		void signalDataReady(TrafficShapedSocket* sock = 0);
 
 		/// Set the upload cap
-		static void setCap(bt::Uint32 uc) {ucap = uc;}
+		static void setCap(bt::Uint32 uc);
 		
 		/// Get the upload cap
 		static Uint32 cap() {return ucap;}
-		
-		/// Set the sleep time when using upload caps
-		static void setSleepTime(bt::Uint32 stime);
 	private: 
 		virtual void update();
 		virtual bool doGroup(SocketGroup* g,Uint32 & allowance,bt::TimeStamp now);
+		virtual Interest interest(TrafficShapedSocket* sock,bt::Uint64 now);
+		bool addReadySocket(TrafficShapedSocket* s,bt::TimeStamp now);
 		
 		int waitForSocketsReady();
 	};
@@ -27,15 +27,20 @@
 
 namespace bt
 {
-
-	IncomingPacket::IncomingPacket(Uint32 size) : data(new Uint8[size]), size(size), read(0)
-	{
-	}
+	// size of the buffers in which received packets are stored, bigger packets get their own buffer
+	const Uint32 SLAB_SIZE = 128 * 1024;
+	
+	BufferPool::Ptr PacketReader::pool;
 
 	PacketReader::PacketReader(Uint32 max_packet_size)
-			: error(false), max_packet_size(max_packet_size)
+			: error(false), slab_used(0), max_packet_size(max_packet_size)
 	{
 		len_received = -1;
+		if (!pool)
+		{
+			pool = BufferPool::Ptr(new BufferPool());
+			pool->setWeakPointer(pool.toWeakRef());
+		}
 	}
 
 
@@ -44,33 +49,42 @@ namespace bt
 	}
 
 
-	IncomingPacket::Ptr PacketReader::dequeuePacket()
-	{
-		QMutexLocker lock(&mutex);
-		if (packet_queue.count() == 0)
-			return IncomingPacket::Ptr();
-
-		IncomingPacket::Ptr pck = packet_queue.front();
-		if (pck->read != pck->size)
-			return IncomingPacket::Ptr();
-
-		packet_queue.pop_front();
-		return pck;
-	}
-
-
 	void PacketReader::update(PeerInterface & peer)
 	{
 		if (error)
 			return;
 
-		IncomingPacket::Ptr pck = dequeuePacket();
-		while (pck)
+		IncomingPacket pck;
+		while (packet_queue.pop(pck))
 		{
-			peer.handlePacket(pck->data.data(), pck->size);
-			pck = dequeuePacket();
+			peer.handlePacket(pck.data, pck.size);
 		}
 	}
+	
+	void PacketReader::allocatePacket(Uint32 size)
+	{
+		if (size > SLAB_SIZE)
+		{
+			current.buffer = pool->get(size);
+			current.data = current.buffer->get();
+		}
+		else
+		{
+			// small packets are put one after the other in a shared slab
+			if (!slab || slab_used + size > slab->capacity())
+			{
+				slab = pool->get(SLAB_SIZE);
+				slab_used = 0;
+			}
+			
+			current.buffer = slab;
+			current.data = slab->get() + slab_used;
+			slab_used += size;
+		}
+		
+		current.size = size;
+		current.read = 0;
+	}
 
 	Uint32 PacketReader::newPacket(Uint8* buf, Uint32 size)
 	{
@@ -115,8 +129,7 @@ namespace bt
 			return size;
 		}
 
-		IncomingPacket::Ptr pck(new IncomingPacket(packet_length));
-		packet_queue.append(pck);
+		allocatePacket(packet_length);
 		return am_of_len_read + readPacket(buf + am_of_len_read, size - am_of_len_read);
 	}
 
@@ -125,23 +138,19 @@ namespace bt
 		if (!size)
 			return 0;
 
-		IncomingPacket::Ptr pck = packet_queue.last();
-		if (pck->read + size >= pck->size)
-		{
-			// we can read the full packet
-			Uint32 tr = pck->size - pck->read;
-			memcpy(pck->data.data() + pck->read, buf, tr);
-			pck->read += tr;
-			return tr;
-		}
-		else
+		Uint32 tr = current.size - current.read;
+		if (tr > size)
+			tr = size; // we can only do a partial read
+		
+		memcpy(current.data + current.read, buf, tr);
+		current.read += tr;
+		if (current.read == current.size)
 		{
-			// we can do a partial read
-			Uint32 tr = size;
-			memcpy(pck->data.data() + pck->read, buf, tr);
-			pck->read += tr;
-			return tr;
+			// the packet is complete, hand it over to the main thread
+			packet_queue.push(current);
+			current = IncomingPacket();
 		}
+		return tr;
 	}
 
 
@@ -150,29 +159,13 @@ namespace bt
 		if (error)
 			return;
 
-		mutex.lock();
-		if (packet_queue.count() == 0)
-		{
-			Uint32 ret = 0;
-			while (ret < size && !error)
-			{
-				ret += newPacket(buf + ret, size - ret);
-			}
-		}
-		else
-		{
-			Uint32 ret = 0;
-			IncomingPacket::Ptr pck = packet_queue.last();
-			if (pck->read == pck->size) // last packet in queue is fully read
-				ret = newPacket(buf, size);
-			else
-				ret = readPacket(buf, size);
+		Uint32 ret = 0;
+		if (current.data) // continue with the packet we were reading
+			ret = readPacket(buf, size);
 
-			while (ret < size  && !error)
-			{
-				ret += newPacket(buf + ret, size - ret);
-			}
+		while (ret < size && !error)
+		{
+			ret += newPacket(buf + ret, size - ret);
 		}
-		mutex.unlock();
 	}
 }
@@ -20,24 +20,27 @@
 #ifndef BTPACKETREADER_H
 #define BTPACKETREADER_H
 
-#include <QList>
-#include <QMutex>
 #include <ktorrent_export.h>
 #include <net/trafficshapedsocket.h>
+#include <util/bufferpool.h>
+#include <util/spscqueue.h>
 
 namespace bt
 {
 	class PeerInterface;
 
+	/**
+	 * A received packet. Small packets share a slab buffer, so this is passed by value
+	 * and nothing gets allocated per packet.
+	 */
 	struct IncomingPacket
 	{
-		QScopedArrayPointer<Uint8> data;
+		Buffer::Ptr buffer; // buffer holding the data, can be shared with other packets
+		Uint8* data;
 		Uint32 size;
 		Uint32 read;
 
-		IncomingPacket(Uint32 size);
-		
-		typedef QSharedPointer<IncomingPacket> Ptr;
+		IncomingPacket() : data(0), size(0), read(0) {}
 	};
 
 	/**
@@ -64,15 +67,21 @@ namespace bt
 	private:
 		Uint32 newPacket(Uint8* buf, Uint32 size);
 		Uint32 readPacket(Uint8* buf, Uint32 size);
-		IncomingPacket::Ptr dequeuePacket();
+		void allocatePacket(Uint32 size);
 
 	private:
 		bool error;
-		QList<IncomingPacket::Ptr> packet_queue;
-		QMutex mutex;
+		// complete packets, filled by the network thread and emptied by the main thread
+		SPSCQueue<IncomingPacket> packet_queue;
+		// packet which is being read (only used by the network thread)
+		IncomingPacket current;
+		Buffer::Ptr slab;
+		Uint32 slab_used;
 		Uint8 len[4];
 		int len_received;
 		Uint32 max_packet_size;
+		
+		static BufferPool::Ptr pool;
 	};
 
 }
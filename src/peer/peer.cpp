@@ -50,6 +50,7 @@ namespace bt
 
 	static Uint32 peer_id_counter = 1;
 	bool Peer::resolve_hostname = true;
+	bool Peer::zero_copy_upload = true;
 
 
 	Peer::Peer(mse::EncryptedPacketSocket::Ptr sock, 
@@ -64,6 +65,8 @@ namespace bt
 			sock(sock), 
 			token(token), 
 			pman(pman),
+			peak_download_rate(0),
+			peak_upload_rate(0),
 			received_have_message(false)
 	{
 		id = peer_id_counter;
@@ -636,7 +639,11 @@ namespace bt
 			stalled_timer.update();
 
 		stats.download_rate = this->getDownloadRate();
+		if (stats.download_rate > peak_download_rate)
+			peak_download_rate = stats.download_rate;
 		stats.upload_rate = this->getUploadRate();
+		if (stats.upload_rate > peak_upload_rate)
+			peak_upload_rate = stats.upload_rate;
 		stats.perc_of_file = this->percentAvailable();
 		stats.snubbed = this->isSnubbed();
 		stats.num_up_requests = uploader->getNumRequests() + sock->numPendingPieceUploads();
@@ -791,6 +798,11 @@ namespace bt
 		resolve_hostname = on;
 	}
 
+	void Peer::setZeroCopyUpload(bool on)
+	{
+		zero_copy_upload = on;
+	}
+
 	void Peer::emitMetadataDownloaded(const QByteArray& data)
 	{
 		emit metadataDownloaded(data);
@@ -878,6 +890,14 @@ namespace bt
 		sock->addPacket(Packet::Ptr(new Packet(index, bt::HAVE)));
 	}
 
+	void Peer::sendHaves(const QList<Uint32> & chunks)
+	{
+		QList<Packet::Ptr> packets;
+		foreach (Uint32 index, chunks)
+			packets.append(Packet::Ptr(new Packet(index, bt::HAVE)));
+		sock->addPackets(packets);
+	}
+
 	void Peer::sendPort(Uint16 port)
 	{
 		sock->addPacket(Packet::Ptr(new Packet(port)));
@@ -929,6 +949,18 @@ namespace bt
 			*			.arg(index).arg(begin).arg(len).arg((quint64)ch,0,16).arg((quint64)ch->getData(),0,16)
 			*			<< endl;;
 			*/
+			// Encrypted and uTP sockets need the data in memory
+			if (zero_copy_upload && !sock->encrypted() && sock->socketDevice()->transportProtocol() == bt::TCP && Packet::fileBackedAllowed())
+			{
+				Uint64 file_off = 0;
+				int fd = ch->pieceFile(begin, len, file_off);
+				if (fd >= 0)
+				{
+					sock->addPacket(Packet::Ptr(new Packet(index, begin, len, fd, file_off)));
+					return true;
+				}
+			}
+			
 			sock->addPacket(Packet::Ptr(new Packet(index, begin, len, ch)));
 			return true;
 		}
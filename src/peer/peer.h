@@ -108,6 +108,12 @@ namespace bt
 		/// Get the download rate in bytes per sec
 		Uint32 getDownloadRate() const;
 
+		/// Get the highest download rate seen on this connection in bytes per sec
+		Uint32 getPeakDownloadRate() const {return peak_download_rate;}
+
+		/// Get the highest upload rate seen on this connection in bytes per sec
+		Uint32 getPeakUploadRate() const {return peak_upload_rate;}
+
 		/// Update the up- and down- speed and handle incoming packets
 		void update();
 
@@ -208,6 +214,12 @@ namespace bt
 		/// Enable or disable hostname resolving
 		static void setResolveHostnames(bool on);
 		
+		/// Enable or disable sending pieces straight from the files to unencrypted TCP peers
+		static void setZeroCopyUpload(bool on);
+		
+		/// Are pieces sent straight from the files
+		static bool zeroCopyUpload() {return zero_copy_upload;}
+		
 		/// Check if the peer has wanted chunks
 		bool hasWantedChunks(const BitSet & wanted_chunks) const;
 		
@@ -262,6 +274,12 @@ namespace bt
 		 */
 		void sendHave(Uint32 index);
 		
+		/**
+		 * Send have packets for multiple chunks in one go.
+		 * @param chunks The chunks
+		 */
+		void sendHaves(const QList<Uint32> & chunks);
+		
 		/**
 		 * Send an allowed fast packet
 		 * @param index
@@ -362,8 +380,11 @@ namespace bt
 		Uint32 ut_pex_id;
 		
 		Uint64 bytes_downloaded_since_unchoke;
+		Uint32 peak_download_rate;
+		Uint32 peak_upload_rate;
 		
 		static bool resolve_hostname;
+		static bool zero_copy_upload;
 		
 		bool received_have_message;
 
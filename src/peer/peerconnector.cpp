@@ -24,49 +24,81 @@
 #include <mse/encryptedauthenticate.h>
 #include <torrent/torrent.h>
 #include <util/functions.h>
+#include <util/log.h>
 #include "peermanager.h"
 #include "authenticationmonitor.h"
+#include "transporthistory.h"
 
 
 namespace bt
 {
 	static ResourceManager half_open_connections(50);
 
+	// head start in ms of the preferred transport, when racing uTP and TCP
+	const TimeStamp RACE_DELAY = 250;
+
 	class PeerConnector::Private
 	{
 	public:
+		/// Half open connection slot of the second transport in a race
+		class RaceSlot : public Resource
+		{
+		public:
+			RaceSlot(Private* d, const QString & group) : Resource(&half_open_connections, group), d(d)
+			{
+			}
+
+			virtual void acquired();
+
+		private:
+			Private* d;
+		};
+
 		Private(PeerConnector* p, const net::Address & addr, bool local, PeerManager* pman, ConnectionLimit::Token::Ptr token)
-			: p(p), addr(addr), local(local), pman(pman), stopping(false), do_not_start(false), token(token)
+			: p(p), addr(addr), local(local), pman(pman), stopping(false), do_not_start(false), token(token),
+			  race_start(0), race_queued(false), race_slot(this, pman->getTorrent().getInfoHash().toString()), preferred(TCP)
 		{
 		}
 
 		~Private()
 		{
-			if(auth.data())
-			{
-				stopping = true;
-				auth.data()->stop();
-				stopping = false;
-			}
+			stopAll();
 		}
 
 		void start(Method method);
+		void startRace();
+		void stopAll();
 		void authenticationFinished(Authenticate* auth, bool ok);
+		Authenticate* createAuthenticate(Method method);
+		bool raceAllowed() const;
 
 	public:
 		PeerConnector* p;
 		QSet<Method> tried_methods;
 		Method current_method;
+		Method race_method;
 		net::Address addr;
 		bool local;
 		QWeakPointer<PeerManager> pman;
 		QWeakPointer<Authenticate> auth;
+		QWeakPointer<Authenticate> racer;
 		bool stopping;
 		bool do_not_start;
 		PeerConnector::WPtr self;
 		ConnectionLimit::Token::Ptr token;
+		TimeStamp race_start; // when the racer should be started, 0 if there is no race pending
+		bool race_queued; // racer is waiting for a half open connection slot
+		RaceSlot race_slot;
+		TransportProtocol preferred;
 	};
 
+	void PeerConnector::Private::RaceSlot::acquired()
+	{
+		d->startRace();
+	}
+
+	bool PeerConnector::transport_racing = true;
+
 	PeerConnector::PeerConnector(const net::Address & addr, bool local, bt::PeerManager* pman, ConnectionLimit::Token::Ptr token)
 		: Resource(&half_open_connections, pman->getTorrent().getInfoHash().toString()),
 		  d(new Private(this, addr, local, pman, token))
@@ -89,18 +121,39 @@ namespace bt
 		half_open_connections.setMaxActive(mc);
 	}
 
+	void PeerConnector::setTransportRacing(bool on)
+	{
+		transport_racing = on;
+	}
+
 	void PeerConnector::start()
 	{
 		half_open_connections.add(this);
 	}
 
+	void PeerConnector::update()
+	{
+		if(d->race_start > 0 && bt::CurrentTime() >= d->race_start)
+		{
+			// the racer counts against the half open connection limit too
+			d->race_start = 0;
+			d->race_queued = true;
+			half_open_connections.add(&d->race_slot);
+		}
+	}
+
 	void PeerConnector::acquired()
 	{
 		PeerManager* pm = d->pman.data();
 		if(!pm || !pm->isStarted())
 			return;
 
-		bt::TransportProtocol primary = ServerInterface::primaryTransportProtocol();
+		// use the transport which performed best in the network of the peer
+		d->preferred = ServerInterface::primaryTransportProtocol();
+		if(d->raceAllowed())
+			d->preferred = TransportHistory::instance().preferred(d->addr, d->preferred);
+
+		bt::TransportProtocol primary = d->preferred;
 		bool encryption = ServerInterface::isEncryptionEnabled();
 		bool utp = ServerInterface::isUtpEnabled();
 
@@ -118,6 +171,28 @@ namespace bt
 			else
 				d->start(TCP_WITHOUT_ENCRYPTION);
 		}
+
+		// Happy eyeballs: give the preferred transport a head start, then try the other one too,
+		// whichever finishes the handshake first is kept
+		if(transport_racing && d->raceAllowed() && TransportHistory::instance().shouldRace(d->addr))
+		{
+			switch(d->current_method)
+			{
+				case TCP_WITH_ENCRYPTION:
+					d->race_method = UTP_WITH_ENCRYPTION;
+					break;
+				case TCP_WITHOUT_ENCRYPTION:
+					d->race_method = UTP_WITHOUT_ENCRYPTION;
+					break;
+				case UTP_WITH_ENCRYPTION:
+					d->race_method = TCP_WITH_ENCRYPTION;
+					break;
+				case UTP_WITHOUT_ENCRYPTION:
+					d->race_method = TCP_WITHOUT_ENCRYPTION;
+					break;
+			}
+			d->race_start = bt::CurrentTime() + RACE_DELAY;
+		}
 	}
 
 	void PeerConnector::authenticationFinished(Authenticate* auth, bool ok)
@@ -125,9 +200,36 @@ namespace bt
 		d->authenticationFinished(auth, ok);
 	}
 
+	bool PeerConnector::Private::raceAllowed() const
+	{
+		return ServerInterface::isUtpEnabled() && !ServerInterface::onlyUseUtp() && OpenFileAllowed();
+	}
+
+	void PeerConnector::Private::stopAll()
+	{
+		race_start = 0;
+		race_queued = false;
+		race_slot.release();
+		stopping = true;
+		if(auth.data())
+			auth.data()->stop();
+		if(racer.data())
+			racer.data()->stop();
+		stopping = false;
+	}
+
 	void PeerConnector::Private::authenticationFinished(Authenticate* auth, bool ok)
 	{
-		this->auth.clear();
+		Method method = current_method;
+		if(auth == racer.data())
+		{
+			method = race_method;
+			racer.clear();
+			race_slot.release();
+		}
+		else
+			this->auth.clear();
+
 		if(stopping)
 			return;
 
@@ -137,13 +239,32 @@ namespace bt
 
 		if(ok)
 		{
+			// the first one to finish the handshake wins the race
+			if(this->auth.data() || racer.data())
+				Out(SYS_CON | LOG_DEBUG) << "Transport race to " << addr.toString() << " won by "
+					<< (method == UTP_WITH_ENCRYPTION || method == UTP_WITHOUT_ENCRYPTION ? "UTP" : "TCP") << endl;
+
+			stopAll();
 			pm->peerAuthenticated(auth, self, ok, token);
 			return;
 		}
 
-		tried_methods.insert(current_method);
+		tried_methods.insert(method);
 
-		bt::TransportProtocol primary = ServerInterface::primaryTransportProtocol();
+		// the other transport of the race is still busy
+		if(this->auth.data() || racer.data())
+			return;
+
+		// no need to wait for the head start to pass anymore, the racer can take over the slot of the connector
+		if(race_start > 0 || race_queued)
+		{
+			race_slot.release();
+			startRace();
+			if(racer.data())
+				return;
+		}
+
+		bt::TransportProtocol primary = preferred;
 		QList<Method> allowed;
 
 		bool tcp_allowed = OpenFileAllowed();
@@ -187,17 +308,40 @@ namespace bt
 			return;
 
 		current_method = method;
-		const Torrent & tor = pm->getTorrent();
+		auth = createAuthenticate(method);
+	}
+
+	void PeerConnector::Private::startRace()
+	{
+		race_start = 0;
+		race_queued = false;
+		PeerManager* pm = pman.data();
+		if(!pm || tried_methods.contains(race_method) || (auth.data() && current_method == race_method))
+		{
+			race_slot.release();
+			return;
+		}
+
+		Out(SYS_CON | LOG_DEBUG) << "Racing UTP and TCP to " << addr.toString() << endl;
+		TransportHistory::instance().raceStarted(addr);
+		racer = createAuthenticate(race_method);
+	}
+
+	Authenticate* PeerConnector::Private::createAuthenticate(PeerConnector::Method method)
+	{
+		const Torrent & tor = pman.data()->getTorrent();
 		TransportProtocol proto = (method == TCP_WITH_ENCRYPTION || method == TCP_WITHOUT_ENCRYPTION) ? TCP : UTP;
+		Authenticate* a = 0;
 		if(method == TCP_WITH_ENCRYPTION || method == UTP_WITH_ENCRYPTION)
-			auth = new mse::EncryptedAuthenticate(addr, proto, tor.getInfoHash(), tor.getPeerID(), self);
+			a = new mse::EncryptedAuthenticate(addr, proto, tor.getInfoHash(), tor.getPeerID(), self);
 		else
-			auth = new Authenticate(addr, proto, tor.getInfoHash(), tor.getPeerID(), self);
+			a = new Authenticate(addr, proto, tor.getInfoHash(), tor.getPeerID(), self);
 
 		if(local)
-			auth.data()->setLocal(true);
+			a->setLocal(true);
 
-		AuthenticationMonitor::instance().add(auth.data());
+		AuthenticationMonitor::instance().add(a);
+		return a;
 	}
 
 }
@@ -65,11 +65,23 @@ namespace bt
 		/// Start connecting
 		void start();
 		
+		/// Start the second transport of a race, when the head start of the first one has passed
+		void update();
+		
 		/**
 		 * Set the maximum number of active PeerConnectors allowed
 		 */
 		static void setMaxActive(Uint32 mc); 
 		
+		/**
+		 * Enable or disable racing uTP and TCP to peers in networks, where
+		 * it is not known yet which transport performs best.
+		 */
+		static void setTransportRacing(bool on);
+		
+		/// Is racing of uTP and TCP enabled
+		static bool transportRacing() {return transport_racing;}
+		
 		typedef QSharedPointer<PeerConnector> Ptr;
 		typedef QWeakPointer<PeerConnector> WPtr;
 		
@@ -83,6 +95,7 @@ namespace bt
 	private:
 		class Private;
 		Private* d;
+		static bool transport_racing;
 	};
 
 }
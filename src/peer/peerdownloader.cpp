@@ -19,7 +19,6 @@
  ***************************************************************************/
 #include "peerdownloader.h"
 
-#include <math.h>
 #include <util/functions.h>
 #include <util/log.h>
 #include "peer.h"
@@ -28,18 +27,18 @@
 
 namespace bt
 {
-	TimeStampedRequest::TimeStampedRequest()
+	TimeStampedRequest::TimeStampedRequest() : bytes_ahead(0)
 	{
 		time_stamp = bt::CurrentTime();
 	}
 			
-	TimeStampedRequest::TimeStampedRequest(const Request & r) : req(r)
+	TimeStampedRequest::TimeStampedRequest(const Request & r) : req(r),bytes_ahead(0)
 	{
 		time_stamp = bt::CurrentTime();
 	}
 	
 	TimeStampedRequest::TimeStampedRequest(const TimeStampedRequest & t) 
-		: req(t.req),time_stamp(t.time_stamp)
+		: req(t.req),time_stamp(t.time_stamp),bytes_ahead(t.bytes_ahead)
 	{
 	}
 	
@@ -60,6 +59,7 @@ namespace bt
 	{
 		time_stamp = bt::CurrentTime();
 		req = r;
+		bytes_ahead = 0;
 		return *this;
 	}
 	
@@ -67,10 +67,12 @@ namespace bt
 	{
 		time_stamp = r.time_stamp;
 		req = r.req;
+		bytes_ahead = r.bytes_ahead;
 		return *this;
 	}
 
-	PeerDownloader::PeerDownloader(Peer* peer,Uint32 chunk_size) : peer(peer),pieces_in_chunk(chunk_size / MAX_PIECE_LEN)
+	PeerDownloader::PeerDownloader(Peer* peer,Uint32 chunk_size) 
+		: peer(peer),pieces_in_chunk(chunk_size / MAX_PIECE_LEN),outstanding_bytes(0)
 	{
 		connect(peer,SIGNAL(destroyed()),this,SLOT(peerDestroyed()));
 		max_wait_queue_size = 25;
@@ -117,7 +119,8 @@ namespace bt
 		
 		if (!wait_queue.removeAll(req))
 		{
-			reqs.removeAll(req);
+			if (reqs.removeAll(req))
+				outstanding_bytes -= qMin<Uint64>(outstanding_bytes,req.getLength());
 			peer->sendCancel(req);
 		}
 	}
@@ -128,7 +131,10 @@ namespace bt
 			return;
 
 		if (reqs.removeAll(req))
+		{
+			outstanding_bytes -= qMin<Uint64>(outstanding_bytes,req.getLength());
 			rejected(req);
+		}
 	}
 	
 	void PeerDownloader::cancelAll()
@@ -146,13 +152,29 @@ namespace bt
 	
 		wait_queue.clear();
 		reqs.clear();
+		outstanding_bytes = 0;
 	}
 
 	void PeerDownloader::piece(const Piece & p)
 	{
 		Request r(p);
-		if (!reqs.removeOne(r))
-			wait_queue.removeAll(r);
+		QList<TimeStampedRequest>::iterator i = reqs.begin();
+		while (i != reqs.end())
+		{
+			if (*i == r)
+			{
+				// measure the round trip time
+				TimeStamp now = bt::CurrentTime();
+				TimeStamp latency = now > i->time_stamp ? now - i->time_stamp : 0;
+				pipeline.pieceReceived(latency,i->bytes_ahead,now);
+				outstanding_bytes -= qMin<Uint64>(outstanding_bytes,r.getLength());
+				reqs.erase(i);
+				return;
+			}
+			i++;
+		}
+		
+		wait_queue.removeAll(r);
 	}
 	
 	void PeerDownloader::peerDestroyed()
@@ -211,7 +233,20 @@ namespace bt
 		// oldest requests at the front, so we simply pop off requests
 		// until we find one that shouldn't be expired
 		while (!reqs.isEmpty() && (now - reqs.first().time_stamp > MAX_INTERVAL))
-			timedout(reqs.takeFirst().req);
+		{
+			Request r = reqs.takeFirst().req;
+			outstanding_bytes -= qMin<Uint64>(outstanding_bytes,r.getLength());
+			timedout(r);
+		}
+	}
+	
+	Uint32 PeerDownloader::expectedLatency() const
+	{
+		Uint64 queued = outstanding_bytes;
+		foreach (const Request & r,wait_queue)
+			queued += r.getLength();
+		
+		return pipeline.expectedLatency(queued,getDownloadRate());
 	}
 
 	Uint32 PeerDownloader::getMaxChunkDownloads() const
@@ -246,6 +281,7 @@ namespace bt
 			i++;
 		}
 		reqs.clear();
+		outstanding_bytes = 0;
 		
 		QList<Request>::iterator j = wait_queue.begin();
 		while (j != wait_queue.end())
@@ -259,12 +295,9 @@ namespace bt
 	
 	void PeerDownloader::update()
 	{ 
-		// modify the interval if necessary
-		double pieces_per_sec = (double)peer->getDownloadRate() / MAX_PIECE_LEN;	
-		int max_reqs = 1 + (int)ceil(10*pieces_per_sec);
-		// cap if client has supplied a reqq in extended protocol handshake
-		if (max_reqs > peer->getStats().max_request_queue && peer->getStats().max_request_queue != 0)
-			max_reqs = peer->getStats().max_request_queue;
+		// size the pipeline to the bandwidth delay product, capped by the reqq the peer supplied in the extended protocol handshake
+		pipeline.update(peer->getDownloadRate(),peer->getStats().max_request_queue);
+		int max_reqs = pipeline.maxRequests();
 		
 		while (wait_queue.count() > 0 && reqs.count() < max_reqs)
 		{
@@ -272,6 +305,8 @@ namespace bt
 			Request req = wait_queue.front();
 			wait_queue.pop_front();
 			TimeStampedRequest r = TimeStampedRequest(req);
+			r.bytes_ahead = outstanding_bytes;
+			outstanding_bytes += req.getLength();
 			reqs.append(r);
 			peer->sendRequest(req);
 		}
@@ -24,6 +24,7 @@
 #include <qobject.h>
 #include <interfaces/piecedownloader.h>
 #include <download/request.h>
+#include <peer/requestpipeline.h>
 
 namespace bt
 {
@@ -38,6 +39,7 @@ namespace bt
 	{
 		Request req;
 		TimeStamp time_stamp;
+		Uint64 bytes_ahead; // bytes which were outstanding when the request was sent
 		
 		TimeStampedRequest();
 		
@@ -153,6 +155,10 @@ namespace bt
 		virtual Uint32 getAverageDownloadRate() const;
 		virtual Uint32 getDownloadRate() const;
 		virtual Uint32 getDownloadRate(Uint32 chunk_index) const;
+		virtual Uint32 expectedLatency() const;
+		
+		/// Get the RequestPipeline, which determines the number of outstanding requests
+		const RequestPipeline & requestPipeline() const {return pipeline;}
 		
 		/**
 		 * Called when a piece has arrived.
@@ -203,6 +209,8 @@ namespace bt
 		QList<Request> wait_queue;
 		Uint32 max_wait_queue_size;
 		Uint32 pieces_in_chunk;
+		RequestPipeline pipeline;
+		Uint64 outstanding_bytes;
 	};
 
 }
@@ -40,6 +40,7 @@
 #include <mse/encryptedpacketsocket.h>
 #include <mse/encryptedauthenticate.h>
 #include <peer/accessmanager.h>
+#include <peer/transporthistory.h>
 #include <torrent/globals.h>
 #include <torrent/server.h>
 #include <dht/dhtbase.h>
@@ -59,6 +60,26 @@ namespace bt
 	typedef QMap<Uint32, Peer::Ptr> PeerMap;
 
 	static ConnectionLimit climit;
+	
+	/// Remember how well the transport of a peer did, so later connections can pick the best one
+	static void RecordTransportSample(Peer::Ptr peer)
+	{
+		// seeders only upload, so take the upload rate into account too
+		const PeerInterface::Stats & s = peer->getStats();
+		Uint32 goodput = 0;
+		if(s.bytes_downloaded >= TransportHistory::MIN_SAMPLE_SIZE)
+			goodput = peer->getPeakDownloadRate();
+		if(s.bytes_uploaded >= TransportHistory::MIN_SAMPLE_SIZE)
+			goodput = qMax(goodput, peer->getPeakUploadRate());
+		
+		if(goodput > 0)
+			TransportHistory::instance().addSample(peer->getAddress(), s.transport_protocol, goodput);
+	}
+	
+	// how long haves are held back with lazy bitfield updates
+	const TimeStamp LAZY_HAVE_INTERVAL = 5000;
+	
+	bool PeerManager::lazy_bitfield = false;
 
 	class PeerManager::Private
 	{
@@ -73,6 +94,7 @@ namespace bt
 		void update();
 		void have(Peer* peer, Uint32 index);
 		void connectToPeers();
+		void sendHaves();
 
 	public:
 		PeerManager* p;
@@ -90,6 +112,8 @@ namespace bt
 		std::map<net::Address, bool> potential_peers;
 		bool partial_seed;
 		Uint32 num_cleared;
+		QList<Uint32> pending_haves;
+		TimeStamp last_haves_sent;
 	};
 
 	PeerManager::PeerManager(Torrent & tor)
@@ -258,6 +282,10 @@ namespace bt
 
 	void PeerManager::closeAllConnections()
 	{
+		// connections which lasted until the torrent was stopped, count as well
+		foreach(Peer::Ptr p, d->peer_map)
+			RecordTransportSample(p);
+		
 		d->peer_map.clear();
 	}
 
@@ -343,6 +371,7 @@ namespace bt
 		ServerInterface::removePeerManager(this);
 		d->connectors.clear();
 		d->superseeder.reset();
+		d->pending_haves.clear();
 		closeAllConnections();
 	}
 
@@ -474,10 +503,12 @@ namespace bt
 		if(d->superseeder)
 			return;
 
-		foreach(Peer::Ptr peer, d->peer_map)
-		{
-			peer->sendHave(index);
-		}
+		d->pending_haves.append(index);
+	}
+	
+	void PeerManager::setLazyBitfield(bool on)
+	{
+		lazy_bitfield = on;
 	}
 
 	Uint32 PeerManager::getNumConnectedPeers() const
@@ -594,7 +625,8 @@ namespace bt
 		  wanted_chunks(tor.getNumChunks()),
 		  cnt(tor.getNumChunks()),
 		  partial_seed(false),
-		  num_cleared(0)
+		  num_cleared(0),
+		  last_haves_sent(0)
 	{
 		started = false;
 		wanted_chunks.setAll(true);
@@ -631,6 +663,9 @@ namespace bt
 
 			if(peer->isKilled())
 			{
+				// this covers incoming connections accepted by the Server as well as outgoing ones
+				RecordTransportSample(peer);
+
 				cnt.decBitSet(peer->getChunksAvailability());
 				updateAvailableChunks();
 				i = peer_map.erase(i);
@@ -654,9 +689,53 @@ namespace bt
 		}
 
 		wanted_changed = false;
+		sendHaves();
+
+		// start the second transport of races which are still going on
+		foreach(PeerConnector::Ptr pcon, connectors)
+			pcon->update();
+
 		connectToPeers();
 	}
 
+	void PeerManager::Private::sendHaves()
+	{
+		if(pending_haves.isEmpty())
+			return;
+
+		TimeStamp now = bt::CurrentTime();
+		if(PeerManager::lazyBitfield() && now - last_haves_sent < LAZY_HAVE_INTERVAL)
+			return;
+
+		last_haves_sent = now;
+		if(superseeder)
+		{
+			pending_haves.clear();
+			return;
+		}
+
+		QList<Uint32> haves;
+		foreach(Peer::Ptr peer, peer_map)
+		{
+			if(peer->isKilled())
+				continue;
+
+			// skip the chunks the peer already has
+			const BitSet & bs = peer->getChunksAvailability();
+			haves.clear();
+			foreach(Uint32 index, pending_haves)
+			{
+				if(!bs.get(index))
+					haves.append(index);
+			}
+
+			if(!haves.isEmpty())
+				peer->sendHaves(haves);
+		}
+
+		pending_haves.clear();
+	}
+
 	void PeerManager::Private::have(Peer* peer, Uint32 index)
 	{
 		if(wanted_chunks.get(index) && !paused)
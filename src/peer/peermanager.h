@@ -262,8 +262,21 @@ namespace bt
 		/// Enable or disable super seeding
 		void setSuperSeeding(bool on, const BitSet & chunks);
 
-		/// Send a have message to all peers
+		/**
+		 * Send a have message to all peers. Haves are collected and sent during the next update,
+		 * peers which already have the chunk do not get one.
+		 */
 		void sendHave(Uint32 index);
+		
+		/**
+		 * Enable or disable lazy bitfield updates. When enabled haves are collected for a
+		 * few seconds before they are sent, in the mean time many peers will have gotten the chunks
+		 * from somebody else, so they do not need a have anymore.
+		 */
+		static void setLazyBitfield(bool on);
+		
+		/// Are lazy bitfield updates enabled
+		static bool lazyBitfield() {return lazy_bitfield;}
 
 		/// Set if we are a partial seed or not
 		void setPartialSeed(bool partial_seed);
@@ -285,6 +298,8 @@ namespace bt
 	private:
 		class Private;
 		Private* d;
+		
+		static bool lazy_bitfield;
 	};
 
 }
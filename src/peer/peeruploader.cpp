@@ -58,6 +58,10 @@ namespace bt
 		if (peer->areWeChoked())
 			return ret;
 		
+		// when seeding, requests come in for chunks all over the torrent, so read ahead is wasted
+		if (requests.count() > 0 && cman.accessPattern() == ADVICE_NORMAL && cman.completed())
+			cman.setAccessPattern(ADVICE_RANDOM);
+		
 		while (requests.count() > 0)
 		{	
 			Request r = requests.front();
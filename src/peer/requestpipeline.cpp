@@ -0,0 +1,106 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "requestpipeline.h"
+#include <math.h>
+#include <QtGlobal>
+
+namespace bt
+{
+	// number of requests used as long as nothing is known about the link
+	const Uint32 INITIAL_REQUESTS = 4;
+	const Uint32 MIN_REQUESTS = 2;
+	const Uint32 MAX_REQUESTS = 250;
+	
+	// the round trip time can go up again once per window, so it follows route changes
+	const TimeStamp RTT_WINDOW = 60 * 1000;
+	
+	// latency used for peers we know nothing about
+	const Uint32 UNKNOWN_LATENCY = 1000;
+
+	RequestPipeline::RequestPipeline() 
+		: srtt(0),base_rtt(0),window_min_rtt(0),window_start(0),max_requests(INITIAL_REQUESTS)
+	{
+	}
+	
+	RequestPipeline::~RequestPipeline()
+	{
+	}
+	
+	void RequestPipeline::pieceReceived(TimeStamp latency,Uint64 bytes_ahead,TimeStamp now)
+	{
+		Uint32 sample = latency > 0 ? (Uint32)latency : 1;
+		if (srtt == 0)
+			srtt = sample;
+		else
+			srtt = (7 * srtt + sample) / 8;
+		
+		// Queueing at the peer only makes pieces arrive later, so the lowest latency is the
+		// best estimate of the round trip time. Subtracting the time needed to send the pieces
+		// in front of it does not work, the download rate is limited by the number of requests
+		// as long as the link is not full, which makes the round trip time collapse.
+		if (base_rtt == 0 || sample < base_rtt)
+			base_rtt = sample;
+		
+		// Only requests sent while nothing was outstanding measure the real round trip time,
+		// so only those are allowed to raise it when the route changes.
+		if (bytes_ahead == 0 && (window_min_rtt == 0 || sample < window_min_rtt))
+			window_min_rtt = sample;
+		
+		if (now - window_start >= RTT_WINDOW)
+		{
+			if (window_min_rtt > 0)
+				base_rtt = window_min_rtt;
+			window_min_rtt = 0;
+			window_start = now;
+		}
+	}
+	
+	void RequestPipeline::update(Uint32 download_rate,Uint32 reqq)
+	{
+		Uint32 max = INITIAL_REQUESTS;
+		if (base_rtt > 0 && download_rate > 0)
+		{
+			double bdp = (double)download_rate * base_rtt / 1000.0 / MAX_PIECE_LEN;
+			max = MIN_REQUESTS + (Uint32)ceil(2 * bdp);
+			if (max < MIN_REQUESTS)
+				max = MIN_REQUESTS;
+		}
+		
+		if (max > MAX_REQUESTS)
+			max = MAX_REQUESTS;
+		
+		// honour the peers wishes
+		if (reqq > 0 && max > reqq)
+			max = reqq;
+		
+		max_requests = max;
+	}
+	
+	Uint32 RequestPipeline::expectedLatency(Uint64 outstanding,Uint32 download_rate) const
+	{
+		Uint32 rtt = srtt > 0 ? srtt : UNKNOWN_LATENCY;
+		if (download_rate == 0)
+			return rtt + (Uint32)qMin<Uint64>(outstanding / MAX_PIECE_LEN * UNKNOWN_LATENCY,60 * 1000);
+		
+		return rtt + (Uint32)((outstanding + MAX_PIECE_LEN) * 1000 / download_rate);
+	}
+
+}
@@ -0,0 +1,88 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef BT_REQUESTPIPELINE_H
+#define BT_REQUESTPIPELINE_H
+
+#include <ktorrent_export.h>
+#include <util/constants.h>
+
+namespace bt
+{
+
+	/**
+	 * Determines how many requests should be outstanding at a peer, based on the
+	 * bandwidth delay product of the link to the peer. The round trip time is the lowest
+	 * time between sending a request and getting the piece. It can only go up again
+	 * through requests which were sent while nothing else was outstanding, so pieces
+	 * queued at the peer do not inflate it.
+	 *
+	 * Twice the bandwidth delay product is kept in flight, so while the link is not full,
+	 * the measured download rate and thus the number of requests keeps growing.
+	 */
+	class KTORRENT_EXPORT RequestPipeline
+	{
+	public:
+		RequestPipeline();
+		virtual ~RequestPipeline();
+		
+		/**
+		 * A piece has arrived.
+		 * @param latency Time in ms between sending the request and getting the piece
+		 * @param bytes_ahead Number of bytes which were requested before it and were still outstanding
+		 * @param now The current time
+		 */
+		void pieceReceived(TimeStamp latency,Uint64 bytes_ahead,TimeStamp now);
+		
+		/**
+		 * Recalculate the maximum number of outstanding requests.
+		 * @param download_rate The download rate in bytes/sec
+		 * @param reqq Maximum number of requests the peer accepts (0 if unknown)
+		 */
+		void update(Uint32 download_rate,Uint32 reqq);
+		
+		/// Get the maximum number of outstanding requests
+		Uint32 maxRequests() const {return max_requests;}
+		
+		/// Get the round trip time in ms (0 if unknown)
+		Uint32 roundTripTime() const {return base_rtt;}
+		
+		/// Get the smoothed round trip time in ms (0 if unknown)
+		Uint32 smoothedRoundTripTime() const {return srtt;}
+		
+		/**
+		 * Estimate how long it will take before a new request is answered.
+		 * @param outstanding Number of bytes which are already requested
+		 * @param download_rate The download rate in bytes/sec
+		 * @return The estimated time in ms
+		 */
+		Uint32 expectedLatency(Uint64 outstanding,Uint32 download_rate) const;
+		
+	private:
+		Uint32 srtt;
+		Uint32 base_rtt;
+		Uint32 window_min_rtt;
+		TimeStamp window_start;
+		Uint32 max_requests;
+	};
+
+}
+
+#endif // BT_REQUESTPIPELINE_H
@@ -18,18 +18,48 @@
  *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
  ***************************************************************************/
 
+#include <new>
+#include <stdlib.h>
 #include <QtTest>
 #include <QObject>
 #include <util/log.h>
+#include <util/functions.h>
 #include <peer/packetreader.h>
 #include <interfaces/peerinterface.h>
 
+// count all memory allocations, to check that the receive path does not allocate per packet
+static QAtomicInt num_allocations(0);
+
+void* operator new(size_t size) throw(std::bad_alloc)
+{
+	num_allocations.ref();
+	void* ptr = malloc(size > 0 ? size : 1);
+	if (!ptr)
+		throw std::bad_alloc();
+	return ptr;
+}
+
+void operator delete(void* ptr) throw()
+{
+	free(ptr);
+}
+
+void* operator new[](size_t size) throw(std::bad_alloc)
+{
+	return operator new(size);
+}
+
+void operator delete[](void* ptr) throw()
+{
+	free(ptr);
+}
+
 
 class PacketReaderTest : public QObject, public bt::PeerInterface
 {
 	Q_OBJECT
 public:
-	PacketReaderTest(QObject* parent = 0) : QObject(parent), bt::PeerInterface(bt::PeerID(), 100)
+	PacketReaderTest(QObject* parent = 0) : QObject(parent), bt::PeerInterface(bt::PeerID(), 100), store(true)
 	{}
 	
 	virtual void chunkAllowed(bt::Uint32 chunk)
@@ -39,6 +69,16 @@ public:
 	
 	virtual void handlePacket(const bt::Uint8* packet, bt::Uint32 size)
 	{
+		num_received++;
+		bytes_received += size;
+		if (!store)
+		{
+			// check the message type and index, like a peer would
+			if (size >= 5 && bt::ReadUint32(packet, 1) != expected_index++)
+				out_of_order++;
+			return;
+		}
+		
 		received_packet.reset(new bt::Uint8[size]);
 		memcpy(received_packet.data(), packet, size);
 		received_packet_size = size;
@@ -62,6 +102,44 @@ public:
 	{
 		received_packet_size = 0;
 		received_packet.reset();
+		num_received = 0;
+		bytes_received = 0;
+		expected_index = 0;
+		out_of_order = 0;
+	}
+	
+	/**
+	 * Build a stream of messages like the ones a seeder sends: mostly 16 KiB pieces with some control messages
+	 * in between. Message i has i as index.
+	 */
+	QByteArray buildStream(bt::Uint32 num_messages, bool with_pieces)
+	{
+		QByteArray stream;
+		QByteArray piece(16 * 1024 + 9, 0);
+		QByteArray have(9, 0);
+		for (bt::Uint32 i = 0; i < num_messages; i++)
+		{
+			QByteArray & msg = (with_pieces && i % 4 == 3) ? piece : have;
+			bt::WriteUint32((bt::Uint8*)msg.data(), 0, msg.size() - 4);
+			msg[4] = (char)(&msg == &piece ? bt::PIECE : bt::HAVE);
+			bt::WriteUint32((bt::Uint8*)msg.data(), 5, i);
+			stream.append(msg);
+		}
+		return stream;
+	}
+	
+	/// Feed a stream to a PacketReader in parts like a socket would, and pass the packets to this
+	void feed(bt::PacketReader & pr, const QByteArray & stream, bt::Uint32 part_size)
+	{
+		bt::Uint8* data = (bt::Uint8*)stream.data();
+		bt::Uint32 off = 0;
+		while (off < (bt::Uint32)stream.size())
+		{
+			bt::Uint32 n = qMin(part_size, (bt::Uint32)stream.size() - off);
+			pr.onDataReady(data + off, n);
+			off += n;
+			pr.update(*this);
+		}
 	}
 	
 private Q_SLOTS:
@@ -156,9 +234,89 @@ private Q_SLOTS:
 		QVERIFY(received_packet_size == 0);
 	}
 	
+	void testManyPackets_data()
+	{
+		QTest::addColumn<bool>("with_pieces");
+		QTest::addColumn<uint>("part_size");
+		QTest::newRow("control, small reads") << false << 7u;
+		QTest::newRow("control, big reads") << false << 16384u;
+		QTest::newRow("mixed, small reads") << true << 1000u;
+		QTest::newRow("mixed, big reads") << true << 65536u;
+	}
+	
+	void testManyPackets()
+	{
+		QFETCH(bool, with_pieces);
+		QFETCH(uint, part_size);
+		
+		reset();
+		store = false;
+		QByteArray stream = buildStream(2000, with_pieces);
+		bt::PacketReader pr(20 * 1024);
+		feed(pr, stream, part_size);
+		store = true;
+		
+		QVERIFY(pr.ok());
+		QVERIFY(num_received == 2000);
+		QVERIFY(out_of_order == 0);
+		QVERIFY(bytes_received == (bt::Uint64)stream.size() - 2000 * 4);
+	}
+	
+	void testAllocations()
+	{
+		reset();
+		store = false;
+		const bt::Uint32 num_messages = 100000;
+		QByteArray stream = buildStream(num_messages, true);
+		bt::PacketReader pr(20 * 1024);
+		
+		// warm up the buffer pool
+		feed(pr, buildStream(1000, true), 65536);
+		reset();
+		store = false;
+		
+		int before = num_allocations;
+		feed(pr, stream, 65536);
+		int allocations = num_allocations - before;
+		store = true;
+		
+		Out(SYS_GEN | LOG_DEBUG) << "Allocations for " << num_messages << " messages: " << allocations << endl;
+		QVERIFY(num_received == num_messages);
+		// only the queue segments and slabs may be allocated, not something per message
+		QVERIFY(allocations < (int)num_messages / 10);
+	}
+	
+	void testThroughput()
+	{
+		reset();
+		store = false;
+		QByteArray stream = buildStream(20000, true);
+		bt::PacketReader pr(20 * 1024);
+		
+		bt::TimeStamp start = bt::Now();
+		for (int i = 0; i < 10; i++)
+		{
+			expected_index = 0;
+			feed(pr, stream, 65536);
+		}
+		bt::TimeStamp duration = bt::Now() - start;
+		store = true;
+		
+		QVERIFY(num_received == 200000);
+		QVERIFY(out_of_order == 0);
+		if (duration > 0)
+			Out(SYS_GEN | LOG_DEBUG) << "PacketReader throughput: " << (bytes_received * 1000 / duration) / (1024 * 1024) << " MiB/s, "
+				<< (num_received * 1000) / duration << " messages/s" << endl;
+	}
+	
 private:
 	QScopedArrayPointer<bt::Uint8> received_packet;
 	bt::Uint32 received_packet_size;
+	bool store;
+	bt::Uint32 num_received;
+	bt::Uint64 bytes_received;
+	bt::Uint32 expected_index;
+	bt::Uint32 out_of_order;
 };
 
 QTEST_MAIN(PacketReaderTest)
@@ -0,0 +1,207 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <math.h>
+#include <QtTest>
+#include <QObject>
+#include <QList>
+#include <util/log.h>
+#include <peer/requestpipeline.h>
+
+using namespace bt;
+
+/**
+ * In process emulation of a link to a peer. Requests take half a round trip to arrive,
+ * the peer sends the pieces one after the other at the bandwidth of the link, and the pieces take
+ * another half a round trip to come back.
+ */
+class Link
+{
+public:
+	Link(Uint32 bandwidth,Uint32 rtt) : bandwidth(bandwidth),rtt(rtt),busy_until(0)
+	{
+	}
+	
+	/// Send a request at time now, returns when the piece will arrive
+	double request(double now)
+	{
+		double start = qMax(now + rtt / 2.0,busy_until);
+		busy_until = start + MAX_PIECE_LEN * 1000.0 / bandwidth;
+		return busy_until + rtt / 2.0;
+	}
+	
+	Uint32 bandwidth; // bytes per second
+	Uint32 rtt; // ms
+	double busy_until;
+};
+
+/// The number of requests PeerDownloader allowed before the RequestPipeline, without a reqq
+static Uint32 LegacyMaxRequests(Uint32 download_rate)
+{
+	double pieces_per_sec = (double)download_rate / MAX_PIECE_LEN;
+	return 1 + (Uint32)ceil(10 * pieces_per_sec);
+}
+
+struct Outstanding
+{
+	double sent;
+	double arrival;
+	Uint64 bytes_ahead;
+};
+
+class RequestPipelineTest : public QObject
+{
+	Q_OBJECT
+public:
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("requestpipelinetest.log");
+	}
+	
+	void cleanupTestCase()
+	{
+	}
+	
+	void testReqq()
+	{
+		RequestPipeline p;
+		QVERIFY(p.maxRequests() > 0);
+		
+		// fast peer with a high round trip time
+		for (TimeStamp t = 0;t < 100;t++)
+			p.pieceReceived(500,0,t);
+		p.update(10 * 1024 * 1024,0);
+		QVERIFY(p.maxRequests() > 100);
+		
+		p.update(10 * 1024 * 1024,64);
+		QVERIFY(p.maxRequests() == 64);
+	}
+	
+	void testQueueingIsNotRoundTripTime()
+	{
+		RequestPipeline p;
+		// 100 KiB/s, 50 ms round trip time, the first request has nothing in front of it
+		p.pieceReceived(50,0,0);
+		// but the following ones have 10 pieces in front of them
+		Uint32 rate = 100 * 1024;
+		Uint64 ahead = 10 * MAX_PIECE_LEN;
+		TimeStamp latency = 50 + ahead * 1000 / rate;
+		for (TimeStamp t = 0;t < 100;t++)
+			p.pieceReceived(latency,ahead,t);
+		
+		QVERIFY(p.roundTripTime() <= 60);
+		p.update(rate,0);
+		QVERIFY(p.maxRequests() <= 4);
+	}
+	
+	void testSlowPeer()
+	{
+		// a slow peer should not hoard requests
+		Link link(20 * 1024,100);
+		double throughput = 0;
+		Uint32 max_requests = run(link,true,throughput);
+		QVERIFY(max_requests <= 4);
+		QVERIFY(throughput > 0.9 * link.bandwidth);
+	}
+	
+	void testThroughput_data()
+	{
+		QTest::addColumn<uint>("rtt");
+		QTest::newRow("10 ms") << 10u;
+		QTest::newRow("50 ms") << 50u;
+		QTest::newRow("100 ms") << 100u;
+		QTest::newRow("200 ms") << 200u;
+		QTest::newRow("400 ms") << 400u;
+	}
+	
+	void testThroughput()
+	{
+		QFETCH(uint,rtt);
+		
+		Link legacy_link(8 * 1024 * 1024,rtt);
+		double legacy = 0;
+		Uint32 legacy_requests = run(legacy_link,false,legacy);
+		
+		Link adaptive_link(8 * 1024 * 1024,rtt);
+		double adaptive = 0;
+		Uint32 max_requests = run(adaptive_link,true,adaptive);
+		
+		Out(SYS_GEN|LOG_DEBUG) << "RTT " << rtt << " ms: old formula " << (Uint32)(legacy / 1024) << " KiB/s with "
+			<< legacy_requests << " requests, adaptive " << (Uint32)(adaptive / 1024) << " KiB/s with "
+			<< max_requests << " requests" << endl;
+		QVERIFY(adaptive > 0.8 * adaptive_link.bandwidth);
+		// about the same throughput, without piling up far more requests then the link can hold
+		QVERIFY(adaptive >= 0.95 * legacy);
+		QVERIFY(max_requests <= legacy_requests);
+	}
+	
+private:
+	/**
+	 * Download over a link for 30 seconds, in steps of 1 ms.
+	 * @param link The link
+	 * @param adaptive Use the RequestPipeline or the old formula based on the download rate (see LegacyMaxRequests)
+	 * @param throughput The throughput over the last 10 seconds in bytes per second
+	 * @return The number of requests allowed at the end
+	 */
+	Uint32 run(Link & link,bool adaptive,double & throughput)
+	{
+		const TimeStamp DURATION = 30 * 1000;
+		RequestPipeline p;
+		QList<Outstanding> outstanding;
+		QList<TimeStamp> arrivals; // for the download rate over the last second
+		Uint64 received = 0;
+		
+		for (TimeStamp now = 0;now < DURATION;now++)
+		{
+			while (!arrivals.isEmpty() && arrivals.first() + 1000 <= now)
+				arrivals.removeFirst();
+			Uint32 rate = arrivals.count() * MAX_PIECE_LEN;
+			
+			while (!outstanding.isEmpty() && outstanding.first().arrival <= now)
+			{
+				Outstanding o = outstanding.takeFirst();
+				p.pieceReceived((TimeStamp)(now - o.sent),o.bytes_ahead,now);
+				arrivals.append(now);
+				if (now >= DURATION - 10 * 1000)
+					received += MAX_PIECE_LEN;
+			}
+			
+			p.update(rate,0);
+			Uint32 max = adaptive ? p.maxRequests() : LegacyMaxRequests(rate);
+			while ((Uint32)outstanding.count() < max)
+			{
+				Outstanding o;
+				o.sent = now;
+				o.arrival = link.request(now);
+				o.bytes_ahead = (Uint64)outstanding.count() * MAX_PIECE_LEN;
+				outstanding.append(o);
+			}
+		}
+		
+		throughput = received / 10.0;
+		return adaptive ? p.maxRequests() : LegacyMaxRequests(arrivals.count() * MAX_PIECE_LEN);
+	}
+};
+
+QTEST_MAIN(RequestPipelineTest)
+
+#include "requestpipelinetest.moc"
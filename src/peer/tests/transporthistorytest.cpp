@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   Copyright (C) 2012 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+
+#include <QtTest>
+#include <QObject>
+#include <util/log.h>
+#include <peer/transporthistory.h>
+
+
+class TransportHistoryTest : public QObject
+{
+	Q_OBJECT
+public:
+	
+	
+private Q_SLOTS:
+	void initTestCase()
+	{
+		bt::InitLog("transporthistorytest.log");
+	}
+	
+	void cleanupTestCase()
+	{
+		bt::TransportHistory::setPolicy(bt::TransportHistory::LEDBAT_FRIENDLY);
+	}
+	
+	void testUnknownNetwork()
+	{
+		bt::TransportHistory th;
+		net::Address addr("10.0.0.1", 6881);
+		QVERIFY(th.preferred(addr, bt::UTP) == bt::UTP);
+		QVERIFY(th.preferred(addr, bt::TCP) == bt::TCP);
+		QVERIFY(th.shouldRace(addr));
+	}
+	
+	void testNetworkPrefix()
+	{
+		bt::TransportHistory th;
+		th.addSample(net::Address("10.0.0.1", 6881), bt::UTP, 1000);
+		
+		// same /24, so the other transport should be tried next
+		QVERIFY(th.goodput(net::Address("10.0.0.200", 1234), bt::UTP) == 1000);
+		QVERIFY(th.preferred(net::Address("10.0.0.200", 1234), bt::UTP) == bt::TCP);
+		QVERIFY(th.shouldRace(net::Address("10.0.0.200", 1234)));
+		
+		// other /24
+		QVERIFY(th.goodput(net::Address("10.0.1.1", 6881), bt::UTP) == 0);
+		
+		th.addSample(net::Address("2001:db8::1", 6881), bt::TCP, 5000);
+		QVERIFY(th.goodput(net::Address("2001:db8::ffff", 6881), bt::TCP) == 5000);
+		QVERIFY(th.goodput(net::Address("2001:db8:0:1::1", 6881), bt::TCP) == 0);
+		QVERIFY(th.count() == 2);
+	}
+	
+	void testPolicy()
+	{
+		bt::TransportHistory th;
+		net::Address addr("10.0.0.1", 6881);
+		th.addSample(addr, bt::UTP, 600);
+		th.addSample(addr, bt::TCP, 1000);
+		QVERIFY(!th.shouldRace(addr));
+		
+		// uTP is slower, but not slow enough to give it up
+		bt::TransportHistory::setPolicy(bt::TransportHistory::LEDBAT_FRIENDLY);
+		QVERIFY(th.preferred(addr, bt::TCP) == bt::UTP);
+		bt::TransportHistory::setPolicy(bt::TransportHistory::THROUGHPUT);
+		QVERIFY(th.preferred(addr, bt::UTP) == bt::TCP);
+		
+		// uTP gets less then half, the average moves a quarter of the way per sample
+		th.addSample(addr, bt::UTP, 200);
+		QVERIFY(th.goodput(addr, bt::UTP) == 500);
+		th.addSample(addr, bt::UTP, 0);
+		bt::TransportHistory::setPolicy(bt::TransportHistory::LEDBAT_FRIENDLY);
+		QVERIFY(th.preferred(addr, bt::UTP) == bt::TCP);
+	}
+	
+	void testMaxNetworks()
+	{
+		bt::TransportHistory th(10);
+		for (int i = 0; i < 20; i++)
+			th.addSample(net::Address(QString("10.0.%1.1").arg(i), 6881), bt::TCP, 1000);
+		
+		QVERIFY(th.count() == 10);
+		
+		// the least recently updated network goes first
+		th.addSample(net::Address("10.0.10.1", 6881), bt::UTP, 1000);
+		th.addSample(net::Address("10.0.100.1", 6881), bt::TCP, 1000);
+		QVERIFY(th.count() == 10);
+		QVERIFY(th.goodput(net::Address("10.0.10.1", 6881), bt::UTP) == 1000);
+		QVERIFY(th.goodput(net::Address("10.0.11.1", 6881), bt::TCP) == 0);
+		QVERIFY(th.goodput(net::Address("10.0.100.1", 6881), bt::TCP) == 1000);
+	}
+	
+	void testMaxRaces()
+	{
+		bt::TransportHistory th;
+		net::Address addr("10.0.0.1", 6881);
+		for (bt::Uint32 i = 0; i < bt::TransportHistory::MAX_RACES; i++)
+		{
+			QVERIFY(th.shouldRace(addr));
+			th.raceStarted(addr);
+			// nothing is known about the goodput yet
+			QVERIFY(th.preferred(addr, bt::UTP) == bt::UTP);
+		}
+		
+		// connections in this network never got measured, so stop racing
+		QVERIFY(!th.shouldRace(addr));
+		th.addSample(addr, bt::UTP, 1000);
+		QVERIFY(!th.shouldRace(addr));
+		QVERIFY(th.preferred(addr, bt::UTP) == bt::TCP);
+	}
+};
+
+QTEST_MAIN(TransportHistoryTest)
+
+#include "transporthistorytest.moc"
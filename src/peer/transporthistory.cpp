@@ -0,0 +1,147 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+
+#include "transporthistory.h"
+#include <util/functions.h>
+
+namespace bt
+{
+	// weight of a new sample in the average
+	const double SAMPLE_WEIGHT = 0.25;
+	// with the LEDBAT friendly policy, TCP is only preferred when uTP gets less then this fraction of it
+	const double FRIENDLY_RATIO = 0.5;
+
+	TransportHistory::Policy TransportHistory::current_policy = TransportHistory::LEDBAT_FRIENDLY;
+
+	TransportHistory::TransportHistory(Uint32 max_networks) : max_networks(max_networks)
+	{
+	}
+
+	TransportHistory::~TransportHistory()
+	{
+	}
+
+	TransportHistory & TransportHistory::instance()
+	{
+		static TransportHistory inst;
+		return inst;
+	}
+
+	void TransportHistory::setPolicy(Policy p)
+	{
+		current_policy = p;
+	}
+
+	QByteArray TransportHistory::networkOf(const net::Address & addr)
+	{
+		if (addr.isIPv4Mapped())
+			return networkOf(addr.convertIPv4Mapped());
+
+		if (addr.ipVersion() == 4)
+		{
+			quint32 ip = addr.toIPv4Address() & 0xFFFFFF00;
+			return QByteArray((const char*)&ip, sizeof(ip));
+		}
+		else
+		{
+			Q_IPV6ADDR ip = addr.toIPv6Address();
+			return QByteArray((const char*)&ip, 8);
+		}
+	}
+
+	TransportHistory::Network & TransportHistory::update(const net::Address & addr)
+	{
+		QByteArray key = networkOf(addr);
+		QHash<QByteArray, Network>::iterator i = networks.find(key);
+		if (i == networks.end())
+		{
+			// forget the network which hasn't been updated for the longest time
+			if ((Uint32)networks.count() >= max_networks && !lru.isEmpty())
+				networks.remove(lru.takeFirst());
+
+			i = networks.insert(key, Network());
+		}
+		else
+			lru.erase(i->lru_position);
+
+		i->lru_position = lru.insert(lru.end(), key);
+		return i.value();
+	}
+
+	void TransportHistory::addSample(const net::Address & addr, TransportProtocol proto, Uint32 goodput)
+	{
+		Network & n = update(addr);
+		if (n.samples[proto] == 0)
+			n.goodput[proto] = goodput;
+		else
+			n.goodput[proto] = (1.0 - SAMPLE_WEIGHT) * n.goodput[proto] + SAMPLE_WEIGHT * goodput;
+		n.samples[proto]++;
+	}
+
+	void TransportHistory::raceStarted(const net::Address & addr)
+	{
+		update(addr).races++;
+	}
+
+	TransportProtocol TransportHistory::preferred(const net::Address & addr, TransportProtocol fallback) const
+	{
+		QHash<QByteArray, Network>::const_iterator i = networks.find(networkOf(addr));
+		if (i == networks.end())
+			return fallback;
+
+		const Network & n = i.value();
+		if (n.samples[TCP] == 0 && n.samples[UTP] == 0)
+			return fallback;
+		else if (n.samples[TCP] == 0)
+			return TCP;
+		else if (n.samples[UTP] == 0)
+			return UTP;
+
+		if (current_policy == LEDBAT_FRIENDLY)
+			return n.goodput[UTP] < FRIENDLY_RATIO * n.goodput[TCP] ? TCP : UTP;
+		else if (n.goodput[UTP] == n.goodput[TCP])
+			return fallback;
+		else
+			return n.goodput[UTP] > n.goodput[TCP] ? UTP : TCP;
+	}
+
+	bool TransportHistory::shouldRace(const net::Address & addr) const
+	{
+		QHash<QByteArray, Network>::const_iterator i = networks.find(networkOf(addr));
+		if (i == networks.end())
+			return true;
+		else
+			return (i->samples[TCP] == 0 || i->samples[UTP] == 0) && i->races < MAX_RACES;
+	}
+
+	Uint32 TransportHistory::goodput(const net::Address & addr, TransportProtocol proto) const
+	{
+		QHash<QByteArray, Network>::const_iterator i = networks.find(networkOf(addr));
+		return i == networks.end() ? 0 : (Uint32)i->goodput[proto];
+	}
+
+	void TransportHistory::clear()
+	{
+		networks.clear();
+		lru.clear();
+	}
+
+}
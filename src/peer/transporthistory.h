@@ -0,0 +1,134 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+
+#ifndef BT_TRANSPORTHISTORY_H
+#define BT_TRANSPORTHISTORY_H
+
+#include <QHash>
+#include <QLinkedList>
+#include <QByteArray>
+#include <ktorrent_export.h>
+#include <util/constants.h>
+#include <net/address.h>
+
+namespace bt
+{
+
+	/**
+		Keeps track of the goodput uTP and TCP connections got per network (/24 for IPv4, /64 for IPv6),
+		so new connections to peers in that network can prefer the transport which performed best.
+	*/
+	class KTORRENT_EXPORT TransportHistory
+	{
+	public:
+		enum Policy
+		{
+			/// Prefer uTP, unless TCP was more then twice as fast
+			LEDBAT_FRIENDLY,
+			/// Prefer the transport with the highest goodput
+			THROUGHPUT
+		};
+
+		/**
+			Constructor
+			@param max_networks Maximum number of networks to remember
+		*/
+		TransportHistory(Uint32 max_networks = 4096);
+		virtual ~TransportHistory();
+
+		/// Get the singleton instance
+		static TransportHistory & instance();
+
+		/**
+			Add a goodput measurement of a connection.
+			@param addr Address of the peer
+			@param proto The transport the connection used
+			@param goodput The goodput in bytes/s
+		*/
+		void addSample(const net::Address & addr, TransportProtocol proto, Uint32 goodput);
+
+		/**
+			Get the transport to try first for a peer. If only one transport has been measured
+			in the peer's network, the other one is returned, so it gets measured too.
+			@param addr Address of the peer
+			@param fallback Returned when nothing is known about the peer's network
+		*/
+		TransportProtocol preferred(const net::Address & addr, TransportProtocol fallback) const;
+
+		/**
+			Whether both transports should be raced, which is the case until both have been measured.
+			Networks where connections never last long enough to measure both, are raced at most MAX_RACES times.
+		*/
+		bool shouldRace(const net::Address & addr) const;
+
+		/// A race between both transports has been started to a peer
+		void raceStarted(const net::Address & addr);
+
+		/// Get the average goodput of a transport in the network of a peer, 0 if unknown
+		Uint32 goodput(const net::Address & addr, TransportProtocol proto) const;
+
+		/// Get the number of networks in the history
+		Uint32 count() const {return networks.count();}
+
+		/// Forget everything
+		void clear();
+
+		/// Set the policy
+		static void setPolicy(Policy p);
+
+		/// Get the policy
+		static Policy policy() {return current_policy;}
+
+		/// Minimum amount of bytes a connection has to download or upload, before its goodput is meaningful
+		static const Uint64 MIN_SAMPLE_SIZE = 1024 * 1024;
+
+		/// Maximum number of races in a network, when the goodput of one of the transports is still unknown
+		static const Uint32 MAX_RACES = 10;
+
+	private:
+		struct Network
+		{
+			Network() : races(0)
+			{
+				goodput[TCP] = goodput[UTP] = 0;
+				samples[TCP] = samples[UTP] = 0;
+			}
+
+			double goodput[2];
+			Uint32 samples[2];
+			Uint32 races;
+			QLinkedList<QByteArray>::iterator lru_position;
+		};
+
+		static QByteArray networkOf(const net::Address & addr);
+		Network & update(const net::Address & addr);
+
+	private:
+		QHash<QByteArray, Network> networks;
+		// least recently updated network first
+		QLinkedList<QByteArray> lru;
+		Uint32 max_networks;
+		static Policy current_policy;
+	};
+
+}
+
+#endif // BT_TRANSPORTHISTORY_H
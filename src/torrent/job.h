@@ -44,6 +44,9 @@ namespace bt
 		/// Do we need to stop the torrent when the job is running
 		bool stopTorrent() const {return stop_torrent;}
 		
+		/// Set whether or not the torrent needs to be stopped when the job is running
+		void setStopTorrent(bool on) {stop_torrent = on;}
+		
 		virtual void start();
 		virtual void kill(bool quietly=true);
 		
@@ -76,7 +76,7 @@ namespace bt
     Uint32 TorrentControl::min_diskspace = 100;
 
     TorrentControl::TorrentControl()
-        : tor(0), psman(0), cman(0), pman(0), downloader(0), uploader(0), choke(0), tmon(0), prealloc(false)
+        : tor(0), psman(0), cman(0), pman(0), downloader(0), uploader(0), choke(0), tmon(0), prealloc(false), preallocating(false)
     {
         job_queue = new JobQueue(this);
         cache_factory = 0;
@@ -151,8 +151,9 @@ namespace bt
             return;
         }
 
-        if (prealloc && preallocate())
-            return;
+        // preallocation runs in the background, chunks are downloaded as soon as their diskspace is allocated
+        if (prealloc && !preallocating)
+            preallocate();
 
         try
         {
@@ -415,18 +416,15 @@ namespace bt
 
         istats.time_started_ul = istats.time_started_dl = QDateTime::currentDateTime();
 
+        // start right away, chunks will only be downloaded once their diskspace has been allocated
         if (prealloc)
-        {
-            if (preallocate())
-                return;
-        }
+            preallocate();
 
         continueStart();
     }
 
     void TorrentControl::continueStart()
     {
-        // continues start after the prealloc_thread has finished preallocation
         pman->start(stats.completed && stats.superseeding);
         pman->loadPeerList(tordir + "peer_list");
         try
@@ -473,6 +471,7 @@ namespace bt
         // stop preallocation
         if (job_queue->currentJob() && job_queue->currentJob()->torrentStatus() == ALLOCATING_DISKSPACE)
             job_queue->currentJob()->kill(false);
+        preallocating = false;
 
         if (stats.running)
         {
@@ -866,6 +865,8 @@ namespace bt
                 if (j)
                 {
                     j->setTorrent(this);
+                    // files of a complete torrent are only read, so we can keep seeding while they are being copied
+                    j->setStopTorrent(!stats.completed);
                     connect(j, SIGNAL(result(KJob*)), this, SLOT(moveDataFilesFinished(KJob*)));
                     job_queue->enqueue(j);
                     return true;
@@ -917,6 +918,7 @@ namespace bt
             Job* j = cman->moveDataFiles(files);
             if (j)
             {
+                j->setStopTorrent(!stats.completed);
                 connect(j, SIGNAL(result(KJob*)), this, SLOT(moveDataFilesWithMapFinished(KJob*)));
                 job_queue->enqueue(j);
             }
@@ -1785,6 +1787,7 @@ namespace bt
     void TorrentControl::preallocFinished(const QString& error, bool completed)
     {
         Out(SYS_GEN | LOG_DEBUG) << "preallocFinished " << error << " " << completed << endl;
+        preallocating = false;
         if (!error.isEmpty() || !completed)
         {
             // upon error just call onIOError and return
@@ -1794,11 +1797,10 @@ namespace bt
         }
         else
         {
-            // continue the startup of the torrent
+            // the torrent has already been started, so only the status needs to be updated
             prealloc = false;
-            stats.status = NOT_STARTED;
             saveStats();
-            continueStart();
+            updateStatus();
             statusChanged(this);
         }
     }
@@ -1908,6 +1910,12 @@ namespace bt
     }
 
 
+    void TorrentControl::ioStats(QMap<QString, IOStats> & stats) const
+    {
+        if (cman)
+            cman->ioStats(stats);
+    }
+
     void TorrentControl::allJobsDone()
     {
         updateStatus();
@@ -1940,6 +1948,7 @@ namespace bt
         {
             Out(SYS_GEN | LOG_NOTICE) << "Pre-allocating diskspace" << endl;
             stats.running = true;
+            preallocating = true;
             job_queue->enqueue(new PreallocationJob(cman, this));
             updateStatus();
             return true;
@@ -40,6 +40,7 @@ class KJob;
 namespace bt
 {
 	class StatsFile;
+	struct IOStats;
 	class Choker;
 	class PeerSourceManager;
 	class ChunkManager;
@@ -195,6 +196,13 @@ namespace bt
 		/// Set a custom Cache factory
 		void setCacheFactory(CacheFactory* cf);
 		
+		/**
+		 * Get the disk I/O statistics of the files of this torrent,
+		 * see IOStatsCollector for statistics per mount point.
+		 * @param stats Map of file paths and their statistics
+		 */
+		void ioStats(QMap<QString,IOStats> & stats) const;
+		
 	public slots:
 		/**
 		 * Update the object, should be called periodically.
@@ -319,6 +327,7 @@ namespace bt
 		QString error_msg;
 		KUrl completed_dir;
 		bool prealloc;
+		bool preallocating;
 		TimeStamp last_diskspace_check;
 		bool loading_stats;
 		
@@ -19,15 +19,31 @@
 ***************************************************************************/
 
 #include "bufferpool.h"
+#include <stdlib.h>
+#include <new>
+#ifdef Q_OS_WIN
+#include <malloc.h>
+#endif
 
 namespace bt
 {
 
-	Buffer::Buffer(Data data, bt::Uint32 fill, bt::Uint32 cap, QWeakPointer<BufferPool> pool)
+	/// Deleter for the aligned data of a Buffer
+	static void FreeAligned(bt::Uint8* ptr)
+	{
+#ifdef Q_OS_WIN
+		_aligned_free(ptr);
+#else
+		free(ptr);
+#endif
+	}
+
+	Buffer::Buffer(Data data, bt::Uint32 fill, bt::Uint32 cap, QWeakPointer<BufferPool> pool, bt::Uint32 alignment)
 		: data(data),
 		  fill(fill),
 		  cap(cap),
-		  pool(pool)
+		  pool(pool),
+		  align(alignment)
 	{
 
 	}
@@ -36,7 +52,7 @@ namespace bt
 	{
 		QSharedPointer<BufferPool> ptr = pool.toStrongRef();
 		if (ptr)
-			ptr->release(data, cap);
+			ptr->release(data, cap, align);
 	}
 
 	BufferPool::BufferPool()
@@ -63,16 +79,57 @@ namespace bt
 		}
 	}
 
-	void BufferPool::release(Buffer::Data data, bt::Uint32 size)
+	Buffer::Ptr BufferPool::getAligned(bt::Uint32 min_size, bt::Uint32 alignment)
+	{
+		// round up to a multiple of the alignment, so that buffers can be reused for similar sizes
+		bt::Uint32 size = (min_size + alignment - 1) & ~(alignment - 1);
+		if (size == 0)
+			size = alignment;
+
+		QMutexLocker lock(&mutex);
+		FreeBufferMap & fb = free_aligned_buffers[alignment];
+		// the bucket of the size may be empty while a bigger free buffer can be reused
+		FreeBufferMap::iterator i = fb.lower_bound(size);
+		while (i != fb.end() && i->second.empty())
+			i++;
+
+		if (i != fb.end())
+		{
+			Buffer::Data data = i->second.front();
+			i->second.pop_front();
+			return Buffer::Ptr(new Buffer(data, min_size, i->first, self, alignment));
+		}
+		else
+		{
+#ifdef Q_OS_WIN
+			void* ptr = _aligned_malloc(size, alignment);
+			if (!ptr)
+				throw std::bad_alloc();
+#else
+			void* ptr = 0;
+			if (posix_memalign(&ptr, alignment, size) != 0)
+				throw std::bad_alloc();
+#endif
+
+			Buffer::Data data((bt::Uint8*)ptr, FreeAligned);
+			return Buffer::Ptr(new Buffer(data, min_size, size, self, alignment));
+		}
+	}
+
+	void BufferPool::release(Buffer::Data data, bt::Uint32 size, bt::Uint32 alignment)
 	{
 		QMutexLocker lock(&mutex);
-		free_buffers[size].push_back(data);
+		if (alignment == 0)
+			free_buffers[size].push_back(data);
+		else
+			free_aligned_buffers[alignment][size].push_back(data);
 	}
 
 	void BufferPool::clear()
 	{
 		QMutexLocker lock(&mutex);
 		free_buffers.clear();
+		free_aligned_buffers.clear();
 	}
 
 } /* namespace bt */
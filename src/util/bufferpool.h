@@ -43,7 +43,7 @@ namespace bt
 		typedef QSharedPointer<Buffer> Ptr;
 		typedef boost::shared_array<bt::Uint8> Data;
 
-		Buffer(Data data, bt::Uint32 fill, bt::Uint32 cap, QWeakPointer<BufferPool> pool);
+		Buffer(Data data, bt::Uint32 fill, bt::Uint32 cap, QWeakPointer<BufferPool> pool, bt::Uint32 alignment = 0);
 		virtual ~Buffer();
 
 		/// Get the buffers capacity
@@ -58,11 +58,15 @@ namespace bt
 		/// Get a pointer to the data
 		bt::Uint8* get() {return data.get();}
 
+		/// Get the alignment of the data (0 if it was allocated with new)
+		bt::Uint32 alignment() const {return align;}
+
 	private:
 		Data data;
 		bt::Uint32 fill;
 		bt::Uint32 cap;
 		QWeakPointer<BufferPool> pool;
+		bt::Uint32 align;
 	};
 
 	/**
@@ -88,12 +92,23 @@ namespace bt
 		 **/
 		Buffer::Ptr get(bt::Uint32 min_size);
 
+		/**
+		 * Get a buffer whose data is aligned on a given boundary, suitable for direct I/O.
+		 * Aligned buffers are kept in their own size class, and their capacity is always
+		 * a multiple of the alignment.
+		 * @param min_size The minimum size it should be
+		 * @param alignment The alignment, must be a power of two
+		 * @return A new Buffer
+		 **/
+		Buffer::Ptr getAligned(bt::Uint32 min_size, bt::Uint32 alignment);
+
 		/**
 		 * Release a buffer, puts it into the free list.
 		 * @param data The Buffer::Data
 		 * @param size The size of the data object
+		 * @param alignment The alignment of the data (0 if it isn't an aligned buffer)
 		 **/
-		void release(Buffer::Data data, bt::Uint32 size);
+		void release(Buffer::Data data, bt::Uint32 size, bt::Uint32 alignment = 0);
 
 		/**
 		 * Clear the pool.
@@ -106,6 +121,7 @@ namespace bt
 		typedef std::map<bt::Uint32, std::list<Buffer::Data> > FreeBufferMap;
 		QMutex mutex;
 		FreeBufferMap free_buffers;
+		std::map<bt::Uint32, FreeBufferMap> free_aligned_buffers;
 		QWeakPointer<BufferPool> self;
 	};
 } /* namespace bt */
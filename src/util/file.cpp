@@ -148,6 +148,14 @@ namespace bt
 #endif
 	}
 
+	void File::advise(Uint64 off,Uint64 size,AccessAdvice advice)
+	{
+		if (!fptr)
+			return;
+		
+		AdviseFile(fileno(fptr),off,size,advice);
+	}
+
 	QString File::errorString() const
 	{
 		return QString(strerror(errno));
@@ -24,6 +24,7 @@
 #include <QSharedPointer>
 #include <ktorrent_export.h>
 #include "constants.h"
+#include "fileops.h"
 
 namespace bt
 {
@@ -106,6 +107,14 @@ namespace bt
 		/// Get the current position in the file.
 		Uint64 tell() const;
 
+		/**
+		 * Tell the kernel how a region of the file is going to be accessed.
+		 * @param off Offset of the region
+		 * @param size Size of the region, 0 means until the end of the file
+		 * @param advice The advice
+		 */
+		void advise(Uint64 off,Uint64 size,AccessAdvice advice);
+
 		/// Get the error string.
 		QString errorString() const;
 		
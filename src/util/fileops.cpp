@@ -35,6 +35,12 @@
 #include <sys/stat.h>
 #include <sys/types.h>
 #include <fcntl.h>
+#ifdef HAVE_MADVISE
+#include <sys/mman.h>
+#endif
+#if defined(HAVE_FALLOCATE) && !defined(FALLOC_FL_KEEP_SIZE)
+#include <linux/falloc.h>
+#endif
 #include <QDir>
 #include <QFile>
 #include <QStringList>
@@ -399,6 +405,32 @@ namespace bt
 		}
 	}
 
+	bool FallocateFile(int fd,Uint64 off,Uint64 size)
+	{
+#ifdef HAVE_FALLOCATE
+		if (fallocate(fd,FALLOC_FL_KEEP_SIZE,off,size) == 0)
+			return true;
+		else if (errno != EOPNOTSUPP && errno != ENOSYS)
+			throw Error(i18n("Cannot expand file: %1",strerror(errno)));
+#endif
+
+		int ret = 0;
+#ifdef HAVE_POSIX_FALLOCATE64
+		ret = posix_fallocate64(fd,off,size);
+#elif HAVE_POSIX_FALLOCATE
+		ret = posix_fallocate(fd,off,size);
+#else
+		Q_UNUSED(fd);
+		Q_UNUSED(off);
+		Q_UNUSED(size);
+		return false;
+#endif
+		if (ret != 0)
+			throw Error(i18n("Cannot expand file: %1",strerror(ret)));
+		
+		return true;
+	}
+
 	void TruncateFile(const QString & path,Uint64 size)
 	{
 		int fd = ::open(QFile::encodeName(path),O_RDWR | O_LARGEFILE);
@@ -417,6 +449,52 @@ namespace bt
 		}
 	}
 
+	void AdviseFile(int fd,Uint64 off,Uint64 size,AccessAdvice advice)
+	{
+#ifdef HAVE_POSIX_FADVISE
+		int adv = POSIX_FADV_NORMAL;
+		switch (advice)
+		{
+			case ADVICE_NORMAL: adv = POSIX_FADV_NORMAL; break;
+			case ADVICE_SEQUENTIAL: adv = POSIX_FADV_SEQUENTIAL; break;
+			case ADVICE_RANDOM: adv = POSIX_FADV_RANDOM; break;
+			case ADVICE_WILLNEED: adv = POSIX_FADV_WILLNEED; break;
+			case ADVICE_DONTNEED: adv = POSIX_FADV_DONTNEED; break;
+		}
+		
+		int ret = posix_fadvise(fd,off,size,adv);
+		if (ret != 0)
+			Out(SYS_DIO|LOG_DEBUG) << "posix_fadvise failed : " << QString(strerror(ret)) << endl;
+#else
+		Q_UNUSED(fd);
+		Q_UNUSED(off);
+		Q_UNUSED(size);
+		Q_UNUSED(advice);
+#endif
+	}
+	
+	void AdviseMemory(void* ptr,Uint64 size,AccessAdvice advice)
+	{
+#ifdef HAVE_MADVISE
+		int adv = MADV_NORMAL;
+		switch (advice)
+		{
+			case ADVICE_NORMAL: adv = MADV_NORMAL; break;
+			case ADVICE_SEQUENTIAL: adv = MADV_SEQUENTIAL; break;
+			case ADVICE_RANDOM: adv = MADV_RANDOM; break;
+			case ADVICE_WILLNEED: adv = MADV_WILLNEED; break;
+			case ADVICE_DONTNEED: adv = MADV_DONTNEED; break;
+		}
+		
+		if (madvise(ptr,size,adv) != 0)
+			Out(SYS_DIO|LOG_DEBUG) << "madvise failed : " << QString(strerror(errno)) << endl;
+#else
+		Q_UNUSED(ptr);
+		Q_UNUSED(size);
+		Q_UNUSED(advice);
+#endif
+	}
+
 	void SeekFile(int fd,Int64 off,int whence)
 	{
 #ifdef HAVE_LSEEK64
@@ -136,6 +136,18 @@ namespace bt
 	 */
 	KTORRENT_EXPORT void TruncateFile(int fd,Uint64 size,bool quick);
 	
+	/**
+	 * Allocate the disk blocks of a region of a file, without changing the file size
+	 * (wrapper around fallocate with FALLOC_FL_KEEP_SIZE). If that is not supported,
+	 * posix_fallocate is used, which may extend the file.
+	 * @param fd The file descriptor of the file
+	 * @param off Offset of the region
+	 * @param size Size of the region
+	 * @return false if the system has no way to allocate disk blocks
+	 * @throw Error if something goes wrong (e.g. not enough diskspace)
+	 */
+	KTORRENT_EXPORT bool FallocateFile(int fd,Uint64 off,Uint64 size);
+	
 	/**
 	 * Truncate a file (wrapper around ftruncate)
 	 * @param fd Path of the file
@@ -157,6 +169,35 @@ namespace bt
 
 #endif
 
+	/// Hints which can be given to the kernel about how file data is going to be accessed
+	enum AccessAdvice
+	{
+		ADVICE_NORMAL,
+		ADVICE_SEQUENTIAL,
+		ADVICE_RANDOM,
+		ADVICE_WILLNEED,
+		ADVICE_DONTNEED
+	};
+
+	/**
+	 * Tell the kernel how a region of a file is going to be accessed (wrapper around posix_fadvise).
+	 * This is only a hint, so failures are ignored.
+	 * @param fd The file descriptor
+	 * @param off Offset of the region
+	 * @param size Size of the region, 0 means until the end of the file
+	 * @param advice The advice
+	 */
+	KTORRENT_EXPORT void AdviseFile(int fd,Uint64 off,Uint64 size,AccessAdvice advice);
+
+	/**
+	 * Tell the kernel how a memory mapped region is going to be accessed (wrapper around madvise).
+	 * This is only a hint, so failures are ignored.
+	 * @param ptr Start of the region, must be page aligned
+	 * @param size Size of the region
+	 * @param advice The advice
+	 */
+	KTORRENT_EXPORT void AdviseMemory(void* ptr,Uint64 size,AccessAdvice advice);
+
 	/**
 	 * Seek in a file, wrapper around lseek
 	 * @param fd The file descriptor
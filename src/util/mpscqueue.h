@@ -0,0 +1,103 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef BT_MPSCQUEUE_H
+#define BT_MPSCQUEUE_H
+
+#include <QAtomicPointer>
+#include "constants.h"
+
+namespace bt
+{
+
+	/**
+	 * Unbounded lock free queue for any number of producer threads and one consumer thread.
+	 * Pushing is one atomic exchange, so producers never wait for each other or the consumer.
+	 * T needs a default constructor, the queue keeps one default constructed item around.
+	 */
+	template<class T>
+	class MPSCQueue
+	{
+		struct Node
+		{
+			T item;
+			QAtomicPointer<Node> next;
+			
+			Node() : next(0) {}
+			Node(const T & item) : item(item),next(0) {}
+		};
+		
+	public:
+		MPSCQueue() : head(new Node())
+		{
+			tail = head;
+		}
+		
+		~MPSCQueue()
+		{
+			while (tail)
+			{
+				Node* n = tail->next;
+				delete tail;
+				tail = n;
+			}
+		}
+		
+		/// Add an item to the back of the queue, may be called by any thread
+		void push(const T & item)
+		{
+			Node* n = new Node(item);
+			Node* prev = head.fetchAndStoreOrdered(n);
+			// between the exchange and this store the consumer sees the queue as ending at prev
+			prev->next.fetchAndStoreRelease(n);
+		}
+		
+		/**
+		 * Take the item at the front of the queue, may only be called by the consumer.
+		 * @param item Will be set to the item
+		 * @return false if the queue is empty
+		 */
+		bool pop(T & item)
+		{
+			Node* n = tail->next.fetchAndAddAcquire(0);
+			if (!n)
+				return false;
+			
+			// n becomes the new dummy node, its item is released when it is popped past
+			item = n->item;
+			delete tail;
+			tail = n;
+			return true;
+		}
+		
+		/// Is the queue empty, may only be called by the consumer
+		bool empty() const
+		{
+			return tail->next.fetchAndAddAcquire(0) == 0;
+		}
+		
+	private:
+		QAtomicPointer<Node> head; // last node, swapped by the producers
+		Node* tail; // dummy node in front of the first item, only used by the consumer
+	};
+
+}
+
+#endif // BT_MPSCQUEUE_H
@@ -0,0 +1,130 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef BT_SPSCQUEUE_H
+#define BT_SPSCQUEUE_H
+
+#include <QAtomicInt>
+#include <QAtomicPointer>
+#include "constants.h"
+
+namespace bt
+{
+
+	/**
+	 * Unbounded lock free queue for one producer thread and one consumer thread.
+	 * Items are stored in fixed size segments, so a memory allocation is only needed
+	 * once every SEGMENT_SIZE items.
+	 */
+	template<class T>
+	class SPSCQueue
+	{
+		enum {SEGMENT_SIZE = 256};
+		
+		struct Segment
+		{
+			T items[SEGMENT_SIZE];
+			QAtomicInt write_pos; // written by the producer
+			int read_pos; // only used by the consumer
+			QAtomicPointer<Segment> next;
+			
+			Segment() : write_pos(0),read_pos(0),next(0) {}
+		};
+		
+	public:
+		SPSCQueue()
+		{
+			head = tail = new Segment();
+		}
+		
+		~SPSCQueue()
+		{
+			while (head)
+			{
+				Segment* n = head->next;
+				delete head;
+				head = n;
+			}
+		}
+		
+		/// Add an item to the back of the queue, may only be called by the producer
+		void push(const T & item)
+		{
+			int pos = tail->write_pos;
+			if (pos == SEGMENT_SIZE)
+			{
+				Segment* s = new Segment();
+				s->items[0] = item;
+				s->write_pos = 1;
+				tail->next.fetchAndStoreRelease(s);
+				tail = s;
+			}
+			else
+			{
+				tail->items[pos] = item;
+				tail->write_pos.fetchAndStoreRelease(pos + 1);
+			}
+		}
+		
+		/**
+		 * Take the item at the front of the queue, may only be called by the consumer.
+		 * @param item Will be set to the item
+		 * @return false if the queue is empty
+		 */
+		bool pop(T & item)
+		{
+			if (head->read_pos == SEGMENT_SIZE)
+			{
+				Segment* n = head->next.fetchAndAddAcquire(0);
+				if (!n)
+					return false;
+				
+				// the producer is done with this segment
+				delete head;
+				head = n;
+			}
+			
+			int pos = head->read_pos;
+			if (pos == head->write_pos.fetchAndAddAcquire(0))
+				return false;
+			
+			item = head->items[pos];
+			head->items[pos] = T(); // release resources held by the item
+			head->read_pos = pos + 1;
+			return true;
+		}
+		
+		/// Is the queue empty, may only be called by the consumer
+		bool empty() const
+		{
+			if (head->read_pos < SEGMENT_SIZE)
+				return head->read_pos == head->write_pos.fetchAndAddAcquire(0);
+			else
+				return head->next.fetchAndAddAcquire(0) == 0;
+		}
+		
+	private:
+		Segment* head; // only used by the consumer
+		Segment* tail; // only used by the producer
+	};
+
+}
+
+#endif // BT_SPSCQUEUE_H
@@ -59,6 +59,42 @@ private slots:
 		QVERIFY(b->size() == 2000);
 		QVERIFY(b->capacity() == 2000);
 	}
+
+	void testAlignedPool()
+	{
+		bt::BufferPool::Ptr pool(new bt::BufferPool());
+		pool->setWeakPointer(pool.toWeakRef());
+
+		bt::Buffer::Ptr a = pool->getAligned(1000, 4096);
+		QVERIFY(a);
+		QVERIFY(a->size() == 1000);
+		QVERIFY(a->capacity() == 4096);
+		QVERIFY(a->alignment() == 4096);
+		QVERIFY(((quintptr)a->get() & 4095) == 0);
+		bt::Uint8* data = a->get();
+		a.clear();
+
+		// unaligned buffers should not be handed out by getAligned and vice versa
+		bt::Buffer::Ptr b = pool->get(4096);
+		QVERIFY(b->get() != data);
+		QVERIFY(b->alignment() == 0);
+
+		a = pool->getAligned(4000, 4096);
+		QVERIFY(a->get() == data);
+		QVERIFY(a->capacity() == 4096);
+
+		bt::Buffer::Ptr c = pool->getAligned(5000, 4096);
+		QVERIFY(c->capacity() == 8192);
+		QVERIFY(((quintptr)c->get() & 4095) == 0);
+
+		// the 4096 bucket is empty now, so the free 8192 buffer should be reused
+		bt::Uint8* big = c->get();
+		c.clear();
+		bt::Buffer::Ptr d = pool->getAligned(100, 4096);
+		QVERIFY(d->get() == big);
+		QVERIFY(d->capacity() == 8192);
+		QVERIFY(d->size() == 100);
+	}
 };
 
 QTEST_MAIN(BufferPoolTest)
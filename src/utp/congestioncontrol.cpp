@@ -0,0 +1,68 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "congestioncontrol.h"
+#include "utpprotocol.h"
+#include "ledbat.h"
+
+namespace utp
+{
+	CongestionControl::Algorithm CongestionControl::default_algorithm = CongestionControl::LEDBAT;
+	bt::Uint32 CongestionControl::default_target_delay = 0;
+
+	CongestionControl::CongestionControl(bt::Uint32 target, bt::Uint32 initial_window)
+		: cwnd(initial_window), target_delay(target)
+	{
+	}
+
+	CongestionControl::~CongestionControl()
+	{
+	}
+
+	void CongestionControl::setWindow(double window)
+	{
+		if (window < MIN_PACKET_SIZE)
+			cwnd = MIN_PACKET_SIZE;
+		else
+			cwnd = (bt::Uint32)window;
+	}
+
+	CongestionControl* CongestionControl::create()
+	{
+		switch (default_algorithm)
+		{
+			case LEDBAT_PLUS_PLUS:
+				return new LedbatPlusPlus(default_target_delay);
+			case LEDBAT:
+			default:
+				return new Ledbat(default_target_delay);
+		}
+	}
+
+	void CongestionControl::setAlgorithm(Algorithm algorithm)
+	{
+		default_algorithm = algorithm;
+	}
+
+	void CongestionControl::setTargetDelay(bt::Uint32 ms)
+	{
+		default_target_delay = ms;
+	}
+}
@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef UTP_CONGESTIONCONTROL_H
+#define UTP_CONGESTIONCONTROL_H
+
+#include <QString>
+#include <ktorrent_export.h>
+#include <util/constants.h>
+
+namespace utp
+{
+	/**
+		Interface for the congestion control of a uTP connection. It manages the congestion window,
+		the maximum amount of bytes in flight, using the measurements of the connection.
+	*/
+	class KTORRENT_EXPORT CongestionControl
+	{
+	public:
+		enum Algorithm
+		{
+			LEDBAT,
+			LEDBAT_PLUS_PLUS
+		};
+
+		/// Measurements of a packet received from the other side
+		struct AckInfo
+		{
+			bt::Uint32 bytes_acked; // payload acked by the packet
+			bt::Uint32 bytes_in_flight; // payload in flight before the packet was received
+			bt::Uint32 queuing_delay; // one way delay minus the lowest one seen, in microseconds
+			bt::Uint32 rtt; // in milliseconds
+			bt::Uint32 packet_size; // maximum payload of a packet
+			bt::TimeStamp now;
+		};
+
+		CongestionControl(bt::Uint32 target, bt::Uint32 initial_window);
+		virtual ~CongestionControl();
+
+		/// Get the name of the algorithm
+		virtual QString name() const = 0;
+
+		/// A packet was received
+		virtual void packetReceived(const AckInfo & ack) = 0;
+
+		/// Packets have been lost
+		virtual void packetsLost(bt::TimeStamp now) = 0;
+
+		/// The retransmission timer has expired
+		virtual void timeout(bt::TimeStamp now) = 0;
+
+		/// Get the congestion window in bytes
+		bt::Uint32 window() const {return cwnd;}
+
+		/// Get the target queuing delay in milliseconds
+		bt::Uint32 target() const {return target_delay;}
+
+		/// Create the congestion control for a new connection
+		static CongestionControl* create();
+
+		/// Set the algorithm of new connections
+		static void setAlgorithm(Algorithm algorithm);
+
+		/// Get the algorithm of new connections
+		static Algorithm algorithm() {return default_algorithm;}
+
+		/**
+			Set the target queuing delay of new connections.
+			@param ms The delay in milliseconds, 0 uses the default of the algorithm
+		*/
+		static void setTargetDelay(bt::Uint32 ms);
+
+		/// Get the target queuing delay of new connections, 0 if it is the default of the algorithm
+		static bt::Uint32 targetDelay() {return default_target_delay;}
+
+	protected:
+		/// Change the window, it never goes below MIN_PACKET_SIZE
+		void setWindow(double window);
+
+	protected:
+		bt::Uint32 cwnd;
+		bt::Uint32 target_delay;
+
+	private:
+		static Algorithm default_algorithm;
+		static bt::Uint32 default_target_delay;
+	};
+}
+
+#endif // UTP_CONGESTIONCONTROL_H
@@ -20,6 +20,7 @@
 
 #include "connection.h"
 #include <time.h>
+#include <string.h>
 #include <QFile>
 #include <QEvent>
 #include <QTextStream>
@@ -36,6 +37,8 @@ using namespace bt;
 
 namespace utp
 {
+	// maximum amount of data waiting to be sent
+	const bt::Uint32 OUTPUT_BUFFER_SIZE = 64 * 1024;
 
 	Connection::TransmissionError::TransmissionError(const char* file, int line)
 	{
@@ -44,7 +47,7 @@ namespace utp
 	}
 
 	Connection::Connection(bt::Uint16 recv_connection_id, Type type, const net::Address& remote, Transmitter* transmitter)
-			: transmitter(transmitter),blocking(false)
+			: transmitter(transmitter),output_buffer_size(0),blocking(false),batching(false),ack_pending(false),timeouts(0)
 	{
 		stats.type = type;
 		stats.remote = remote;
@@ -57,8 +60,16 @@ namespace utp
 		fin_sent = false;
 		stats.rtt = 100;
 		stats.rtt_var = 0;
+		stats.queuing_delay = 0;
 		stats.timeout = 1000;
-		stats.packet_size = 1500 - IP_AND_UDP_OVERHEAD - sizeof(utp::Header);
+		// Start with ethernet sized packets, and search upwards to what the interface allows
+		pmtu_max = qMin(transmitter->maxDatagramSize(remote), PMTU_MAX_DATAGRAM_SIZE);
+		stats.pmtu = pmtu_floor = pmtu_max > 0 ? qMin(PMTU_BASE_DATAGRAM_SIZE, pmtu_max) : PMTU_BASE_DATAGRAM_SIZE;
+		pmtu_ceiling = pmtu_max > 0 ? pmtu_max : pmtu_floor;
+		pmtu_probe_size = 0;
+		pmtu_probe_seq_nr = 0;
+		pmtu_next_search = 0;
+		stats.packet_size = stats.pmtu - Header::size() - MAX_EXTENSION_LENGTH;
 		stats.last_window_size_transmitted = 128 * 1024;
 		if (type == OUTGOING)
 		{
@@ -136,7 +147,17 @@ namespace utp
 		//DumpPacket(*hdr,sack);
 
 		updateDelayMeasurement(hdr);
-		remote_wnd->packetReceived(hdr, sack, this);
+		bt::Uint32 bytes_acked = remote_wnd->packetReceived(hdr, sack, this);
+		updateCongestionWindow(bytes_acked);
+		timeouts = 0;
+		if (pmtu_probe_size > 0 && remote_wnd->isAcked(pmtu_probe_seq_nr))
+		{
+			// probe got through, so the path MTU is at least this big
+			pmtu_floor = stats.pmtu = pmtu_probe_size;
+			pmtu_probe_size = 0;
+			updatePacketSize();
+		}
+
 		switch (stats.state)
 		{
 			case CS_SYN_SENT:
@@ -191,8 +212,11 @@ namespace utp
 					}
 					else
 					{
-						// send back an ACK
-						sendStateOrData();
+						// send back an ACK, in a batch one ACK covers all packets
+						if (batching)
+							ack_pending = true;
+						else
+							sendStateOrData();
 						if (blocking && local_wnd->isReadable() > 0)
 							data_ready.wakeAll();
 					}
@@ -241,7 +265,7 @@ namespace utp
 
 					// send back an ACK
 					sendStateOrData();
-					if (stats.state == CS_FINISHED && !fin_sent && output_buffer.size() == 0)
+					if (stats.state == CS_FINISHED && !fin_sent && output_buffer.isEmpty())
 					{
 						sendFIN();
 						fin_sent = true;
@@ -283,6 +307,24 @@ namespace utp
 		return stats.state;
 	}
 
+	void Connection::beginBatch()
+	{
+		QMutexLocker lock(&mutex);
+		batching = true;
+	}
+
+	void Connection::endBatch()
+	{
+		QMutexLocker lock(&mutex);
+		batching = false;
+		if (ack_pending)
+		{
+			ack_pending = false;
+			if (stats.state == CS_CONNECTED || stats.state == CS_FINISHED)
+				sendStateOrData();
+		}
+	}
+
 	void Connection::checkState()
 	{
 		// Check if we have become readable or writeable, and notify if necessary
@@ -356,7 +398,7 @@ namespace utp
 		}
 
 
-		if (!transmitter->sendTo(self.toStrongRef(), packet))
+		if (!transmitter->sendTo(self.toStrongRef(), packet, false))
 			throw TransmissionError(__FILE__, __LINE__);
 
 		last_packet_sent = tv;
@@ -398,15 +440,30 @@ namespace utp
 		else
 			stats.reply_micro = hdr->timestamp_difference_microseconds - tms;
 
-		bt::Uint32 base_delay = delay_window->update(hdr, now.toTimeStamp());
+		// The timestamp difference includes the clock offset between both sides,
+		// subtracting the lowest one seen leaves the queuing delay
+		if (hdr->timestamp_difference_microseconds != 0)
+		{
+			bt::Uint32 base_delay = delay_window->update(hdr, now.toTimeStamp());
+			stats.queuing_delay = hdr->timestamp_difference_microseconds - base_delay;
+		}
+	}
 
-		int our_delay = hdr->timestamp_difference_microseconds / 1000 - base_delay;
-		int off_target = CCONTROL_TARGET - our_delay;
-		double delay_factor = (double)off_target / (double)CCONTROL_TARGET;
-		double window_factor = remote_wnd->windowUsageFactor();
-		double scaled_gain = MAX_CWND_INCREASE_PACKETS_PER_RTT * delay_factor * window_factor;
+	void Connection::updateCongestionWindow(bt::Uint32 bytes_acked)
+	{
+		CongestionControl::AckInfo ack;
+		ack.bytes_acked = bytes_acked;
+		ack.bytes_in_flight = remote_wnd->currentWindow() + bytes_acked;
+		ack.queuing_delay = stats.queuing_delay;
+		ack.rtt = stats.rtt;
+		ack.packet_size = stats.pmtu - Header::size() - MAX_EXTENSION_LENGTH;
+		ack.now = bt::Now();
+		remote_wnd->congestionControl()->packetReceived(ack);
+		updatePacketSize();
+	}
 
-		remote_wnd->updateWindowSize(scaled_gain);
+	void Connection::updatePacketSize()
+	{
 		if (remote_wnd->maxWindow() <= MIN_PACKET_SIZE)
 			stats.packet_size = MIN_PACKET_SIZE;
 		else if (remote_wnd->maxWindow() <= 1000)
@@ -414,17 +471,7 @@ namespace utp
 		else if (remote_wnd->maxWindow() <= 5000)
 			stats.packet_size = 1000;
 		else
-			stats.packet_size = 1500 - IP_AND_UDP_OVERHEAD - sizeof(utp::Header);
-
-		/*
-		Out(SYS_UTP|LOG_DEBUG) << "base_delay " << base_delay << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "our_delay " << our_delay << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "off_target " << off_target << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "delay_factor " << delay_factor << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "window_factor " << window_factor << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "scaled_gain " << scaled_gain << endl;
-		Out(SYS_UTP|LOG_DEBUG) << "packet_size " << stats.packet_size << endl;
-		*/
+			stats.packet_size = stats.pmtu - Header::size() - MAX_EXTENSION_LENGTH; // leave room for a selective ack
 	}
 
 	int Connection::send(const bt::Uint8* data, Uint32 len)
@@ -433,27 +480,50 @@ namespace utp
 		if (stats.state != CS_CONNECTED)
 			return -1;
 
-		// first put data in the output buffer then send packets
-		bt::Uint32 ret = output_buffer.write(data, len);
+		// first put data in the output buffer then send packets,
+		// the data is copied once, straight into the buffers of the packets
+		bt::Uint32 ret = 0;
+		while (ret < len && output_buffer_size < OUTPUT_BUFFER_SIZE)
+		{
+			bt::Uint32 to_write = qMin(len - ret, OUTPUT_BUFFER_SIZE - output_buffer_size);
+			bt::Uint32 n = 0;
+			if (!output_buffer.isEmpty())
+				n = output_buffer.last().appendData(data + ret, to_write, stats.packet_size);
+
+			if (n == 0)
+			{
+				// last packet is full, start a new one
+				output_buffer.append(PacketBuffer(qMax(PacketBuffer::MAX_SIZE, stats.packet_size + PacketBuffer::HEAD_ROOM)));
+				n = output_buffer.last().appendData(data + ret, to_write, stats.packet_size);
+			}
+
+			ret += n;
+			output_buffer_size += n;
+		}
+
 		sendPackets();
-		stats.writeable = !output_buffer.full();
+		stats.writeable = output_buffer_size < OUTPUT_BUFFER_SIZE;
 		return ret;
 	}
 
 	void Connection::sendPackets()
 	{
-		// chop output_buffer data in packets and keep sending
+		sendProbe();
+
+		// send the packets in the output_buffer
 		// until we are no longer allowed or the buffer is empty
-		while (output_buffer.size() > 0 && remote_wnd->availableSpace() > 0)
+		while (!output_buffer.isEmpty() && remote_wnd->availableSpace() > 0)
 		{
-			bt::Uint32 to_read = qMin((bt::Uint32)output_buffer.size(), remote_wnd->availableSpace());
+			PacketBuffer & first = output_buffer.first();
+			bt::Uint32 to_read = qMin(first.payloadSize(), remote_wnd->availableSpace());
 			to_read = qMin(to_read, stats.packet_size);
-			to_read = qMin(to_read, PacketBuffer::MAX_SIZE - extensionLength() - Header::size());
+			to_read = qMin(to_read, first.capacity() - extensionLength() - Header::size());
 			if (to_read == 0)
 				break;
 
-			PacketBuffer packet;
-			packet.fillData(output_buffer, to_read);
+			// Only when the window or the packet size has shrunk, the packet needs to be split
+			PacketBuffer packet = to_read < first.payloadSize() ? first.takeFront(to_read) : output_buffer.takeFirst();
+			output_buffer_size -= to_read;
 
 			TimeValue now;
 			sendDataPacket(packet, stats.seq_nr, now);
@@ -462,7 +532,7 @@ namespace utp
 			stats.seq_nr++;
 		}
 
-		if (stats.state == CS_FINISHED && !fin_sent && output_buffer.size() == 0)
+		if (stats.state == CS_FINISHED && !fin_sent && output_buffer.isEmpty())
 		{
 			sendFIN();
 			fin_sent = true;
@@ -473,13 +543,13 @@ namespace utp
 
 	void Connection::sendStateOrData()
 	{
-		if (output_buffer.size() > 0 && remote_wnd->availableSpace() > 0)
+		if (!output_buffer.isEmpty() && remote_wnd->availableSpace() > 0)
 			sendPackets();
 		else
 			sendState();
 	}
 
-	void Connection::sendDataPacket(PacketBuffer & packet, Uint16 seq_nr, const utp::TimeValue& now)
+	bt::Uint32 Connection::writeDataHeader(bt::Uint8* ptr, Uint16 seq_nr, const utp::TimeValue& now)
 	{
 		bt::Uint32 extension_length = extensionLength();
 
@@ -493,34 +563,133 @@ namespace utp
 		hdr.wnd_size = stats.last_window_size_transmitted = local_wnd->availableSpace();
 		hdr.seq_nr = seq_nr;
 		hdr.ack_nr = local_wnd->lastSeqNr();
-		if (!packet.setHeader(hdr, extension_length))
-		{
-			// Not enough head room
-			throw TransmissionError(__FILE__, __LINE__);
-		}
+		hdr.write(ptr);
 
 		if (extension_length > 0)
 		{
-			bt::Uint8* ptr = packet.extensionData();
+			bt::Uint8* ext = ptr + Header::size();
 			SelectiveAck sack;
-			sack.extension = ptr[0] = 0;
-			sack.length = ptr[1] = extension_length - 2;
-			sack.bitmask = ptr + 2;
+			sack.extension = ext[0] = 0;
+			sack.length = ext[1] = extension_length - 2;
+			sack.bitmask = ext + 2;
 			local_wnd->fillSelectiveAck(&sack);
 		}
 
-		if (!transmitter->sendTo(self.toStrongRef(), packet))
+		return Header::size() + extension_length;
+	}
+
+	void Connection::sendDataPacket(PacketBuffer & packet, Uint16 seq_nr, const utp::TimeValue& now, bool probe)
+	{
+		bt::Uint8 header[MAX_HEADER_SIZE];
+		if (!packet.setHeader(header, writeDataHeader(header, seq_nr, now)))
+		{
+			// Not enough head room
+			throw TransmissionError(__FILE__, __LINE__);
+		}
+
+		if (!transmitter->sendTo(self.toStrongRef(), packet, probe))
 			throw TransmissionError(__FILE__, __LINE__);
 
 		last_packet_sent = now;
 		stats.packets_sent++;
 	}
 
-	void Connection::retransmit(PacketBuffer & packet, Uint16 p_seq_nr)
+	bt::Uint32 Connection::nextProbeSize()
+	{
+		if (pmtu_max == 0)
+			return 0;
+
+		if (pmtu_ceiling - pmtu_floor < PMTU_SEARCH_RESOLUTION)
+		{
+			// Done searching, but the path may change, so try again once in a while
+			bt::TimeStamp now = bt::Now();
+			if (pmtu_next_search == 0)
+				pmtu_next_search = now + PMTU_SEARCH_INTERVAL;
+
+			if (now < pmtu_next_search || pmtu_floor + PMTU_SEARCH_RESOLUTION > pmtu_max)
+				return 0;
+
+			pmtu_next_search = 0;
+			pmtu_ceiling = pmtu_max;
+		}
+
+		// Usually the whole path allows what the interface allows, so try that first, then do a binary search
+		if (pmtu_ceiling == pmtu_max)
+			return pmtu_max;
+		else
+			return (pmtu_floor + pmtu_ceiling + 1) / 2;
+	}
+
+	void Connection::sendProbe()
 	{
+		if (pmtu_probe_size > 0 || stats.state != CS_CONNECTED)
+			return;
+
+		bt::Uint32 probe_size = nextProbeSize();
+		if (probe_size == 0)
+			return;
+
+		// A lost probe is only noticed when 3 packets behind it are acked,
+		// so only probe when there is enough data to fill it and to send after it
+		bt::Uint32 payload_size = probe_size - Header::size() - extensionLength();
+		bt::Uint32 needed = payload_size + 3 * stats.packet_size;
+		if (output_buffer_size < needed || remote_wnd->availableSpace() < needed)
+			return;
+
+		// The probe is a normal data packet which is bigger then the others, so when it is lost
+		// the retransmission, without the don't fragment bit, gets the data through anyway.
+		PacketBuffer packet(probe_size + PacketBuffer::HEAD_ROOM);
+		while (packet.payloadSize() < payload_size && !output_buffer.isEmpty())
+		{
+			PacketBuffer & first = output_buffer.first();
+			bt::Uint32 n = packet.appendData(first.payloadData(), qMin(first.payloadSize(), payload_size - packet.payloadSize()), payload_size);
+			if (n == first.payloadSize())
+				output_buffer.removeFirst();
+			else
+				first.takeFront(n);
+			output_buffer_size -= n;
+		}
+
+		TimeValue now;
+		sendDataPacket(packet, stats.seq_nr, now, true);
+		remote_wnd->addPacket(packet, stats.seq_nr, now.toTimeStamp());
+		pmtu_probe_size = packet.bufferSize();
+		pmtu_probe_seq_nr = stats.seq_nr;
+		stats.seq_nr++;
+	}
+
+	bool Connection::retransmit(PacketBuffer & packet, Uint16 p_seq_nr)
+	{
+		bool lost_probe = pmtu_probe_size > 0 && p_seq_nr == pmtu_probe_seq_nr;
+		if (lost_probe)
+		{
+			// probe got lost, so the path MTU is smaller
+			pmtu_ceiling = pmtu_probe_size - 1;
+			pmtu_probe_size = 0;
+		}
+
+		// The first transmission may still be in the output queue, so the new header can't be
+		// written in front of the payload yet, the transmitter does that when it is safe
+		bt::Uint8 header[MAX_HEADER_SIZE];
 		TimeValue now;
-		sendDataPacket(packet, p_seq_nr, now);
+		bt::Uint32 header_size = writeDataHeader(header, p_seq_nr, now);
+		if (!transmitter->resendTo(self.toStrongRef(), packet, header, header_size))
+			throw TransmissionError(__FILE__, __LINE__);
+
+		last_packet_sent = now;
+		stats.packets_sent++;
 		startTimer();
+		return !lost_probe;
+	}
+
+	void Connection::probeTooBig(bt::Uint32 size)
+	{
+		QMutexLocker lock(&mutex);
+		if (size <= pmtu_ceiling)
+			pmtu_ceiling = size - 1;
+
+		if (pmtu_probe_size == size)
+			pmtu_probe_size = 0;
 	}
 
 	bt::Uint32 Connection::bytesAvailable() const
@@ -606,6 +775,8 @@ namespace utp
 		QMutexLocker lock(&mutex);
 		if (now >= stats.absolute_timeout)
 			handleTimeout();
+		else
+			transmitter->scheduleTimeout(stats.remote, stats.recv_connection_id, stats.absolute_timeout); // woken up too early
 	}
 
 	void Connection::handleTimeout()
@@ -624,7 +795,17 @@ namespace utp
 					data_ready.wakeAll();
 				break;
 			case CS_CONNECTED:
+				timeouts = remote_wnd->allPacketsAcked() ? 0 : timeouts + 1;
 				remote_wnd->timeout(this);
+				if (timeouts >= PMTU_BLACK_HOLE_TIMEOUTS && pmtu_max > 0 && stats.pmtu > PMTU_MIN_DATAGRAM_SIZE)
+				{
+					// Packets of this size might not get through anymore, fall back
+					// to the minimum and search again
+					Out(SYS_UTP | LOG_DEBUG) << "UTP: path MTU black hole on connection " << stats.recv_connection_id << "|" << stats.send_connection_id << endl;
+					pmtu_ceiling = stats.pmtu;
+					stats.pmtu = pmtu_floor = PMTU_MIN_DATAGRAM_SIZE;
+					pmtu_next_search = 0;
+				}
 				stats.packet_size = MIN_PACKET_SIZE;
 				stats.timeout *= 2;
 
@@ -672,13 +853,14 @@ namespace utp
 	bool Connection::allDataSent() const
 	{
 		QMutexLocker lock(&mutex);
-		return remote_wnd->allPacketsAcked() && output_buffer.size() == 0;
+		return remote_wnd->allPacketsAcked() && output_buffer.isEmpty();
 	}
 
 	void Connection::startTimer()
 	{
 		stats.absolute_timeout = TimeValue();
 		stats.absolute_timeout.addMilliSeconds(stats.timeout);
+		transmitter->scheduleTimeout(stats.remote, stats.recv_connection_id, stats.absolute_timeout);
 	}
 
 	bt::Uint32 Connection::extensionLength() const
@@ -694,5 +876,27 @@ namespace utp
 
 	Transmitter::~Transmitter()
 	{}
+
+	void Transmitter::scheduleTimeout(const net::Address& remote, bt::Uint16 recv_connection_id, const TimeValue& deadline)
+	{
+		Q_UNUSED(remote);
+		Q_UNUSED(recv_connection_id);
+		Q_UNUSED(deadline);
+	}
+
+	bool Transmitter::resendTo(Connection::Ptr conn, const PacketBuffer & packet, const bt::Uint8* header, bt::Uint32 header_size)
+	{
+		PacketBuffer copy = packet.copy();
+		if (!copy.setHeader(header, header_size))
+			return false;
+
+		return sendTo(conn, copy, false);
+	}
+
+	bt::Uint32 Transmitter::maxDatagramSize(const net::Address & remote) const
+	{
+		Q_UNUSED(remote);
+		return 0;
+	}
 }
 
@@ -22,6 +22,7 @@
 #define UTP_CONNECTION_H
 
 #include <QPair>
+#include <QList>
 #include <QMutex>
 #include <QWaitCondition>
 #include <QBasicTimer>
@@ -29,7 +30,6 @@
 #include <ktorrent_export.h>
 #include <net/address.h>
 #include <utp/utpprotocol.h>
-#include <util/circularbuffer.h>
 #include <util/timer.h>
 #include <utp/remotewindow.h>
 #include <boost/concept_check.hpp>
@@ -79,7 +79,9 @@ namespace utp
 			TimeValue absolute_timeout;
 			int rtt;
 			int rtt_var;
+			bt::Uint32 queuing_delay; // in microseconds
 			bt::Uint32 packet_size;
+			bt::Uint32 pmtu; // biggest datagram which is known to get through
 			bt::Uint32 last_window_size_transmitted;
 
 			bt::Uint64 bytes_received;
@@ -111,6 +113,12 @@ namespace utp
 		/// Handle a single packet
 		ConnectionState handlePacket(const PacketParser & parser, bt::Buffer::Ptr packet);
 
+		/// Start handling a batch of packets, acknowledgements are held back until endBatch
+		void beginBatch();
+
+		/// Finish a batch of packets, sends one acknowledgement for all the data received in it
+		void endBatch();
+
 		/// Get the remote address
 		const net::Address & remoteAddress() const {return stats.remote;}
 
@@ -151,7 +159,10 @@ namespace utp
 		virtual void updateRTT(const Header* hdr, bt::Uint32 packet_rtt, bt::Uint32 packet_size);
 
 		/// Retransmit a packet
-		virtual void retransmit(PacketBuffer & packet, bt::Uint16 p_seq_nr);
+		virtual bool retransmit(PacketBuffer & packet, bt::Uint16 p_seq_nr);
+
+		/// A path MTU probe of size bytes could not be sent, because it is bigger then the MTU of the interface
+		void probeTooBig(bt::Uint32 size);
 
 		/// Is all data sent
 		bool allDataSent() const;
@@ -174,11 +185,16 @@ namespace utp
 		void sendFIN();
 		void sendReset();
 		void updateDelayMeasurement(const Header* hdr);
+		void updateCongestionWindow(bt::Uint32 bytes_acked);
 		void sendStateOrData();
 		void sendPackets();
 		void sendPacket(bt::Uint32 type, bt::Uint16 p_ack_nr);
 		void checkIfClosed();
-		void sendDataPacket(PacketBuffer & packet, bt::Uint16 seq_nr, const TimeValue & now);
+		void sendDataPacket(PacketBuffer & packet, bt::Uint16 seq_nr, const TimeValue & now, bool probe = false);
+		bt::Uint32 writeDataHeader(bt::Uint8* ptr, bt::Uint16 seq_nr, const TimeValue & now);
+		void sendProbe();
+		bt::Uint32 nextProbeSize();
+		void updatePacketSize();
 		void startTimer();
 		void checkState();
 		bt::Uint32 extensionLength() const;
@@ -188,7 +204,9 @@ namespace utp
 		Transmitter* transmitter;
 		LocalWindow* local_wnd;
 		RemoteWindow* remote_wnd;
-		bt::CircularBuffer output_buffer;
+		// data which has not been sent yet, already cut into packets
+		QList<PacketBuffer> output_buffer;
+		bt::Uint32 output_buffer_size;
 		//bt::Timer timer;
 		mutable QMutex mutex;
 		QWaitCondition connected;
@@ -199,6 +217,16 @@ namespace utp
 		DelayWindow* delay_window;
 		Connection::WPtr self;
 		bool blocking;
+		bool batching;
+		bool ack_pending;
+		// path MTU search, the path MTU is somewhere between floor and ceiling
+		bt::Uint32 pmtu_max; // 0 if there is no path MTU discovery
+		bt::Uint32 pmtu_floor;
+		bt::Uint32 pmtu_ceiling;
+		bt::Uint32 pmtu_probe_size; // 0 if there is no probe in flight
+		bt::Uint16 pmtu_probe_seq_nr;
+		bt::TimeStamp pmtu_next_search;
+		bt::Uint32 timeouts;
 
 		friend class UTPServer;
 	};
@@ -211,14 +239,43 @@ namespace utp
 	public:
 		virtual ~Transmitter();
 
-		/// Send a packet of a connection
-		virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet) = 0;
+		/**
+			Send a packet of a connection.
+			@param conn The connection
+			@param packet The packet
+			@param probe Whether it is a path MTU probe, which must be sent with the don't fragment bit set
+		*/
+		virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet, bool probe) = 0;
+
+		/**
+			Send a packet of a connection again with a new header. The packet data is shared with the first
+			transmission, which may not have been sent yet, so the header must not be written into it right away.
+			The default implementation sends a copy of the payload with the new header in front of it.
+			@param conn The connection
+			@param packet The packet
+			@param header The new header, including extensions
+			@param header_size The size of the header
+		*/
+		virtual bool resendTo(Connection::Ptr conn, const PacketBuffer & packet, const bt::Uint8* header, bt::Uint32 header_size);
 
 		/// Connection has become readable, writeable or both
 		virtual void stateChanged(Connection::Ptr conn, bool readable, bool writeable) = 0;
 
 		/// Called when the connection is closed
 		virtual void closed(Connection::Ptr conn) = 0;
+
+		/**
+			The timeout of a connection has changed, Connection::checkTimeout should be called
+			when the deadline has passed. A connection has one deadline at a time, a new one replaces the old one.
+			The default implementation does nothing.
+		*/
+		virtual void scheduleTimeout(const net::Address & remote, bt::Uint16 recv_connection_id, const TimeValue & deadline);
+
+		/**
+			Get the biggest datagram which can be sent to remote without fragmenting it, the path MTU is searched up to it.
+			The default implementation returns 0, which turns off path MTU discovery.
+		*/
+		virtual bt::Uint32 maxDatagramSize(const net::Address & remote) const;
 	};
 
 }
@@ -0,0 +1,175 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "connectiontable.h"
+#include <QtGlobal>
+
+using namespace bt;
+
+namespace utp
+{
+	const bt::Uint32 MIN_CAPACITY = 64;
+
+	uint qHash(const ConnectionKey & key)
+	{
+		// FNV-1a over the address, port and connection ID
+		bt::Uint32 h = 2166136261u;
+		if (key.remote.ipVersion() == 4)
+		{
+			bt::Uint32 ip = key.remote.toIPv4Address();
+			for (int i = 0; i < 4; i++)
+				h = (h ^ ((ip >> (i * 8)) & 0xFF)) * 16777619u;
+		}
+		else
+		{
+			Q_IPV6ADDR ip = key.remote.toIPv6Address();
+			for (int i = 0; i < 16; i++)
+				h = (h ^ ip[i]) * 16777619u;
+		}
+
+		bt::Uint32 rest = ((bt::Uint32)key.remote.port() << 16) | key.recv_connection_id;
+		for (int i = 0; i < 4; i++)
+			h = (h ^ ((rest >> (i * 8)) & 0xFF)) * 16777619u;
+
+		return h;
+	}
+
+	ConnectionTable::ConnectionTable() : mask(MIN_CAPACITY - 1), num_connections(0)
+	{
+		slots.resize(MIN_CAPACITY);
+	}
+
+	ConnectionTable::~ConnectionTable()
+	{
+	}
+
+	int ConnectionTable::findSlot(const net::Address & remote, bt::Uint16 recv_connection_id, bt::Uint32 hash) const
+	{
+		bt::Uint32 i = hash & mask;
+		while (slots[i].conn)
+		{
+			const Slot & s = slots[i];
+			if (s.hash == hash && s.conn->receiveConnectionID() == recv_connection_id && s.conn->remoteAddress() == remote)
+				return i;
+			i = (i + 1) & mask;
+		}
+		return -1;
+	}
+
+	Connection::Ptr ConnectionTable::find(const net::Address & remote, bt::Uint16 recv_connection_id) const
+	{
+		int i = findSlot(remote, recv_connection_id, qHash(ConnectionKey(remote, recv_connection_id)));
+		return i >= 0 ? slots[i].conn : Connection::Ptr();
+	}
+
+	bool ConnectionTable::contains(const net::Address & remote, bt::Uint16 recv_connection_id) const
+	{
+		return findSlot(remote, recv_connection_id, qHash(ConnectionKey(remote, recv_connection_id))) >= 0;
+	}
+
+	void ConnectionTable::insert(Connection::Ptr conn)
+	{
+		Slot s;
+		s.conn = conn;
+		s.hash = qHash(ConnectionKey(conn->remoteAddress(), conn->receiveConnectionID()));
+
+		int i = findSlot(conn->remoteAddress(), conn->receiveConnectionID(), s.hash);
+		if (i >= 0)
+		{
+			slots[i] = s;
+			return;
+		}
+
+		// keep the load factor below one half, so probe sequences stay short
+		if (2 * (num_connections + 1) > (bt::Uint32)slots.size())
+			resize(slots.size() * 2);
+
+		insertSlot(s);
+		num_connections++;
+	}
+
+	void ConnectionTable::insertSlot(const Slot & s)
+	{
+		bt::Uint32 i = s.hash & mask;
+		while (slots[i].conn)
+			i = (i + 1) & mask;
+		slots[i] = s;
+	}
+
+	bool ConnectionTable::remove(const net::Address & remote, bt::Uint16 recv_connection_id)
+	{
+		int found = findSlot(remote, recv_connection_id, qHash(ConnectionKey(remote, recv_connection_id)));
+		if (found < 0)
+			return false;
+
+		// Shift the following entries back, so no tombstones are needed
+		bt::Uint32 hole = found;
+		bt::Uint32 i = (hole + 1) & mask;
+		while (slots[i].conn)
+		{
+			bt::Uint32 home = slots[i].hash & mask;
+			// move the entry if the hole lies between its home slot and its current slot
+			if (((i - home) & mask) >= ((i - hole) & mask))
+			{
+				slots[hole] = slots[i];
+				hole = i;
+			}
+			i = (i + 1) & mask;
+		}
+		slots[hole] = Slot();
+		num_connections--;
+
+		if ((bt::Uint32)slots.size() > MIN_CAPACITY && 8 * num_connections < (bt::Uint32)slots.size())
+			resize(slots.size() / 2);
+
+		return true;
+	}
+
+	void ConnectionTable::clear()
+	{
+		slots.clear();
+		slots.resize(MIN_CAPACITY);
+		mask = MIN_CAPACITY - 1;
+		num_connections = 0;
+	}
+
+	void ConnectionTable::resize(bt::Uint32 new_capacity)
+	{
+		QVector<Slot> old = slots;
+		slots.clear();
+		slots.resize(new_capacity);
+		mask = new_capacity - 1;
+		for (int i = 0; i < old.size(); i++)
+		{
+			if (old[i].conn)
+				insertSlot(old[i]);
+		}
+	}
+
+	bt::Uint16 ConnectionTable::allocateID(const net::Address & remote) const
+	{
+		// IDs only need to be unique per remote address
+		bt::Uint16 id = qrand() % 32535;
+		while (contains(remote, id))
+			id = qrand() % 32535;
+		return id;
+	}
+
+}
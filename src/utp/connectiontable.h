@@ -0,0 +1,113 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef UTP_CONNECTIONTABLE_H
+#define UTP_CONNECTIONTABLE_H
+
+#include <QVector>
+#include <ktorrent_export.h>
+#include <net/address.h>
+#include "connection.h"
+
+namespace utp
+{
+	/**
+		Identifies a connection: the connection ID is only unique per remote address.
+	*/
+	struct KTORRENT_EXPORT ConnectionKey
+	{
+		net::Address remote;
+		bt::Uint16 recv_connection_id;
+
+		ConnectionKey() : recv_connection_id(0) {}
+		ConnectionKey(const net::Address & remote, bt::Uint16 recv_connection_id)
+				: remote(remote), recv_connection_id(recv_connection_id) {}
+
+		bool operator == (const ConnectionKey & other) const
+		{
+			return recv_connection_id == other.recv_connection_id && remote == other.remote;
+		}
+	};
+
+	KTORRENT_EXPORT uint qHash(const ConnectionKey & key);
+
+	/**
+		Table of all UTP connections, keyed by remote address and connection ID.
+		It is a flat open addressing hash table with linear probing, so looking up
+		the connection of a packet is one hash and usually one comparison.
+	*/
+	class KTORRENT_EXPORT ConnectionTable
+	{
+	public:
+		ConnectionTable();
+		virtual ~ConnectionTable();
+
+		/// Find a connection, returns a null pointer if there is none
+		Connection::Ptr find(const net::Address & remote, bt::Uint16 recv_connection_id) const;
+
+		/// Is there a connection with this address and ID
+		bool contains(const net::Address & remote, bt::Uint16 recv_connection_id) const;
+
+		/// Add a connection, replaces the connection with the same address and ID
+		void insert(Connection::Ptr conn);
+
+		/// Remove a connection, returns false if it wasn't there
+		bool remove(const net::Address & remote, bt::Uint16 recv_connection_id);
+
+		/// Remove all connections
+		void clear();
+
+		/// Get the number of connections
+		bt::Uint32 count() const {return num_connections;}
+
+		/**
+			Pick a random connection ID for a new connection to a remote address,
+			which is not in use for that address.
+		*/
+		bt::Uint16 allocateID(const net::Address & remote) const;
+
+		/// Get the number of slots, for iterating over the table
+		bt::Uint32 capacity() const {return slots.size();}
+
+		/// Get the connection in a slot, slots can be empty
+		Connection::Ptr at(bt::Uint32 slot) const {return slots[slot].conn;}
+
+	private:
+		struct Slot
+		{
+			bt::Uint32 hash;
+			Connection::Ptr conn;
+
+			Slot() : hash(0) {}
+		};
+
+		int findSlot(const net::Address & remote, bt::Uint16 recv_connection_id, bt::Uint32 hash) const;
+		void resize(bt::Uint32 new_capacity);
+		void insertSlot(const Slot & s);
+
+	private:
+		QVector<Slot> slots;
+		bt::Uint32 mask;
+		bt::Uint32 num_connections;
+	};
+
+}
+
+#endif // UTP_CONNECTIONTABLE_H
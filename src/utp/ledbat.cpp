@@ -0,0 +1,184 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include "ledbat.h"
+#include <math.h>
+#include "utpprotocol.h"
+
+namespace utp
+{
+	const bt::Uint32 LEDBAT_INITIAL_WINDOW = 64 * 1024;
+
+	const bt::Uint32 LEDBAT_PLUS_PLUS_TARGET = 60;
+	const bt::Uint32 LEDBAT_PLUS_PLUS_INITIAL_WINDOW = 4 * PMTU_BASE_DATAGRAM_SIZE;
+	// time between two slowdowns, as a multiple of the duration of the last one
+	const bt::Uint32 LEDBAT_PLUS_PLUS_SLOWDOWN_INTERVAL = 9;
+
+	Ledbat::Ledbat(bt::Uint32 target)
+		: CongestionControl(target > 0 ? target : CCONTROL_TARGET, LEDBAT_INITIAL_WINDOW)
+	{
+	}
+
+	Ledbat::~Ledbat()
+	{
+	}
+
+	QString Ledbat::name() const
+	{
+		return "LEDBAT";
+	}
+
+	void Ledbat::packetReceived(const AckInfo & ack)
+	{
+		double target_us = target_delay * 1000.0;
+		double delay_factor = (target_us - ack.queuing_delay) / target_us;
+		double window_factor = qMax((double)ack.bytes_in_flight / cwnd, 1.0);
+		double scaled_gain = MAX_CWND_INCREASE_PACKETS_PER_RTT * delay_factor * window_factor;
+		setWindow(cwnd + scaled_gain);
+	}
+
+	void Ledbat::packetsLost(bt::TimeStamp now)
+	{
+		Q_UNUSED(now);
+		setWindow(0.78 * cwnd);
+	}
+
+	void Ledbat::timeout(bt::TimeStamp now)
+	{
+		Q_UNUSED(now);
+		cwnd = MIN_PACKET_SIZE;
+	}
+
+	///////////////////////////////////////////////////////
+
+	LedbatPlusPlus::LedbatPlusPlus(bt::Uint32 target)
+		: CongestionControl(target > 0 ? target : LEDBAT_PLUS_PLUS_TARGET, LEDBAT_PLUS_PLUS_INITIAL_WINDOW),
+		  phase(SLOW_START),
+		  ssthresh(0xFFFFFFFF),
+		  last_rtt(0),
+		  slowdown_start(0),
+		  slowdown_end(0),
+		  next_slowdown(0),
+		  last_decrease(0)
+	{
+	}
+
+	LedbatPlusPlus::~LedbatPlusPlus()
+	{
+	}
+
+	QString LedbatPlusPlus::name() const
+	{
+		return "LEDBAT++";
+	}
+
+	double LedbatPlusPlus::gain(bt::Uint32 rtt) const
+	{
+		// The base delay is unknown because of the clock offset between both sides,
+		// so the round trip time stands in for it
+		return 1.0 / qMin(16.0, ceil(2.0 * target_delay / rtt));
+	}
+
+	void LedbatPlusPlus::endSlowStart(bt::TimeStamp now, bt::Uint32 rtt)
+	{
+		phase = CONGESTION_AVOIDANCE;
+		ssthresh = cwnd;
+		// The first slowdown comes 2 RTTs after the initial slow start, the next ones
+		// are scheduled so that slowing down takes at most 10% of the time
+		if (slowdown_start == 0)
+			next_slowdown = now + 2 * rtt;
+		else
+			next_slowdown = now + LEDBAT_PLUS_PLUS_SLOWDOWN_INTERVAL * (now - slowdown_start);
+	}
+
+	void LedbatPlusPlus::packetReceived(const AckInfo & ack)
+	{
+		bt::Uint32 rtt = qMax(ack.rtt, (bt::Uint32)1);
+		bt::Uint32 mss = qMax(ack.packet_size, MIN_PACKET_SIZE);
+		last_rtt = rtt;
+
+		if (phase == SLOWDOWN)
+		{
+			// Keep the window at 2 packets, so the queues can drain
+			if (ack.now < slowdown_end)
+				return;
+
+			phase = SLOW_START;
+		}
+
+		if (phase == SLOW_START)
+		{
+			if (ack.queuing_delay > target_delay * 750 || cwnd >= ssthresh)
+			{
+				// 3/4 of the target delay or back at the window before the slowdown
+				endSlowStart(ack.now, rtt);
+			}
+			else
+			{
+				setWindow(cwnd + gain(rtt) * ack.bytes_acked);
+				return;
+			}
+		}
+
+		if (ack.now >= next_slowdown)
+		{
+			ssthresh = cwnd;
+			slowdown_start = ack.now;
+			slowdown_end = ack.now + 2 * rtt;
+			phase = SLOWDOWN;
+			setWindow(2 * mss);
+			return;
+		}
+
+		if (ack.bytes_acked == 0)
+			return;
+
+		// in packets, per packet acked the window changes with delta / W
+		double w = (double)cwnd / mss;
+		double delay = ack.queuing_delay / (target_delay * 1000.0);
+		double delta = gain(rtt);
+		if (delay > 1.0)
+			delta = qMax(delta - (delay - 1.0) * w, -w / 2);
+
+		setWindow(cwnd + delta * ack.bytes_acked / w);
+	}
+
+	void LedbatPlusPlus::packetsLost(bt::TimeStamp now)
+	{
+		// only halve the window once per round trip
+		if (phase == SLOWDOWN || now - last_decrease < last_rtt)
+			return;
+
+		last_decrease = now;
+		setWindow(cwnd / 2);
+		if (phase == SLOW_START)
+			endSlowStart(now, qMax(last_rtt, (bt::Uint32)1));
+		else
+			ssthresh = cwnd;
+	}
+
+	void LedbatPlusPlus::timeout(bt::TimeStamp now)
+	{
+		last_decrease = now;
+		ssthresh = qMax(cwnd / 2, 2 * MIN_PACKET_SIZE);
+		cwnd = MIN_PACKET_SIZE;
+		phase = SLOW_START;
+	}
+}
@@ -0,0 +1,91 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef UTP_LEDBAT_H
+#define UTP_LEDBAT_H
+
+#include <utp/congestioncontrol.h>
+
+namespace utp
+{
+	/**
+		LEDBAT (RFC 6817), the window grows or shrinks with every packet received,
+		depending on how far the queuing delay is from the target.
+	*/
+	class KTORRENT_EXPORT Ledbat : public CongestionControl
+	{
+	public:
+		/**
+			Constructor
+			@param target Target delay in ms, 0 for the default
+		*/
+		Ledbat(bt::Uint32 target = 0);
+		virtual ~Ledbat();
+
+		virtual QString name() const;
+		virtual void packetReceived(const AckInfo & ack);
+		virtual void packetsLost(bt::TimeStamp now);
+		virtual void timeout(bt::TimeStamp now);
+	};
+
+	/**
+		LEDBAT++ (draft-irtf-iccrg-ledbat-plus-plus), which has a lower target, slow start,
+		grows slower then TCP when the delay is small, and shrinks multiplicatively when the
+		delay is above the target. Periodic slowdowns drain the queues, so the base delay
+		can be measured again, and connections sharing a bottleneck get a fair share.
+	*/
+	class KTORRENT_EXPORT LedbatPlusPlus : public CongestionControl
+	{
+	public:
+		/**
+			Constructor
+			@param target Target delay in ms, 0 for the default
+		*/
+		LedbatPlusPlus(bt::Uint32 target = 0);
+		virtual ~LedbatPlusPlus();
+
+		virtual QString name() const;
+		virtual void packetReceived(const AckInfo & ack);
+		virtual void packetsLost(bt::TimeStamp now);
+		virtual void timeout(bt::TimeStamp now);
+
+	private:
+		enum Phase
+		{
+			SLOW_START,
+			CONGESTION_AVOIDANCE,
+			SLOWDOWN
+		};
+
+		double gain(bt::Uint32 rtt) const;
+		void endSlowStart(bt::TimeStamp now, bt::Uint32 rtt);
+
+	private:
+		Phase phase;
+		bt::Uint32 ssthresh;
+		bt::Uint32 last_rtt;
+		bt::TimeStamp slowdown_start;
+		bt::TimeStamp slowdown_end;
+		bt::TimeStamp next_slowdown;
+		bt::TimeStamp last_decrease;
+	};
+}
+
+#endif // UTP_LEDBAT_H
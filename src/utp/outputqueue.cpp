@@ -20,6 +20,7 @@
 
 #include "outputqueue.h"
 #include <QSet>
+#include <algorithm>
 #include <util/log.h>
 #include <net/socket.h>
 
@@ -27,8 +28,10 @@ using namespace bt;
 
 namespace utp
 {
+	// maximum number of packets sent with one system call
+	const int SEND_BATCH_SIZE = 64;
 
-	OutputQueue::OutputQueue() : mutex(QMutex::Recursive)
+	OutputQueue::OutputQueue() : num_queued(0)
 	{
 	}
 
@@ -36,58 +39,128 @@ namespace utp
 	{
 	}
 
-	int OutputQueue::add(const PacketBuffer & packet, Connection::WPtr conn)
+	int OutputQueue::add(const PacketBuffer & packet, Connection::WPtr conn, bool probe)
 	{
-		QMutexLocker lock(&mutex);
-		queue.append(Entry(packet, conn));
-		return queue.size();
+		// count first, so the UTP thread never thinks the queue is empty while a packet is being added
+		int ret = num_queued.fetchAndAddOrdered(1) + 1;
+		queue.push(Entry(packet, conn, probe));
+		return ret;
 	}
 
-	void OutputQueue::send(net::ServerSocket* sock)
+	int OutputQueue::add(const PacketBuffer & packet, Connection::WPtr conn, const bt::Uint8* header, bt::Uint32 header_size)
+	{
+		Entry e(packet, conn, false);
+		memcpy(e.header, header, header_size);
+		e.header_size = header_size;
+
+		int ret = num_queued.fetchAndAddOrdered(1) + 1;
+		queue.push(e);
+		return ret;
+	}
+
+	bool OutputQueue::send(net::ServerSocket* sock)
 	{
 		QList<Connection::WPtr> to_close;
-		QMutexLocker lock(&mutex);
+		int done = 0;
 		try
 		{
 			// Keep sending until the output queue is empty or the socket
-			// can't handle the data anymore
-			while (!queue.empty())
+			// can't handle the data anymore, a batch of packets goes with one system call
+			net::Datagram dgrams[SEND_BATCH_SIZE];
+			const bt::Uint8* payloads[SEND_BATCH_SIZE];
+			Entry e;
+			for (;;)
 			{
-				Entry & packet = queue.front();
-				Connection::Ptr conn = packet.conn.toStrongRef();
-				if (!conn)
+				while (pending.count() < SEND_BATCH_SIZE && queue.pop(e))
+					pending.append(e);
+
+				if (pending.isEmpty())
+					break;
+
+				// A path MTU probe is sent on its own, with the don't fragment bit set.
+				// A retransmission gets its header when all packets before it have been sent,
+				// so it waits for the next batch if the first transmission is in this one.
+				int count = 0;
+				bool probe = false;
+				QList<Entry>::iterator i = pending.begin();
+				while (i != pending.end() && count < SEND_BATCH_SIZE && !probe)
 				{
-					queue.pop_front();
-					continue;
+					Connection::Ptr conn = i->conn.toStrongRef();
+					if (!conn)
+					{
+						i = pending.erase(i);
+						done++;
+						continue;
+					}
+					else if (i->probe && count > 0)
+						break;
+					else if (i->header_size > 0)
+					{
+						if (std::find(payloads, payloads + count, i->data.payloadData()) != payloads + count)
+							break;
+
+						i->data.setHeader(i->header, i->header_size);
+						i->header_size = 0;
+					}
+
+					payloads[count] = i->data.payloadData();
+					dgrams[count].data = (bt::Uint8*)i->data.data();
+					dgrams[count].size = i->data.bufferSize();
+					dgrams[count].addr = conn->remoteAddress();
+					probe = i->probe;
+					count++;
+					i++;
 				}
 
-				int ret = sock->sendTo(packet.data.data(), packet.data.bufferSize(), conn->remoteAddress());
+				if (count == 0)
+					continue;
+
+				if (probe)
+					sock->setDontFragment(true);
+				int ret = sock->sendToBatch(dgrams, count);
+				if (probe)
+					sock->setDontFragment(false);
+
 				if (ret == net::SEND_WOULD_BLOCK)
 					break;
-				else if (ret == net::SEND_FAILURE)
+				else if (ret == net::SEND_TOO_BIG && pending.front().probe)
+				{
+					// The probe is bigger then the MTU of the interface,
+					// lower the ceiling of the search, and send it again with fragmentation allowed
+					Entry & front = pending.front();
+					Connection::Ptr conn = front.conn.toStrongRef();
+					if (conn)
+						conn->probeTooBig(front.data.bufferSize());
+					front.probe = false;
+				}
+				else if (ret == net::SEND_FAILURE || ret == net::SEND_TOO_BIG)
 				{
 					// Kill the connection of this packet
-					to_close.append(packet.conn);
-					queue.pop_front();
+					to_close.append(pending.front().conn);
+					pending.pop_front();
+					done++;
 				}
 				else
-					queue.pop_front();
+				{
+					for (int j = 0; j < ret; j++)
+						pending.pop_front();
+					done += ret;
+				}
 			}
 		}
 		catch (Connection::TransmissionError & err)
 		{
 			Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
 		}
-		sock->setWriteNotificationsEnabled(!queue.isEmpty());
-		lock.unlock(); // unlock, so we can't get deadlocked in any subsequent close calls
 
+		bool empty = num_queued.fetchAndAddOrdered(-done) == done;
 		foreach (utp::Connection::WPtr conn, to_close)
 		{
 			Connection::Ptr c = conn.toStrongRef();
 			if (c)
 				c->close();
 		}
+		return empty;
 	}
 
-
 }
@@ -23,7 +23,9 @@
 #define UTP_OUTPUTQUEUE_H
 
 #include <QList>
+#include <QAtomicInt>
 #include <net/serversocket.h>
+#include <util/mpscqueue.h>
 #include "connection.h"
 #include "packetbuffer.h"
 
@@ -31,7 +33,8 @@
 namespace utp
 {
 	/**
-	 * Manages the send queue of all UTP server sockets
+	 * Manages the send queue of the UTP server sockets, every shard of the server has one.
+	 * Any thread can add packets without locking, only the UTP thread may send them.
 	 */
 	class OutputQueue
 	{
@@ -40,32 +43,54 @@ namespace utp
 		virtual ~OutputQueue();
 
 		/**
-		 * Add an entry to the queue.
+		 * Add an entry to the queue, the packet data is shared, not copied.
 		 * @param data The packet
 		 * @param conn The connection this packet belongs to
+		 * @param probe Whether the packet is a path MTU probe
 		 * @return The number of queued packets
 		 */
-		int add(const PacketBuffer & packet, Connection::WPtr conn);
+		int add(const PacketBuffer & packet, Connection::WPtr conn, bool probe = false);
+
+		/**
+		 * Add a retransmission to the queue. The packet data is shared with the first transmission,
+		 * the new header is put in front of the payload when everything queued before it has been sent.
+		 * @param data The packet
+		 * @param conn The connection this packet belongs to
+		 * @param header The new header, including extensions
+		 * @param header_size The size of the header, at most MAX_HEADER_SIZE
+		 * @return The number of queued packets
+		 */
+		int add(const PacketBuffer & packet, Connection::WPtr conn, const bt::Uint8* header, bt::Uint32 header_size);
 
 		/**
 		 * Attempt to send the queue on a socket
 		 * @param sock The socket
+		 * @return true if the queue is empty, false if the socket could not take everything
 		 */
-		void send(net::ServerSocket* sock);
+		bool send(net::ServerSocket* sock);
 
 	private:
 		struct Entry
 		{
 			PacketBuffer data;
 			Connection::WPtr conn;
+			bool probe;
+			// header which still has to be put in front of the payload, if header_size is not 0
+			bt::Uint8 header[MAX_HEADER_SIZE];
+			bt::Uint32 header_size;
+
+			Entry() : probe(false), header_size(0)
+			{}
 
-			Entry(const PacketBuffer & data, Connection::WPtr conn)
-					: data(data), conn(conn)
+			Entry(const PacketBuffer & data, Connection::WPtr conn, bool probe)
+					: data(data), conn(conn), probe(probe), header_size(0)
 			{}
 		};
 
-		QList<Entry> queue;
-		QMutex mutex;
+		bt::MPSCQueue<Entry> queue;
+		// entries taken from the queue which could not be sent yet, only used by the UTP thread
+		QList<Entry> pending;
+		QAtomicInt num_queued;
 	};
 
 }
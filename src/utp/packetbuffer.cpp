@@ -34,14 +34,32 @@ namespace utp
 		: header(0),
 		  extension(0),
 		  payload(0),
-		  size(0)
+		  tail(0),
+		  size(0),
+		  cap(MAX_SIZE)
 	{
 		if (!pool)
 		{
 			pool = bt::BufferPool::Ptr(new bt::BufferPool());
 			pool->setWeakPointer(pool.toWeakRef());
 		}
-		buffer = pool->get(MAX_SIZE);
+		buffer = pool->get(cap);
+	}
+
+	PacketBuffer::PacketBuffer(bt::Uint32 capacity)
+		: header(0),
+		  extension(0),
+		  payload(0),
+		  tail(0),
+		  size(0),
+		  cap(capacity)
+	{
+		if (!pool)
+		{
+			pool = bt::BufferPool::Ptr(new bt::BufferPool());
+			pool->setWeakPointer(pool.toWeakRef());
+		}
+		buffer = pool->get(cap);
 	}
 
 	PacketBuffer::PacketBuffer(const PacketBuffer & buf)
@@ -49,7 +67,9 @@ namespace utp
 		  header(buf.header),
 		  extension(buf.extension),
 		  payload(buf.payload),
-		  size(buf.size)
+		  tail(buf.tail),
+		  size(buf.size),
+		  cap(buf.cap)
 	{
 
 	}
@@ -65,7 +85,7 @@ namespace utp
 
 	bool PacketBuffer::setHeader(const Header & hdr, bt::Uint32 extension_length)
 	{
-		if (Header::size() - extension_length > headRoom())
+		if (Header::size() + extension_length > headRoom())
 			return false;
 
 		if (payload)
@@ -76,21 +96,42 @@ namespace utp
 		hdr.write(header);
 		extension = header + Header::size();
 		if (payload)
-			size = (buffer->get() + MAX_SIZE) - header;
+			size = tail - header;
 		else
 			size = Header::size() + extension_length;
 
 		return true;
 	}
 
+	bool PacketBuffer::setHeader(const bt::Uint8* data, bt::Uint32 data_size)
+	{
+		if (data_size > headRoom())
+			return false;
+
+		if (payload)
+			header = payload - data_size;
+		else
+			header = buffer->get();
+
+		memcpy(header, data, data_size);
+		extension = header + Header::size();
+		if (payload)
+			size = tail - header;
+		else
+			size = data_size;
+
+		return true;
+	}
+
 	bt::Uint32 PacketBuffer::fillData(bt::CircularBuffer & cbuf, bt::Uint32 to_read)
 	{
 		// Make sure we leave enough room for a header
-		if (to_read > MAX_SIZE - Header::size())
-			to_read = MAX_SIZE - Header::size();
+		if (to_read > cap - Header::size())
+			to_read = cap - Header::size();
 
 		// Data is put at the end of the buffer, so we can put headers easily in front of it
-		payload = (buffer->get() + MAX_SIZE) - to_read;
+		payload = (buffer->get() + cap) - to_read;
+		tail = buffer->get() + cap;
 		cbuf.read(payload, to_read);
 		size = to_read;
 
@@ -100,19 +141,61 @@ namespace utp
 
 	bt::Uint32 PacketBuffer::fillData(const bt::Uint8* data, bt::Uint32 data_size)
 	{
-		if (data_size > MAX_SIZE)
-			data_size = MAX_SIZE;
+		if (data_size > cap)
+			data_size = cap;
 
-		payload = (buffer->get() + MAX_SIZE) - data_size;
+		payload = (buffer->get() + cap) - data_size;
+		tail = buffer->get() + cap;
 		memcpy(payload, data, data_size);
 		header = extension = payload;
 		size = data_size;
 		return data_size;
 	}
 
+	bt::Uint32 PacketBuffer::appendData(const bt::Uint8* data, bt::Uint32 data_size, bt::Uint32 max_payload)
+	{
+		if (!payload)
+			header = extension = payload = tail = buffer->get() + HEAD_ROOM;
+		else if (header != payload)
+			return 0; // already sent
+
+		bt::Uint32 room = 0;
+		if (payloadSize() < max_payload)
+			room = qMin<bt::Uint32>((buffer->get() + cap) - tail, max_payload - payloadSize());
+		if (data_size > room)
+			data_size = room;
+
+		memcpy(tail, data, data_size);
+		tail += data_size;
+		size = tail - payload;
+		return data_size;
+	}
+
+	PacketBuffer PacketBuffer::takeFront(bt::Uint32 amount)
+	{
+		if (amount > payloadSize())
+			amount = payloadSize();
+
+		PacketBuffer front(cap);
+		front.fillData(payload, amount);
+		payload += amount;
+		header = extension = payload;
+		size = tail - payload;
+		return front;
+	}
+
+	PacketBuffer PacketBuffer::copy() const
+	{
+		PacketBuffer ret(cap);
+		if (payload)
+			ret.fillData(payload, payloadSize());
+		return ret;
+	}
+
 	void PacketBuffer::fillDummyData(bt::Uint32 amount)
 	{
-		header = extension = payload = (buffer->get() + MAX_SIZE) - amount;
+		header = extension = payload = (buffer->get() + cap) - amount;
+		tail = buffer->get() + cap;
 		size += amount;
 	}
 
@@ -38,6 +38,12 @@ namespace utp
 	{
 	public:
 		PacketBuffer();
+
+		/**
+		 * Create a buffer for packets bigger then MAX_SIZE.
+		 * @param capacity Size of the buffer
+		 **/
+		explicit PacketBuffer(bt::Uint32 capacity);
 		PacketBuffer(const PacketBuffer & buf);
 		virtual ~PacketBuffer();
 
@@ -54,6 +60,14 @@ namespace utp
 		 **/
 		bool setHeader(const Header & hdr, bt::Uint32 extension_length);
 
+		/**
+		 * Put a header, which has already been written, in front of the payload.
+		 * @param data The header including extensions
+		 * @param data_size Size of the header
+		 * @return False if there is not enough head room, true otherwise
+		 **/
+		bool setHeader(const bt::Uint8* data, bt::Uint32 data_size);
+
 		/// Get a pointer to the extension data
 		bt::Uint8* extensionData() {return extension;}
 
@@ -73,6 +87,30 @@ namespace utp
 		 **/
 		bt::Uint32 fillData(const bt::Uint8* data, bt::Uint32 data_size);
 
+		/**
+		 * Append data to the payload. The payload of an empty buffer starts after HEAD_ROOM bytes,
+		 * so the header and extensions can be put in front of it without moving the data.
+		 * @param data The data to copy from
+		 * @param data_size The data size
+		 * @param max_payload Maximum size of the payload
+		 * @return The amount appended, 0 if the payload is full
+		 **/
+		bt::Uint32 appendData(const bt::Uint8* data, bt::Uint32 data_size, bt::Uint32 max_payload);
+
+		/**
+		 * Split off the front of the payload into a new buffer.
+		 * This will invalidate already filled in headers.
+		 * @param amount Amount of payload to split off
+		 * @return The new buffer
+		 **/
+		PacketBuffer takeFront(bt::Uint32 amount);
+
+		/**
+		 * Make a copy of the payload in a new buffer, so the header can be rewritten
+		 * without touching the data of packets which are still being sent.
+		 **/
+		PacketBuffer copy() const;
+
 		/**
 		 * For testing purpoes fill with dummy data.
 		 * @param amount Amount to fill
@@ -90,20 +128,31 @@ namespace utp
 		/// Get the buffer size
 		bt::Uint32 bufferSize() const {return size;}
 
+		/// Get a pointer to the payload
+		const bt::Uint8* payloadData() const {return payload;}
+
 		/// Get the size of the payload
-		bt::Uint32 payloadSize() const {return payload ? (buffer->get() + MAX_SIZE) - payload: 0;}
+		bt::Uint32 payloadSize() const {return payload ? tail - payload : 0;}
 
 		/// Get the amount of headroom (room in front of payload)
-		bt::Uint32 headRoom() const {return payload ? payload - buffer->get() : MAX_SIZE;}
+		bt::Uint32 headRoom() const {return payload ? payload - buffer->get() : cap;}
+
+		/// Get the capacity of the buffer
+		bt::Uint32 capacity() const {return cap;}
 
 		static const bt::Uint32 MAX_SIZE = 1500;
 
+		/// Room kept free in front of appended data, enough for the header and a selective ack
+		static const bt::Uint32 HEAD_ROOM = 32;
+
 	private:
 		bt::Buffer::Ptr buffer;
 		bt::Uint8* header;
 		bt::Uint8* extension;
 		bt::Uint8* payload;
+		bt::Uint8* tail;
 		bt::Uint32 size;
+		bt::Uint32 cap;
 
 		static bt::BufferPool::Ptr pool;
 	};
@@ -40,7 +40,7 @@ namespace utp
 	{
 		QMutexLocker lock(&mutex);
 		poll_index = -1;
-		conn_ids.reset();
+		conns.clear();
 	}
 
 }
@@ -21,9 +21,11 @@
 #ifndef UTP_POLLPIPE_H
 #define UTP_POLLPIPE_H
 
-#include <bitset>
+#include <QSet>
+#include <ktorrent_export.h>
 #include <net/poll.h>
 #include <net/wakeuppipe.h>
+#include "connectiontable.h"
 
 
 namespace utp
@@ -33,7 +35,7 @@ namespace utp
 	/**
 		Special wake up pipe for UTP polling
 	*/
-	class PollPipe : public net::WakeUpPipe
+	class KTORRENT_EXPORT PollPipe : public net::WakeUpPipe
 	{
 	public:
 		PollPipe(net::Poll::Mode mode);
@@ -45,19 +47,19 @@ namespace utp
 		bool polling() const {return poll_index >= 0;}
 
 		/// Prepare the poll
-		void prepare(net::Poll* p, bt::Uint16 conn_id, PollPipe::Ptr self)
+		void prepare(net::Poll* p, const ConnectionKey & conn, PollPipe::Ptr self)
 		{
 			QMutexLocker lock(&mutex);
-			conn_ids.set(conn_id, true);
+			conns.insert(conn);
 			if (poll_index < 0)
 				poll_index = p->add(qSharedPointerCast<PollClient>(self));
 		}
 
 		/// Are we polling a connection
-		bool polling(bt::Uint16 conn) const
+		bool polling(const ConnectionKey & conn) const
 		{
 			QMutexLocker lock(&mutex);
-			return poll_index >= 0 && conn_ids[conn];
+			return poll_index >= 0 && conns.contains(conn);
 		}
 
 		/// Reset the poll_index
@@ -69,7 +71,8 @@ namespace utp
 	private:
 		net::Poll::Mode mode;
 		int poll_index;
-		std::bitset<65536> conn_ids;
+		// connection IDs are only unique per remote address, so the address is part of the key
+		QSet<ConnectionKey> conns;
 	};
 
 
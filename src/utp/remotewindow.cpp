@@ -45,7 +45,7 @@ namespace utp
 
 	RemoteWindow::RemoteWindow()
 			: cur_window(0),
-			  max_window(64 * 1024),
+			  congestion(CongestionControl::create()),
 			  wnd_size(0),
 			  last_ack_nr(0),
 			  last_ack_receive_count(0)
@@ -56,9 +56,16 @@ namespace utp
 	RemoteWindow::~RemoteWindow()
 	{
 		clear();
+		delete congestion;
 	}
 
-	void RemoteWindow::packetReceived(const utp::Header* hdr, const SelectiveAck* sack, Retransmitter* conn)
+	void RemoteWindow::setCongestionControl(CongestionControl* cc)
+	{
+		delete congestion;
+		congestion = cc;
+	}
+
+	bt::Uint32 RemoteWindow::packetReceived(const utp::Header* hdr, const SelectiveAck* sack, Retransmitter* conn)
 	{
 		if (hdr->ack_nr == last_ack_nr)
 		{
@@ -73,6 +80,7 @@ namespace utp
 
 		wnd_size = hdr->wnd_size;
 
+		bt::Uint32 acked = 0;
 		bt::TimeStamp now = bt::Now();
 		QList<UnackedPacket>::iterator i = unacked_packets.begin();
 		while (i != unacked_packets.end())
@@ -82,6 +90,7 @@ namespace utp
 				// everything up until the ack_nr in the header is acked
 				conn->updateRTT(hdr, now - i->send_time, i->packet.payloadSize());
 				cur_window -= i->packet.payloadSize();
+				acked += i->packet.payloadSize();
 				i = unacked_packets.erase(i);
 			}
 			else if (sack)
@@ -90,6 +99,7 @@ namespace utp
 				{
 					conn->updateRTT(hdr, now - i->send_time, i->packet.payloadSize());
 					cur_window -= i->packet.payloadSize();
+					acked += i->packet.payloadSize();
 					i = unacked_packets.erase(i);
 				}
 				else
@@ -103,6 +113,8 @@ namespace utp
 		{
 			checkLostPackets(hdr, sack, conn);
 		}
+
+		return acked;
 	}
 
 	void RemoteWindow::addPacket(const PacketBuffer & packet, bt::Uint16 seq_nr, bt::TimeStamp send_time)
@@ -126,14 +138,16 @@ namespace utp
 			{
 				try
 				{
-					conn->retransmit(first_unacked.packet, first_unacked.seq_nr);
+					// a lost path MTU probe says nothing about congestion
+					if (conn->retransmit(first_unacked.packet, first_unacked.seq_nr))
+						lost_packets = true;
 					first_unacked.send_time = now;
 					first_unacked.retransmitted = true;
 				}
 				catch (utp::Connection::TransmissionError & )
 				{
+					lost_packets = true;
 				}
-				lost_packets = true;
 			}
 
 			itr++;
@@ -150,14 +164,15 @@ namespace utp
 				{
 					try
 					{
-						conn->retransmit(itr->packet, itr->seq_nr);
+						if (conn->retransmit(itr->packet, itr->seq_nr))
+							lost_packets = true;
 						itr->send_time = now;
 						itr->retransmitted = true;
 					}
 					catch (utp::Connection::TransmissionError & )
 					{
+						lost_packets = true;
 					}
-					lost_packets = true;
 				}
 				itr++;
 			}
@@ -166,7 +181,7 @@ namespace utp
 		if (lost_packets)
 		{
 			Out(SYS_UTP | LOG_DEBUG) << "UTP: lost packets on connection " << hdr->connection_id << endl;
-			max_window = (bt::Uint32)qRound(0.78 * max_window);
+			congestion->packetsLost(now);
 		}
 	}
 
@@ -194,8 +209,8 @@ namespace utp
 	{
 		try
 		{
-			max_window = MIN_PACKET_SIZE;
 			bt::TimeStamp now = bt::Now();
+			congestion->timeout(now);
 			// When a timeout occurs retransmit packets which are lost longer then the current timeout
 			for (QList<UnackedPacket>::iterator i = unacked_packets.begin(); i != unacked_packets.end(); i++)
 			{
@@ -213,16 +228,15 @@ namespace utp
 		}
 	}
 
-	void RemoteWindow::updateWindowSize(double scaled_gain)
+	bool RemoteWindow::isAcked(bt::Uint16 seq_nr) const
 	{
-		int d = (int)qRound(scaled_gain);
-		if ((int)max_window + d < MIN_PACKET_SIZE)
-			max_window = MIN_PACKET_SIZE;
-		else
-			max_window += d;
+		foreach (const UnackedPacket & pkt, unacked_packets)
+		{
+			if (pkt.seq_nr == seq_nr)
+				return false;
+		}
 
-		//if (scaled_gain > 1000)
-		//	Out(SYS_UTP|LOG_DEBUG) << "RemoteWindow::updateWindowSize " << scaled_gain << " " << max_window << endl;
+		return true;
 	}
 
 	void RemoteWindow::clear()
@@ -28,6 +28,7 @@
 #include <util/constants.h>
 #include <utp/timevalue.h>
 #include <utp/packetbuffer.h>
+#include <utp/congestioncontrol.h>
 
 namespace utp
 {
@@ -57,8 +58,8 @@ namespace utp
 		/// Update the RTT time
 		virtual void updateRTT(const Header* hdr, bt::Uint32 packet_rtt, bt::Uint32 packet_size) = 0;
 
-		/// Retransmit a packet
-		virtual void retransmit(PacketBuffer & packet, bt::Uint16 p_seq_nr) = 0;
+		/// Retransmit a packet, returns false if the loss of it is no sign of congestion
+		virtual bool retransmit(PacketBuffer & packet, bt::Uint16 p_seq_nr) = 0;
 
 		/// Get the current timeout
 		virtual bt::Uint32 currentTimeout() const = 0;
@@ -73,8 +74,8 @@ namespace utp
 		RemoteWindow();
 		virtual ~RemoteWindow();
 
-		/// A packet was received (update window size and check for acks)
-		void packetReceived(const Header* hdr, const SelectiveAck* sack, Retransmitter* conn);
+		/// A packet was received (update window size and check for acks), returns the number of bytes acked
+		bt::Uint32 packetReceived(const Header* hdr, const SelectiveAck* sack, Retransmitter* conn);
 
 		/// Add a packet to the remote window (should include headers)
 		void addPacket(const PacketBuffer & packet, bt::Uint16 seq_nr, bt::TimeStamp send_time);
@@ -82,13 +83,13 @@ namespace utp
 		/// Are we allowed to send
 		bool allowedToSend(bt::Uint32 packet_size) const
 		{
-			return cur_window + packet_size <= qMin(wnd_size, max_window);
+			return cur_window + packet_size <= qMin(wnd_size, congestion->window());
 		}
 
 		/// Calculates how much window space is availabe
 		bt::Uint32 availableSpace() const
 		{
-			bt::Uint32 m = qMin(wnd_size, max_window);
+			bt::Uint32 m = qMin(wnd_size, congestion->window());
 			if (cur_window > m)
 				return 0;
 			else
@@ -101,17 +102,20 @@ namespace utp
 		/// Get the number of unacked packets
 		bt::Uint32 numUnackedPackets() const {return unacked_packets.count();}
 
+		/// Check if a packet which has been added is acked
+		bool isAcked(bt::Uint16 seq_nr) const;
+
 		/// A timeout occured
 		void timeout(Retransmitter* conn);
 
-		/// Get the window usage factor
-		double windowUsageFactor() const {return qMax((double)cur_window / max_window, 1.0);}
+		/// Get the congestion control
+		CongestionControl* congestionControl() const {return congestion;}
 
-		/// Update the window size
-		void updateWindowSize(double scaled_gain);
+		/// Replace the congestion control, the window takes ownership of it
+		void setCongestionControl(CongestionControl* cc);
 
 		bt::Uint32 currentWindow() const {return cur_window;}
-		bt::Uint32 maxWindow() const {return max_window;}
+		bt::Uint32 maxWindow() const {return congestion->window();}
 		bt::Uint32 windowSize() const {return wnd_size;}
 
 		/// Clear the window
@@ -123,7 +127,7 @@ namespace utp
 
 	private:
 		bt::Uint32 cur_window;
-		bt::Uint32 max_window;
+		CongestionControl* congestion;
 		bt::Uint32 wnd_size; // advertised window size from the other side
 		QList<UnackedPacket> unacked_packets;
 		bt::Uint16 last_ack_nr;
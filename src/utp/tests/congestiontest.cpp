@@ -18,200 +18,105 @@
 *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
 ***************************************************************************/
 
+
 #include <QtTest>
 #include <QObject>
 #include <util/log.h>
-#include <utp/connection.h>
-#include <utp/utpsocket.h>
-#include <utp/utpserver.h>
-#include <util/functions.h>
-#include <time.h>
-#include <unistd.h>
-
+#include <utp/congestioncontrol.h>
+#include "emulatedlink.h"
 
-#define PACKETS_TO_SEND 20
-#define TEST_DATA "This is the packet loss test\n"
+#define RUN_TIME 10000
 
 using namespace utp;
 using namespace bt;
 
 /**
-	Server which simulates packet loss
+	Compares the congestion control algorithms on an emulated link
 */
-class CongestionTestServer : public UTPServer
+class CongestionTest : public QObject
 {
 	Q_OBJECT
 public:
-	CongestionTestServer(QObject* parent = 0) : UTPServer(parent),congestion_delay(200)
-	{}
-	
-	virtual ~CongestionTestServer()
-	{}
-	
-	virtual bool sendTo(const QByteArray& data, const net::Address& addr)
-	{
-	}
-	
-	virtual bool sendTo(const bt::Uint8* data, const bt::Uint32 size, const net::Address& addr)
+	CongestionTest(QObject* parent = 0) : QObject(parent)
 	{
 	}
 	
-	void setCongestionDelay(int cd)
+private slots:
+	void initTestCase()
 	{
-		congestion_delay = cd;
+		bt::InitLog("congestiontest.log");
+		qsrand(42);
 	}
 	
-public slots:
-	void delayedSend()
+	void cleanupTestCase()
 	{
+		CongestionControl::setAlgorithm(CongestionControl::LEDBAT);
 	}
 	
-private:
-	int congestion_delay;
-};
-
-class SendThread : public QThread
-{
-	Q_OBJECT
-public:
-	
-	SendThread(Connection::Ptr outgoing,QObject* parent = 0) : QThread(parent),outgoing(outgoing)
-	{}
-	
-	virtual void run()
+	void testCleanLink()
 	{
-		char test[] = TEST_DATA;
-		int sent = 0;
-		while (sent < PACKETS_TO_SEND)
-		{
-			int ret = outgoing->send((const bt::Uint8*)test,strlen(test));
-			if (ret > 0)
-			{
-				sent++;
-			}
-			
-			msleep(200);
-		}
+		// 1 MB/s with a 200 ms queue and a 50 ms round trip time
+		EmulatedLink::Settings s = {1000000,200000,25,0,0,0};
+		EmulatedLink::Results ledbat = benchmark(CongestionControl::LEDBAT,s);
+		EmulatedLink::Results ledbat_pp = benchmark(CongestionControl::LEDBAT_PLUS_PLUS,s);
+		QVERIFY(!ledbat.corrupted && !ledbat_pp.corrupted);
 		
-		while (!outgoing->allDataSent())
-			sleep(1);
-	
-		Out(SYS_UTP|LOG_DEBUG) << "Transmitted " << sent << " packets " << endl;
-		outgoing->dumpStats();
+		// both should fill most of the link, LEDBAT++ with less delay
+		QVERIFY(ledbat.goodput > 0.5 * s.bandwidth);
+		QVERIFY(ledbat_pp.goodput > 0.5 * s.bandwidth);
+		QVERIFY(ledbat_pp.mean_queuing_delay < ledbat.mean_queuing_delay);
 	}
 	
-	Connection::Ptr outgoing;
-};
-
-class CongestionTest : public QEventLoop
-{
-	Q_OBJECT
-public:
-	CongestionTest(QObject* parent = 0) : QEventLoop(parent)
+	void testCompetingTCP()
 	{
-	}
-	
-public slots:
-	void accepted()
-	{
-		incoming = srv.acceptedConnection().toStrongRef();
-		exit();
-	}
-	
-	void endEventLoop()
-	{
-		exit();
-	}
-	
-private slots:
-	void initTestCase()
-	{
-		bt::InitLog("congestiontest.log");
-		
-		incoming = outgoing = 0;
-		port = 50000;
-		while (port < 60000)
-		{
-			if (!srv.changePort(port))
-				port++;
-			else
-				break;
-		}
+		// the same link, shared with a TCP flow which fills the queue
+		EmulatedLink::Settings s = {1000000,200000,25,0,0,1};
+		EmulatedLink::Results ledbat = benchmark(CongestionControl::LEDBAT,s);
+		EmulatedLink::Results ledbat_pp = benchmark(CongestionControl::LEDBAT_PLUS_PLUS,s);
+		QVERIFY(!ledbat.corrupted && !ledbat_pp.corrupted);
 		
-		srv.setCreateSockets(false);
-		srv.start();
+		// uTP is a background protocol, TCP should get the biggest share
+		QVERIFY(ledbat.tcp_goodput > ledbat.goodput);
+		QVERIFY(ledbat_pp.tcp_goodput > ledbat_pp.goodput);
 	}
 	
-	void cleanupTestCase()
-	{
-		srv.stop();
-	}
-	
-	void testConnect()
+	void testLossyLink()
 	{
-		net::Address addr("127.0.0.1",port);
-		connect(&srv,SIGNAL(accepted()),this,SLOT(accepted()),Qt::QueuedConnection);
-		outgoing = srv.connectTo(addr);
-		QVERIFY(outgoing != 0);
-		QTimer::singleShot(5000,this,SLOT(endEventLoop())); // use a 5 second timeout
-		exec();
-		QVERIFY(incoming != 0);
+		// 2 % random loss and 5 ms of jitter
+		EmulatedLink::Settings s = {1000000,200000,25,5,2,0};
+		EmulatedLink::Results ledbat = benchmark(CongestionControl::LEDBAT,s);
+		EmulatedLink::Results ledbat_pp = benchmark(CongestionControl::LEDBAT_PLUS_PLUS,s);
+		QVERIFY(!ledbat.corrupted && !ledbat_pp.corrupted);
+		QVERIFY(ledbat.goodput > 0);
+		QVERIFY(ledbat_pp.goodput > 0);
 	}
 	
-	void testCongestionTest()
+private:
+	EmulatedLink::Results benchmark(CongestionControl::Algorithm algorithm,const EmulatedLink::Settings & s)
 	{
-		bt::Out(SYS_UTP|LOG_DEBUG) << "testCongestionTest" << bt::endl;
-		if (outgoing->connectionState() != CS_CONNECTED || incoming->connectionState() != CS_CONNECTED)
-		{
-			QSKIP("Not Connected",SkipAll);
-			return;
-		}
-		/*
-		srv.setCongestionTestSimulation(true,0.1); // Drop 10 % of all packets
-		SendThread st(outgoing);
-		st.start(); // The thread will start sending a whole bunch of data
-		int received = 0;
-		QString received_data;
-		while (!st.isFinished())
+		CongestionControl::setAlgorithm(algorithm);
+		EmulatedLink link(s);
+		EmulatedLink::Results r;
+		memset(&r,0,sizeof(r));
+		if (!link.connect())
 		{
-			bt::Uint32 ba = incoming->bytesAvailable();
-			if (ba > 0)
-			{
-				QByteArray data(ba,0);
-				int ret = incoming->recv((bt::Uint8*)data.data(),ba);
-				if (ret > 0)
-				{
-					received_data.append(data);
-					received += ret;
-				}
-			}
-			else
-			{
-				usleep(50000);
-			}
+			Out(SYS_UTP|LOG_DEBUG) << "Not connected" << endl;
+			return r;
 		}
 		
-		st.wait();
-		Out(SYS_UTP|LOG_DEBUG) << "Received " << received << " bytes:" << endl;
-		Out(SYS_UTP|LOG_DEBUG) << received_data << endl;
-		incoming->dumpStats();
-		QVERIFY(incoming->bytesAvailable() == 0);
-		QVERIFY(received_data.count(TEST_DATA) == PACKETS_TO_SEND);
-		QVERIFY(outgoing->allDataSent());
-		*/
+		r = link.run(RUN_TIME);
+		Connection::Ptr conn = link.sendingConnection();
+		Out(SYS_UTP|LOG_DEBUG) << "Algorithm: " << (algorithm == CongestionControl::LEDBAT ? "LEDBAT" : "LEDBAT++") << endl;
+		Out(SYS_UTP|LOG_DEBUG) << "Link: " << s.bandwidth << " B/s, queue " << s.queue_size << " B, delay " << s.delay
+			<< " ms, jitter " << s.jitter << " ms, loss " << s.loss << " %, TCP flows " << s.tcp_flows << endl;
+		Out(SYS_UTP|LOG_DEBUG) << "uTP goodput: " << r.goodput << " B/s, TCP goodput: " << r.tcp_goodput << " B/s" << endl;
+		Out(SYS_UTP|LOG_DEBUG) << "Queuing delay: mean " << r.mean_queuing_delay << " ms, max " << r.max_queuing_delay << " ms" << endl;
+		Out(SYS_UTP|LOG_DEBUG) << "Dropped: " << r.dropped << endl;
+		conn->dumpStats();
+		return r;
 	}
-	
-private:
-	
-	
-private:
-	Connection::Ptr incoming;
-	Connection::Ptr outgoing;
-	CongestionTestServer srv;
-	int port;
 };
 
 QTEST_MAIN(CongestionTest)
 
 #include "congestiontest.moc"
-
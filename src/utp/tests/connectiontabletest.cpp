@@ -0,0 +1,206 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <QObject>
+#include <QMap>
+#include <util/log.h>
+#include <utp/connection.h>
+#include <utp/connectiontable.h>
+
+using namespace utp;
+
+#define NUM_CONNECTIONS 10000
+
+class ConnectionTableTest : public QObject, public Transmitter
+{
+	Q_OBJECT
+public:
+	ConnectionTableTest(QObject* parent = 0) : QObject(parent)
+	{
+	}
+
+	virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet, bool probe)
+	{
+		Q_UNUSED(conn);
+		Q_UNUSED(packet);
+		Q_UNUSED(probe);
+		return true;
+	}
+
+	virtual void stateChanged(Connection::Ptr conn, bool readable, bool writeable)
+	{
+		Q_UNUSED(conn);
+		Q_UNUSED(readable);
+		Q_UNUSED(writeable);
+	}
+
+	virtual void closed(Connection::Ptr conn)
+	{
+		Q_UNUSED(conn);
+	}
+
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("connectiontabletest.log");
+	}
+
+	void cleanupTestCase()
+	{
+	}
+
+	void testSameID()
+	{
+		ConnectionTable table;
+		net::Address a("10.0.0.1", 6881);
+		net::Address b("10.0.0.2", 6881);
+		net::Address c("2001:db8::1", 6881);
+		Connection::Ptr ca = create(a, 100);
+		Connection::Ptr cb = create(b, 100);
+		Connection::Ptr cc = create(c, 100);
+		table.insert(ca);
+		table.insert(cb);
+		table.insert(cc);
+
+		// the same ID at different addresses are different connections
+		QVERIFY(table.count() == 3);
+		QVERIFY(table.find(a, 100) == ca);
+		QVERIFY(table.find(b, 100) == cb);
+		QVERIFY(table.find(c, 100) == cc);
+		QVERIFY(!table.find(a, 101));
+		QVERIFY(!table.find(net::Address("10.0.0.1", 6882), 100));
+
+		QVERIFY(table.remove(a, 100));
+		QVERIFY(!table.remove(a, 100));
+		QVERIFY(!table.contains(a, 100));
+		QVERIFY(table.find(b, 100) == cb);
+		QVERIFY(table.count() == 2);
+	}
+
+	void testManyConnections()
+	{
+		ConnectionTable table;
+		QList<Connection::Ptr> conns = createMany();
+		foreach (Connection::Ptr c, conns)
+			table.insert(c);
+		QVERIFY(table.count() == NUM_CONNECTIONS);
+
+		// iterate
+		bt::Uint32 found = 0;
+		for (bt::Uint32 i = 0; i < table.capacity(); i++)
+			if (table.at(i))
+				found++;
+		QVERIFY(found == NUM_CONNECTIONS);
+
+		// remove every other connection, the rest must still be found
+		for (int i = 0; i < conns.count(); i += 2)
+			QVERIFY(table.remove(conns[i]->remoteAddress(), conns[i]->receiveConnectionID()));
+		for (int i = 0; i < conns.count(); i++)
+		{
+			Connection::Ptr c = table.find(conns[i]->remoteAddress(), conns[i]->receiveConnectionID());
+			QVERIFY(i % 2 == 0 ? !c : c == conns[i]);
+		}
+
+		// removing everything shrinks the table again
+		for (int i = 1; i < conns.count(); i += 2)
+			QVERIFY(table.remove(conns[i]->remoteAddress(), conns[i]->receiveConnectionID()));
+		QVERIFY(table.count() == 0);
+		QVERIFY(table.capacity() <= 64);
+	}
+
+	void testAllocateID()
+	{
+		ConnectionTable table;
+		net::Address a("10.0.0.1", 6881);
+		for (int i = 0; i < 1000; i++)
+		{
+			bt::Uint16 id = table.allocateID(a);
+			QVERIFY(!table.contains(a, id));
+			table.insert(create(a, id));
+		}
+		QVERIFY(table.count() == 1000);
+	}
+
+	void testBenchmark_data()
+	{
+		QTest::addColumn<bool>("hashed");
+		QTest::newRow("hash table") << true;
+		QTest::newRow("map on connection id") << false;
+	}
+
+	void testBenchmark()
+	{
+		QFETCH(bool, hashed);
+		QList<Connection::Ptr> conns = createMany();
+		ConnectionTable table;
+		QMap<quint16, Connection::Ptr> map;
+		foreach (Connection::Ptr c, conns)
+		{
+			table.insert(c);
+			map.insert(c->receiveConnectionID(), c);
+		}
+
+		int found = 0;
+		if (hashed)
+		{
+			QBENCHMARK
+			{
+				foreach (Connection::Ptr c, conns)
+					if (table.find(c->remoteAddress(), c->receiveConnectionID()))
+						found++;
+			}
+		}
+		else
+		{
+			QBENCHMARK
+			{
+				foreach (Connection::Ptr c, conns)
+					if (map.find(c->receiveConnectionID()) != map.end())
+						found++;
+			}
+		}
+		QVERIFY(found > 0 && found % NUM_CONNECTIONS == 0);
+	}
+
+private:
+	Connection::Ptr create(const net::Address & addr, bt::Uint16 id)
+	{
+		Connection::Ptr conn(new Connection(id, Connection::INCOMING, addr, this));
+		conn->setWeakPointer(conn);
+		return conn;
+	}
+
+	/// Connections with unique IDs, spread over a lot of addresses
+	QList<Connection::Ptr> createMany()
+	{
+		QList<Connection::Ptr> conns;
+		for (bt::Uint32 i = 0; i < NUM_CONNECTIONS; i++)
+		{
+			net::Address addr(QString("10.%1.%2.1").arg(i / 256).arg(i % 256), 6881 + i % 7);
+			conns.append(create(addr, (bt::Uint16)(i * 3)));
+		}
+		return conns;
+	}
+};
+
+QTEST_MAIN(ConnectionTableTest)
+
+#include "connectiontabletest.moc"
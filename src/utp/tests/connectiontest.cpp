@@ -31,13 +31,14 @@ class ConnectionTest : public QEventLoop,public Transmitter
 	Q_OBJECT
 public:
 	
-	ConnectionTest(QObject* parent = 0) : QEventLoop(parent),remote("127.0.0.1",50000)
+	ConnectionTest(QObject* parent = 0) : QEventLoop(parent),remote("127.0.0.1",50000),max_datagram(0)
 	{
 	}
 	
-	virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet)
+	virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet, bool probe)
 	{
 		sent_packets.append(packet);
+		sent_probes.append(probe);
 		Q_UNUSED(conn);
 		return true;
 	}
@@ -54,6 +55,12 @@ public:
 		Q_UNUSED(conn);
 	}
 	
+	virtual bt::Uint32 maxDatagramSize(const net::Address & remote) const
+	{
+		Q_UNUSED(remote);
+		return max_datagram;
+	}
+	
 	bt::Buffer::Ptr buildPacket(bt::Uint32 type,bt::Uint32 recv_conn_id,bt::Uint32 send_conn_id,bt::Uint16 seq_nr,bt::Uint16 ack_nr)
 	{
 		TimeValue tv;
@@ -65,7 +72,7 @@ public:
 		hdr.connection_id = type == ST_SYN ? recv_conn_id : send_conn_id;
 		hdr.timestamp_microseconds = tv.microseconds;
 		hdr.timestamp_difference_microseconds = 0;
-		hdr.wnd_size = 6666;
+		hdr.wnd_size = 64 * 1024;
 		hdr.seq_nr = seq_nr;
 		hdr.ack_nr = ack_nr;
 		hdr.write(packet->get());
@@ -91,6 +98,8 @@ private slots:
 	void init()
 	{
 		sent_packets.clear();
+		sent_probes.clear();
+		max_datagram = 0;
 	}
 	
 	void testConnID()
@@ -133,12 +142,118 @@ private slots:
 		conn.handlePacket(pp,pkt);
 		QVERIFY(s.state == CS_CONNECTED);
 	}
+	
+	void testPathMTUProbe()
+	{
+		max_datagram = 4000;
+		bt::Uint32 conn_id = 666;
+		Connection::Ptr conn(new Connection(conn_id,utp::Connection::OUTGOING,remote,this));
+		conn->setWeakPointer(conn.toWeakRef());
+		conn->startConnecting();
+		const Connection::Stats & s = conn->connectionStats();
+		QVERIFY(s.pmtu == PMTU_BASE_DATAGRAM_SIZE);
+		
+		bt::Buffer::Ptr pkt = buildPacket(ST_STATE,conn_id,conn_id + 1,1,1);
+		PacketParser pp(pkt->get(), pkt->size());
+		QVERIFY(pp.parse());
+		conn->handlePacket(pp,pkt);
+		QVERIFY(s.state == CS_CONNECTED);
+		
+		// the probe goes out in front of the rest of the data, as big as the interface allows
+		static bt::Uint8 data[20000];
+		QVERIFY(conn->send(data,sizeof(data)) == (int)sizeof(data));
+		QVERIFY(sent_packets.count() > 2);
+		QVERIFY(sent_probes[1]);
+		QVERIFY(sent_packets[1].bufferSize() == max_datagram);
+		QVERIFY(sent_packets[1].payloadSize() == max_datagram - Header::size());
+		for (int i = 2;i < sent_packets.count();i++)
+		{
+			QVERIFY(!sent_probes[i]);
+			QVERIFY(sent_packets[i].bufferSize() <= PMTU_BASE_DATAGRAM_SIZE);
+		}
+		
+		// once it is acked, bigger packets can be used
+		pkt = buildPacket(ST_STATE,conn_id,conn_id + 1,2,2);
+		PacketParser pp2(pkt->get(), pkt->size());
+		QVERIFY(pp2.parse());
+		conn->handlePacket(pp2,pkt);
+		QVERIFY(s.pmtu == max_datagram);
+	}
+	
+	void testPathMTUProbeLost()
+	{
+		max_datagram = 4000;
+		bt::Uint32 conn_id = 666;
+		Connection::Ptr conn(new Connection(conn_id,utp::Connection::OUTGOING,remote,this));
+		conn->setWeakPointer(conn.toWeakRef());
+		conn->startConnecting();
+		const Connection::Stats & s = conn->connectionStats();
+		
+		bt::Buffer::Ptr pkt = buildPacket(ST_STATE,conn_id,conn_id + 1,1,1);
+		PacketParser pp(pkt->get(), pkt->size());
+		QVERIFY(pp.parse());
+		conn->handlePacket(pp,pkt);
+		
+		static bt::Uint8 data[20000];
+		QVERIFY(conn->send(data,sizeof(data)) == (int)sizeof(data));
+		QVERIFY(sent_probes[1]);
+		QVERIFY(sent_packets[1].bufferSize() == max_datagram);
+		int num_sent = sent_packets.count();
+		
+		// duplicate acks of the packet before the probe, so the probe is lost
+		for (int i = 0;i < 3;i++)
+		{
+			pkt = buildPacket(ST_STATE,conn_id,conn_id + 1,1,1);
+			PacketParser dup(pkt->get(), pkt->size());
+			QVERIFY(dup.parse());
+			conn->handlePacket(dup,pkt);
+		}
+		
+		// the data is retransmitted in a packet which may be fragmented, and the path MTU stays the same
+		bool retransmitted = false;
+		for (int i = num_sent;i < sent_packets.count();i++)
+		{
+			QVERIFY(!sent_probes[i]);
+			if (sent_packets[i].bufferSize() == max_datagram)
+				retransmitted = true;
+		}
+		QVERIFY(retransmitted);
+		QVERIFY(s.pmtu == PMTU_BASE_DATAGRAM_SIZE);
+	}
+	
+	void testPathMTUProbeTooBig()
+	{
+		max_datagram = 4000;
+		bt::Uint32 conn_id = 666;
+		Connection::Ptr conn(new Connection(conn_id,utp::Connection::OUTGOING,remote,this));
+		conn->setWeakPointer(conn.toWeakRef());
+		conn->startConnecting();
+		
+		bt::Buffer::Ptr pkt = buildPacket(ST_STATE,conn_id,conn_id + 1,1,1);
+		PacketParser pp(pkt->get(), pkt->size());
+		QVERIFY(pp.parse());
+		conn->handlePacket(pp,pkt);
+		
+		static bt::Uint8 data[20000];
+		QVERIFY(conn->send(data,sizeof(data)) == (int)sizeof(data));
+		QVERIFY(sent_probes[1]);
+		
+		// the socket refused it, so the next probe is halfway between the base size and the probe
+		conn->probeTooBig(sent_packets[1].bufferSize());
+		int num_sent = sent_packets.count();
+		QVERIFY(conn->send(data,sizeof(data)) == (int)sizeof(data));
+		QVERIFY(sent_packets.count() > num_sent);
+		QVERIFY(sent_probes[num_sent]);
+		QVERIFY(sent_packets[num_sent].bufferSize() == (PMTU_BASE_DATAGRAM_SIZE + max_datagram) / 2);
+	}
 
 	
 private:
 	net::Address remote;
 	QList<PacketBuffer> sent_packets;
+	QList<bool> sent_probes;
 	bt::BufferPool::Ptr pool;
+	bt::Uint32 max_datagram;
 };
 
 QTEST_MAIN(ConnectionTest)
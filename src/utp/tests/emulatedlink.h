@@ -0,0 +1,412 @@
+/***************************************************************************
+ *   Copyright (C) 2010 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef UTP_EMULATEDLINK_H
+#define UTP_EMULATEDLINK_H
+
+#include <unistd.h>
+#include <string.h>
+#include <QList>
+#include <QMultiMap>
+#include <QByteArray>
+#include <util/bufferpool.h>
+#include <utp/connection.h>
+#include <utp/utpprotocol.h>
+
+namespace utp
+{
+	/**
+		Emulates the network path between two uTP connections in the same process, so the
+		congestion control can be tested without a real network. The path from the sender to
+		the receiver goes through a bottleneck with a limited bandwidth and a drop tail queue,
+		followed by a delay with jitter and random packet loss. The way back only has the delay.
+		TCP like flows can share the bottleneck with the uTP connection.
+		The emulation runs in real time, because the connections use the real clock.
+	*/
+	class EmulatedLink : public Transmitter
+	{
+	public:
+		struct Settings
+		{
+			bt::Uint32 bandwidth; // of the bottleneck in bytes per second
+			bt::Uint32 queue_size; // of the bottleneck in bytes
+			bt::Uint32 delay; // one way delay in ms
+			bt::Uint32 jitter; // in ms
+			int loss; // percentage of packets dropped at random
+			int tcp_flows; // number of competing TCP flows
+		};
+
+		struct Results
+		{
+			double goodput; // bytes per second received by the uTP connection
+			double tcp_goodput; // bytes per second of all TCP flows together
+			double mean_queuing_delay; // in ms
+			double max_queuing_delay; // in ms
+			bt::Uint64 dropped; // uTP packets dropped on the way to the receiver
+			bool corrupted; // the receiver got different data then was sent
+		};
+
+		EmulatedLink(const Settings & s)
+			: settings(s),
+			  pool(new bt::BufferPool()),
+			  link_free(0),
+			  sent(0),
+			  received(0),
+			  tcp_acked(0),
+			  dropped(0),
+			  queued(0),
+			  queuing_delay_sum(0),
+			  queuing_delay_max(0),
+			  corrupted(false)
+		{
+			pool->setWeakPointer(pool.toWeakRef());
+			for (int i = 0; i < settings.tcp_flows; i++)
+				tcp.append(TcpFlow());
+
+			deadlines[0] = deadlines[1] = 0;
+			sender = Connection::Ptr(new Connection(SENDER_ID, Connection::OUTGOING, net::Address("10.0.0.2", 6881), this));
+			sender->setWeakPointer(sender.toWeakRef());
+			receiver = Connection::Ptr(new Connection(SENDER_ID + 1, Connection::INCOMING, net::Address("10.0.0.1", 6881), this));
+			receiver->setWeakPointer(receiver.toWeakRef());
+		}
+
+		virtual ~EmulatedLink()
+		{
+			events.clear();
+			sender.clear();
+			receiver.clear();
+		}
+
+		/// The uTP connection which sends the data
+		Connection::Ptr sendingConnection() const {return sender;}
+
+		/// The uTP connection which receives the data
+		Connection::Ptr receivingConnection() const {return receiver;}
+
+		/// Do the handshake, returns false if it doesn't succeed within 5 seconds
+		bool connect()
+		{
+			sender->startConnecting();
+			for (int i = 0; i < 5000; i++)
+			{
+				step(false);
+				if (sender->connectionState() == CS_CONNECTED && receiver->connectionState() == CS_CONNECTED)
+					return true;
+				usleep(1000);
+			}
+			return false;
+		}
+
+		/**
+			Send as much data as possible from the sender to the receiver.
+			@param duration How long in ms
+			@return The measurements of this run
+		*/
+		Results run(bt::Uint32 duration)
+		{
+			bt::Uint64 received_before = received;
+			bt::Uint64 tcp_before = tcp_acked;
+			bt::Uint64 dropped_before = dropped;
+			queued = queuing_delay_sum = queuing_delay_max = 0;
+
+			bt::Uint64 start = now();
+			bt::Uint64 end = start + duration * 1000ULL;
+			while (now() < end && sender->connectionState() == CS_CONNECTED)
+			{
+				step(true);
+				usleep(100);
+			}
+
+			double elapsed = (now() - start) / 1000000.0;
+			Results r;
+			r.goodput = (received - received_before) / elapsed;
+			r.tcp_goodput = (tcp_acked - tcp_before) / elapsed;
+			r.mean_queuing_delay = queued > 0 ? queuing_delay_sum / (queued * 1000.0) : 0.0;
+			r.max_queuing_delay = queuing_delay_max / 1000.0;
+			r.dropped = dropped - dropped_before;
+			r.corrupted = corrupted;
+			return r;
+		}
+
+		/// Amount of bytes the receiver has read
+		bt::Uint64 bytesReceived() const {return received;}
+
+		virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet, bool probe)
+		{
+			Q_UNUSED(probe);
+			bt::Uint64 t = now();
+			Event ev;
+			ev.type = UTP_PACKET;
+			ev.flow = 0;
+			ev.data = QByteArray((const char*)packet.data(), packet.bufferSize());
+			if (conn == sender)
+			{
+				ev.to = receiver;
+				bt::Uint64 arrival = enqueue(packet.bufferSize() + IP_AND_UDP_OVERHEAD, t);
+				if (arrival == 0)
+					dropped++;
+				else
+					events.insert(arrival, ev);
+			}
+			else
+			{
+				ev.to = sender;
+				events.insert(t + settings.delay * 1000ULL, ev);
+			}
+			return true;
+		}
+
+		virtual void stateChanged(Connection::Ptr conn, bool readable, bool writeable)
+		{
+			Q_UNUSED(conn);
+			Q_UNUSED(readable);
+			Q_UNUSED(writeable);
+		}
+
+		virtual void closed(Connection::Ptr conn)
+		{
+			Q_UNUSED(conn);
+		}
+
+		virtual void scheduleTimeout(const net::Address & remote, bt::Uint16 recv_connection_id, const TimeValue & deadline)
+		{
+			Q_UNUSED(remote);
+			deadlines[recv_connection_id - SENDER_ID] = deadline.seconds * 1000000ULL + deadline.microseconds;
+		}
+
+	private:
+		enum EventType
+		{
+			UTP_PACKET,
+			TCP_ACK,
+			TCP_LOSS
+		};
+
+		struct Event
+		{
+			EventType type;
+			Connection::Ptr to;
+			QByteArray data;
+			int flow;
+		};
+
+		/// TCP Reno like flow, which always has data to send
+		struct TcpFlow
+		{
+			TcpFlow() : cwnd(2), ssthresh(1000000), in_flight(0), last_decrease(0) {}
+
+			double cwnd; // in packets
+			double ssthresh;
+			int in_flight;
+			bt::Uint64 last_decrease;
+		};
+
+		static const bt::Uint16 SENDER_ID = 100;
+		static const bt::Uint32 TCP_PACKET_SIZE = 1500;
+		static const bt::Uint32 TCP_PAYLOAD_SIZE = 1460;
+
+		/// Current time in microseconds
+		static bt::Uint64 now()
+		{
+			TimeValue tv;
+			return tv.seconds * 1000000ULL + tv.microseconds;
+		}
+
+		/**
+			Put a packet in the queue of the bottleneck.
+			@return The time in microseconds the packet arrives at the other side, 0 if it is dropped
+		*/
+		bt::Uint64 enqueue(bt::Uint32 size, bt::Uint64 t)
+		{
+			if (link_free < t)
+				link_free = t;
+
+			bt::Uint64 backlog = (link_free - t) * settings.bandwidth / 1000000;
+			if (backlog + size > settings.queue_size)
+				return 0;
+
+			if (settings.loss > 0 && qrand() % 100 < settings.loss)
+				return 0;
+
+			bt::Uint64 delay = link_free - t;
+			queued++;
+			queuing_delay_sum += delay;
+			if (delay > queuing_delay_max)
+				queuing_delay_max = delay;
+
+			link_free += (bt::Uint64)size * 1000000 / settings.bandwidth;
+			bt::Uint64 arrival = link_free + settings.delay * 1000ULL;
+			if (settings.jitter > 0)
+				arrival += qrand() % (settings.jitter * 1000);
+			return arrival;
+		}
+
+		/// Round trip time in microseconds of a packet which enters the bottleneck now
+		bt::Uint64 roundTripTime(bt::Uint64 t) const
+		{
+			return 2000ULL * settings.delay + (link_free > t ? link_free - t : 0);
+		}
+
+		void step(bool transfer)
+		{
+			bt::Uint64 t = now();
+			while (!events.isEmpty() && events.begin().key() <= t)
+			{
+				Event ev = events.begin().value();
+				events.erase(events.begin());
+				switch (ev.type)
+				{
+					case UTP_PACKET:
+						deliver(ev);
+						break;
+					case TCP_ACK:
+						tcpAck(tcp[ev.flow]);
+						break;
+					case TCP_LOSS:
+						tcpLoss(tcp[ev.flow], t);
+						break;
+				}
+			}
+
+			for (int i = 0; i < 2; i++)
+			{
+				if (deadlines[i] > 0 && deadlines[i] <= t)
+				{
+					deadlines[i] = 0;
+					(i == 0 ? sender : receiver)->checkTimeout(TimeValue());
+				}
+			}
+
+			if (!transfer)
+				return;
+
+			for (int i = 0; i < tcp.count(); i++)
+				tcpSend(tcp[i], i, t);
+
+			fill();
+			drain();
+		}
+
+		void deliver(const Event & ev)
+		{
+			bt::Buffer::Ptr buffer = pool->get(ev.data.size());
+			memcpy(buffer->get(), ev.data.constData(), ev.data.size());
+			PacketParser parser(buffer->get(), buffer->size());
+			if (parser.parse())
+				ev.to->handlePacket(parser, buffer);
+		}
+
+		/// Keep the output buffer of the sender full, every byte is its offset modulo 251
+		void fill()
+		{
+			bt::Uint8 data[16384];
+			for (;;)
+			{
+				for (bt::Uint32 i = 0; i < sizeof(data); i++)
+					data[i] = (sent + i) % 251;
+
+				int ret = sender->send(data, sizeof(data));
+				if (ret <= 0)
+					break;
+
+				sent += ret;
+			}
+		}
+
+		/// Read everything the receiver has, and check it
+		void drain()
+		{
+			bt::Uint8 data[16384];
+			int ret = 0;
+			while ((ret = receiver->recv(data, sizeof(data))) > 0)
+			{
+				for (int i = 0; i < ret; i++)
+					if (data[i] != (received + i) % 251)
+						corrupted = true;
+
+				received += ret;
+			}
+		}
+
+		void tcpSend(TcpFlow & flow, int idx, bt::Uint64 t)
+		{
+			while (flow.in_flight < (int)flow.cwnd)
+			{
+				Event ev;
+				ev.flow = idx;
+				bt::Uint64 arrival = enqueue(TCP_PACKET_SIZE, t);
+				if (arrival == 0)
+				{
+					// the sender finds out about a round trip later, through duplicate acks
+					ev.type = TCP_LOSS;
+					arrival = t + roundTripTime(t);
+				}
+				else
+				{
+					ev.type = TCP_ACK;
+					arrival += settings.delay * 1000ULL;
+				}
+				events.insert(arrival, ev);
+				flow.in_flight++;
+			}
+		}
+
+		void tcpAck(TcpFlow & flow)
+		{
+			flow.in_flight--;
+			tcp_acked += TCP_PAYLOAD_SIZE;
+			if (flow.cwnd < flow.ssthresh)
+				flow.cwnd += 1;
+			else
+				flow.cwnd += 1 / flow.cwnd;
+		}
+
+		void tcpLoss(TcpFlow & flow, bt::Uint64 t)
+		{
+			flow.in_flight--;
+			// halve the window only once per round trip
+			if (t - flow.last_decrease < roundTripTime(t))
+				return;
+
+			flow.last_decrease = t;
+			flow.cwnd = flow.ssthresh = qMax(flow.cwnd / 2, 2.0);
+		}
+
+	private:
+		Settings settings;
+		bt::BufferPool::Ptr pool;
+		Connection::Ptr sender;
+		Connection::Ptr receiver;
+		QMultiMap<bt::Uint64, Event> events;
+		QList<TcpFlow> tcp;
+		bt::Uint64 deadlines[2];
+		bt::Uint64 link_free;
+		bt::Uint64 sent;
+		bt::Uint64 received;
+		bt::Uint64 tcp_acked;
+		bt::Uint64 dropped;
+		bt::Uint64 queued;
+		bt::Uint64 queuing_delay_sum;
+		bt::Uint64 queuing_delay_max;
+		bool corrupted;
+	};
+}
+
+#endif // UTP_EMULATEDLINK_H
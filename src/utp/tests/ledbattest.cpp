@@ -0,0 +1,175 @@
+/***************************************************************************
+*   Copyright (C) 2009 by Joris Guisson                                   *
+*   joris.guisson@gmail.com                                               *
+*                                                                         *
+*   This program is free software; you can redistribute it and/or modify  *
+*   it under the terms of the GNU General Public License as published by  *
+*   the Free Software Foundation; either version 2 of the License, or     *
+*   (at your option) any later version.                                   *
+*                                                                         *
+*   This program is distributed in the hope that it will be useful,       *
+*   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+*   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+*   GNU General Public License for more details.                          *
+*                                                                         *
+*   You should have received a copy of the GNU General Public License     *
+*   along with this program; if not, write to the                         *
+*   Free Software Foundation, Inc.,                                       *
+*   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+***************************************************************************/
+
+
+#include <QtTest>
+#include <QObject>
+#include <util/log.h>
+#include <utp/ledbat.h>
+#include <utp/utpprotocol.h>
+
+using namespace utp;
+
+class LedbatTest : public QObject
+{
+	Q_OBJECT
+public:
+	LedbatTest(QObject* parent = 0) : QObject(parent)
+	{
+	}
+	
+	CongestionControl::AckInfo ack(bt::Uint32 bytes_acked,bt::Uint32 queuing_delay_ms,bt::TimeStamp now)
+	{
+		CongestionControl::AckInfo a;
+		a.bytes_acked = bytes_acked;
+		a.bytes_in_flight = 0;
+		a.queuing_delay = queuing_delay_ms * 1000;
+		a.rtt = 50;
+		a.packet_size = 1000;
+		a.now = now;
+		return a;
+	}
+	
+private slots:
+	void initTestCase()
+	{
+		bt::InitLog("ledbattest.log");
+	}
+	
+	void cleanupTestCase()
+	{
+		CongestionControl::setAlgorithm(CongestionControl::LEDBAT);
+		CongestionControl::setTargetDelay(0);
+	}
+	
+	void testCreate()
+	{
+		CongestionControl::setAlgorithm(CongestionControl::LEDBAT);
+		CongestionControl::setTargetDelay(0);
+		CongestionControl* cc = CongestionControl::create();
+		QVERIFY(cc->name() == "LEDBAT");
+		QVERIFY(cc->target() == CCONTROL_TARGET);
+		delete cc;
+		
+		CongestionControl::setAlgorithm(CongestionControl::LEDBAT_PLUS_PLUS);
+		CongestionControl::setTargetDelay(40);
+		cc = CongestionControl::create();
+		QVERIFY(cc->name() == "LEDBAT++");
+		QVERIFY(cc->target() == 40);
+		delete cc;
+	}
+	
+	void testLedbat()
+	{
+		Ledbat cc;
+		bt::Uint32 wnd = cc.window();
+		
+		// below the target the window grows, above it shrinks
+		cc.packetReceived(ack(1000,0,1000));
+		QVERIFY(cc.window() > wnd);
+		wnd = cc.window();
+		cc.packetReceived(ack(1000,2 * CCONTROL_TARGET,1010));
+		QVERIFY(cc.window() < wnd);
+		
+		wnd = cc.window();
+		cc.packetsLost(1020);
+		QVERIFY(cc.window() == (bt::Uint32)(0.78 * wnd));
+		
+		cc.timeout(1030);
+		QVERIFY(cc.window() == MIN_PACKET_SIZE);
+	}
+	
+	void testLedbatPlusPlusSlowStart()
+	{
+		LedbatPlusPlus cc;
+		QVERIFY(cc.target() == 60);
+		bt::Uint32 wnd = cc.window();
+		
+		// gain is 1 / ceil(2 * 60 / 50) = 1/3
+		cc.packetReceived(ack(3000,0,1000));
+		QVERIFY(cc.window() == wnd + 1000);
+		
+		// slow start ends at 3/4 of the target, after that the window grows by gain / W per byte acked
+		wnd = cc.window();
+		cc.packetReceived(ack(1000,50,1010));
+		QVERIFY(cc.window() > wnd && cc.window() - wnd < 1000 / 3 / 6);
+		
+		// far above the target it shrinks, but at most by half when a whole window is acked
+		wnd = cc.window();
+		cc.packetReceived(ack(wnd,1000,1020));
+		QVERIFY(cc.window() + 1 >= wnd / 2 && cc.window() <= wnd / 2 + 1);
+	}
+	
+	void testLedbatPlusPlusSlowdown()
+	{
+		LedbatPlusPlus cc;
+		for (int i = 0;i < 10;i++)
+			cc.packetReceived(ack(3000,0,1000));
+		
+		// leave slow start at 1100, the first slowdown comes 2 RTTs later
+		cc.packetReceived(ack(1000,50,1100));
+		bt::Uint32 wnd = cc.window();
+		cc.packetReceived(ack(1000,0,1199));
+		QVERIFY(cc.window() > wnd);
+		
+		wnd = cc.window();
+		cc.packetReceived(ack(1000,0,1200));
+		QVERIFY(cc.window() == 2000);
+		
+		// the window stays at 2 packets for 2 RTTs
+		cc.packetReceived(ack(1000,0,1250));
+		QVERIFY(cc.window() == 2000);
+		
+		// then slow start until the window before the slowdown
+		cc.packetReceived(ack(3000,0,1300));
+		QVERIFY(cc.window() == 3000);
+		for (int i = 0;i < 100 && cc.window() < wnd;i++)
+			cc.packetReceived(ack(3000,0,1310 + i));
+		
+		// and the next slowdown comes 9 times the duration of the last one later
+		bt::Uint32 now = 1500;
+		cc.packetReceived(ack(1000,0,now));
+		QVERIFY(cc.window() > 2000);
+		cc.packetReceived(ack(1000,0,now + 9 * (now - 1200)));
+		QVERIFY(cc.window() == 2000);
+	}
+	
+	void testLedbatPlusPlusLoss()
+	{
+		LedbatPlusPlus cc;
+		cc.packetReceived(ack(30000,0,1000));
+		bt::Uint32 wnd = cc.window();
+		
+		// only one decrease per round trip
+		cc.packetsLost(1000);
+		QVERIFY(cc.window() == wnd / 2);
+		cc.packetsLost(1010);
+		QVERIFY(cc.window() == wnd / 2);
+		cc.packetsLost(1050);
+		QVERIFY(cc.window() == wnd / 4);
+		
+		cc.timeout(1100);
+		QVERIFY(cc.window() == MIN_PACKET_SIZE);
+	}
+};
+
+QTEST_MAIN(LedbatTest)
+
+#include "ledbattest.moc"
@@ -94,6 +94,112 @@ private slots:
 		QVERIFY(pbuf.payloadSize() == 200);
 		QVERIFY(memcmp(pbuf.data(), tmp, 200) == 0);
 	}
+
+	void testAppend()
+	{
+		bt::Uint8 tmp[1000];
+		for (int i = 0; i < 1000; i++)
+			tmp[i] = i % 256;
+
+		utp::PacketBuffer pbuf;
+		QVERIFY(pbuf.appendData(tmp, 600, 1000) == 600);
+		QVERIFY(pbuf.appendData(tmp + 600, 600, 1000) == 400);
+		QVERIFY(pbuf.appendData(tmp, 100, 1000) == 0);
+		QVERIFY(pbuf.payloadSize() == 1000);
+		QVERIFY(pbuf.headRoom() == utp::PacketBuffer::HEAD_ROOM);
+		QVERIFY(memcmp(pbuf.data(), tmp, 1000) == 0);
+
+		// split off the front, the rest stays behind
+		utp::PacketBuffer front = pbuf.takeFront(300);
+		QVERIFY(front.payloadSize() == 300);
+		QVERIFY(memcmp(front.data(), tmp, 300) == 0);
+		QVERIFY(pbuf.payloadSize() == 700);
+		QVERIFY(memcmp(pbuf.data(), tmp + 300, 700) == 0);
+
+		// the header goes in front of the payload, without moving it
+		utp::Header hdr;
+		memset(&hdr, 0, sizeof(utp::Header));
+		hdr.seq_nr = 1000;
+		QVERIFY(pbuf.setHeader(hdr, 6));
+		QVERIFY(pbuf.bufferSize() == 700 + utp::Header::size() + 6);
+		QVERIFY(memcmp(pbuf.data() + utp::Header::size() + 6, tmp + 300, 700) == 0);
+
+		// once the header is set, nothing can be appended anymore
+		QVERIFY(pbuf.appendData(tmp, 100, 1000) == 0);
+
+		// a copy does not share the data
+		utp::PacketBuffer copy = pbuf.copy();
+		QVERIFY(copy.payloadSize() == 700);
+		QVERIFY(copy.data() != pbuf.data() + utp::Header::size() + 6);
+		QVERIFY(memcmp(copy.data(), tmp + 300, 700) == 0);
+	}
+
+	void testResendHeader()
+	{
+		bt::Uint8 tmp[1000];
+		for (int i = 0; i < 1000; i++)
+			tmp[i] = i % 256;
+
+		utp::PacketBuffer pbuf;
+		QVERIFY(pbuf.appendData(tmp, 1000, 1000) == 1000);
+		utp::Header hdr;
+		memset(&hdr, 0, sizeof(utp::Header));
+		hdr.seq_nr = 1000;
+		QVERIFY(pbuf.setHeader(hdr, 0));
+
+		// a retransmission shares the payload, and gets a bigger header in the head room
+		bt::Uint8 header[utp::MAX_HEADER_SIZE];
+		memset(header, 0xAA, utp::MAX_HEADER_SIZE);
+		utp::PacketBuffer resend = pbuf;
+		QVERIFY(resend.setHeader(header, utp::MAX_HEADER_SIZE));
+		QVERIFY(resend.payloadData() == pbuf.payloadData());
+		QVERIFY(resend.bufferSize() == 1000 + utp::MAX_HEADER_SIZE);
+		QVERIFY(memcmp(resend.data(), header, utp::MAX_HEADER_SIZE) == 0);
+		QVERIFY(memcmp(resend.data() + utp::MAX_HEADER_SIZE, tmp, 1000) == 0);
+
+		// not enough head room
+		QVERIFY(!resend.setHeader(tmp, utp::PacketBuffer::HEAD_ROOM + 1));
+	}
+
+	void testResendBenchmark_data()
+	{
+		QTest::addColumn<bool>("in_place");
+		QTest::newRow("header in the head room") << true;
+		QTest::newRow("copy of the payload") << false;
+	}
+
+	void testResendBenchmark()
+	{
+		// the cost of retransmitting one full packet
+		QFETCH(bool, in_place);
+		bt::Uint8 tmp[1400];
+		memset(tmp, 0xFF, 1400);
+		utp::PacketBuffer pbuf;
+		QVERIFY(pbuf.appendData(tmp, 1400, 1400) == 1400);
+
+		bt::Uint8 header[utp::MAX_HEADER_SIZE];
+		memset(header, 0, utp::MAX_HEADER_SIZE);
+		bt::Uint32 sent = 0;
+		if (in_place)
+		{
+			QBENCHMARK
+			{
+				utp::PacketBuffer resend = pbuf;
+				resend.setHeader(header, utp::MAX_HEADER_SIZE);
+				sent += resend.bufferSize();
+			}
+		}
+		else
+		{
+			QBENCHMARK
+			{
+				utp::PacketBuffer resend = pbuf.copy();
+				resend.setHeader(header, utp::MAX_HEADER_SIZE);
+				sent += resend.bufferSize();
+			}
+		}
+		QVERIFY(sent > 0 && sent % (1400 + utp::MAX_HEADER_SIZE) == 0);
+	}
 };
 
 QTEST_MAIN(PacketBufferTest)
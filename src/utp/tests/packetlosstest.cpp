@@ -27,6 +27,7 @@
 #include <util/functions.h>
 #include <time.h>
 #include <unistd.h>
+#include "emulatedlink.h"
 
 
 #define PACKETS_TO_SEND 20
@@ -215,6 +216,21 @@ private slots:
 		QVERIFY(outgoing->allDataSent());
 	}
 	
+	void testEmulatedPacketLoss()
+	{
+		// 10 % loss, with jitter so packets also arrive out of order
+		EmulatedLink::Settings s = {1000000,100000,20,10,10,0};
+		EmulatedLink link(s);
+		QVERIFY(link.connect());
+		
+		EmulatedLink::Results r = link.run(5000);
+		Out(SYS_UTP|LOG_DEBUG) << "Received " << link.bytesReceived() << " bytes, dropped " << r.dropped << " packets" << endl;
+		link.sendingConnection()->dumpStats();
+		QVERIFY(!r.corrupted);
+		QVERIFY(r.dropped > 0);
+		QVERIFY(link.bytesReceived() > 0);
+	}
+	
 private:
 	
 	
@@ -48,10 +48,11 @@ public:
 		update_rtt_called = true;
 	}
 	
-	virtual void retransmit(PacketBuffer & /*packet*/,bt::Uint16 p_seq_nr)
+	virtual bool retransmit(PacketBuffer & /*packet*/,bt::Uint16 p_seq_nr)
 	{
 		bt::Out(SYS_UTP|LOG_NOTICE) << "retransmit " << p_seq_nr << bt::endl;
 		retransmit_ok = retransmit_seq_nr.contains(p_seq_nr);
+		return true;
 	}
 	
 	void reset()
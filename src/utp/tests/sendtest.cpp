@@ -169,6 +169,28 @@ private slots:
 		}
 	}
 	
+	void testBenchmark()
+	{
+		bt::Out(SYS_UTP|LOG_DEBUG) << "testBenchmark" << bt::endl;
+		// Cost of one full packet: copying it into the packet buffers, queueing, sending and receiving
+		bt::Uint8 sdata[1400];
+		bt::Uint8 rdata[1400];
+		memset(sdata,0xAB,1400);
+		outgoing->setBlocking(true);
+		QBENCHMARK
+		{
+			QVERIFY(outgoing->send(sdata,1400) == 1400);
+			int received = 0;
+			while (received < 1400)
+			{
+				int ret = incoming->recv(rdata + received,1400 - received);
+				QVERIFY(ret > 0);
+				received += ret;
+			}
+		}
+		QVERIFY(memcmp(sdata,rdata,1400) == 0);
+	}
+	
 private:
 	int port;
 	utp::UTPSocket* incoming;
@@ -0,0 +1,196 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#include <QtTest>
+#include <QMap>
+#include <QSet>
+#include "util/log.h"
+#include "utp/timerwheel.h"
+
+using namespace utp;
+using namespace bt;
+
+class TimerWheelTest : public QObject
+{
+	Q_OBJECT
+
+private Q_SLOTS:
+	void initTestCase()
+	{
+		bt::InitLog("timerwheeltest.log");
+	}
+
+	void cleanupTestCase()
+	{
+	}
+
+	void testExpire_data()
+	{
+		QTest::addColumn<bt::Uint32>("delay");
+		QTest::newRow("first level") << (bt::Uint32)5;
+		QTest::newRow("second level") << (bt::Uint32)500;
+		QTest::newRow("third level") << (bt::Uint32)30000;
+		QTest::newRow("fourth level") << (bt::Uint32)600000;
+		QTest::newRow("beyond the wheel") << (bt::Uint32)20000000;
+	}
+
+	void testExpire()
+	{
+		QFETCH(bt::Uint32, delay);
+		TimeStamp now = 123456789;
+		TimerWheel<Uint32> w(now);
+		w.schedule(1, now + delay);
+		QVERIFY(w.count() == 1);
+
+		// nothing may expire before the deadline, and it has to expire on it
+		QList<Uint32> expired;
+		TimeStamp step = delay > 1000 ? 97 : 1;
+		while (now + step < 123456789 + delay)
+		{
+			now += step;
+			QVERIFY(w.nextDeadline() <= 123456789 + delay);
+			w.expire(now, expired);
+			QVERIFY(expired.isEmpty());
+		}
+
+		w.expire(123456789 + delay, expired);
+		QVERIFY(expired.count() == 1 && expired.first() == 1);
+		QVERIFY(w.count() == 0);
+		QVERIFY(w.nextDeadline() == 0);
+	}
+
+	void testReschedule()
+	{
+		TimerWheel<Uint32> w(1000);
+		QList<Uint32> expired;
+
+		// moving the deadline away
+		w.schedule(1, 1100);
+		w.schedule(1, 1500);
+		w.expire(1499, expired);
+		QVERIFY(expired.isEmpty());
+		w.expire(1500, expired);
+		QVERIFY(expired.count() == 1);
+
+		// moving it closer
+		expired.clear();
+		w.schedule(2, 5000);
+		w.schedule(2, 1600);
+		w.expire(1600, expired);
+		QVERIFY(expired.count() == 1);
+		expired.clear();
+		w.expire(6000, expired);
+		QVERIFY(expired.isEmpty());
+
+		// cancelling it
+		w.schedule(3, 7000);
+		w.cancel(3);
+		w.expire(8000, expired);
+		QVERIFY(expired.isEmpty());
+		QVERIFY(w.count() == 0);
+	}
+
+	void testClockGoesBackwards()
+	{
+		TimerWheel<Uint32> w(100000);
+		QList<Uint32> expired;
+		w.schedule(1, 100500);
+		w.expire(50000, expired);
+		QVERIFY(expired.isEmpty());
+		w.expire(100500, expired);
+		QVERIFY(expired.count() == 1);
+	}
+
+	void testRandom()
+	{
+		// compare with a map of deadlines
+		qsrand(42);
+		TimeStamp now = 1000000;
+		TimerWheel<Uint32> w(now);
+		QMap<Uint32, TimeStamp> ref;
+		for (int i = 0; i < 200000; i++)
+		{
+			Uint32 id = qrand() % 500;
+			int op = qrand() % 10;
+			if (op < 5)
+			{
+				TimeStamp d = now + (qrand() % 4 == 0 ? qrand() % 2000000 : qrand() % 3000);
+				w.schedule(id, d);
+				ref[id] = d;
+			}
+			else if (op == 5)
+			{
+				w.cancel(id);
+				ref.remove(id);
+			}
+
+			TimeStamp first = 0;
+			foreach (TimeStamp d, ref)
+				if (first == 0 || d < first)
+					first = d;
+			QVERIFY(w.nextDeadline() <= qMax(first, now + 1));
+
+			now += qrand() % 100 == 0 ? qrand() % 100000 : qrand() % 5;
+			QList<Uint32> expired;
+			w.expire(now, expired);
+			QSet<Uint32> fired = expired.toSet();
+			QVERIFY(fired.count() == expired.count());
+
+			QMap<Uint32, TimeStamp>::iterator itr = ref.begin();
+			while (itr != ref.end())
+			{
+				if (itr.value() <= now)
+				{
+					QVERIFY(fired.remove(itr.key()));
+					itr = ref.erase(itr);
+				}
+				else
+					itr++;
+			}
+			QVERIFY(fired.isEmpty());
+			QVERIFY(w.count() == (Uint32)ref.count());
+		}
+	}
+
+	void testBenchmark()
+	{
+		// lots of idle connections, whose deadline moves with every packet
+		TimeStamp now = 1000000;
+		TimerWheel<Uint32> w(now);
+		for (Uint32 id = 0; id < 10000; id++)
+			w.schedule(id, now + 1000 + id % 500);
+
+		QList<Uint32> expired;
+		QBENCHMARK
+		{
+			now += 1;
+			for (Uint32 i = 0; i < 100; i++)
+				w.schedule(qrand() % 10000, now + 1000);
+			w.expire(now, expired);
+			foreach (Uint32 id, expired)
+				w.schedule(id, now + 1000);
+			expired.clear();
+		}
+	}
+};
+
+QTEST_MAIN(TimerWheelTest)
+
+#include "timerwheeltest.moc"
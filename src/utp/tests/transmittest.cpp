@@ -28,6 +28,7 @@
 #include <utp/utpserver.h>
 #include <util/functions.h>
 #include <unistd.h>
+#include <time.h>
 #include <util/sha1hash.h>
 #include <util/sha1hashgen.h>
 
@@ -85,7 +86,8 @@ class SendThread : public QThread
 	Q_OBJECT
 public:
 	
-	SendThread(Connection::Ptr outgoing, UTPServer & srv,QObject* parent = 0) : QThread(parent),outgoing(outgoing),srv(srv)
+	SendThread(Connection::Ptr outgoing, UTPServer & srv,QObject* parent = 0,bt::Int64 to_send = BYTES_TO_SEND)
+		: QThread(parent),outgoing(outgoing),srv(srv),to_send(to_send)
 	{}
 	
 	virtual void run()
@@ -97,10 +99,9 @@ public:
 		bt::Int64 sent = 0;
 		int off = 0;
 		net::Poll poller;
-		while (sent < BYTES_TO_SEND && outgoing->connectionState() != CS_CLOSED)
+		while (sent < to_send && outgoing->connectionState() != CS_CLOSED)
 		{
-			int to_send = step - off;
-			int ret = outgoing->send((const bt::Uint8*)data.data() + off,to_send);
+			int ret = outgoing->send((const bt::Uint8*)data.data() + off,step - off);
 			if (ret > 0)
 			{
 				hgen.update((const bt::Uint8*)data.data() + off,ret);
@@ -130,6 +131,47 @@ public:
 	Connection::Ptr outgoing;
 	bt::SHA1Hash sent_hash;
 	UTPServer & srv;
+	bt::Int64 to_send;
+};
+
+class ReceiveThread : public QThread
+{
+	Q_OBJECT
+public:
+	
+	ReceiveThread(Connection::Ptr incoming,bt::Int64 to_receive,QObject* parent = 0)
+		: QThread(parent),incoming(incoming),to_receive(to_receive),received(0)
+	{}
+	
+	virtual void run()
+	{
+		bt::SHA1HashGen hgen;
+		incoming->setBlocking(true);
+		while (received < to_receive && incoming->connectionState() != CS_CLOSED)
+		{
+			bt::Uint32 ba = incoming->bytesAvailable();
+			if (ba > 0)
+			{
+				QByteArray data(ba,0);
+				int ret = incoming->recv((bt::Uint8*)data.data(),ba);
+				if (ret > 0)
+				{
+					hgen.update((bt::Uint8*)data.data(),ret);
+					received += ret;
+				}
+			}
+			else if (incoming->connectionState() != CS_CLOSED)
+			{
+				incoming->waitForData(1000);
+			}
+		}
+		received_hash = hgen.get();
+	}
+	
+	Connection::Ptr incoming;
+	bt::SHA1Hash received_hash;
+	bt::Int64 to_receive;
+	bt::Int64 received;
 };
 
 class TransmitTest : public QEventLoop
@@ -210,6 +252,8 @@ private slots:
 		
 		bt::SHA1HashGen hgen;
 		
+		bt::TimeStamp start = bt::Now();
+		clock_t cpu_start = clock();
 		SendThread st(outgoing, srv);
 		st.start(); // The thread will start sending a whole bunch of data
 		bt::Int64 received = 0;
@@ -238,8 +282,15 @@ private slots:
 			}
 		}
 		
+		// on loopback the path MTU search goes up to PMTU_MAX_DATAGRAM_SIZE, log what that gives
+		bt::TimeStamp elapsed = qMax<bt::TimeStamp>(bt::Now() - start, 1);
+		double cpu = (double)(clock() - cpu_start) / CLOCKS_PER_SEC;
 		st.wait();
 		Out(SYS_UTP|LOG_DEBUG) << "Received " << received << endl;
+		Out(SYS_UTP|LOG_DEBUG) << "Path MTU " << outgoing->connectionStats().pmtu << ": "
+			<< (received / 1048576.0) / (elapsed / 1000.0) << " MiB/s, "
+			<< cpu * 1000.0 / (received / 1048576.0) << " ms CPU per MiB" << endl;
+		QVERIFY(outgoing->connectionStats().pmtu >= PMTU_BASE_DATAGRAM_SIZE);
 		incoming->dumpStats();
 		QVERIFY(incoming->bytesAvailable() == 0);
 		QVERIFY(outgoing->allDataSent());
@@ -251,8 +302,114 @@ private slots:
 		QVERIFY(rhash == st.sent_hash);
 	}
 	
-private:
+	void testShards_data()
+	{
+		QTest::addColumn<int>("threads");
+		QTest::newRow("1 thread") << 1;
+		QTest::newRow("4 threads") << 4;
+	}
 	
+	void testShards()
+	{
+		// Several clients transmit at the same time to one server, which divides them over its threads
+		QFETCH(int,threads);
+		const int NUM_CLIENTS = 8;
+		const bt::Int64 SHARD_BYTES = 10*1024*1024;
+		
+		UTPServer::setNumThreads(threads);
+		UTPServer server;
+		UTPServer::setNumThreads(1);
+		int server_port = bind(server,port + 1);
+		QVERIFY(server_port > 0);
+		server.setCreateSockets(false);
+		server.start();
+		
+		QList<UTPServer*> clients;
+		QList<Connection::Ptr> outgoing;
+		QList<int> client_ports;
+		for (int i = 0;i < NUM_CLIENTS;i++)
+		{
+			UTPServer* c = new UTPServer();
+			client_ports.append(bind(*c,client_ports.isEmpty() ? server_port + 1 : client_ports.last() + 1));
+			QVERIFY(client_ports.last() > 0);
+			c->setCreateSockets(false);
+			c->start();
+			clients.append(c);
+			
+			Connection::Ptr conn = c->connectTo(net::Address("127.0.0.1",server_port)).toStrongRef();
+			QVERIFY(conn);
+			conn->setBlocking(true);
+			QVERIFY(conn->waitUntilConnected());
+			outgoing.append(conn);
+		}
+		
+		// Match every accepted connection with the client it came from
+		QList<ReceiveThread*> receivers;
+		for (int i = 0;i < NUM_CLIENTS;i++)
+			receivers.append(0);
+		
+		for (int tries = 0;tries < 50 && receivers.contains(0);tries++)
+		{
+			Connection::Ptr incoming = server.acceptedConnection().toStrongRef();
+			if (!incoming)
+			{
+				QTest::qWait(100);
+				continue;
+			}
+			
+			for (int i = 0;i < NUM_CLIENTS;i++)
+			{
+				if (client_ports[i] == incoming->remoteAddress().port())
+					receivers[i] = new ReceiveThread(incoming,SHARD_BYTES);
+			}
+		}
+		QVERIFY(!receivers.contains(0));
+		
+		QList<SendThread*> senders;
+		for (int i = 0;i < NUM_CLIENTS;i++)
+			senders.append(new SendThread(outgoing[i],*clients[i],0,SHARD_BYTES));
+		
+		bt::TimeStamp start = bt::Now();
+		for (int i = 0;i < NUM_CLIENTS;i++)
+		{
+			receivers[i]->start();
+			senders[i]->start();
+		}
+		
+		foreach (ReceiveThread* r,receivers)
+			r->wait();
+		bt::TimeStamp elapsed = bt::Now() - start;
+		Out(SYS_UTP|LOG_DEBUG) << "Received " << NUM_CLIENTS << " x " << SHARD_BYTES << " bytes with " << threads
+			<< " threads in " << elapsed << " ms" << endl;
+		
+		foreach (SendThread* st,senders)
+			st->wait();
+		
+		for (int i = 0;i < NUM_CLIENTS;i++)
+		{
+			QVERIFY(receivers[i]->received >= SHARD_BYTES);
+			QVERIFY(receivers[i]->received_hash == senders[i]->sent_hash);
+		}
+		
+		qDeleteAll(senders);
+		qDeleteAll(receivers);
+		outgoing.clear();
+		server.stop();
+		foreach (UTPServer* c,clients)
+			c->stop();
+		qDeleteAll(clients);
+	}
+	
+private:
+	int bind(UTPServer & s,int first_port)
+	{
+		for (int p = first_port;p < 60000;p++)
+		{
+			if (s.changePort(p))
+				return p;
+		}
+		return 0;
+	}
 	
 private:
 	Connection::Ptr incoming;
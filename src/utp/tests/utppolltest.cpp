@@ -24,6 +24,7 @@
 #include <util/log.h>
 #include <utp/utpserver.h>
 #include <utp/utpsocket.h>
+#include <utp/pollpipe.h>
 #include <net/poll.h>
 #include <torrent/globals.h>
 #include <util/bitset.h>
@@ -97,6 +98,22 @@ private slots:
 		}
 	}
 	
+	void testPollPipeKey()
+	{
+		// the same connection ID of another peer must not be mistaken for the polled connection
+		net::Poll poll;
+		PollPipe::Ptr pipe(new PollPipe(net::Poll::INPUT));
+		ConnectionKey polled(net::Address("127.0.0.1",6881),1000);
+		pipe->prepare(&poll,polled,pipe);
+		QVERIFY(pipe->polling(polled));
+		QVERIFY(!pipe->polling(ConnectionKey(net::Address("127.0.0.2",6881),1000)));
+		QVERIFY(!pipe->polling(ConnectionKey(net::Address("127.0.0.1",6882),1000)));
+		QVERIFY(!pipe->polling(ConnectionKey(net::Address("127.0.0.1",6881),1001)));
+		
+		pipe->reset();
+		QVERIFY(!pipe->polling(polled));
+	}
+	
 	void testPollConnect()
 	{
 		poller.reset();
@@ -0,0 +1,332 @@
+/***************************************************************************
+ *   Copyright (C) 2011 by Joris Guisson                                   *
+ *   joris.guisson@gmail.com                                               *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ *                                                                         *
+ *   This program is distributed in the hope that it will be useful,       *
+ *   but WITHOUT ANY WARRANTY; without even the implied warranty of        *
+ *   MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the         *
+ *   GNU General Public License for more details.                          *
+ *                                                                         *
+ *   You should have received a copy of the GNU General Public License     *
+ *   along with this program; if not, write to the                         *
+ *   Free Software Foundation, Inc.,                                       *
+ *   51 Franklin Street, Fifth Floor, Boston, MA 02110-1301, USA.          *
+ ***************************************************************************/
+
+#ifndef UTP_TIMERWHEEL_H
+#define UTP_TIMERWHEEL_H
+
+#include <QHash>
+#include <QList>
+#include <util/constants.h>
+
+namespace utp
+{
+	/**
+		Hierarchical timer wheel with a resolution of one millisecond. Every timer has an ID,
+		and there is at most one deadline per ID. The ID type needs a qHash function.
+
+		Moving a deadline further away, which happens every time a packet is sent or received,
+		only updates the deadline of the ID. The old entry in the wheel stays and moves the timer
+		to the new deadline when it comes by. Only moving a deadline closer adds a new entry,
+		the old one is discarded when it expires.
+	*/
+	template <class Key>
+	class TimerWheel
+	{
+	public:
+		TimerWheel(bt::TimeStamp now);
+		virtual ~TimerWheel();
+
+		/**
+			Schedule a timer, replaces the previous deadline of the ID.
+			@param id ID of the timer
+			@param deadline The time in ms at which it should expire
+		*/
+		void schedule(const Key & id, bt::TimeStamp deadline);
+
+		/**
+			Cancel a timer.
+			@param id ID of the timer
+		*/
+		void cancel(const Key & id);
+
+		/**
+			Advance the wheel and collect the timers which have expired.
+			Expired timers are removed, they need to be scheduled again.
+			@param now The current time in ms
+			@param expired List to add the IDs of the expired timers to
+		*/
+		void expire(bt::TimeStamp now, QList<Key> & expired);
+
+		/**
+			Get the time at which expire should be called again. This can be earlier
+			then the first deadline, but never later.
+			@return The time in ms, or 0 if there are no timers
+		*/
+		bt::TimeStamp nextDeadline() const;
+
+		/// Get the number of scheduled timers
+		bt::Uint32 count() const {return timers.count();}
+
+	private:
+		struct Entry
+		{
+			Key id;
+			bt::TimeStamp deadline;
+
+			Entry(const Key & id, bt::TimeStamp deadline) : id(id), deadline(deadline) {}
+		};
+
+		struct Timer
+		{
+			// the wanted deadline
+			bt::TimeStamp deadline;
+			// the deadline of the entry in the wheel
+			bt::TimeStamp queued;
+		};
+
+		static const int BITS = 6;
+		static const int SLOTS = 1 << BITS;
+		static const int LEVELS = 4;
+
+		void insert(const Entry & e);
+		bool isStale(const Entry & e) const;
+		void cascade(int level);
+		void tick(bt::TimeStamp now, QList<Key> & expired);
+		void rebuild(bt::TimeStamp now);
+
+	private:
+		bt::TimeStamp current;
+		QList<Entry> wheel[LEVELS][SLOTS];
+		bt::Uint32 entries[LEVELS];
+		QHash<Key, Timer> timers;
+	};
+
+	template <class Key>
+	TimerWheel<Key>::TimerWheel(bt::TimeStamp now) : current(now)
+	{
+		for (int i = 0; i < LEVELS; i++)
+			entries[i] = 0;
+	}
+
+	template <class Key>
+	TimerWheel<Key>::~TimerWheel()
+	{
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::schedule(const Key & id, bt::TimeStamp deadline)
+	{
+		typename QHash<Key, Timer>::iterator i = timers.find(id);
+		if (i == timers.end())
+		{
+			Timer t;
+			t.deadline = t.queued = deadline;
+			timers.insert(id, t);
+			insert(Entry(id, deadline));
+		}
+		else
+		{
+			i->deadline = deadline;
+			if (deadline < i->queued)
+			{
+				// the old entry is too late, it will be discarded when it comes by
+				i->queued = deadline;
+				insert(Entry(id, deadline));
+			}
+		}
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::cancel(const Key & id)
+	{
+		// the entries in the wheel are discarded when they come by
+		timers.remove(id);
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::insert(const Entry & e)
+	{
+		// deadlines in the past expire at the next tick
+		bt::TimeStamp t = e.deadline > current ? e.deadline : current + 1;
+		bt::TimeStamp delta = t - current;
+		int level = 0;
+		while (level < LEVELS - 1 && delta >= (bt::TimeStamp)1 << ((level + 1) * BITS))
+			level++;
+
+		if (level == LEVELS - 1 && delta >= (bt::TimeStamp)1 << (LEVELS * BITS))
+		{
+			// beyond the range of the wheel, move it back in again later
+			t = current + ((bt::TimeStamp)1 << (LEVELS * BITS)) - 1;
+		}
+
+		wheel[level][(t >> (level * BITS)) & (SLOTS - 1)].append(e);
+		entries[level]++;
+	}
+
+	template <class Key>
+	bool TimerWheel<Key>::isStale(const Entry & e) const
+	{
+		typename QHash<Key, Timer>::const_iterator i = timers.find(e.id);
+		return i == timers.end() || i->queued != e.deadline;
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::cascade(int level)
+	{
+		QList<Entry> & slot = wheel[level][(current >> (level * BITS)) & (SLOTS - 1)];
+		QList<Entry> moved = slot;
+		slot.clear();
+		entries[level] -= moved.count();
+		foreach (const Entry & e, moved)
+		{
+			if (!isStale(e))
+				insert(e);
+		}
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::tick(bt::TimeStamp now, QList<Key> & expired)
+	{
+		current++;
+		// when a lower level wraps around, the next slot of the level above it comes down
+		for (int level = 1; level < LEVELS; level++)
+		{
+			if ((current & (((bt::TimeStamp)1 << (level * BITS)) - 1)) != 0)
+				break;
+			cascade(level);
+		}
+
+		QList<Entry> & slot = wheel[0][current & (SLOTS - 1)];
+		if (slot.isEmpty())
+			return;
+
+		QList<Entry> due = slot;
+		slot.clear();
+		entries[0] -= due.count();
+		foreach (const Entry & e, due)
+		{
+			typename QHash<Key, Timer>::iterator i = timers.find(e.id);
+			if (i == timers.end() || i->queued != e.deadline)
+				continue;
+
+			if (i->deadline <= now)
+			{
+				expired.append(e.id);
+				timers.erase(i);
+			}
+			else
+			{
+				// the deadline has moved
+				i->queued = i->deadline;
+				insert(Entry(e.id, i->deadline));
+			}
+		}
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::expire(bt::TimeStamp now, QList<Key> & expired)
+	{
+		if (now < current)
+		{
+			// the clock went backwards
+			rebuild(now);
+			return;
+		}
+
+		while (current < now)
+		{
+			if (timers.isEmpty())
+			{
+				current = now;
+				break;
+			}
+
+			// skip over the empty levels, but stop before the next slot of the first level with entries
+			int level = 0;
+			while (level < LEVELS - 1 && entries[level] == 0)
+				level++;
+
+			if (level > 0)
+			{
+				bt::TimeStamp skip_to = current | (((bt::TimeStamp)1 << (level * BITS)) - 1);
+				if (skip_to > current)
+					current = skip_to < now ? skip_to : now;
+				if (current == now)
+					break;
+			}
+
+			tick(now, expired);
+		}
+	}
+
+	template <class Key>
+	void TimerWheel<Key>::rebuild(bt::TimeStamp now)
+	{
+		for (int level = 0; level < LEVELS; level++)
+		{
+			for (int i = 0; i < SLOTS; i++)
+				wheel[level][i].clear();
+			entries[level] = 0;
+		}
+
+		current = now;
+		typename QHash<Key, Timer>::iterator i = timers.begin();
+		while (i != timers.end())
+		{
+			i->queued = i->deadline;
+			insert(Entry(i.key(), i->deadline));
+			i++;
+		}
+	}
+
+	template <class Key>
+	bt::TimeStamp TimerWheel<Key>::nextDeadline() const
+	{
+		if (timers.isEmpty())
+			return 0;
+
+		// first non empty slot of the lowest level, or the first time a slot of a higher level comes down
+		bt::TimeStamp next = 0;
+		if (entries[0] > 0)
+		{
+			for (bt::TimeStamp t = current + 1; t <= current + SLOTS; t++)
+			{
+				if (!wheel[0][t & (SLOTS - 1)].isEmpty())
+				{
+					next = t;
+					break;
+				}
+			}
+		}
+
+		for (int level = 1; level < LEVELS; level++)
+		{
+			if (entries[level] == 0)
+				continue;
+
+			bt::TimeStamp block = current >> (level * BITS);
+			for (int k = 1; k <= SLOTS; k++)
+			{
+				if (!wheel[level][(block + k) & (SLOTS - 1)].isEmpty())
+				{
+					bt::TimeStamp t = (block + k) << (level * BITS);
+					if (next == 0 || t < next)
+						next = t;
+					break;
+				}
+			}
+		}
+
+		return next;
+	}
+
+}
+
+#endif // UTP_TIMERWHEEL_H
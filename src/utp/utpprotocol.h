@@ -115,6 +115,16 @@ namespace utp
 	const bt::Uint32 KEEP_ALIVE_TIMEOUT = 30000;
 
 	const bt::Uint32 IP_AND_UDP_OVERHEAD = 28;
+	const bt::Uint32 MAX_EXTENSION_LENGTH = 6; // selective ack with a 4 byte bitmask
+	const bt::Uint32 MAX_HEADER_SIZE = 20 + MAX_EXTENSION_LENGTH; // header and extensions of a data packet
+
+	// path MTU discovery, sizes are of UDP datagrams, so the uTP header and extensions are included
+	const bt::Uint32 PMTU_MIN_DATAGRAM_SIZE = 1280 - 48; // minimum MTU of IPv6, used after a black hole
+	const bt::Uint32 PMTU_BASE_DATAGRAM_SIZE = 1500 - 48; // ethernet, for IPv4 and IPv6
+	const bt::Uint32 PMTU_MAX_DATAGRAM_SIZE = 8192; // bigger datagrams are dropped by ServerSocket
+	const bt::Uint32 PMTU_SEARCH_RESOLUTION = 16;
+	const bt::Uint32 PMTU_SEARCH_INTERVAL = 10*60*1000; // search again after 10 minutes
+	const bt::Uint32 PMTU_BLACK_HOLE_TIMEOUTS = 2;
 
 	/*
 	 Test if a bit is acked
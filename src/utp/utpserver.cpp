@@ -21,6 +21,7 @@
 #include "utpserver.h"
 #include "utpserver_p.h"
 #include <QEvent>
+#include <QVector>
 #include <QTimer>
 #include <QHostAddress>
 #include <QCoreApplication>
@@ -34,6 +35,7 @@
 #include <mse/encryptedpacketsocket.h>
 #include <torrent/globals.h>
 #include <net/portlist.h>
+#include <net/socket.h>
 #include "utpprotocol.h"
 #include "utpserverthread.h"
 #include "utpsocket.h"
@@ -63,138 +65,452 @@ namespace utp
 
 	///////////////////////////////////////////////////////////
 
-	UTPServer::Private::Private(UTPServer* p) :
-			p(p),
-			running(false),
-			utp_thread(0),
+	// maximum number of packets waiting for a shard, more are dropped
+	const int MAX_INBOX_SIZE = 4096;
+
+	UTPShard::UTPShard(UTPServer* srv) :
+			srv(srv),
 			mutex(QMutex::Recursive),
-			create_sockets(true),
-			tos(0),
-			mtc(new MainThreadCall(p))
+			timer(this),
+			timer_wheel(TimeValue().toTimeStamp()),
+			timer_armed(0),
+			timer_stopped(false)
 	{
-		QObject::connect(p, SIGNAL(handlePendingConnectionsDelayed()),
-		                 mtc, SLOT(handlePendingConnections()), Qt::QueuedConnection);
+		timer.setSingleShot(true);
+		connect(&timer, SIGNAL(timeout()), this, SLOT(checkTimeouts()));
+	}
 
-		poll_pipes.setAutoDelete(true);
+	UTPShard::~UTPShard()
+	{
 	}
 
-	UTPServer::Private::~Private()
+	void UTPShard::dispatch(const net::ServerSocket::PacketList & packets)
 	{
-		if (running)
-			stop();
+		if (QThread::currentThread() == thread())
+		{
+			dataReceived(packets);
+			return;
+		}
 
-		pending.clear();
-		delete mtc;
+		bool wake_up = false;
+		{
+			QMutexLocker lock(&inbox_mutex);
+			wake_up = inbox.isEmpty();
+			if (inbox.count() + packets.count() > MAX_INBOX_SIZE)
+			{
+				// The shard can't keep up, drop the packets like a full socket buffer would
+				Out(SYS_UTP | LOG_DEBUG) << "UTP: shard overloaded, dropping " << packets.count() << " packets" << endl;
+				return;
+			}
+			inbox.append(packets);
+		}
+
+		if (wake_up)
+			QMetaObject::invokeMethod(this, "processInbox", Qt::QueuedConnection);
 	}
 
-	void UTPServer::Private::stop()
+	void UTPShard::processInbox()
 	{
-		running = false;
-		if (utp_thread)
+		net::ServerSocket::PacketList packets;
 		{
-			utp_thread->exit();
-			utp_thread->wait();
-			delete utp_thread;
-			utp_thread = 0;
+			QMutexLocker lock(&inbox_mutex);
+			packets.swap(inbox);
 		}
 
-		timer.stop();
-		connections.clear();
-
-		// Close the socket
-		sockets.clear();
-		Globals::instance().getPortList().removePort(port, net::UDP);
+		if (!packets.isEmpty())
+			dataReceived(packets);
 	}
 
-	bool UTPServer::Private::bind(const net::Address& addr)
+	void UTPShard::dataReceived(const net::ServerSocket::PacketList& packets)
 	{
-		net::ServerSocket::Ptr sock(new net::ServerSocket(this));
-		if (!sock->bind(addr))
+		QMutexLocker lock(&mutex);
+
+		// Hold back the ACKs of all connections which get data in this batch,
+		// so a connection sends one ACK for all its packets instead of one per packet
+		QList<Connection::Ptr> batch;
+		foreach (const net::ServerSocket::PacketList::value_type & pkt, packets)
 		{
-			return false;
+			bt::Buffer::Ptr buffer = pkt.first;
+			if (buffer->size() < (int)utp::Header::size())
+				continue;
+
+			PacketParser parser(buffer->get(), buffer->size());
+			if (!parser.parse() || parser.header()->type != ST_DATA)
+				continue;
+
+			Connection::Ptr c = connections.find(pkt.second, parser.header()->connection_id);
+			if (c && !batch.contains(c))
+			{
+				c->beginBatch();
+				batch.append(c);
+			}
 		}
-		else
+
+		foreach (const net::ServerSocket::PacketList::value_type & pkt, packets)
 		{
-			Out(SYS_UTP | LOG_NOTICE) << "UTP: bound to " << addr.toString() << endl;
-			sock->setTOS(tos);
-			sock->setReadNotificationsEnabled(false);
-			sock->setWriteNotificationsEnabled(false);
-			sockets.append(sock);
-			return true;
+			//Out(SYS_UTP|LOG_NOTICE) << "UTP: received " << ba << " bytes packet from " << addr.toString() << endl;
+			try
+			{
+				if (pkt.first->size() >= (int)utp::Header::size()) // discard packets which are to small
+				{
+					srv->handlePacket(pkt.first, pkt.second);
+				}
+			}
+			catch (utp::Connection::TransmissionError & err)
+			{
+				Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
+			}
+		}
+
+		foreach (Connection::Ptr c, batch)
+		{
+			try
+			{
+				c->endBatch();
+			}
+			catch (utp::Connection::TransmissionError & err)
+			{
+				Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
+				c->close();
+			}
+		}
+	}
+
+	void UTPShard::handlePacket(bt::Buffer::Ptr buffer, const net::Address & addr)
+	{
+		PacketParser parser(buffer->get(), buffer->size());
+		if (!parser.parse())
+			return;
+
+		QMutexLocker lock(&mutex);
+		const Header* hdr = parser.header();
+		//Dump(packet,addr);
+		//DumpPacket(*hdr);
+		Connection::Ptr c;
+		switch (hdr->type)
+		{
+			case ST_DATA:
+			case ST_FIN:
+			case ST_STATE:
+				try
+				{
+					c = connections.find(addr, hdr->connection_id);
+					if (c && c->handlePacket(parser, buffer) == CS_CLOSED)
+					{
+						connections.remove(addr, c->receiveConnectionID());
+					}
+				}
+				catch (Connection::TransmissionError & err)
+				{
+					Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
+					if (c)
+						c->close();
+				}
+				break;
+			case ST_RESET:
+				reset(hdr, addr);
+				break;
+			case ST_SYN:
+				syn(parser, buffer, addr);
+				break;
 		}
 	}
 
-	void UTPServer::Private::syn(const PacketParser & parser, bt::Buffer::Ptr buffer, const net::Address & addr)
+	void UTPShard::syn(const PacketParser & parser, bt::Buffer::Ptr buffer, const net::Address & addr)
 	{
 		const Header* hdr = parser.header();
 		quint16 recv_conn_id = hdr->connection_id + 1;
-		if (connections.contains(recv_conn_id))
+		if (connections.contains(addr, recv_conn_id))
 		{
 			// Send a reset packet if the ID is in use
-			Connection::Ptr conn(new Connection(recv_conn_id, Connection::INCOMING, addr, p));
+			Connection::Ptr conn(new Connection(recv_conn_id, Connection::INCOMING, addr, srv));
 			conn->setWeakPointer(conn);
 			conn->sendReset();
 		}
 		else
 		{
-			Connection::Ptr conn(new Connection(recv_conn_id, Connection::INCOMING, addr, p));
+			Connection::Ptr conn(new Connection(recv_conn_id, Connection::INCOMING, addr, srv));
 			try
 			{
 				conn->setWeakPointer(conn);
 				conn->handlePacket(parser, buffer);
-				connections.insert(recv_conn_id, conn);
-				if (create_sockets)
+				connections.insert(conn);
+
+				UTPServer::Private* d = srv->d;
+				if (d->create_sockets)
 				{
 					UTPSocket* utps = new UTPSocket(conn);
 					mse::EncryptedPacketSocket::Ptr ss(new mse::EncryptedPacketSocket(utps));
 					{
-						QMutexLocker lock(&pending_mutex);
-						pending.append(ss);
+						QMutexLocker lock(&d->pending_mutex);
+						d->pending.append(ss);
 					}
-					p->handlePendingConnectionsDelayed();
+					srv->handlePendingConnectionsDelayed();
 				}
 				else
 				{
-					last_accepted.append(conn);
-					p->accepted();
+					{
+						QMutexLocker lock(&d->pending_mutex);
+						d->last_accepted.append(conn);
+					}
+					srv->accepted();
 				}
 			}
 			catch (Connection::TransmissionError & err)
 			{
 				Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
-				connections.remove(recv_conn_id);
+				connections.remove(addr, recv_conn_id);
 			}
 		}
 	}
 
-	void UTPServer::Private::reset(const utp::Header* hdr)
+	void UTPShard::reset(const utp::Header* hdr, const net::Address & addr)
 	{
-		Connection::Ptr c = find(hdr->connection_id);
+		Connection::Ptr c = connections.find(addr, hdr->connection_id);
 		if (c)
 		{
 			c->reset();
 		}
 	}
 
-	Connection::Ptr UTPServer::Private::find(quint16 conn_id)
+	Connection::WPtr UTPShard::connectTo(const net::Address & addr)
 	{
-		ConnectionMapItr i = connections.find(conn_id);
-		if (i != connections.end())
-			return i.value();
+		QMutexLocker lock(&mutex);
+		quint16 recv_conn_id = connections.allocateID(addr);
+
+		Connection::Ptr conn(new Connection(recv_conn_id, Connection::OUTGOING, addr, srv));
+		conn->setWeakPointer(conn);
+		conn->moveToThread(thread());
+		connections.insert(conn);
+		try
+		{
+			conn->startConnecting();
+			return conn;
+		}
+		catch (Connection::TransmissionError & err)
+		{
+			connections.remove(addr, recv_conn_id);
+			return Connection::WPtr();
+		}
+	}
+
+	void UTPShard::armTimer()
+	{
+		// timer_mutex must be locked
+		if (timer_stopped)
+			return;
+
+		timer_armed = timer_wheel.nextDeadline();
+		if (timer_armed == 0)
+		{
+			timer.stop();
+		}
 		else
-			return Connection::Ptr();
+		{
+			bt::TimeStamp now = TimeValue().toTimeStamp();
+			timer.start(timer_armed > now ? timer_armed - now : 0);
+		}
+	}
+
+	void UTPShard::scheduleTimeout(const ConnectionKey & key, bt::TimeStamp deadline)
+	{
+		QMutexLocker lock(&timer_mutex);
+		timer_wheel.schedule(key, deadline);
+		if (timer_armed == 0 || deadline < timer_armed)
+		{
+			// The timer can only be started from the thread of the shard
+			if (QThread::currentThread() == thread())
+			{
+				armTimer();
+			}
+			else
+			{
+				timer_armed = deadline;
+				QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+			}
+		}
+	}
+
+	void UTPShard::customEvent(QEvent* ev)
+	{
+		if (ev->type() == QEvent::User)
+		{
+			QMutexLocker lock(&timer_mutex);
+			armTimer();
+		}
+	}
+
+	void UTPShard::checkTimeouts()
+	{
+		QList<ConnectionKey> expired;
+		{
+			QMutexLocker lock(&timer_mutex);
+			timer_wheel.expire(TimeValue().toTimeStamp(), expired);
+		}
+
+		{
+			QMutexLocker lock(&mutex);
+			TimeValue now;
+			foreach (const ConnectionKey & key, expired)
+			{
+				Connection::Ptr c = connections.find(key.remote, key.recv_connection_id);
+				if (c)
+					c->checkTimeout(now);
+			}
+		}
+
+		QMutexLocker lock(&timer_mutex);
+		armTimer();
+	}
+
+	void UTPShard::cleanup()
+	{
+		QMutexLocker lock(&mutex);
+		QList<Connection::Ptr> closed;
+		for (bt::Uint32 i = 0; i < connections.capacity(); i++)
+		{
+			Connection::Ptr c = connections.at(i);
+			if (c && c->connectionState() == CS_CLOSED)
+				closed.append(c);
+		}
+
+		QMutexLocker timer_lock(&timer_mutex);
+		foreach (Connection::Ptr c, closed)
+		{
+			timer_wheel.cancel(ConnectionKey(c->remoteAddress(), c->receiveConnectionID()));
+			connections.remove(c->remoteAddress(), c->receiveConnectionID());
+		}
+	}
+
+	void UTPShard::stopTimer()
+	{
+		if (QThread::currentThread() == thread())
+		{
+			QMutexLocker lock(&timer_mutex);
+			timer_stopped = true;
+			timer_armed = 0;
+			timer.stop();
+		}
+		else if (thread()->isRunning())
+		{
+			QMetaObject::invokeMethod(this, "stopTimer", Qt::BlockingQueuedConnection);
+		}
+	}
+
+	void UTPShard::stop()
+	{
+		{
+			// the thread is gone, so the timer can be armed again when the server is restarted
+			QMutexLocker lock(&timer_mutex);
+			timer_stopped = false;
+		}
+
+		QMutexLocker lock(&mutex);
+		connections.clear();
+	}
+
+	///////////////////////////////////////////////////////////
+
+	UTPServer::Private::Private(UTPServer* p) :
+			p(p),
+			running(false),
+			utp_thread(0),
+			create_sockets(true),
+			tos(0),
+			dont_fragment(false),
+			mtc(new MainThreadCall(p))
+	{
+		QObject::connect(p, SIGNAL(handlePendingConnectionsDelayed()),
+		                 mtc, SLOT(handlePendingConnections()), Qt::QueuedConnection);
+
+		poll_pipes.setAutoDelete(true);
+		for (bt::Uint32 i = 0; i < UTPServer::numThreads(); i++)
+			shards.append(new UTPShard(p));
+	}
+
+	UTPServer::Private::~Private()
+	{
+		// the shard threads have to be gone before the shards are deleted
+		if (running || utp_thread)
+			stop();
+
+		pending.clear();
+		qDeleteAll(shards);
+		delete mtc;
+	}
+
+	void UTPServer::Private::stop()
+	{
+		running = false;
+		// the timers have to be stopped in the threads of the shards, while these are still running
+		foreach (UTPShard* s, shards)
+			s->stopTimer();
+
+		if (utp_thread)
+		{
+			utp_thread->exit();
+			utp_thread->wait();
+			delete utp_thread;
+			utp_thread = 0;
+		}
+
+		foreach (QThread* t, shard_threads)
+		{
+			t->exit();
+			t->wait();
+		}
+		qDeleteAll(shard_threads);
+		shard_threads.clear();
+
+		foreach (UTPShard* s, shards)
+			s->stop();
+
+		// Close the socket
+		sockets.clear();
+		Globals::instance().getPortList().removePort(port, net::UDP);
+	}
+
+	bool UTPServer::Private::bind(const net::Address& addr)
+	{
+		net::ServerSocket::Ptr sock(new net::ServerSocket(this));
+		if (!sock->bind(addr))
+		{
+			return false;
+		}
+		else
+		{
+			Out(SYS_UTP | LOG_NOTICE) << "UTP: bound to " << addr.toString() << endl;
+			sock->setTOS(tos);
+			// path MTU probes are sent with the don't fragment bit set, other packets without it,
+			// so it must be possible to turn it on and off on every socket
+			dont_fragment = sock->setDontFragment(true) && sock->setDontFragment(false) && (sockets.isEmpty() || dont_fragment);
+			sock->setSegmentationOffload(true);
+			sock->setReadNotificationsEnabled(false);
+			sock->setWriteNotificationsEnabled(false);
+			sockets.append(sock);
+			return true;
+		}
+	}
+
+	UTPShard* UTPServer::Private::shard(const net::Address & addr)
+	{
+		if (shards.count() == 1)
+			return shards.first();
+		else
+			return shards.at(qHash(ConnectionKey(addr, 0)) % shards.count());
 	}
 
 	void UTPServer::Private::wakeUpPollPipes(utp::Connection::Ptr conn, bool readable, bool writeable)
 	{
+		ConnectionKey key(conn->remoteAddress(), conn->receiveConnectionID());
 		QMutexLocker lock(&mutex);
 		for (PollPipePairItr itr = poll_pipes.begin();itr != poll_pipes.end();itr++)
 		{
 			PollPipePair* pp = itr->second;
-			if (readable && pp->read_pipe->polling(conn->receiveConnectionID()))
+			if (readable && pp->read_pipe->polling(key))
 				itr->second->read_pipe->wakeUp();
 
-			if (writeable && pp->write_pipe->polling(conn->receiveConnectionID()))
+			if (writeable && pp->write_pipe->polling(key))
 				itr->second->write_pipe->wakeUp();
 		}
 	}
@@ -202,34 +518,51 @@ namespace utp
 
 	void UTPServer::Private::dataReceived(bt::Buffer::Ptr buffer, const net::Address& addr)
 	{
-		QMutexLocker lock(&mutex);
-		//Out(SYS_UTP|LOG_NOTICE) << "UTP: received " << ba << " bytes packet from " << addr.toString() << endl;
-		try
+		net::ServerSocket::PacketList packets;
+		packets.append(qMakePair(buffer, addr));
+		dataReceived(packets);
+	}
+
+	void UTPServer::Private::dataReceived(const net::ServerSocket::PacketList& packets)
+	{
+		if (shards.count() == 1)
 		{
-			if (buffer->size() >= (int)utp::Header::size()) // discard packets which are to small
-			{
-				p->handlePacket(buffer, addr);
-			}
+			shards.first()->dataReceived(packets);
+			return;
 		}
-		catch (utp::Connection::TransmissionError & err)
+
+		// Split the batch over the shards, keeping the order of the packets of every shard
+		QVector<net::ServerSocket::PacketList> split(shards.count());
+		foreach (const net::ServerSocket::PacketList::value_type & pkt, packets)
+			split[shards.indexOf(shard(pkt.second))].append(pkt);
+
+		for (int i = 0; i < shards.count(); i++)
 		{
-			Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
+			if (!split[i].isEmpty())
+				shards[i]->dispatch(split[i]);
 		}
 	}
 
 	void UTPServer::Private::readyToWrite(net::ServerSocket* sock)
 	{
-		output_queue.send(sock);
+		bool empty = true;
+		foreach (UTPShard* s, shards)
+		{
+			if (!s->output_queue.send(sock))
+				empty = false;
+		}
+		sock->setWriteNotificationsEnabled(!empty);
 	}
 
 	///////////////////////////////////////////////////////////
 
+	bt::Uint32 UTPServer::num_threads = 1;
+
 	UTPServer::UTPServer(QObject* parent)
 			: ServerInterface(parent), d(new Private(this))
 
 	{
 		qsrand(time(0));
-		connect(&d->timer, SIGNAL(timeout()), this, SLOT(checkTimeouts()));
 	}
 
 	UTPServer::~UTPServer()
@@ -294,13 +627,17 @@ namespace utp
 
 	void UTPServer::threadStarted()
 	{
-		d->timer.start(500);
 		foreach (net::ServerSocket::Ptr sock, d->sockets)
 		{
 			sock->setReadNotificationsEnabled(true);
 		}
 	}
 
+	void UTPServer::setNumThreads(bt::Uint32 num)
+	{
+		num_threads = qMax<bt::Uint32>(num, 1);
+	}
+
 #if 0
 	static void Dump(const QByteArray & data, const net::Address& addr)
 	{
@@ -343,47 +680,28 @@ namespace utp
 
 	void UTPServer::handlePacket(bt::Buffer::Ptr buffer, const net::Address& addr)
 	{
-		PacketParser parser(buffer->get(), buffer->size());
-		if (!parser.parse())
-			return;
+		d->shard(addr)->handlePacket(buffer, addr);
+	}
 
-		const Header* hdr = parser.header();
-		//Dump(packet,addr);
-		//DumpPacket(*hdr);
-		Connection::Ptr c;
-		switch (hdr->type)
-		{
-			case ST_DATA:
-			case ST_FIN:
-			case ST_STATE:
-				try
-				{
-					c = d->find(hdr->connection_id);
-					if (c && c->handlePacket(parser, buffer) == CS_CLOSED)
-					{
-						d->connections.remove(c->receiveConnectionID());
-					}
-				}
-				catch (Connection::TransmissionError & err)
-				{
-					Out(SYS_UTP | LOG_NOTICE) << "UTP: " << err.location << endl;
-					if (c)
-						c->close();
-				}
-				break;
-			case ST_RESET:
-				d->reset(hdr);
-				break;
-			case ST_SYN:
-				d->syn(parser, buffer, addr);
-				break;
-		}
+
+	bool UTPServer::sendTo(utp::Connection::Ptr conn, const PacketBuffer & packet, bool probe)
+	{
+		packetQueued(d->shard(conn->remoteAddress())->output_queue.add(packet, conn, probe));
+		return true;
 	}
 
+	bool UTPServer::resendTo(Connection::Ptr conn, const PacketBuffer & packet, const bt::Uint8* header, bt::Uint32 header_size)
+	{
+		if (header_size > MAX_HEADER_SIZE || header_size > packet.headRoom())
+			return false;
 
-	bool UTPServer::sendTo(utp::Connection::Ptr conn, const PacketBuffer & packet)
+		packetQueued(d->shard(conn->remoteAddress())->output_queue.add(packet, conn, header, header_size));
+		return true;
+	}
+
+	void UTPServer::packetQueued(int num_queued)
 	{
-		if (d->output_queue.add(packet, conn) == 1)
+		if (num_queued == 1)
 		{
 			// If there is only one packet queued,
 			// We need to enable the write notifiers, use the event queue to do this
@@ -398,7 +716,6 @@ namespace utp
 				sock->setWriteNotificationsEnabled(true);
 			}
 		}
-		return true;
 	}
 
 	void UTPServer::customEvent(QEvent* ev)
@@ -416,25 +733,7 @@ namespace utp
 		if (d->sockets.isEmpty() || addr.port() == 0)
 			return Connection::WPtr();
 
-		QMutexLocker lock(&d->mutex);
-		quint16 recv_conn_id = qrand() % 32535;
-		while (d->connections.contains(recv_conn_id))
-			recv_conn_id = qrand() % 32535;
-
-		Connection::Ptr conn(new Connection(recv_conn_id, Connection::OUTGOING, addr, this));
-		conn->setWeakPointer(conn);
-		conn->moveToThread(d->utp_thread);
-		d->connections.insert(recv_conn_id, conn);
-		try
-		{
-			conn->startConnecting();
-			return conn;
-		}
-		catch (Connection::TransmissionError & err)
-		{
-			d->connections.remove(recv_conn_id);
-			return Connection::WPtr();
-		}
+		return d->shard(addr)->connectTo(addr);
 	}
 
 	void UTPServer::stop()
@@ -450,7 +749,25 @@ namespace utp
 			d->utp_thread = new UTPServerThread(this);
 			foreach (net::ServerSocket::Ptr sock, d->sockets)
 				sock->moveToThread(d->utp_thread);
-			d->timer.moveToThread(d->utp_thread);
+
+			// The first shard runs in the UTP thread, the others get a thread of their own
+			for (int i = 0; i < d->shards.count(); i++)
+			{
+				UTPShard* s = d->shards[i];
+				if (i == 0)
+				{
+					s->moveToThread(d->utp_thread);
+				}
+				else
+				{
+					QThread* t = new QThread();
+					s->moveToThread(t);
+					d->shard_threads.append(t);
+					t->start();
+				}
+				// arm the timer once the thread is running
+				QCoreApplication::postEvent(s, new QEvent(QEvent::User));
+			}
 			d->utp_thread->start();
 		}
 	}
@@ -472,7 +789,7 @@ namespace utp
 
 			if (conn->bytesAvailable() > 0 || conn->connectionState() == CS_CLOSED)
 				pair->read_pipe->wakeUp();
-			pair->read_pipe->prepare(p, conn->receiveConnectionID(), pair->read_pipe);
+			pair->read_pipe->prepare(p, ConnectionKey(conn->remoteAddress(), conn->receiveConnectionID()), pair->read_pipe);
 		}
 		else
 		{
@@ -481,7 +798,7 @@ namespace utp
 
 			if (conn->isWriteable())
 				pair->write_pipe->wakeUp();
-			pair->write_pipe->prepare(p, conn->receiveConnectionID(), pair->write_pipe);
+			pair->write_pipe->prepare(p, ConnectionKey(conn->remoteAddress(), conn->receiveConnectionID()), pair->write_pipe);
 		}
 	}
 
@@ -497,6 +814,7 @@ namespace utp
 
 	Connection::WPtr UTPServer::acceptedConnection()
 	{
+		QMutexLocker lock(&d->pending_mutex);
 		if (d->last_accepted.isEmpty())
 			return Connection::WPtr();
 		else
@@ -511,30 +829,23 @@ namespace utp
 
 	void UTPServer::cleanup()
 	{
-		QMutexLocker lock(&d->mutex);
-		QMap<quint16, Connection::Ptr>::iterator i = d->connections.begin();
-		while (i != d->connections.end())
-		{
-			if (i.value()->connectionState() == CS_CLOSED)
-			{
-				i = d->connections.erase(i);
-			}
-			else
-				i++;
-		}
+		foreach (UTPShard* s, d->shards)
+			s->cleanup();
 	}
 
-	void UTPServer::checkTimeouts()
+	void UTPServer::scheduleTimeout(const net::Address& remote, bt::Uint16 recv_connection_id, const TimeValue& deadline)
 	{
-		QMutexLocker lock(&d->mutex);
+		// round up, so the connection has really timed out when the wheel says so
+		bt::TimeStamp t = deadline.seconds * 1000 + (deadline.microseconds + 999) / 1000;
+		d->shard(remote)->scheduleTimeout(ConnectionKey(remote, recv_connection_id), t);
+	}
 
-		TimeValue now;
-		QMap<quint16, Connection::Ptr>::iterator itr = d->connections.begin();
-		while (itr != d->connections.end())
-		{
-			itr.value()->checkTimeout(now);
-			itr++;
-		}
+	bt::Uint32 UTPServer::maxDatagramSize(const net::Address & remote) const
+	{
+		if (!d->dont_fragment)
+			return 0;
+
+		return net::Socket::maxDatagramSize(remote);
 	}
 
 
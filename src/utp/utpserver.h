@@ -31,6 +31,7 @@
 namespace utp
 {
 	class UTPSocket;
+	class UTPShard;
 
 	/**
 		Implements the UTP server. It listens for UTP packets and manages all connections.
@@ -48,7 +49,10 @@ namespace utp
 		virtual bool changePort(bt::Uint16 port);
 
 		/// Send a packet to some host
-		virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet);
+		virtual bool sendTo(Connection::Ptr conn, const PacketBuffer & packet, bool probe);
+
+		/// Send a packet again with a new header
+		virtual bool resendTo(Connection::Ptr conn, const PacketBuffer & packet, const bt::Uint8* header, bt::Uint32 header_size);
 
 		/// Setup a connection to a remote address
 		Connection::WPtr connectTo(const net::Address & addr);
@@ -71,6 +75,16 @@ namespace utp
 		/// Thread has been started
 		void threadStarted();
 
+		/**
+			Set the number of threads which handle UTP connections, connections are
+			divided over them by the address of the remote host. Only servers
+			created afterwards will use the new value.
+		*/
+		static void setNumThreads(bt::Uint32 num);
+
+		/// Get the number of threads which handle UTP connections
+		static bt::Uint32 numThreads() {return num_threads;}
+
 		/**
 			Handle newly connected sockets, it starts authentication on them.
 			This needs to be called from the main thread.
@@ -81,6 +95,8 @@ namespace utp
 		virtual void handlePacket(bt::Buffer::Ptr buffer, const net::Address & addr);
 		virtual void stateChanged(Connection::Ptr conn, bool readable, bool writeable);
 		virtual void closed(Connection::Ptr conn);
+		virtual void scheduleTimeout(const net::Address & remote, bt::Uint16 recv_connection_id, const TimeValue & deadline);
+		virtual bt::Uint32 maxDatagramSize(const net::Address & remote) const;
 		virtual void customEvent(QEvent* ev);
 
 	signals:
@@ -90,11 +106,17 @@ namespace utp
 
 	private slots:
 		void cleanup();
-		void checkTimeouts();
+
+	private:
+		void packetQueued(int num_queued);
 
 	private:
 		class Private;
 		Private* d;
+
+		static bt::Uint32 num_threads;
+
+		friend class UTPShard;
 	};
 
 }
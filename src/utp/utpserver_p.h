@@ -21,7 +21,6 @@
 #ifndef UTP_UTPSERVER_P_H
 #define UTP_UTPSERVER_P_H
 
-#include <QMap>
 #include <QTimer>
 #include <QSocketNotifier>
 #include <net/socket.h>
@@ -35,6 +34,8 @@
 #include "pollpipe.h"
 #include "utpserver.h"
 #include "outputqueue.h"
+#include "timerwheel.h"
+#include "connectiontable.h"
 
 
 namespace utp
@@ -79,7 +80,82 @@ namespace utp
 
 
 	typedef bt::PtrMap<net::Poll*, PollPipePair>::iterator PollPipePairItr;
-	typedef QMap<quint16, Connection::Ptr>::iterator ConnectionMapItr;
+
+	/**
+		Part of the connections of a UTPServer, with its own lock, timers and output queue.
+		Every shard runs in its own thread, the first one in the UTP thread itself.
+		Connections are assigned to a shard by the address of the remote host, so
+		all packets of a connection, including the SYN, end up in the same shard.
+	*/
+	class UTPShard : public QObject
+	{
+		Q_OBJECT
+	public:
+		UTPShard(UTPServer* srv);
+		virtual ~UTPShard();
+
+		/**
+			Pass packets received by the UTP thread on to the shard, if the shard
+			runs in another thread they are queued until that thread picks them up.
+		*/
+		void dispatch(const net::ServerSocket::PacketList & packets);
+
+		/// Handle a batch of packets, this is called from the thread of the shard
+		void dataReceived(const net::ServerSocket::PacketList & packets);
+
+		/// Handle a packet of one of the connections of this shard
+		void handlePacket(bt::Buffer::Ptr buffer, const net::Address & addr);
+
+		/// Setup a connection to a remote address
+		Connection::WPtr connectTo(const net::Address & addr);
+
+		/// Schedule the timeout of a connection (deadline in ms)
+		void scheduleTimeout(const ConnectionKey & key, bt::TimeStamp deadline);
+
+		/// Remove all closed connections
+		void cleanup();
+
+		/// Drop all connections, the thread of the shard must be gone (see stopTimer)
+		void stop();
+
+	public slots:
+		/**
+			Stop the timer, it can only be stopped from the thread of the shard,
+			so from another thread this waits until the shard's thread has done it.
+			Must be called before the thread of the shard quits.
+		*/
+		void stopTimer();
+
+		/// Handle the packets queued by dispatch
+		void processInbox();
+
+		/// Let the connections which have reached their deadline check for a timeout
+		void checkTimeouts();
+
+	protected:
+		virtual void customEvent(QEvent* ev);
+
+	private:
+		void syn(const PacketParser & parser, bt::Buffer::Ptr buffer, const net::Address & addr);
+		void reset(const Header* hdr, const net::Address & addr);
+		void armTimer();
+
+	public:
+		OutputQueue output_queue;
+
+	private:
+		UTPServer* srv;
+		QMutex mutex;
+		ConnectionTable connections;
+		// single shot timer, armed for the first deadline in the timer wheel
+		QTimer timer;
+		TimerWheel<ConnectionKey> timer_wheel;
+		bt::TimeStamp timer_armed;
+		bool timer_stopped;
+		QMutex timer_mutex;
+		net::ServerSocket::PacketList inbox;
+		QMutex inbox_mutex;
+	};
 
 	class UTPServer::Private : public net::ServerSocket::DataHandler
 	{
@@ -89,30 +165,33 @@ namespace utp
 
 
 		bool bind(const net::Address & addr);
-		void syn(const PacketParser & parser, bt::Buffer::Ptr buffer, const net::Address & addr);
-		void reset(const Header* hdr);
 		void wakeUpPollPipes(Connection::Ptr conn, bool readable, bool writeable);
-		Connection::Ptr find(quint16 conn_id);
 		void stop();
+		UTPShard* shard(const net::Address & addr);
 		virtual void dataReceived(bt::Buffer::Ptr buffer, const net::Address& addr);
+		virtual void dataReceived(const net::ServerSocket::PacketList & packets);
 		virtual void readyToWrite(net::ServerSocket* sock);
 
 	public:
 		UTPServer* p;
 		QList<net::ServerSocket::Ptr> sockets;
 		bool running;
-		QMap<quint16, Connection::Ptr> connections;
 		UTPServerThread* utp_thread;
+		QList<UTPShard*> shards;
+		// threads of all shards except the first one, which runs in the UTP thread
+		QList<QThread*> shard_threads;
+		// protects poll_pipes
 		QMutex mutex;
 		bt::PtrMap<net::Poll*, PollPipePair> poll_pipes;
 		bool create_sockets;
 		bt::Uint8 tos;
-		OutputQueue output_queue;
+		// whether or not the don't fragment bit can be turned on and off on all sockets
+		bool dont_fragment;
 		QList<mse::EncryptedPacketSocket::Ptr> pending;
+		// protects pending and last_accepted, which are filled from the shard threads
 		QMutex pending_mutex;
 		MainThreadCall* mtc;
 		QList<Connection::WPtr> last_accepted;
-		QTimer timer;
 	};
 }
 